@@ -0,0 +1,306 @@
+#include "archive.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "stream.h"
+#include "symbol_cache.h"
+
+namespace {
+constexpr char MAGIC[8] = {'Q', 'R', 'A', 'R', 'C', 'H', 'V', '1'};
+
+std::runtime_error system_error(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+void store_le(u_int8_t* p, u_int64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    p[i] = static_cast<u_int8_t>(value >> (8 * i));
+  }
+}
+
+u_int64_t load_le(const u_int8_t* p, int bytes) {
+  u_int64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value |= static_cast<u_int64_t>(p[i]) << (8 * i);
+  }
+  return value;
+}
+
+void write_at(int fd, const std::string& data, u_int64_t offset,
+              const std::string& path) {
+  for (size_t done = 0; done < data.size();) {
+    const ssize_t n = ::pwrite(fd, data.data() + done, data.size() - done,
+                               static_cast<off_t>(offset + done));
+    if (n < 0 && errno != EINTR) {
+      throw system_error("cannot write " + path);
+    }
+    done += n < 0 ? 0 : static_cast<size_t>(n);
+  }
+}
+}  // namespace
+
+size_t archive_stride(int version) {
+  const size_t size = symbol_size(version);
+  return (size * ((size + 7) / 8) + 7) / 8 * 8;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string& path,
+                             const ArchiveWriterOptions& options)
+    : path(path), options(options) {
+  this->options.grow_bytes = std::max<size_t>(options.grow_bytes, 1);
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw system_error("cannot open " + path);
+  }
+  // アドレス空間だけ先に確保し、ファイルは ensure_size() で伸ばす。
+  // 写像が動かないので、書き手はロックなしで自分の範囲へ書ける
+  void* address = ::mmap(nullptr, options.max_bytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_NORESERVE, fd, 0);
+  if (address == MAP_FAILED) {
+    const std::runtime_error error = system_error("cannot map " + path);
+    ::close(fd);
+    throw error;
+  }
+  map = static_cast<u_int8_t*>(address);
+}
+
+ArchiveWriter::~ArchiveWriter() { close_file(); }
+
+void ArchiveWriter::close_file() {
+  if (map != nullptr) {
+    ::munmap(map, options.max_bytes);
+    map = nullptr;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+void ArchiveWriter::ensure_size(u_int64_t end) {
+  if (end <= file_size.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(grow_mutex);
+  if (end <= file_size.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const u_int64_t step = options.grow_bytes;
+  const u_int64_t size =
+      std::min<u_int64_t>((end + step - 1) / step * step, options.max_bytes);
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    throw system_error("cannot grow " + path);
+  }
+  file_size.store(size, std::memory_order_release);
+}
+
+u_int64_t ArchiveWriter::reserve(u_int64_t stride) {
+  // 上限を越える予約は tail を進めないので、断った分の穴はできない
+  u_int64_t offset = tail.load(std::memory_order_relaxed);
+  do {
+    if (offset + stride > options.max_bytes) {
+      throw std::runtime_error("archive " + path + " would exceed " +
+                               std::to_string(options.max_bytes) + " bytes");
+    }
+  } while (!tail.compare_exchange_weak(offset, offset + stride,
+                                       std::memory_order_relaxed));
+  return offset;
+}
+
+void ArchiveWriter::add(size_t index, const Symbol& symbol,
+                        std::string_view payload) {
+  if (map == nullptr) {
+    throw std::logic_error("add() after finish()");
+  }
+  {
+    // 重複を先に弾き、弾いた呼び出しが行の範囲を使わないようにする
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (entries.size() <= index) {
+      entries.resize(index + 1);
+    }
+    if (entries[index].added) {
+      throw std::invalid_argument("archive record " + std::to_string(index) +
+                                  " added twice");
+    }
+    entries[index].added = true;
+  }
+  Entry entry;
+  entry.payload_hash = hash_bytes(payload.data(), payload.size());
+  entry.error_correction_level =
+      static_cast<u_int8_t>(symbol.error_correction_level);
+  entry.added = true;
+  if (symbol.ok()) {
+    const u_int64_t stride = archive_stride(symbol.version);
+    try {
+      const u_int64_t offset = reserve(stride);
+      ensure_size(offset + stride);
+      // 伸ばした部分は0で埋まっているので、詰め物は書かなくてよい
+      pack_rows(symbol, map + offset);
+      count_bytes_out(stride);
+      entry.offset = offset;
+    } catch (...) {
+      // 書けなかったレコードを失敗した符号化に見せず、finish() に
+      // 欠けとして報告させる
+      std::lock_guard<std::mutex> lock(index_mutex);
+      entries[index].added = false;
+      throw;
+    }
+    entry.version = static_cast<u_int8_t>(symbol.version);
+    entry.mask_pattern = static_cast<u_int8_t>(symbol.mask_pattern);
+  }
+  std::lock_guard<std::mutex> lock(index_mutex);
+  entries[index] = entry;
+}
+
+void ArchiveWriter::finish() {
+  if (map == nullptr) {
+    throw std::logic_error("finish() called twice");
+  }
+  std::lock_guard<std::mutex> lock(index_mutex);
+  std::string index(entries.size() * ARCHIVE_INDEX_ENTRY_SIZE, '\0');
+  for (size_t i = 0; i < entries.size(); i++) {
+    const Entry& entry = entries[i];
+    if (!entry.added) {
+      throw std::runtime_error("archive record " + std::to_string(i) +
+                               " was never added");
+    }
+    u_int8_t* p = reinterpret_cast<u_int8_t*>(index.data()) +
+                  i * ARCHIVE_INDEX_ENTRY_SIZE;
+    store_le(p, entry.offset, 8);
+    store_le(p + 8, entry.payload_hash, 8);
+    p[16] = entry.version;
+    p[17] = entry.error_correction_level;
+    p[18] = entry.mask_pattern;
+  }
+  // 行の大きさはどれも8の倍数なので、索引も8バイト境界から始まる
+  const u_int64_t index_offset = tail.load(std::memory_order_relaxed);
+  const u_int64_t end = index_offset + index.size();
+  std::string header(ARCHIVE_HEADER_SIZE, '\0');
+  u_int8_t* p = reinterpret_cast<u_int8_t*>(header.data());
+  std::memcpy(p, MAGIC, sizeof(MAGIC));
+  store_le(p + 8, ARCHIVE_LAYOUT_VERSION, 4);
+  store_le(p + 12, ARCHIVE_HEADER_SIZE, 4);
+  store_le(p + 16, entries.size(), 8);
+  store_le(p + 24, index_offset, 8);
+  store_le(p + 32, end, 8);
+
+  ::munmap(map, options.max_bytes);
+  map = nullptr;
+  if (::ftruncate(fd, static_cast<off_t>(end)) != 0) {
+    throw system_error("cannot resize " + path);
+  }
+  write_at(fd, index, index_offset, path);
+  write_at(fd, header, 0, path);
+  if (::close(fd) != 0) {
+    fd = -1;
+    throw system_error("cannot close " + path);
+  }
+  fd = -1;
+}
+
+Symbol ArchiveSymbol::toSymbol() const {
+  Symbol out;
+  out.error_correction_level = error_correction_level;
+  if (!ok()) {
+    out.setError("record failed to encode");
+    return out;
+  }
+  out.version = version;
+  out.mask_pattern = mask_pattern;
+  out.size = size;
+  out.words_per_row = (size + 63) / 64;
+  out.modules.assign(static_cast<size_t>(size) * out.words_per_row, 0);
+  for (int x = 0; x < size; x++) {
+    u_int64_t* words = out.modules.data() + x * out.words_per_row;
+    for (int y = 0; y < size; y++) {
+      words[y / 64] |= static_cast<u_int64_t>(getCell(x, y)) << (y % 64);
+    }
+  }
+  return out;
+}
+
+ArchiveReader::ArchiveReader(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw system_error("cannot open " + path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    const std::runtime_error error = system_error("cannot stat " + path);
+    ::close(fd);
+    throw error;
+  }
+  map_size = static_cast<size_t>(st.st_size);
+  if (map_size < ARCHIVE_HEADER_SIZE) {
+    ::close(fd);
+    throw std::runtime_error(path + " is not a symbol archive");
+  }
+  void* address = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (address == MAP_FAILED) {
+    throw system_error("cannot map " + path);
+  }
+  map = static_cast<const u_int8_t*>(address);
+  // 印刷側は番号で飛び飛びに読むので先読みしない
+  ::madvise(address, map_size, MADV_RANDOM);
+
+  count = load_le(map + 16, 8);
+  index_offset = load_le(map + 24, 8);
+  const char* problem = nullptr;
+  if (std::memcmp(map, MAGIC, sizeof(MAGIC)) != 0) {
+    problem = " is not a finished symbol archive";
+  } else if (load_le(map + 8, 4) != ARCHIVE_LAYOUT_VERSION ||
+             load_le(map + 12, 4) != ARCHIVE_HEADER_SIZE) {
+    problem = " has an unknown archive layout";
+  } else if (load_le(map + 32, 8) != map_size ||
+             index_offset < ARCHIVE_HEADER_SIZE || index_offset > map_size ||
+             (map_size - index_offset) / ARCHIVE_INDEX_ENTRY_SIZE != count ||
+             (map_size - index_offset) % ARCHIVE_INDEX_ENTRY_SIZE != 0) {
+    problem = " is truncated or has a corrupt header";
+  }
+  if (problem != nullptr) {
+    ::munmap(const_cast<u_int8_t*>(map), map_size);
+    throw std::runtime_error(path + problem);
+  }
+}
+
+ArchiveReader::~ArchiveReader() {
+  ::munmap(const_cast<u_int8_t*>(map), map_size);
+}
+
+ArchiveSymbol ArchiveReader::at(size_t index) const {
+  if (index >= count) {
+    throw std::out_of_range("archive record " + std::to_string(index) +
+                            " out of range (" + std::to_string(count) +
+                            " records)");
+  }
+  const u_int8_t* p = map + index_offset + index * ARCHIVE_INDEX_ENTRY_SIZE;
+  ArchiveSymbol symbol;
+  symbol.payload_hash = load_le(p + 8, 8);
+  symbol.error_correction_level = p[17];
+  if (p[16] == 0) {
+    return symbol;
+  }
+  const u_int64_t offset = load_le(p, 8);
+  if (p[16] > 40 || p[17] > H || p[18] > 7 || offset < ARCHIVE_HEADER_SIZE ||
+      offset > index_offset ||
+      index_offset - offset < archive_stride(p[16])) {
+    throw std::runtime_error("archive record " + std::to_string(index) +
+                             " is corrupt");
+  }
+  symbol.version = p[16];
+  symbol.mask_pattern = p[18];
+  symbol.size = symbol_size(symbol.version);
+  symbol.row_bytes = (symbol.size + 7) / 8;
+  symbol.rows = map + offset;
+  return symbol;
+}
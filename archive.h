@@ -0,0 +1,140 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "qr.h"
+
+// Packed symbol archive (`--format archive --output FILE`): millions of
+// symbols in one file, which a print spooler maps and reads symbol N from
+// without parsing the rest.
+//
+// Layout, integers little endian:
+//   header (64 bytes): "QRARCHV1", u32 layout version (1), u32 header size,
+//     u64 record count, u64 index offset, u64 file size, 24 reserved bytes
+//   rows: each symbol as `size` rows of (size + 7) / 8 bytes, MSB first,
+//     1 = dark (the rows of a binary record), padded to
+//     archive_stride(version) bytes, so every record of a version takes the
+//     same space. Records appear in the order the writers reserved them.
+//   index (at the index offset): one 24 byte entry per record index:
+//     u64 offset of its rows, u64 payload hash (hash_bytes()), u8 version
+//     (0: the record failed and has no rows), u8 error correction level,
+//     u8 mask pattern, 5 reserved bytes
+// The header is written last; a file whose writer did not finish has no
+// magic and is rejected by ArchiveReader.
+
+constexpr size_t ARCHIVE_HEADER_SIZE = 64;
+constexpr size_t ARCHIVE_INDEX_ENTRY_SIZE = 24;
+constexpr u_int32_t ARCHIVE_LAYOUT_VERSION = 1;
+
+// Bytes the rows of one symbol of `version` occupy, a multiple of 8.
+size_t archive_stride(int version);
+
+struct ArchiveWriterOptions {
+  // Address space mapped for the file. The file itself grows in steps of
+  // grow_bytes; add() throws once the rows would pass max_bytes.
+  size_t max_bytes = size_t{1} << 36;
+  size_t grow_bytes = size_t{64} << 20;
+};
+
+// Writes an archive through a shared mapping. add() may be called from any
+// number of threads at once: each call reserves a disjoint range of the file
+// with one atomic add and packs the rows straight into the mapping.
+class ArchiveWriter {
+ public:
+  // Creates (or truncates) `path`. Throws std::runtime_error.
+  explicit ArchiveWriter(const std::string& path,
+                         const ArchiveWriterOptions& options = {});
+  // Unmaps without finishing: the file is left without a header.
+  ~ArchiveWriter();
+  ArchiveWriter(const ArchiveWriter&) = delete;
+  ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+  // Stores record `index`; a failed symbol is stored as an entry without
+  // rows. Thread safe. Throws std::invalid_argument when `index` was already
+  // added and std::runtime_error when the file cannot grow; the record then
+  // counts as never added, so finish() fails rather than storing it as a
+  // failed encode.
+  void add(size_t index, const Symbol& symbol, std::string_view payload);
+  // Writes the index and the header and closes the file. Record indices run
+  // from 0 to the largest added; throws std::runtime_error when one of them
+  // was never added, or when writing fails.
+  void finish();
+
+ private:
+  struct Entry {
+    u_int64_t offset = 0;
+    u_int64_t payload_hash = 0;
+    u_int8_t version = 0;
+    u_int8_t error_correction_level = 0;
+    u_int8_t mask_pattern = 0;
+    bool added = false;
+  };
+
+  // stride バイトの行の範囲を予約する。max_bytes を越えるなら例外
+  u_int64_t reserve(u_int64_t stride);
+  // ファイルが end バイト目まで書けるように伸ばす
+  void ensure_size(u_int64_t end);
+  void close_file();
+
+  std::string path;
+  ArchiveWriterOptions options;
+  int fd = -1;
+  u_int8_t* map = nullptr;
+  std::atomic<u_int64_t> tail{ARCHIVE_HEADER_SIZE};  // 次に予約する位置
+  std::atomic<u_int64_t> file_size{0};
+  std::mutex grow_mutex;
+  std::mutex index_mutex;
+  std::vector<Entry> entries;
+};
+
+// One record of an archive; the rows point into the reader's mapping.
+struct ArchiveSymbol {
+  int version = 0;  // 0: the record failed to encode and has no rows
+  int error_correction_level = L;
+  int mask_pattern = -1;
+  int size = 0;
+  int row_bytes = 0;
+  u_int64_t payload_hash = 0;
+  const u_int8_t* rows = nullptr;
+
+  bool ok() const { return version != 0; }
+  const u_int8_t* row(int x) const {
+    return rows + static_cast<size_t>(x) * row_bytes;
+  }
+  bool getCell(int x, int y) const {
+    return (row(x)[y / 8] >> (7 - y % 8)) & 1;
+  }
+  // Copies the modules into a Symbol (error is set for a failed record).
+  Symbol toSymbol() const;
+};
+
+class ArchiveReader {
+ public:
+  // Maps `path` read-only. Throws std::runtime_error when it is not a
+  // complete archive (bad magic, layout version or sizes).
+  explicit ArchiveReader(const std::string& path);
+  ~ArchiveReader();
+  ArchiveReader(const ArchiveReader&) = delete;
+  ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+  size_t size() const { return count; }
+  // Record `index` without copying. Throws std::out_of_range, and
+  // std::runtime_error when its entry points outside the rows.
+  ArchiveSymbol at(size_t index) const;
+
+ private:
+  const u_int8_t* map = nullptr;
+  size_t map_size = 0;
+  size_t count = 0;
+  u_int64_t index_offset = 0;
+};
+
+#endif  // ARCHIVE_H
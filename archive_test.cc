@@ -0,0 +1,180 @@
+#include "archive.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stream.h"
+#include "symbol_cache.h"
+
+namespace {
+std::string temp_path(const std::string& name) {
+  return (std::filesystem::temp_directory_path() /
+          ("qr_archive_test_" + name + "_" + std::to_string(::getpid())))
+      .string();
+}
+
+std::vector<std::string> mixed_payloads(int count) {
+  std::vector<std::string> payloads;
+  for (int i = 0; i < count; i++) {
+    payloads.push_back(i % 41 == 6 ? "lower case"
+                                   : std::string(1 + i * 13 % 1200, 'Z'));
+  }
+  return payloads;
+}
+
+void expect_record(const ArchiveSymbol& record, const std::string& payload,
+                   const EncodeOptions& options) {
+  const Symbol expected = encode_symbol(payload, options);
+  EXPECT_EQ(record.payload_hash, hash_bytes(payload.data(), payload.size()));
+  ASSERT_EQ(record.ok(), expected.ok());
+  const Symbol symbol = record.toSymbol();
+  if (!expected.ok()) {
+    EXPECT_FALSE(symbol.ok());
+    return;
+  }
+  EXPECT_EQ(record.version, expected.version);
+  EXPECT_EQ(record.error_correction_level, expected.error_correction_level);
+  EXPECT_EQ(record.mask_pattern, expected.mask_pattern);
+  EXPECT_EQ(record.size, expected.size);
+  EXPECT_EQ(symbol.modules, expected.modules);
+  EXPECT_EQ(record.getCell(0, 0), expected.getCell(0, 0));
+}
+
+TEST(ArchiveTest, ParallelWritersAndRandomAccess) {
+  const std::vector<std::string> payloads = mixed_payloads(400);
+  const EncodeOptions options{Q};
+  const std::string path = temp_path("parallel");
+  size_t row_bytes = 0;
+  {
+    ArchiveWriterOptions writer_options;
+    writer_options.grow_bytes = 4096;  // 書きながら何度も伸ばす
+    ArchiveWriter writer(path, writer_options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t] {
+        // 各スレッドが後ろから飛び飛びに書く
+        for (size_t i = payloads.size() - 1 - t; i < payloads.size(); i -= 4) {
+          writer.add(i, encode_symbol(payloads[i], options), payloads[i]);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    EXPECT_THROW(writer.add(3, encode_symbol("X", options), "X"),
+                 std::invalid_argument);
+    writer.finish();
+  }
+  for (const std::string& payload : payloads) {
+    const Symbol symbol = encode_symbol(payload, options);
+    row_bytes += symbol.ok() ? archive_stride(symbol.version) : 0;
+  }
+  EXPECT_EQ(std::filesystem::file_size(path),
+            ARCHIVE_HEADER_SIZE + row_bytes +
+                payloads.size() * ARCHIVE_INDEX_ENTRY_SIZE);
+
+  ArchiveReader reader(path);
+  ASSERT_EQ(reader.size(), payloads.size());
+  for (size_t i : {size_t{399}, size_t{0}, size_t{6}, size_t{250}}) {
+    expect_record(reader.at(i), payloads[i], options);
+  }
+  for (size_t i = 0; i < payloads.size(); i++) {
+    expect_record(reader.at(i), payloads[i], options);
+  }
+  EXPECT_THROW(reader.at(payloads.size()), std::out_of_range);
+  std::remove(path.c_str());
+}
+
+TEST(ArchiveTest, RejectsIncompleteArchives) {
+  const std::string path = temp_path("incomplete");
+  {
+    ArchiveWriter writer(path);
+    writer.add(0, encode_symbol("HELLO"), "HELLO");
+    writer.add(2, encode_symbol("WORLD"), "WORLD");
+    EXPECT_THROW(writer.finish(), std::runtime_error);  // 1 が無い
+  }
+  EXPECT_THROW(ArchiveReader reader(path), std::runtime_error);
+
+  {
+    ArchiveWriter writer(path);
+    writer.add(0, encode_symbol("HELLO"), "HELLO");
+    writer.finish();
+  }
+  EXPECT_EQ(ArchiveReader(path).size(), 1u);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  EXPECT_THROW(ArchiveReader reader(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(ArchiveTest, OutOfSpaceIsNotAFailedEncode) {
+  const std::string path = temp_path("full");
+  const Symbol hello = encode_symbol("HELLO", EncodeOptions{M, 1});
+  ArchiveWriterOptions options;
+  options.max_bytes = ARCHIVE_HEADER_SIZE + archive_stride(1) * 3 / 2;
+  {
+    ArchiveWriter writer(path, options);
+    writer.add(0, hello, "HELLO");
+    EXPECT_THROW(writer.add(1, hello, "HELLO"), std::runtime_error);
+    // 入らなかったレコードは失敗した符号化として残さない
+    EXPECT_THROW(writer.finish(), std::runtime_error);
+  }
+  EXPECT_THROW(ArchiveReader reader(path), std::runtime_error);
+
+  // 断った予約は tail を進めないので、入る大きさの記録はまだ書ける
+  options.max_bytes = ARCHIVE_HEADER_SIZE + archive_stride(1) * 2;
+  {
+    ArchiveWriter writer(path, options);
+    writer.add(0, hello, "HELLO");
+    EXPECT_THROW(writer.add(1, encode_symbol("HELLO", EncodeOptions{M, 2}),
+                            "HELLO"),
+                 std::runtime_error);
+    writer.add(1, hello, "HELLO");
+    writer.finish();
+  }
+  ArchiveReader reader(path);
+  ASSERT_EQ(2u, reader.size());
+  expect_record(reader.at(1), "HELLO", EncodeOptions{M, 1});
+  std::remove(path.c_str());
+}
+
+TEST(ArchiveTest, RunStreamWritesArchive) {
+  const std::vector<std::string> payloads = mixed_payloads(100);
+  std::string input;
+  for (const std::string& payload : payloads) {
+    input += payload + '\n';
+  }
+  std::FILE* in = std::tmpfile();
+  std::fwrite(input.data(), 1, input.size(), in);
+  std::rewind(in);
+  std::FILE* errors = std::tmpfile();
+  StreamOptions options;
+  options.format = OutputFormat::ARCHIVE;
+  options.output_file = temp_path("stream");
+  options.block_records = 16;
+  options.batch.threads = 3;
+  options.batch.chunk_size = 4;
+  StreamStats stats = run_stream(in, options, errors);
+  EXPECT_EQ(stats.records, payloads.size());
+  EXPECT_EQ(stats.failed, 3u);
+
+  ArchiveReader reader(options.output_file);
+  ASSERT_EQ(reader.size(), payloads.size());
+  for (size_t i = 0; i < payloads.size(); i++) {
+    expect_record(reader.at(i), payloads[i], options.batch.encode);
+  }
+  std::remove(options.output_file.c_str());
+
+  options.output_file.clear();
+  std::rewind(in);
+  EXPECT_THROW(run_stream(in, options, errors), std::invalid_argument);
+  std::fclose(in);
+  std::fclose(errors);
+}
+}  // namespace
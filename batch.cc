@@ -0,0 +1,73 @@
+#include "batch.h"
+
+#include <string>
+
+#include "metrics.h"
+#include "symbol_cache.h"
+
+// 符号化したシンボルを読み戻し、入力と食い違えば失敗にする
+void verify_symbol(std::string_view payload, const EncodeOptions& options,
+                   Symbol& symbol, DecodeResult& decoded) {
+  decode_symbol(symbol, decoded);
+  const StructuredAppend& expected = options.structured_append;
+  const StructuredAppend& append = decoded.structured_append;
+  if (!decoded.ok()) {
+    symbol.setError("Verification failed: " + decoded.error, REJECT_VERIFY);
+  } else if (decoded.corrected != 0) {
+    symbol.setError("Verification failed: " +
+                        std::to_string(decoded.corrected) +
+                        " codewords needed correction",
+                    REJECT_VERIFY);
+  } else if (decoded.error_correction_level !=
+                 options.error_correction_level ||
+             decoded.mask_pattern != symbol.mask_pattern) {
+    symbol.setError("Verification failed: format information mismatch",
+                    REJECT_VERIFY);
+  } else if (append.total != expected.total ||
+             (expected.total != 0 && (append.index != expected.index ||
+                                      append.parity != expected.parity))) {
+    symbol.setError("Verification failed: Structured Append header mismatch",
+                    REJECT_VERIFY);
+  } else if (decoded.text != payload) {
+    symbol.setError("Verification failed: decoded text differs from input",
+                    REJECT_VERIFY);
+  }
+  if (!symbol.ok()) {
+    count_reject(symbol.reject_reason);
+  }
+}
+
+std::vector<Symbol> encode_batch(std::span<const std::string_view> payloads,
+                                 const BatchOptions& options) {
+  WorkStealingPool pool(options.threads);
+  return encode_batch(payloads, options, pool);
+}
+
+std::vector<Symbol> encode_batch(std::span<const std::string_view> payloads,
+                                 const BatchOptions& options,
+                                 WorkStealingPool& pool) {
+  std::vector<Symbol> result(payloads.size());
+  // ワーカーごとの作業領域。チャンクをまたいで再利用する
+  std::vector<EncodeScratch> scratch(pool.threadCount());
+  std::vector<DecodeResult> decoded(options.verify ? pool.threadCount() : 0);
+  pool.parallelFor(
+      payloads.size(), options.chunk_size,
+      [&](size_t begin, size_t end, int worker) {
+        for (size_t i = begin; i < end; i++) {
+          if (options.cache != nullptr &&
+              options.cache->lookup(payloads[i], options.encode, result[i])) {
+            continue;
+          }
+          encode_symbol(payloads[i], options.encode, scratch[worker],
+                        result[i]);
+          if (options.verify && result[i].ok()) {
+            verify_symbol(payloads[i], options.encode, result[i],
+                          decoded[worker]);
+          }
+          if (options.cache != nullptr) {
+            options.cache->insert(payloads[i], options.encode, result[i]);
+          }
+        }
+      });
+  return result;
+}
@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "decoder.h"
+#include "qr.h"
+#include "thread_pool.h"
+
+class SymbolCache;
+
+struct BatchOptions {
+  EncodeOptions encode;
+  int threads = 0;         // 0: std::thread::hardware_concurrency()
+  size_t chunk_size = 16;  // payloads per work-stealing task
+  // Decode every symbol again and fail it unless it reads back as its payload
+  // at the requested error correction level without any correction.
+  bool verify = false;
+  // Optional cache shared by all workers (see symbol_cache.h). Only symbols
+  // that encoded, and verified when `verify` is set, are stored; a hit is
+  // returned without encoding or verifying again.
+  SymbolCache* cache = nullptr;
+};
+
+// Decodes `symbol` into `decoded` and sets symbol's error unless it reads back
+// as `payload` with the format and Structured Append header of `options`
+// and without any correction. What BatchOptions::verify runs per symbol.
+void verify_symbol(std::string_view payload, const EncodeOptions& options,
+                   Symbol& symbol, DecodeResult& decoded);
+
+// Encodes every payload with the same options; result[i] belongs to
+// payloads[i]. A payload that cannot be encoded yields a Symbol whose error is
+// set, and the rest of the batch is unaffected.
+std::vector<Symbol> encode_batch(std::span<const std::string_view> payloads,
+                                 const BatchOptions& options = {});
+// Same, reusing an existing pool (options.threads is ignored).
+std::vector<Symbol> encode_batch(std::span<const std::string_view> payloads,
+                                 const BatchOptions& options,
+                                 WorkStealingPool& pool);
+
+#endif  // BATCH_H
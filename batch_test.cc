@@ -0,0 +1,114 @@
+#include "batch.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+std::vector<std::string> mixed_payloads() {
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 40; i++) {
+    // バージョン1〜30程度が混ざるように長さを変える
+    payloads.push_back(std::string(1 + (i * 37) % 700, "AB0$:"[i % 5]));
+  }
+  return payloads;
+}
+
+TEST(BatchTest, MatchesSingleEncode) {
+  auto payloads = mixed_payloads();
+  std::vector<std::string_view> views(payloads.begin(), payloads.end());
+  for (int threads : {1, 4}) {
+    for (size_t chunk : {size_t{1}, size_t{3}}) {
+      BatchOptions options;
+      options.encode.error_correction_level = M;
+      options.threads = threads;
+      options.chunk_size = chunk;
+      auto symbols = encode_batch(views, options);
+      ASSERT_EQ(symbols.size(), payloads.size());
+      for (size_t i = 0; i < payloads.size(); i++) {
+        QrCode qr(select_version(payloads[i], ALNUM_MODE, M), AUTO_MASK,
+                  ALNUM_MODE, M);
+        qr.createQrCode(payloads[i]);
+        const Symbol& symbol = symbols[i];
+        ASSERT_TRUE(symbol.ok()) << symbol.error;
+        EXPECT_EQ(symbol.version, qr.getVersion());
+        EXPECT_EQ(symbol.mask_pattern, qr.getMaskPattern());
+        ASSERT_EQ(symbol.size, qr.getSize());
+        for (int x = 0; x < symbol.size; x++) {
+          for (int y = 0; y < symbol.size; y++) {
+            ASSERT_EQ(symbol.getCell(x, y), qr.getCell(x, y))
+                << "payload " << i << " (" << x << ", " << y << ")";
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(BatchTest, PerRecordError) {
+  std::string too_long(5000, 'A');
+  std::vector<std::string_view> views = {"HELLO", "hello", too_long, "WORLD"};
+  BatchOptions options;
+  options.threads = 2;
+  options.chunk_size = 1;
+  auto symbols = encode_batch(views, options);
+  ASSERT_EQ(symbols.size(), 4u);
+  EXPECT_TRUE(symbols[0].ok());
+  EXPECT_FALSE(symbols[1].ok());  // 小文字は英数字モードで表せない
+  EXPECT_FALSE(symbols[2].ok());
+  EXPECT_TRUE(symbols[3].ok());
+  EXPECT_EQ(symbols[3].version, 1);
+}
+
+TEST(BatchTest, Verify) {
+  auto payloads = mixed_payloads();
+  payloads.push_back("https://example.com/?q=\xE3\x81\x82");
+  payloads.push_back(std::string(4000, '7'));
+  std::vector<std::string_view> views(payloads.begin(), payloads.end());
+  for (ErrorCorrectionLevel ecl : {L, H}) {
+    BatchOptions options;
+    options.encode.error_correction_level = ecl;
+    options.encode.mode_specifier = AUTO_MODE;
+    options.threads = 3;
+    options.verify = true;
+    auto symbols = encode_batch(views, options);
+    options.verify = false;
+    auto unverified = encode_batch(views, options);
+    ASSERT_EQ(symbols.size(), payloads.size());
+    for (size_t i = 0; i < symbols.size(); i++) {
+      // 検証は結果を変えない (4000桁は H に収まらない)
+      EXPECT_EQ(unverified[i].ok(), symbols[i].ok()) << symbols[i].error;
+      EXPECT_EQ(unverified[i].modules, symbols[i].modules);
+    }
+  }
+}
+
+TEST(BatchTest, PoolReuse) {
+  WorkStealingPool pool(3);
+  EXPECT_EQ(pool.threadCount(), 3);
+  EXPECT_TRUE(encode_batch({}, BatchOptions{}, pool).empty());
+  std::vector<std::string_view> views(10, "HELLO WORLD");
+  for (int round = 0; round < 3; round++) {
+    auto symbols = encode_batch(views, BatchOptions{}, pool);
+    ASSERT_EQ(symbols.size(), views.size());
+    for (const auto& symbol : symbols) {
+      EXPECT_EQ(symbol.modules, symbols[0].modules);
+    }
+  }
+  std::vector<int> hits(100);
+  EXPECT_THROW(pool.parallelFor(100, 7,
+                                [&](size_t begin, size_t end, int) {
+                                  for (size_t i = begin; i < end; i++) {
+                                    hits[i]++;
+                                  }
+                                  if (begin == 14) {
+                                    throw std::runtime_error("chunk");
+                                  }
+                                }),
+               std::runtime_error);
+  for (int hit : hits) {
+    EXPECT_EQ(hit, 1);
+  }
+}
+}  // namespace
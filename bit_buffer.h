@@ -0,0 +1,89 @@
+#ifndef BIT_BUFFER_H
+#define BIT_BUFFER_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <vector>
+
+// MSB-first bit stream backed by 64-bit words. Usable in constant
+// expressions (see qr_static.h).
+// Bit i lives in words[i / 64] at position 63 - i % 64, so reading the words
+// big-endian byte by byte yields the QR codewords directly.
+class BitBuffer {
+ public:
+  BitBuffer() = default;
+  constexpr explicit BitBuffer(size_t capacity_bits) {
+    reserve(capacity_bits);
+  }
+
+  // Appends the lowest `nbits` bits of `value`, most significant bit first.
+  // `nbits` must be in [0, 32].
+  constexpr void append(u_int32_t value, int nbits) {
+    appendWide(value, nbits);
+  }
+
+  // Same for up to 64 bits at once; `nbits` must be in [0, 64].
+  constexpr void appendWide(u_int64_t value, int nbits) {
+    if (nbits == 0) {
+      return;
+    }
+    u_int64_t v = nbits == 64 ? value : value & ((u_int64_t{1} << nbits) - 1);
+    int offset = static_cast<int>(bit_count % 64);
+    if (offset == 0) {
+      words.push_back(0);
+    }
+    int free_bits = 64 - offset;
+    if (nbits <= free_bits) {
+      words.back() |= v << (free_bits - nbits);
+    } else {
+      int rest = nbits - free_bits;
+      words.back() |= v >> rest;
+      words.push_back(v << (64 - rest));
+    }
+    bit_count += nbits;
+  }
+
+  constexpr bool operator[](size_t i) const {
+    return (words[i / 64] >> (63 - i % 64)) & 1;
+  }
+
+  // The i-th complete byte; bits past size() read as zero.
+  constexpr u_int8_t byteAt(size_t i) const {
+    return static_cast<u_int8_t>(words[i / 8] >> (56 - 8 * (i % 8)));
+  }
+
+  constexpr size_t size() const { return bit_count; }
+  constexpr size_t byteCount() const { return (bit_count + 7) / 8; }
+  constexpr bool empty() const { return bit_count == 0; }
+
+  // Drops all bits but keeps the allocation so the buffer can be reused.
+  constexpr void clear() {
+    words.clear();
+    bit_count = 0;
+  }
+  constexpr void reserve(size_t capacity_bits) {
+    words.reserve((capacity_bits + 63) / 64);
+  }
+
+  // Writes byteCount() bytes into `out`.
+  constexpr void copyBytesTo(u_int8_t* out) const {
+    size_t n = byteCount();
+    for (size_t i = 0; i < n; i++) {
+      out[i] = byteAt(i);
+    }
+  }
+  constexpr std::vector<u_int8_t> toBytes() const {
+    std::vector<u_int8_t> result(byteCount());
+    copyBytesTo(result.data());
+    return result;
+  }
+
+  constexpr const std::vector<u_int64_t>& data() const { return words; }
+
+ private:
+  std::vector<u_int64_t> words;
+  size_t bit_count = 0;
+};
+
+#endif  // BIT_BUFFER_H
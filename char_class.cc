@@ -0,0 +1,187 @@
+#include "char_class.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define QR_X86_SIMD 1
+#endif
+
+#ifdef QR_X86_SIMD
+namespace {
+// a <= b (符号なし) のバイトで 0xFF
+__attribute__((target("ssse3"))) inline __m128i less_equal_u8(__m128i a,
+                                                              __m128i b) {
+  return _mm_cmpeq_epi8(_mm_min_epu8(a, b), a);
+}
+
+// lo <= x <= hi
+__attribute__((target("ssse3"))) inline __m128i in_range(__m128i x, char lo,
+                                                         char hi) {
+  return less_equal_u8(_mm_sub_epi8(x, _mm_set1_epi8(lo)),
+                       _mm_set1_epi8(static_cast<char>(hi - lo)));
+}
+
+// 英数字の集合は '0'-':', 'A'-'Z', '-'-'/', '*'-'+', '$'-'%', ' ' の範囲の和
+__attribute__((target("ssse3"))) inline void classify16(__m128i x,
+                                                        __m128i& numeric,
+                                                        __m128i& alnum) {
+  numeric = in_range(x, '0', '9');
+  alnum = _mm_or_si128(
+      _mm_or_si128(in_range(x, '0', ':'), in_range(x, 'A', 'Z')),
+      _mm_or_si128(_mm_or_si128(in_range(x, '-', '/'), in_range(x, '*', '+')),
+                   _mm_or_si128(in_range(x, '$', '%'),
+                                _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')))));
+}
+
+__attribute__((target("ssse3"))) u_int8_t classify_block_ssse3(
+    std::string_view s) {
+  __m128i all_numeric = _mm_set1_epi8(-1);
+  __m128i all_alnum = _mm_set1_epi8(-1);
+  size_t i = 0;
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i numeric, alnum;
+    classify16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i)),
+               numeric, alnum);
+    all_numeric = _mm_and_si128(all_numeric, numeric);
+    all_alnum = _mm_and_si128(all_alnum, alnum);
+  }
+  u_int8_t result = (_mm_movemask_epi8(all_numeric) == 0xFFFF ? CHAR_NUMERIC
+                                                              : 0) |
+                    (_mm_movemask_epi8(all_alnum) == 0xFFFF ? CHAR_ALNUM : 0);
+  return result & classify_block_scalar(s.substr(i));
+}
+
+__attribute__((target("ssse3"))) void classify_chars_ssse3(
+    std::string_view s, u_int8_t* classes) {
+  size_t i = 0;
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i numeric, alnum;
+    classify16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i)),
+               numeric, alnum);
+    __m128i result =
+        _mm_or_si128(_mm_and_si128(numeric, _mm_set1_epi8(CHAR_NUMERIC)),
+                     _mm_and_si128(alnum, _mm_set1_epi8(CHAR_ALNUM)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(classes + i), result);
+  }
+  for (; i < s.size(); i++) {
+    classes[i] = char_class(s[i]);
+  }
+}
+
+__attribute__((target("ssse3"))) void pack_numeric_ssse3(std::string_view s,
+                                                         BitBuffer& out) {
+  // 16バイト読んで先頭12桁 = 4組を処理する。各組を [d0 d1 d2 0] に並べ、
+  // PMADDUBSW で (100 d0 + 10 d1, d2)、PMADDWD で 32ビットの値にする
+  const __m128i triples =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i weights =
+      _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0);
+  const __m128i zero_digit = _mm_set1_epi8('0');
+  const __m128i ones = _mm_set1_epi16(1);
+  size_t i = 0;
+  alignas(16) u_int32_t values[4];
+  for (; i + 16 <= s.size(); i += 12) {
+    __m128i digits = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i)),
+        zero_digit);
+    __m128i v = _mm_madd_epi16(
+        _mm_maddubs_epi16(_mm_shuffle_epi8(digits, triples), weights), ones);
+    _mm_store_si128(reinterpret_cast<__m128i*>(values), v);
+    out.appendWide((u_int64_t{values[0]} << 30) | (u_int64_t{values[1]} << 20) |
+                       (values[2] << 10) | values[3],
+                   40);
+  }
+  pack_numeric_scalar(s.substr(i), out);
+}
+
+__attribute__((target("ssse3"))) void pack_alnum_ssse3(std::string_view s,
+                                                       BitBuffer& out) {
+  // 上位ニブル(2-5)ごとに下位ニブルで引く表。範囲外は使われない
+  const __m128i table2 = _mm_setr_epi8(36, 0, 0, 0, 37, 38, 0, 0, 0, 0, 39, 40,
+                                       0, 41, 42, 43);
+  const __m128i table3 =
+      _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 44, 0, 0, 0, 0, 0);
+  const __m128i table4 = _mm_setr_epi8(0, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+                                       19, 20, 21, 22, 23, 24);
+  const __m128i table5 = _mm_setr_epi8(25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+                                       35, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i pair_weights = _mm_set1_epi16(0x012D);  // (45, 1)
+  size_t i = 0;
+  alignas(16) u_int16_t pairs[8];
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i));
+    __m128i lo = _mm_and_si128(x, nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+    __m128i value = _mm_or_si128(
+        _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(2)),
+                          _mm_shuffle_epi8(table2, lo)),
+            _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(3)),
+                          _mm_shuffle_epi8(table3, lo))),
+        _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(4)),
+                                   _mm_shuffle_epi8(table4, lo)),
+                     _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(5)),
+                                   _mm_shuffle_epi8(table5, lo))));
+    _mm_store_si128(reinterpret_cast<__m128i*>(pairs),
+                    _mm_maddubs_epi16(value, pair_weights));
+    u_int64_t first = 0;
+    for (int k = 0; k < 5; k++) {
+      first = (first << 11) | pairs[k];
+    }
+    u_int64_t second = 0;
+    for (int k = 5; k < 8; k++) {
+      second = (second << 11) | pairs[k];
+    }
+    out.appendWide(first, 55);
+    out.appendWide(second, 33);
+  }
+  pack_alnum_scalar(s.substr(i), out);
+}
+}  // namespace
+#endif
+
+namespace {
+struct CharKernel {
+  u_int8_t (*classify_block)(std::string_view);
+  void (*classify_chars)(std::string_view, u_int8_t*);
+  void (*pack_numeric)(std::string_view, BitBuffer&);
+  void (*pack_alnum)(std::string_view, BitBuffer&);
+  const char* name;
+};
+
+CharKernel select_char_kernel() {
+#ifdef QR_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return {classify_block_ssse3, classify_chars_ssse3, pack_numeric_ssse3,
+            pack_alnum_ssse3, "ssse3"};
+  }
+#endif
+  return {classify_block_scalar, classify_chars_scalar, pack_numeric_scalar,
+          pack_alnum_scalar, "scalar"};
+}
+
+const CharKernel& char_kernel() {
+  static const CharKernel kernel = select_char_kernel();
+  return kernel;
+}
+}  // namespace
+
+u_int8_t classify_block(std::string_view s) {
+  return char_kernel().classify_block(s);
+}
+
+void classify_chars(std::string_view s, u_int8_t* classes) {
+  char_kernel().classify_chars(s, classes);
+}
+
+void pack_numeric(std::string_view s, BitBuffer& out) {
+  char_kernel().pack_numeric(s, out);
+}
+
+void pack_alnum(std::string_view s, BitBuffer& out) {
+  char_kernel().pack_alnum(s, out);
+}
+
+const char* char_kernel_name() { return char_kernel().name; }
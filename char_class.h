@@ -0,0 +1,100 @@
+#ifndef CHAR_CLASS_H
+#define CHAR_CLASS_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+
+#include "bit_buffer.h"
+
+// Which data modes can encode a byte. Byte mode takes everything.
+constexpr u_int8_t CHAR_NUMERIC = 0b01;
+constexpr u_int8_t CHAR_ALNUM = 0b10;
+// alnum_value of a byte that is not alphanumeric
+constexpr u_int8_t NOT_ALNUM = 0xFF;
+
+// 英数字モードの文字。位置がそのまま値になる
+constexpr char ALNUM_CHARSET[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+struct CharTable {
+  u_int8_t char_class[256];
+  u_int8_t alnum_value[256];
+};
+
+constexpr CharTable make_char_table() {
+  CharTable table{};
+  for (int c = 0; c < 256; c++) {
+    table.alnum_value[c] = NOT_ALNUM;
+  }
+  for (int v = 0; v < 45; v++) {
+    auto c = static_cast<u_int8_t>(ALNUM_CHARSET[v]);
+    table.alnum_value[c] = static_cast<u_int8_t>(v);
+    table.char_class[c] = CHAR_ALNUM | (v < 10 ? CHAR_NUMERIC : 0);
+  }
+  return table;
+}
+
+inline constexpr CharTable CHAR_TABLE = make_char_table();
+
+constexpr u_int8_t char_class(char c) {
+  return CHAR_TABLE.char_class[static_cast<u_int8_t>(c)];
+}
+constexpr u_int8_t alnum_value(char c) {
+  return CHAR_TABLE.alnum_value[static_cast<u_int8_t>(c)];
+}
+
+// CHAR_* flags shared by every byte of `s` (CHAR_NUMERIC | CHAR_ALNUM for an
+// empty string). One vectorised pass.
+u_int8_t classify_block(std::string_view s);
+// char_class() of every byte into `classes` (s.size() bytes).
+void classify_chars(std::string_view s, u_int8_t* classes);
+
+// Packers for input already known to be valid for the mode (classify_block):
+// 3 digits -> 10 bits (remainder 7 / 4 bits), 2 characters -> 11 bits
+// (remainder 6 bits).
+void pack_numeric(std::string_view s, BitBuffer& out);
+void pack_alnum(std::string_view s, BitBuffer& out);
+// Table-only reference versions of the kernels above, also used in constant
+// expressions (the kernels dispatch at run time).
+constexpr u_int8_t classify_block_scalar(std::string_view s) {
+  u_int8_t result = CHAR_NUMERIC | CHAR_ALNUM;
+  for (char c : s) {
+    result &= char_class(c);
+  }
+  return result;
+}
+
+constexpr void classify_chars_scalar(std::string_view s, u_int8_t* classes) {
+  for (size_t i = 0; i < s.size(); i++) {
+    classes[i] = char_class(s[i]);
+  }
+}
+
+constexpr void pack_numeric_scalar(std::string_view s, BitBuffer& out) {
+  for (size_t i = 0; i < s.size(); i += 3) {
+    size_t digits = std::min<size_t>(3, s.size() - i);
+    u_int32_t value = 0;
+    for (size_t j = i; j < i + digits; j++) {
+      value = value * 10 + (s[j] - '0');
+    }
+    out.append(value, static_cast<int>(digits * 3 + 1));
+  }
+}
+
+constexpr void pack_alnum_scalar(std::string_view s, BitBuffer& out) {
+  size_t i = 0;
+  for (; i + 1 < s.size(); i += 2) {
+    out.append(alnum_value(s[i]) * 45u + alnum_value(s[i + 1]), 11);
+  }
+  if (i < s.size()) {
+    out.append(alnum_value(s[i]), 6);
+  }
+}
+
+// "ssse3" or "scalar"
+const char* char_kernel_name();
+
+#endif  // CHAR_CLASS_H
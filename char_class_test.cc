@@ -0,0 +1,96 @@
+#include "char_class.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+std::string bits_of(const BitBuffer& buffer) {
+  std::string result;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    result += buffer[i] ? '1' : '0';
+  }
+  return result;
+}
+
+TEST(CharClassTest, Table) {
+  for (int v = 0; v < 45; v++) {
+    EXPECT_EQ(alnum_value(ALNUM_CHARSET[v]), v);
+  }
+  EXPECT_EQ(char_class('7'), CHAR_NUMERIC | CHAR_ALNUM);
+  EXPECT_EQ(char_class('Q'), CHAR_ALNUM);
+  EXPECT_EQ(char_class(':'), CHAR_ALNUM);
+  EXPECT_EQ(char_class('q'), 0);
+  EXPECT_EQ(char_class('\xC0'), 0);
+  EXPECT_EQ(alnum_value('#'), NOT_ALNUM);
+  static_assert(alnum_value('Z') == 35);
+}
+
+TEST(CharClassTest, KernelsMatchScalar) {
+  std::mt19937 random(13);
+  const std::string digits = "0123456789";
+  const std::string alnum = ALNUM_CHARSET;
+  for (int trial = 0; trial < 500; trial++) {
+    const std::string& alphabet = trial % 2 ? digits : alnum;
+    std::string s;
+    for (int i = 0, n = trial % 70; i < n; i++) {
+      s += alphabet[random() % alphabet.size()];
+    }
+    u_int8_t expected = trial % 2 ? CHAR_NUMERIC | CHAR_ALNUM : CHAR_ALNUM;
+    if (s.find_first_not_of(digits) == std::string::npos) {
+      expected = CHAR_NUMERIC | CHAR_ALNUM;
+    }
+    ASSERT_EQ(classify_block(s), expected) << s;
+    ASSERT_EQ(classify_block(s), classify_block_scalar(s));
+
+    BitBuffer fast, reference;
+    if (expected & CHAR_NUMERIC) {
+      pack_numeric(s, fast);
+      pack_numeric_scalar(s, reference);
+    } else {
+      pack_alnum(s, fast);
+      pack_alnum_scalar(s, reference);
+    }
+    ASSERT_EQ(bits_of(fast), bits_of(reference)) << s;
+
+    // どこか1バイトを壊すと、そのモードでは受け付けない
+    if (!s.empty()) {
+      std::string broken = s;
+      broken[random() % s.size()] = "a#\x80\n"[random() % 4];
+      ASSERT_EQ(classify_block(broken), 0) << broken;
+      std::vector<u_int8_t> classes(broken.size());
+      classify_chars(broken, classes.data());
+      for (size_t i = 0; i < broken.size(); i++) {
+        ASSERT_EQ(classes[i], char_class(broken[i]));
+      }
+    }
+  }
+  // 全256バイトの分類
+  std::string all;
+  for (int c = 0; c < 256; c++) {
+    all += static_cast<char>(c);
+  }
+  std::vector<u_int8_t> classes(all.size());
+  classify_chars(all, classes.data());
+  for (int c = 0; c < 256; c++) {
+    EXPECT_EQ(classes[c], CHAR_TABLE.char_class[c]) << c;
+  }
+}
+
+TEST(CharClassTest, PackedBits) {
+  BitBuffer numeric;
+  pack_numeric("0123456789012345", numeric);  // 5組 + 1桁
+  EXPECT_EQ(bits_of(numeric), "0000001100" "0101011001" "1010100110"
+                              "1110000101" "0011101010" "0101");
+  BitBuffer alnum;
+  pack_alnum("AC-42 $%*+./:ZZZ", alnum);
+  BitBuffer expected;
+  const std::string text = "AC-42 $%*+./:ZZZ";
+  for (size_t i = 0; i < text.size(); i += 2) {
+    expected.append(alnum_value(text[i]) * 45 + alnum_value(text[i + 1]), 11);
+  }
+  EXPECT_EQ(bits_of(alnum), bits_of(expected));
+}
+}  // namespace
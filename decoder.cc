@@ -0,0 +1,439 @@
+#include "decoder.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "char_class.h"
+
+namespace {
+// 許容する形式情報・型番情報のビット誤り (BCH 符号の最小距離は 7 と 8)
+constexpr int MAX_INFORMATION_BIT_ERRORS = 3;
+
+bool module_at(const u_int64_t* modules, int words_per_row, int x, int y) {
+  return (modules[static_cast<size_t>(x) * words_per_row + y / 64] >>
+          (y % 64)) &
+         1;
+}
+
+// 左上の形式情報ビット i の位置 (QrCode::setFormatCells() と同じ)
+constexpr int FORMAT_POSITIONS[15][2] = {
+    {0, 8}, {1, 8}, {2, 8}, {3, 8}, {4, 8}, {5, 8}, {7, 8}, {8, 8},
+    {8, 7}, {8, 5}, {8, 4}, {8, 3}, {8, 2}, {8, 1}, {8, 0},
+};
+
+void read_format_bits(const u_int64_t* modules, int size, int words_per_row,
+                      u_int32_t copies[2]) {
+  auto bit = [&](int x, int y) {
+    return static_cast<u_int32_t>(module_at(modules, words_per_row, x, y));
+  };
+  copies[0] = copies[1] = 0;
+  for (int i = 0; i < 15; i++) {
+    copies[0] |= bit(FORMAT_POSITIONS[i][0], FORMAT_POSITIONS[i][1]) << i;
+    // 右上(行8)と左下(列8)のもう1組
+    copies[1] |= (i < 8 ? bit(8, size - 1 - i) : bit(size - 15 + i, 8)) << i;
+  }
+}
+
+// 形式情報に最も近い (誤り訂正レベル, マスクパターン) を選ぶ
+void decode_format(const u_int64_t* modules, int size, int words_per_row,
+                   DecodeResult& out) {
+  u_int32_t copies[2];
+  read_format_bits(modules, size, words_per_row, copies);
+  int best_distance = MAX_INFORMATION_BIT_ERRORS + 1;
+  for (int ecl = L; ecl <= H; ecl++) {
+    for (int pattern = 0; pattern < 8; pattern++) {
+      const u_int32_t expected = FORMAT_INFORMATION_BITS[ecl][pattern];
+      const int distance = std::min(std::popcount(copies[0] ^ expected),
+                                    std::popcount(copies[1] ^ expected));
+      if (distance < best_distance) {
+        best_distance = distance;
+        out.error_correction_level = ecl;
+        out.mask_pattern = pattern;
+      }
+    }
+  }
+  if (best_distance > MAX_INFORMATION_BIT_ERRORS) {
+    throw std::runtime_error("Format information is unreadable");
+  }
+}
+
+// 型番情報 (版7以上) が大きさから求めた版と合うか確かめる
+void check_version_information(const u_int64_t* modules, int size,
+                               int words_per_row, int version) {
+  if (version < 7) {
+    return;
+  }
+  const int found = read_version_information(modules, size, words_per_row);
+  if (found == 0) {
+    throw std::runtime_error("Version information is unreadable");
+  }
+  if (found != version) {
+    throw std::runtime_error("Version information (" + std::to_string(found) +
+                             ") does not match the symbol size (" +
+                             std::to_string(size) + ")");
+  }
+}
+
+// 最終コードワード列の index 番目が属するブロックと、ブロック内の位置
+// (encode_blocks() のインターリーブの逆)
+void locate_codeword(const BlockLayout& layout, int index, int& block,
+                     int& position) {
+  const int blocks = layout.blockCount();
+  const int short_data = layout.short_block_data;
+  const int data_total = layout.dataCodewords();
+  if (index < short_data * blocks) {
+    block = index % blocks;
+    position = index / blocks;
+  } else if (index < data_total) {
+    block = layout.short_blocks + (index - short_data * blocks);
+    position = short_data;
+  } else {
+    const int ec_index = index - data_total;
+    block = ec_index % blocks;
+    position = short_data + (block < layout.short_blocks ? 0 : 1) +
+               ec_index / blocks;
+  }
+}
+
+// 上位ビットから順に読む。残りが足りるかは呼び出し側で確かめる
+class BitReader {
+ public:
+  BitReader(const u_int8_t* data, size_t bit_count)
+      : data(data), bit_count(bit_count) {}
+
+  size_t remaining() const { return bit_count - position; }
+  u_int32_t read(int n) {
+    u_int32_t value = 0;
+    while (n > 0) {
+      const int offset = static_cast<int>(position % 8);
+      const int take = std::min(n, 8 - offset);
+      const u_int32_t byte = data[position / 8];
+      value = (value << take) |
+              ((byte >> (8 - offset - take)) & ((u_int32_t{1} << take) - 1));
+      position += take;
+      n -= take;
+    }
+    return value;
+  }
+
+ private:
+  const u_int8_t* data;
+  size_t bit_count;
+  size_t position = 0;
+};
+
+void check_group(u_int32_t value, u_int32_t limit) {
+  if (value >= limit) {
+    throw std::runtime_error("Invalid character group (" +
+                             std::to_string(value) + ")");
+  }
+}
+
+// データコードワードを区間ごとに文字列へ戻す
+void parse_segments(const u_int8_t* data, int data_codewords, int version,
+                    StructuredAppend& append, std::string& text) {
+  append = StructuredAppend{};
+  text.clear();
+  BitReader reader(data, static_cast<size_t>(data_codewords) * 8);
+  // 終端パターンは容量が尽きる場合は省略される (4ビット未満)
+  while (reader.remaining() >= 4) {
+    const ModeSpecifier mode = static_cast<ModeSpecifier>(reader.read(4));
+    if (mode == 0) {
+      break;
+    }
+    if (mode == STRUCTURED_APPEND_MODE) {
+      if (reader.remaining() < STRUCTURED_APPEND_HEADER_BITS - 4) {
+        throw std::runtime_error("Truncated Structured Append header");
+      }
+      append.index = static_cast<int>(reader.read(4));
+      append.total = static_cast<int>(reader.read(4)) + 1;
+      append.parity = static_cast<u_int8_t>(reader.read(8));
+      if (append.index >= append.total) {
+        throw std::runtime_error("Structured Append position " +
+                                 std::to_string(append.index) +
+                                 " is beyond the total of " +
+                                 std::to_string(append.total));
+      }
+      continue;
+    }
+    if (mode != NUMBER_MODE && mode != ALNUM_MODE && mode != BYTE_MODE) {
+      throw std::runtime_error("Unsupported mode indicator (" +
+                               std::to_string(mode) + ")");
+    }
+    const int count_bits = char_count_bits(mode, version);
+    if (reader.remaining() < static_cast<size_t>(count_bits)) {
+      throw std::runtime_error("Truncated segment header");
+    }
+    u_int32_t count = reader.read(count_bits);
+    if (reader.remaining() < encoded_data_bits(count, mode)) {
+      throw std::runtime_error("Segment of " + std::to_string(count) +
+                               " characters overruns the data codewords");
+    }
+    if (mode == NUMBER_MODE) {
+      for (; count >= 3; count -= 3) {
+        const u_int32_t group = reader.read(10);
+        check_group(group, 1000);
+        text += static_cast<char>('0' + group / 100);
+        text += static_cast<char>('0' + group / 10 % 10);
+        text += static_cast<char>('0' + group % 10);
+      }
+      if (count == 2) {
+        const u_int32_t group = reader.read(7);
+        check_group(group, 100);
+        text += static_cast<char>('0' + group / 10);
+        text += static_cast<char>('0' + group % 10);
+      } else if (count == 1) {
+        const u_int32_t group = reader.read(4);
+        check_group(group, 10);
+        text += static_cast<char>('0' + group);
+      }
+    } else if (mode == ALNUM_MODE) {
+      for (; count >= 2; count -= 2) {
+        const u_int32_t pair = reader.read(11);
+        check_group(pair, 45 * 45);
+        text += ALNUM_CHARSET[pair / 45];
+        text += ALNUM_CHARSET[pair % 45];
+      }
+      if (count == 1) {
+        const u_int32_t value = reader.read(6);
+        check_group(value, 45);
+        text += ALNUM_CHARSET[value];
+      }
+    } else {
+      for (; count > 0; count--) {
+        text += static_cast<char>(reader.read(8));
+      }
+    }
+  }
+}
+
+void decode(const u_int64_t* modules, int size, int words_per_row,
+            const int* erasures, size_t erasure_count, DecodeResult& out) {
+  if (size < symbol_size(MIN_VERSION) || size > symbol_size(MAX_VERSION) ||
+      (size - 17) % 4 != 0) {
+    throw std::runtime_error("Invalid symbol size (" + std::to_string(size) +
+                             ")");
+  }
+  const int version = (size - 17) / 4;
+  const int plane_words_per_row = (size + 63) / 64;
+  if (words_per_row < plane_words_per_row) {
+    throw std::runtime_error("Rows of " + std::to_string(words_per_row) +
+                             " words cannot hold " + std::to_string(size) +
+                             " modules");
+  }
+  decode_format(modules, size, words_per_row, out);
+  check_version_information(modules, size, words_per_row, version);
+  out.version = version;
+
+  // マスクを外してから、符号化と同じ配置順でコードワードを読み戻す
+  std::array<u_int64_t, MAX_SYMBOL_WORDS> plane;
+  const u_int64_t* mask = mask_plane(version, out.mask_pattern);
+  for (int x = 0; x < size; x++) {
+    for (int w = 0; w < plane_words_per_row; w++) {
+      const int index = x * plane_words_per_row + w;
+      plane[index] =
+          modules[static_cast<size_t>(x) * words_per_row + w] ^ mask[index];
+    }
+  }
+  const BlockLayout layout = block_layout(version, out.error_correction_level);
+  const int total = layout.totalCodewords();
+  const u_int32_t* order = placement_order(version).data();
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> codewords;
+  for (int k = 0; k < total; k++) {
+    u_int32_t byte = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      const u_int32_t position = order[k * 8 + bit];
+      byte = (byte << 1) | ((plane[position >> 6] >> (position & 63)) & 1);
+    }
+    codewords[k] = static_cast<u_int8_t>(byte);
+  }
+
+  // ブロックごとに集め直して訂正し、データ部を元の順に並べる
+  const int blocks = layout.blockCount();
+  const int ec = layout.ec_codewords_per_block;
+  const int short_data = layout.short_block_data;
+  const int data_total = layout.dataCodewords();
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> data;
+  u_int8_t block[255];
+  int block_erasures[MAX_EC_CODEWORDS_PER_BLOCK];
+  int offset = 0;
+  out.corrected = 0;
+  for (int b = 0; b < blocks; b++) {
+    const int length = short_data + (b < layout.short_blocks ? 0 : 1);
+    for (int i = 0; i < short_data; i++) {
+      block[i] = codewords[i * blocks + b];
+    }
+    if (length > short_data) {
+      block[short_data] =
+          codewords[short_data * blocks + (b - layout.short_blocks)];
+    }
+    for (int i = 0; i < ec; i++) {
+      block[length + i] = codewords[data_total + i * blocks + b];
+    }
+    size_t block_erasure_count = 0;
+    for (size_t k = 0; k < erasure_count; k++) {
+      if (erasures[k] < 0 || erasures[k] >= total) {
+        throw std::runtime_error("Erasure index out of range (" +
+                                 std::to_string(erasures[k]) + ")");
+      }
+      int erasure_block, position;
+      locate_codeword(layout, erasures[k], erasure_block, position);
+      if (erasure_block == b) {
+        if (block_erasure_count == MAX_EC_CODEWORDS_PER_BLOCK) {
+          throw std::runtime_error("Too many erasures in block " +
+                                   std::to_string(b));
+        }
+        block_erasures[block_erasure_count++] = position;
+      }
+    }
+    const int fixed = rs_decode_block(block, length + ec, ec, block_erasures,
+                                      block_erasure_count);
+    if (fixed < 0) {
+      throw std::runtime_error("Block " + std::to_string(b) +
+                               " has too many errors to correct");
+    }
+    out.corrected += fixed;
+    std::memcpy(data.data() + offset, block, length);
+    offset += length;
+  }
+  parse_segments(data.data(), data_total, version, out.structured_append,
+                 out.text);
+}
+
+void join(std::span<const DecodeResult> parts, DecodeResult& out) {
+  if (parts.empty()) {
+    throw std::runtime_error("No Structured Append symbols to join");
+  }
+  const StructuredAppend& first = parts[0].structured_append;
+  if (first.total != static_cast<int>(parts.size())) {
+    throw std::runtime_error(
+        "Structured Append sequence of " + std::to_string(first.total) +
+        " symbols but " + std::to_string(parts.size()) + " were given");
+  }
+  // 位置ごとの部品。読んだ順に並んでいなくてよい
+  const DecodeResult* ordered[MAX_STRUCTURED_APPEND_SYMBOLS] = {};
+  size_t length = 0;
+  for (const DecodeResult& part : parts) {
+    if (!part.ok()) {
+      throw std::runtime_error("Structured Append symbol was not read: " +
+                               part.error);
+    }
+    const StructuredAppend& append = part.structured_append;
+    if (append.total != first.total || append.parity != first.parity) {
+      throw std::runtime_error(
+          "Symbols belong to different Structured Append sequences");
+    }
+    if (ordered[append.index] != nullptr) {
+      throw std::runtime_error("Structured Append position " +
+                               std::to_string(append.index) +
+                               " appears twice");
+    }
+    ordered[append.index] = &part;
+    length += part.text.size();
+  }
+  out.text.reserve(length);
+  for (int i = 0; i < first.total; i++) {
+    out.text += ordered[i]->text;
+    out.corrected += ordered[i]->corrected;
+  }
+  if (structured_append_parity(out.text) != first.parity) {
+    throw std::runtime_error("Structured Append parity does not match");
+  }
+  out.structured_append = {0, first.total, first.parity};
+}
+}  // namespace
+
+int read_version_information(const u_int64_t* modules, int size,
+                             int words_per_row) {
+  if (size < symbol_size(7)) {
+    return 0;
+  }
+  auto bit = [&](int x, int y) {
+    return static_cast<u_int32_t>(module_at(modules, words_per_row, x, y));
+  };
+  // 右上と左下の6x3領域。QrCode::setVersionCells() の逆
+  u_int32_t copies[2] = {0, 0};
+  for (int i = 0; i < 18; i++) {
+    const int a = size - 11 + i % 3;
+    const int b = i / 3;
+    copies[0] |= bit(a, b) << i;
+    copies[1] |= bit(b, a) << i;
+  }
+  int best_version = 0;
+  int best_distance = MAX_INFORMATION_BIT_ERRORS + 1;
+  for (int v = 7; v <= MAX_VERSION; v++) {
+    const int distance =
+        std::min(std::popcount(copies[0] ^ VERSION_INFORMATION_BITS[v]),
+                 std::popcount(copies[1] ^ VERSION_INFORMATION_BITS[v]));
+    if (distance < best_distance) {
+      best_distance = distance;
+      best_version = v;
+    }
+  }
+  return best_version;
+}
+
+void decode_matrix(const u_int64_t* modules, int size, int words_per_row,
+                   DecodeResult& out, const int* erasures,
+                   size_t erasure_count) {
+  out.version = 0;
+  out.mask_pattern = -1;
+  out.corrected = 0;
+  out.structured_append = StructuredAppend{};
+  out.text.clear();
+  out.error.clear();
+  try {
+    decode(modules, size, words_per_row, erasures, erasure_count, out);
+  } catch (const std::exception& e) {
+    out.version = 0;
+    out.mask_pattern = -1;
+    out.structured_append = StructuredAppend{};
+    out.text.clear();
+    out.error = e.what();
+  }
+}
+
+void decode_symbol(const Symbol& symbol, DecodeResult& out) {
+  if (!symbol.ok()) {
+    out = DecodeResult{};
+    out.error = "Symbol was not encoded: " + symbol.error;
+    return;
+  }
+  decode_matrix(symbol.modules.data(), symbol.size, symbol.words_per_row,
+                out);
+}
+
+DecodeResult decode_symbol(const Symbol& symbol) {
+  DecodeResult result;
+  decode_symbol(symbol, result);
+  return result;
+}
+
+DecodeResult decode_qr(const QrCode& qr) {
+  DecodeResult result;
+  decode_matrix(qr.row(0), qr.getSize(), qr.wordsPerRow(), result);
+  return result;
+}
+
+void join_structured_append(std::span<const DecodeResult> parts,
+                            DecodeResult& out) {
+  out = DecodeResult{};
+  try {
+    join(parts, out);
+  } catch (const std::exception& e) {
+    out.corrected = 0;
+    out.structured_append = StructuredAppend{};
+    out.text.clear();
+    out.error = e.what();
+  }
+}
+
+DecodeResult join_structured_append(std::span<const DecodeResult> parts) {
+  DecodeResult result;
+  join_structured_append(parts, result);
+  return result;
+}
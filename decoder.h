@@ -0,0 +1,56 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <span>
+#include <string>
+
+#include "qr.h"
+
+// Reads a symbol back from its module matrix: format and version
+// information, unmasking, the zigzag placement in reverse, de-interleaving,
+// Reed-Solomon correction and numeric/alphanumeric/byte segment parsing.
+// Meant for verifying every symbol before it ships, so a clean symbol costs
+// one remainder division per block and, once `out` has been used, decoding
+// allocates nothing.
+
+struct DecodeResult {
+  int version = 0;
+  int error_correction_level = L;
+  int mask_pattern = -1;
+  int corrected = 0;  // 誤り訂正で直したコードワード数
+  StructuredAppend structured_append;  // total 0: no Structured Append header
+  std::string text;
+  std::string error;
+
+  bool ok() const { return error.empty(); }
+};
+
+// `modules` is a row-major bitplane of `size` rows, `words_per_row` words
+// each, as exposed by QrCode::row() and Symbol::row(); set bits are dark.
+// `erasures` are indices into the final interleaved codeword sequence known
+// to be unreadable. Errors are reported through out.error, not thrown.
+void decode_matrix(const u_int64_t* modules, int size, int words_per_row,
+                   DecodeResult& out, const int* erasures = nullptr,
+                   size_t erasure_count = 0);
+// Version (7 to 40) whose version information is nearest to either copy in
+// the matrix (at most 3 bit errors), or 0 when neither is readable. A scanner
+// uses it to correct a symbol size estimated from the image.
+int read_version_information(const u_int64_t* modules, int size,
+                             int words_per_row);
+void decode_symbol(const Symbol& symbol, DecodeResult& out);
+DecodeResult decode_symbol(const Symbol& symbol);
+DecodeResult decode_qr(const QrCode& qr);
+
+// Joins the decoded symbols of one Structured Append sequence, in any order,
+// into out.text. Every part must have been read, carry the same total and
+// parity, and hold a different position; the parity of the joined text is
+// checked as well. out.corrected sums the parts and out.structured_append
+// keeps the total and parity; the other fields stay at their defaults.
+void join_structured_append(std::span<const DecodeResult> parts,
+                            DecodeResult& out);
+DecodeResult join_structured_append(std::span<const DecodeResult> parts);
+
+#endif  // DECODER_H
@@ -0,0 +1,163 @@
+#include "decoder.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+// k 番目の最終コードワードの最上位ビットを置いたモジュールを反転する
+void flip_codeword(Symbol& symbol, int k) {
+  const u_int32_t position = placement_order(symbol.version)[k * 8];
+  symbol.modules[position >> 6] ^= u_int64_t{1} << (position & 63);
+}
+
+void flip_cell(Symbol& symbol, int x, int y) {
+  symbol.modules[static_cast<size_t>(x) * symbol.words_per_row + y / 64] ^=
+      u_int64_t{1} << (y % 64);
+}
+
+TEST(DecoderTest, RoundTrip) {
+  std::mt19937 random(3);
+  const std::string alphabets[] = {
+      "0123456789", "0123456789ABCXYZ $%*+-./:",
+      std::string("abc\0\xFF\xE3\x81\x82 09AZ", 13)};
+  EncodeScratch scratch;
+  Symbol symbol;
+  DecodeResult decoded;
+  for (int trial = 0; trial < 120; trial++) {
+    std::string payload;
+    const int length =
+        static_cast<int>(random() % (trial < 100 ? 200 : 1500));
+    for (int i = 0; i < length; i++) {
+      const std::string& alphabet = alphabets[random() % 3];
+      payload += alphabet[random() % alphabet.size()];
+    }
+    EncodeOptions options{static_cast<ErrorCorrectionLevel>(trial % 4), 0,
+                          trial % 3 == 0 ? static_cast<int>(random() % 8)
+                                         : AUTO_MASK,
+                          trial % 5 == 0 ? BYTE_MODE : AUTO_MODE};
+    encode_symbol(payload, options, scratch, symbol);
+    if (!symbol.ok()) {
+      continue;
+    }
+    decode_symbol(symbol, decoded);
+    ASSERT_TRUE(decoded.ok()) << decoded.error;
+    EXPECT_EQ(payload, decoded.text);
+    EXPECT_EQ(symbol.version, decoded.version);
+    EXPECT_EQ(options.error_correction_level, decoded.error_correction_level);
+    EXPECT_EQ(symbol.mask_pattern, decoded.mask_pattern);
+    EXPECT_EQ(0, decoded.corrected);
+  }
+
+  QrCode qr(1, AUTO_MASK, ALNUM_MODE, M);
+  qr.createQrCode("HELLO WORLD");
+  DecodeResult from_qr = decode_qr(qr);
+  ASSERT_TRUE(from_qr.ok()) << from_qr.error;
+  EXPECT_EQ("HELLO WORLD", from_qr.text);
+  EXPECT_EQ(M, from_qr.error_correction_level);
+}
+
+TEST(DecoderTest, CorrectsDamagedModules) {
+  const std::string payload = "https://example.com/track?id=0012345678";
+  for (int version : {5, 7, 22}) {
+    for (ErrorCorrectionLevel ecl : {L, M, Q, H}) {
+      Symbol symbol = encode_symbol(payload, {ecl, version, AUTO_MASK,
+                                              AUTO_MODE});
+      ASSERT_TRUE(symbol.ok()) << symbol.error;
+      const BlockLayout layout = block_layout(version, ecl);
+      const int blocks = layout.blockCount();
+      const int t = layout.ec_codewords_per_block / 2;
+      // 各ブロックに t 個ずつ (インターリーブの先頭 t 周)
+      for (int k = 0; k < t * blocks; k++) {
+        flip_codeword(symbol, k);
+      }
+      // 形式情報と型番情報の片方にもビット誤り
+      flip_cell(symbol, 0, 8);
+      flip_cell(symbol, 8, symbol.size - 1);
+      if (version >= 7) {
+        flip_cell(symbol, symbol.size - 11, 0);
+        flip_cell(symbol, 1, symbol.size - 10);
+      }
+      DecodeResult decoded = decode_symbol(symbol);
+      ASSERT_TRUE(decoded.ok()) << decoded.error;
+      EXPECT_EQ(payload, decoded.text);
+      EXPECT_EQ(t * blocks, decoded.corrected);
+
+      // 1つ多いと訂正できない
+      for (int b = 0; b < blocks; b++) {
+        flip_codeword(symbol, t * blocks + b);
+      }
+      EXPECT_FALSE(decode_symbol(symbol).ok()) << version << ' ' << int(ecl);
+    }
+  }
+}
+
+TEST(DecoderTest, Erasures) {
+  const std::string payload = "ERASURES 0123456789";
+  Symbol symbol = encode_symbol(payload, {H, 4, AUTO_MASK, AUTO_MODE});
+  ASSERT_TRUE(symbol.ok()) << symbol.error;
+  // 4-H は1ブロックに誤り訂正コードワード16個。位置の分かった消失なら
+  // 16個まで直せる (誤りとしては8個まで)
+  const int blocks = block_layout(4, H).blockCount();
+  std::vector<int> erasures;
+  for (int k = 0; k < 16 * blocks; k++) {
+    flip_codeword(symbol, k);
+    erasures.push_back(k);
+  }
+  EXPECT_FALSE(decode_symbol(symbol).ok());
+  DecodeResult decoded;
+  decode_matrix(symbol.modules.data(), symbol.size, symbol.words_per_row,
+                decoded, erasures.data(), erasures.size());
+  ASSERT_TRUE(decoded.ok()) << decoded.error;
+  EXPECT_EQ(payload, decoded.text);
+  EXPECT_EQ(16 * blocks, decoded.corrected);
+
+  const int out_of_range = block_layout(4, H).totalCodewords();
+  decode_matrix(symbol.modules.data(), symbol.size, symbol.words_per_row,
+                decoded, &out_of_range, 1);
+  EXPECT_FALSE(decoded.ok());
+}
+
+TEST(DecoderTest, ReadsVersionInformation) {
+  for (int version : {7, 21, 40}) {
+    Symbol symbol = encode_symbol("VERSION", {L, version, AUTO_MASK,
+                                              AUTO_MODE});
+    ASSERT_TRUE(symbol.ok()) << symbol.error;
+    const u_int64_t* modules = symbol.modules.data();
+    EXPECT_EQ(version, read_version_information(modules, symbol.size,
+                                                symbol.words_per_row));
+    // 片方のコピーが壊れても、もう片方で読める
+    for (int i = 0; i < 6; i++) {
+      flip_cell(symbol, symbol.size - 11, i);
+    }
+    EXPECT_EQ(version, read_version_information(modules, symbol.size,
+                                                symbol.words_per_row));
+  }
+  Symbol small = encode_symbol("V1", {L, 1, AUTO_MASK, AUTO_MODE});
+  EXPECT_EQ(0, read_version_information(small.modules.data(), small.size,
+                                        small.words_per_row));
+}
+
+TEST(DecoderTest, RejectsUnreadableSymbols) {
+  Symbol symbol = encode_symbol("HELLO", {Q, 0, AUTO_MASK, AUTO_MODE});
+  ASSERT_TRUE(symbol.ok());
+  // 形式情報の両方を壊す
+  Symbol no_format = symbol;
+  for (int i = 0; i < 8; i++) {
+    flip_cell(no_format, i == 6 ? 7 : i, 8);
+    flip_cell(no_format, 8, no_format.size - 1 - i);
+  }
+  DecodeResult decoded = decode_symbol(no_format);
+  EXPECT_FALSE(decoded.ok());
+  EXPECT_EQ(0, decoded.version);
+
+  std::vector<u_int64_t> modules(30, 0);
+  decode_matrix(modules.data(), 30, 1, decoded);
+  EXPECT_FALSE(decoded.ok());
+
+  Symbol failed = encode_symbol(std::string(5000, 'A'));
+  EXPECT_FALSE(decode_symbol(failed).ok());
+}
+}  // namespace
@@ -0,0 +1,244 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <vector>
+
+namespace {
+constexpr std::array<u_int32_t, 256> make_crc32_table() {
+  std::array<u_int32_t, 256> table{};
+  for (u_int32_t i = 0; i < 256; i++) {
+    u_int32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+constexpr std::array<u_int32_t, 256> CRC32_TABLE = make_crc32_table();
+
+// LSB-first bit writer (deflate packs everything from the low bit up)
+class BitWriter {
+ public:
+  explicit BitWriter(std::string& out) : out(out) {}
+
+  // nbits <= 32
+  void write(u_int32_t value, int nbits) {
+    accumulator |= static_cast<u_int64_t>(value) << count;
+    count += nbits;
+    while (count >= 8) {
+      out.push_back(static_cast<char>(accumulator & 0xFF));
+      accumulator >>= 8;
+      count -= 8;
+    }
+  }
+  // Huffman codes are defined MSB first, so they go in bit-reversed.
+  void writeCode(u_int32_t code, int nbits) {
+    u_int32_t reversed = 0;
+    for (int i = 0; i < nbits; i++) {
+      reversed |= ((code >> i) & 1) << (nbits - 1 - i);
+    }
+    write(reversed, nbits);
+  }
+  void alignToByte() {
+    if (count > 0) {
+      write(0, 8 - count);
+    }
+  }
+
+ private:
+  std::string& out;
+  u_int64_t accumulator = 0;
+  int count = 0;
+};
+
+// 長さ符号 257..285 の基準値と拡張ビット数 (RFC 1951 3.2.5)
+constexpr u_int16_t LENGTH_BASE[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                       11, 13, 15, 17,  19,  23,  27,  31,
+                                       35, 43, 51, 59,  67,  83,  99,  115,
+                                       131, 163, 195, 227, 258};
+constexpr u_int8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr u_int16_t DISTANCE_BASE[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,
+    97,  129, 193, 257, 385, 513,  769,  1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+constexpr u_int8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                         4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                         9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+constexpr int MIN_MATCH = 3;
+constexpr int MAX_MATCH = 258;
+constexpr size_t WINDOW_SIZE = 32768;
+// ハッシュ表は入力に合わせて 2^MIN_HASH_BITS から 2^MAX_HASH_BITS まで
+constexpr int MIN_HASH_BITS = 8;
+constexpr int MAX_HASH_BITS = 15;
+
+void write_literal_length(BitWriter& writer, int symbol) {
+  // 固定ハフマン符号 (RFC 1951 3.2.6)
+  if (symbol < 144) {
+    writer.writeCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.writeCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.writeCode(symbol - 256, 7);
+  } else {
+    writer.writeCode(0xC0 + symbol - 280, 8);
+  }
+}
+
+void write_match(BitWriter& writer, int length, size_t distance) {
+  int l = static_cast<int>(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29,
+                                            length) -
+                           LENGTH_BASE) -
+          1;
+  write_literal_length(writer, 257 + l);
+  writer.write(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+  int d = static_cast<int>(std::upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30,
+                                            distance) -
+                           DISTANCE_BASE) -
+          1;
+  writer.writeCode(d, 5);
+  writer.write(static_cast<u_int32_t>(distance - DISTANCE_BASE[d]),
+               DISTANCE_EXTRA[d]);
+}
+
+int match_length(const u_int8_t* data, size_t n, size_t position,
+                 size_t distance) {
+  if (distance == 0 || distance > position || distance > WINDOW_SIZE) {
+    return 0;
+  }
+  const size_t limit = std::min<size_t>(MAX_MATCH, n - position);
+  const u_int8_t* a = data + position;
+  const u_int8_t* b = a - distance;
+  size_t length = 0;
+  while (length < limit && a[length] == b[length]) {
+    length++;
+  }
+  return static_cast<int>(length);
+}
+
+u_int32_t hash3(const u_int8_t* p, int bits) {
+  u_int32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - bits);
+}
+
+void deflate_stored(const u_int8_t* data, size_t n, std::string& out) {
+  size_t position = 0;
+  do {
+    size_t length = std::min<size_t>(n - position, 65535);
+    bool last = position + length == n;
+    out.push_back(last ? 1 : 0);  // BFINAL, BTYPE=00, 残りは0埋め
+    out.push_back(static_cast<char>(length & 0xFF));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(~length & 0xFF));
+    out.push_back(static_cast<char>((~length >> 8) & 0xFF));
+    out.append(reinterpret_cast<const char*>(data + position), length);
+    position += length;
+  } while (position < n);
+}
+
+void deflate_fixed(const u_int8_t* data, size_t n, size_t stride,
+                   std::string& out) {
+  BitWriter writer(out);
+  writer.write(1, 1);  // BFINAL
+  writer.write(1, 2);  // BTYPE = 01 (fixed Huffman)
+  // 小さな画像で固定の 32K 要素を毎回埋めないよう、表は入力の大きさに
+  // 合わせ、スレッドごとに使い回す。位置は +1 して 0 を空とし、32ビットで
+  // 持つ。桁あふれで距離がずれても match_length() が照合するので壊れない
+  const int hash_bits = std::clamp(static_cast<int>(std::bit_width(n)),
+                                   MIN_HASH_BITS, MAX_HASH_BITS);
+  thread_local std::vector<u_int32_t> head;
+  head.assign(size_t{1} << hash_bits, 0);
+  size_t position = 0;
+  while (position < n) {
+    int best_length = 0;
+    size_t best_distance = 0;
+    auto consider = [&](size_t distance) {
+      int length = match_length(data, n, position, distance);
+      if (length > best_length) {
+        best_length = length;
+        best_distance = distance;
+      }
+    };
+    consider(1);
+    consider(stride);
+    u_int32_t hash = 0;
+    const bool hashable = position + MIN_MATCH <= n;
+    if (hashable) {
+      hash = hash3(data + position, hash_bits);
+      if (head[hash] != 0) {
+        consider(static_cast<u_int32_t>(position + 1) - head[hash]);
+      }
+    }
+    if (best_length >= MIN_MATCH) {
+      write_match(writer, best_length, best_distance);
+      // 一致区間の先頭だけハッシュに登録する (速度優先)
+      if (hashable) {
+        head[hash] = static_cast<u_int32_t>(position + 1);
+      }
+      position += best_length;
+    } else {
+      write_literal_length(writer, data[position]);
+      if (hashable) {
+        head[hash] = static_cast<u_int32_t>(position + 1);
+      }
+      position++;
+    }
+  }
+  write_literal_length(writer, 256);  // end of block
+  writer.alignToByte();
+}
+}  // namespace
+
+u_int32_t crc32_update(u_int32_t crc, const u_int8_t* data, size_t n) {
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) {
+    crc = CRC32_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+u_int32_t adler32_update(u_int32_t adler, const u_int8_t* data, size_t n) {
+  // 5552バイトごとに剰余を取れば32ビットであふれない
+  constexpr size_t NMAX = 5552;
+  u_int32_t a = adler & 0xFFFF;
+  u_int32_t b = adler >> 16;
+  while (n > 0) {
+    size_t block = std::min(n, NMAX);
+    n -= block;
+    for (size_t i = 0; i < block; i++) {
+      a += data[i];
+      b += a;
+    }
+    data += block;
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+void deflate_append(const u_int8_t* data, size_t n, DeflateMode mode,
+                    size_t stride, std::string& out) {
+  if (mode == DeflateMode::STORED) {
+    deflate_stored(data, n, out);
+  } else {
+    deflate_fixed(data, n, stride, out);
+  }
+}
+
+void zlib_append(const u_int8_t* data, size_t n, DeflateMode mode,
+                 size_t stride, std::string& out) {
+  // CMF = 0x78 (deflate, 32K window); FLG = 0x01 makes CMF*256+FLG % 31 == 0
+  out.push_back(0x78);
+  out.push_back(0x01);
+  deflate_append(data, n, mode, stride, out);
+  u_int32_t adler = adler32_update(1, data, n);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((adler >> shift) & 0xFF));
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+// Minimal zlib (RFC 1950/1951) writer for PNG output: stored or fixed-Huffman
+// blocks only, so no dynamic tables and no external library.
+
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320) as used by PNG chunks.
+// Start with crc = 0 and feed the previous result to continue.
+u_int32_t crc32_update(u_int32_t crc, const u_int8_t* data, size_t n);
+// Adler-32 as used by the zlib trailer. Start with adler = 1.
+u_int32_t adler32_update(u_int32_t adler, const u_int8_t* data, size_t n);
+
+enum class DeflateMode {
+  STORED,  // no compression, 65535-byte blocks
+  FIXED,   // one fixed-Huffman block with greedy LZ77 matching
+};
+
+// Appends a raw deflate stream of `data` to `out`. `stride` is a likely match
+// distance (the scanline length for images: rows repeat), tried alongside
+// distance 1 and a hashed earlier occurrence; 0 disables it.
+void deflate_append(const u_int8_t* data, size_t n, DeflateMode mode,
+                    size_t stride, std::string& out);
+// The same wrapped in a zlib header and Adler-32 trailer.
+void zlib_append(const u_int8_t* data, size_t n, DeflateMode mode,
+                 size_t stride, std::string& out);
+
+#endif  // DEFLATE_H
@@ -1,21 +1,380 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
 
+#include "metrics.h"
 #include "qr.h"
+#include "render.h"
+#include "scanner.h"
+#include "server.h"
+#include "symbol_cache.h"
+#include "stream.h"
+
+namespace {
+void print_usage(const char *program) {
+  std::cerr
+      << "usage: " << program << " TEXT\n"
+      << "       " << program << " (--stdin | --input FILE) [options]\n"
+      << "       " << program << " --scan IMAGE...  (binary PGM or PBM)\n"
+      << "       " << program
+      << " serve --socket PATH [--threads N] [--max-batch N] [--cache-mb N]\n"
+      << "             [--max-image-side PIXELS] [--metrics FILE]"
+      << " [--metrics-json FILE]\n"
+      << "options:\n"
+      << "  -0, --null          records are NUL-delimited (default: newline)\n"
+      << "  --output-dir DIR    one file per record (DIR/<index>.<format>)\n"
+      << "  --output FILE       all records into FILE (default: stdout)\n"
+      << "  --format text|binary|pbm|pgm|png|svg|archive\n"
+      << "  --scale N           pixels per module for images (default: 4)\n"
+      << "  --quiet-zone N      light border in modules (default: 4)\n"
+      << "  --errors FILE       per-record errors (default: stderr)\n"
+      << "  --ecl L|M|Q|H       error correction level (default: L)\n"
+      << "  --mode auto|numeric|alnum|byte (default: auto)\n"
+      << "  --threads N         worker threads (default: all cores)\n"
+      << "  --chunk N           records per work-stealing task\n"
+      << "  --verify            decode every symbol back and fail mismatches\n"
+      << "  --cache-mb N        cache repeated payloads and their renderings\n"
+      << "                      in up to N MiB (statistics go to stderr;\n"
+      << "                      not with --pipeline)\n"
+      << "  --pipeline S,C,E,P,M,R  encode in stages with these threads for\n"
+      << "                      segment, codewords, ecc, placement, mask and\n"
+      << "                      render (e.g. 1,1,2,1,2,4)\n"
+      << "  --metrics FILE      write stage timings and counters at exit in\n"
+      << "                      Prometheus text (\"-\": stderr)\n"
+      << "  --metrics-json FILE the same as one JSON object\n";
+}
+
+int parse_ecl(const std::string &value) {
+  static const char LEVELS[] = "LMQH";
+  if (value.size() == 1 && std::strchr(LEVELS, value[0]) != nullptr) {
+    return static_cast<int>(std::strchr(LEVELS, value[0]) - LEVELS);
+  }
+  throw std::invalid_argument("unknown error correction level: " + value);
+}
+
+ModeSpecifier parse_mode(const std::string &value) {
+  if (value == "auto") {
+    return AUTO_MODE;
+  } else if (value == "numeric") {
+    return NUMBER_MODE;
+  } else if (value == "alnum") {
+    return ALNUM_MODE;
+  } else if (value == "byte") {
+    return BYTE_MODE;
+  }
+  throw std::invalid_argument("unknown mode: " + value);
+}
+
+// --cache-mb N をバイト数にする。N は1以上で、<< 20 しても size_t に収まること
+size_t parse_cache_mb(const std::string &value) {
+  constexpr unsigned long long MAX_MB =
+      std::numeric_limits<size_t>::max() >> 20;
+  unsigned long long mb = 0;
+  size_t used = 0;
+  try {
+    // stoull は "-1" を黙って折り返すので符号は先に弾く
+    if (value.find('-') == std::string::npos) {
+      mb = std::stoull(value, &used);
+    }
+  } catch (const std::exception &) {
+    used = 0;
+  }
+  if (used == 0 || used != value.size() || mb < 1 || mb > MAX_MB) {
+    throw std::invalid_argument("--cache-mb must be in [1, " +
+                                std::to_string(MAX_MB) + "] but got " + value);
+  }
+  return static_cast<size_t>(mb) << 20;
+}
+
+std::string read_file(const char *path) {
+  std::FILE *file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    throw std::runtime_error("cannot open " + std::string(path));
+  }
+  std::string data;
+  char buffer[1 << 16];
+  size_t n;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.append(buffer, n);
+  }
+  std::fclose(file);
+  return data;
+}
+
+// 画像ごとに読めた文字列を1行ずつ出す。読めない画像は標準エラーへ
+int run_scan(int argc, char *argv[]) {
+  if (argc < 3) {
+    throw std::invalid_argument("--scan needs at least one image");
+  }
+  GrayImage image;
+  ScanScratch scratch;
+  ScanResult result;
+  int failed = 0;
+  for (int i = 2; i < argc; i++) {
+    try {
+      read_netpbm(read_file(argv[i]), image);
+    } catch (const std::exception &e) {
+      std::cerr << argv[i] << ": " << e.what() << "\n";
+      failed++;
+      continue;
+    }
+    scan_image(image, scratch, result);
+    if (result.ok()) {
+      std::cout << result.decoded.text << '\n';
+    } else {
+      std::cerr << argv[i] << ": " << result.decoded.error << "\n";
+      failed++;
+    }
+  }
+  return failed == 0 ? 0 : 3;
+}
+
+// --metrics / --metrics-json の出力先
+struct MetricsOutput {
+  std::string prometheus;
+  std::string json;
+
+  bool parse(const std::string &arg,
+             const std::function<std::string()> &value) {
+    if (arg == "--metrics") {
+      prometheus = value();
+    } else if (arg == "--metrics-json") {
+      json = value();
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void write() const {
+    if (!METRICS_ENABLED && !(prometheus.empty() && json.empty())) {
+      std::cerr << "metrics were disabled at build time (QR_METRICS)\n";
+    }
+    const MetricsSnapshot snapshot = metrics_snapshot();
+    for (bool as_json : {false, true}) {
+      const std::string &path = as_json ? json : prometheus;
+      if (path.empty()) {
+        continue;
+      }
+      std::string text;
+      if (as_json) {
+        append_metrics_json(snapshot, text);
+      } else {
+        append_prometheus(snapshot, text);
+      }
+      if (path == "-") {
+        std::cerr << text;
+        continue;
+      }
+      std::ofstream out(path, std::ios::binary);
+      if (!(out << text)) {
+        throw std::runtime_error("cannot write " + path);
+      }
+    }
+  }
+};
+
+EncodeServer *running_server = nullptr;
+
+void stop_server(int) { running_server->stop(); }
+
+// 同じ端末から何度も起動する代わりに、ソケットで常駐して受け付ける
+int run_serve(int argc, char *argv[]) {
+  ServeOptions options;
+  std::unique_ptr<SymbolCache> cache;
+  MetricsOutput metrics;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::invalid_argument(arg + " needs a value");
+      }
+      return argv[++i];
+    };
+    if (arg == "--socket") {
+      options.socket_path = value();
+    } else if (arg == "--threads") {
+      options.threads = std::stoi(value());
+    } else if (arg == "--max-batch") {
+      options.max_batch = std::max<size_t>(std::stoul(value()), 1);
+    } else if (arg == "--max-image-side") {
+      options.max_image_side = std::stoi(value());
+    } else if (arg == "--cache-mb") {
+      SymbolCacheOptions cache_options;
+      cache_options.max_bytes = parse_cache_mb(value());
+      cache = std::make_unique<SymbolCache>(cache_options);
+      options.cache = cache.get();
+    } else if (!metrics.parse(arg, value)) {
+      throw std::invalid_argument("unknown option: " + arg);
+    }
+  }
+  if (options.socket_path.empty()) {
+    throw std::invalid_argument("serve needs --socket PATH");
+  }
+  EncodeServer server(options);
+  running_server = &server;
+  std::signal(SIGINT, stop_server);
+  std::signal(SIGTERM, stop_server);
+  server.run();
+  std::signal(SIGINT, SIG_DFL);
+  std::signal(SIGTERM, SIG_DFL);
+  running_server = nullptr;
+  const ServeStats stats = server.stats();
+  std::cerr << "served " << stats.requests << " requests (" << stats.failed
+            << " failed) in " << stats.batches << " batches over "
+            << stats.connections << " connections\n";
+  metrics.write();
+  return 0;
+}
+
+int run_streaming(int argc, char *argv[]) {
+  StreamOptions options;
+  options.batch.encode.mode_specifier = AUTO_MODE;
+  std::string input_path;
+  std::string errors_path;
+  bool from_stdin = false;
+  std::unique_ptr<SymbolCache> cache;
+  MetricsOutput metrics;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::invalid_argument(arg + " needs a value");
+      }
+      return argv[++i];
+    };
+    if (arg == "--stdin") {
+      from_stdin = true;
+    } else if (arg == "--input") {
+      input_path = value();
+    } else if (arg == "-0" || arg == "--null") {
+      options.delimiter = '\0';
+    } else if (arg == "--output-dir") {
+      options.output_dir = value();
+    } else if (arg == "--output") {
+      options.output_file = value();
+    } else if (arg == "--format") {
+      std::string format = value();
+      if (format == "text") {
+        options.format = OutputFormat::TEXT;
+      } else if (format == "binary") {
+        options.format = OutputFormat::BINARY;
+      } else if (format == "pbm") {
+        options.format = OutputFormat::PBM;
+      } else if (format == "pgm") {
+        options.format = OutputFormat::PGM;
+      } else if (format == "png") {
+        options.format = OutputFormat::PNG;
+      } else if (format == "svg") {
+        options.format = OutputFormat::SVG;
+      } else if (format == "archive") {
+        options.format = OutputFormat::ARCHIVE;
+      } else {
+        throw std::invalid_argument("unknown format: " + format);
+      }
+    } else if (arg == "--scale") {
+      options.render.scale = std::stoi(value());
+    } else if (arg == "--quiet-zone") {
+      options.render.quiet_zone = std::stoi(value());
+    } else if (arg == "--errors") {
+      errors_path = value();
+    } else if (arg == "--ecl") {
+      options.batch.encode.error_correction_level =
+          static_cast<ErrorCorrectionLevel>(parse_ecl(value()));
+    } else if (arg == "--mode") {
+      options.batch.encode.mode_specifier = parse_mode(value());
+    } else if (arg == "--threads") {
+      options.batch.threads = std::stoi(value());
+    } else if (arg == "--chunk") {
+      options.batch.chunk_size = std::stoul(value());
+    } else if (arg == "--verify") {
+      options.batch.verify = true;
+    } else if (arg == "--cache-mb") {
+      SymbolCacheOptions cache_options;
+      cache_options.max_bytes = parse_cache_mb(value());
+      cache = std::make_unique<SymbolCache>(cache_options);
+      options.batch.cache = cache.get();
+    } else if (arg == "--pipeline") {
+      options.pipeline = true;
+      options.pipeline_threads = parse_pipeline_threads(value());
+    } else if (!metrics.parse(arg, value)) {
+      throw std::invalid_argument("unknown option: " + arg);
+    }
+  }
+  if (from_stdin == !input_path.empty()) {
+    throw std::invalid_argument("exactly one of --stdin or --input is needed");
+  }
+  if (options.format == OutputFormat::PBM ||
+      options.format == OutputFormat::PGM ||
+      options.format == OutputFormat::PNG) {
+    // 版1でも収まらない --scale / --quiet-zone はレコードごとでなく起動時に断る
+    check_render_options(symbol_size(MIN_VERSION), options.render);
+  }
+
+  std::FILE *input = from_stdin ? stdin : std::fopen(input_path.c_str(), "rb");
+  if (input == nullptr) {
+    throw std::runtime_error("cannot open " + input_path);
+  }
+  std::FILE *errors =
+      errors_path.empty() ? stderr : std::fopen(errors_path.c_str(), "w");
+  if (errors == nullptr) {
+    throw std::runtime_error("cannot open " + errors_path);
+  }
+  StreamStats stats = run_stream(input, options, errors);
+  if (input != stdin) {
+    std::fclose(input);
+  }
+  if (errors != stderr) {
+    std::fclose(errors);
+  }
+  if (cache != nullptr) {
+    const SymbolCacheStats cached = cache->stats();
+    std::cerr << "cache: " << cached.hits << " hits, " << cached.misses
+              << " misses, " << cached.rendered_hits << " rendered hits, "
+              << cached.evictions << " evictions, " << cached.entries
+              << " entries, " << cached.bytes << " bytes\n";
+  }
+  metrics.write();
+  // 失敗したレコードがあっても処理は続け、終了コードで知らせる
+  return stats.failed == 0 ? 0 : 3;
+}
+}  // namespace
 
 int main(int argc, char *argv[]) {
-  QrCode qr;
+  const bool serve = argc >= 2 && std::strcmp(argv[1], "serve") == 0;
+  if (serve || (argc >= 2 && argv[1][0] == '-' && argv[1][1] != '\0')) {
+    try {
+      if (serve) {
+        return run_serve(argc, argv);
+      }
+      if (std::strcmp(argv[1], "--scan") == 0) {
+        return run_scan(argc, argv);
+      }
+      return run_streaming(argc, argv);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << e.what() << "\n";
+      print_usage(argv[0]);
+      return 2;
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+  }
   if (argc != 2) {
     std::cerr << "the number of arguments must be 1 but got "
               << std::to_string(argc) << "\n";
+    print_usage(argv[0]);
     return 1;
   }
   std::cout << "Input: " << argv[1] << '\n';
+  QrCode qr(select_version(argv[1], AUTO_MODE, L), AUTO_MASK, AUTO_MODE);
   qr.createQrCode(argv[1]);
   qr.printCells();
-  // for (auto i = 0; i < 21; i++) {
-  //   for (auto j = 0; j < 21; j++) {
-  //     std::cout << qr.computeByMask(i, j, true) << ' ';
-  //   }
-  //   std::cout << '\n';
-  // }
 }
@@ -0,0 +1,261 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace {
+const char* const STAGE_NAMES[] = {"segment",   "codewords", "ecc",
+                                   "placement", "mask",      "encode",
+                                   "render",    "serve"};
+const char* const REJECT_NAMES[] = {"capacity", "character", "option",
+                                    "verify", "other"};
+const char LEVEL_NAMES[] = "LMQH";
+
+#ifdef QR_METRICS
+// スロットは解放せず、終わったスレッドの分を次のスレッドへ回す。
+// 終了処理の後に抜けるスレッドもあるので、登録簿は破棄しない
+struct SlotRegistry {
+  std::mutex mutex;
+  std::deque<MetricSlot> slots;
+  std::vector<MetricSlot*> free;
+};
+
+SlotRegistry& registry() {
+  static SlotRegistry* instance = new SlotRegistry;
+  return *instance;
+}
+
+struct SlotLease {
+  MetricSlot* slot = nullptr;
+  ~SlotLease() {
+    if (slot != nullptr) {
+      SlotRegistry& r = registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      r.free.push_back(slot);
+    }
+  }
+};
+
+thread_local SlotLease lease;
+
+template <typename T, size_t N>
+void add_all(const std::array<std::atomic<T>, N>& from,
+             std::array<T, N>& to) {
+  for (size_t i = 0; i < N; i++) {
+    to[i] += from[i].load(std::memory_order_relaxed);
+  }
+}
+
+template <typename T, size_t N>
+void zero_all(std::array<std::atomic<T>, N>& counters) {
+  for (auto& counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+}
+#endif  // QR_METRICS
+
+double seconds(u_int64_t ns) { return static_cast<double>(ns) * 1e-9; }
+
+void append_number(const char* format, double value, std::string& out) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), format, value);
+  out += buffer;
+}
+
+void append_counter_header(const char* name, const char* help,
+                           const char* type, std::string& out) {
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+// name{label="value"} count
+void append_sample(const char* name, const char* label, std::string_view value,
+                   u_int64_t count, std::string& out) {
+  out += name;
+  out += '{';
+  out += label;
+  out += "=\"";
+  out += value;
+  out += "\"} ";
+  out += std::to_string(count);
+  out += '\n';
+}
+}  // namespace
+
+const char* metric_stage_name(int stage) {
+  return stage >= 0 && stage < METRIC_STAGES ? STAGE_NAMES[stage] : "unknown";
+}
+
+const char* reject_reason_name(int reason) {
+  return reason >= 0 && reason < REJECT_REASONS ? REJECT_NAMES[reason]
+                                                : "unknown";
+}
+
+#ifdef QR_METRICS
+MetricSlot& metric_slot() {
+  if (lease.slot == nullptr) {
+    SlotRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (!r.free.empty()) {
+      lease.slot = r.free.back();
+      r.free.pop_back();
+    } else {
+      lease.slot = &r.slots.emplace_back();
+    }
+  }
+  return *lease.slot;
+}
+#endif  // QR_METRICS
+
+MetricsSnapshot metrics_snapshot() {
+  MetricsSnapshot snapshot;
+#ifdef QR_METRICS
+  SlotRegistry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (const MetricSlot& slot : r.slots) {
+    add_all(slot.stage_count, snapshot.stage_count);
+    add_all(slot.stage_ns, snapshot.stage_ns);
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+      add_all(slot.stage_buckets[stage], snapshot.stage_buckets[stage]);
+    }
+    add_all(slot.symbols_by_version, snapshot.symbols_by_version);
+    add_all(slot.symbols_by_level, snapshot.symbols_by_level);
+    add_all(slot.symbols_by_mask, snapshot.symbols_by_mask);
+    snapshot.bytes_in += slot.bytes_in.load(std::memory_order_relaxed);
+    snapshot.bytes_out += slot.bytes_out.load(std::memory_order_relaxed);
+    add_all(slot.rejects, snapshot.rejects);
+  }
+#endif  // QR_METRICS
+  return snapshot;
+}
+
+void reset_metrics() {
+#ifdef QR_METRICS
+  SlotRegistry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (MetricSlot& slot : r.slots) {
+    zero_all(slot.stage_count);
+    zero_all(slot.stage_ns);
+    for (auto& buckets : slot.stage_buckets) {
+      zero_all(buckets);
+    }
+    zero_all(slot.symbols_by_version);
+    zero_all(slot.symbols_by_level);
+    zero_all(slot.symbols_by_mask);
+    slot.bytes_in.store(0, std::memory_order_relaxed);
+    slot.bytes_out.store(0, std::memory_order_relaxed);
+    zero_all(slot.rejects);
+  }
+#endif  // QR_METRICS
+}
+
+void append_prometheus(const MetricsSnapshot& snapshot, std::string& out) {
+  append_counter_header("qr_stage_seconds",
+                        "Time spent per encoding stage, per symbol.",
+                        "histogram", out);
+  for (int stage = 0; stage < METRIC_STAGES; stage++) {
+    const std::string labels =
+        std::string("{stage=\"") + STAGE_NAMES[stage] + "\"";
+    u_int64_t cumulative = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      cumulative += snapshot.stage_buckets[stage][i];
+      out += "qr_stage_seconds_bucket" + labels + ",le=\"";
+      if (i == LATENCY_BUCKETS - 1) {
+        out += "+Inf";
+      } else {
+        append_number("%g", seconds(u_int64_t{1} << (i + 7)), out);
+      }
+      out += "\"} " + std::to_string(cumulative) + '\n';
+    }
+    out += "qr_stage_seconds_sum" + labels + "} ";
+    append_number("%.9f", seconds(snapshot.stage_ns[stage]), out);
+    out += "\nqr_stage_seconds_count" + labels + "} " +
+           std::to_string(snapshot.stage_count[stage]) + '\n';
+  }
+
+  append_counter_header("qr_symbols_by_version_total",
+                        "Symbols encoded, by version.", "counter", out);
+  for (int version = 1; version <= MAX_METRIC_VERSION; version++) {
+    append_sample("qr_symbols_by_version_total", "version",
+                  std::to_string(version),
+                  snapshot.symbols_by_version[version], out);
+  }
+  append_counter_header("qr_symbols_by_level_total",
+                        "Symbols encoded, by error correction level.",
+                        "counter", out);
+  for (int level = 0; level < 4; level++) {
+    append_sample("qr_symbols_by_level_total", "level",
+                  std::string_view(LEVEL_NAMES + level, 1),
+                  snapshot.symbols_by_level[level], out);
+  }
+  append_counter_header("qr_symbols_by_mask_total",
+                        "Symbols encoded, by mask pattern.", "counter", out);
+  for (int mask = 0; mask < 8; mask++) {
+    append_sample("qr_symbols_by_mask_total", "mask", std::to_string(mask),
+                  snapshot.symbols_by_mask[mask], out);
+  }
+  append_counter_header("qr_rejects_total",
+                        "Payloads that could not be encoded, by reason.",
+                        "counter", out);
+  for (int reason = 0; reason < REJECT_REASONS; reason++) {
+    append_sample("qr_rejects_total", "reason", REJECT_NAMES[reason],
+                  snapshot.rejects[reason], out);
+  }
+  append_counter_header("qr_payload_bytes_total",
+                        "Payload bytes of encoded symbols.", "counter", out);
+  out += "qr_payload_bytes_total " + std::to_string(snapshot.bytes_in) + '\n';
+  append_counter_header("qr_output_bytes_total",
+                        "Rendered or packed output bytes.", "counter", out);
+  out += "qr_output_bytes_total " + std::to_string(snapshot.bytes_out) + '\n';
+}
+
+void append_metrics_json(const MetricsSnapshot& snapshot, std::string& out) {
+  auto append_list = [&](const auto& values, size_t first) {
+    out += '[';
+    for (size_t i = first; i < values.size(); i++) {
+      out += (i == first ? "" : ",") + std::to_string(values[i]);
+    }
+    out += ']';
+  };
+  out += "{\"enabled\":";
+  out += METRICS_ENABLED ? "true" : "false";
+  // バケット i の上限 (ns)。最後のバケットは上限なし
+  out += ",\"bucket_upper_ns\":[";
+  for (int i = 0; i + 1 < LATENCY_BUCKETS; i++) {
+    out += (i == 0 ? "" : ",") + std::to_string(u_int64_t{1} << (i + 7));
+  }
+  out += "],\"stages\":{";
+  for (int stage = 0; stage < METRIC_STAGES; stage++) {
+    out += std::string(stage == 0 ? "" : ",") + '"' + STAGE_NAMES[stage] +
+           "\":{\"count\":" + std::to_string(snapshot.stage_count[stage]) +
+           ",\"ns\":" + std::to_string(snapshot.stage_ns[stage]) +
+           ",\"buckets\":";
+    append_list(snapshot.stage_buckets[stage], 0);
+    out += '}';
+  }
+  out += "},\"symbols_by_version\":";
+  append_list(snapshot.symbols_by_version, 1);  // 版1から
+  out += ",\"symbols_by_level\":{";
+  for (int level = 0; level < 4; level++) {
+    out += std::string(level == 0 ? "" : ",") + '"' + LEVEL_NAMES[level] +
+           "\":" + std::to_string(snapshot.symbols_by_level[level]);
+  }
+  out += "},\"symbols_by_mask\":";
+  append_list(snapshot.symbols_by_mask, 0);
+  out += ",\"rejects\":{";
+  for (int reason = 0; reason < REJECT_REASONS; reason++) {
+    out += std::string(reason == 0 ? "" : ",") + '"' + REJECT_NAMES[reason] +
+           "\":" + std::to_string(snapshot.rejects[reason]);
+  }
+  out += "},\"bytes_in\":" + std::to_string(snapshot.bytes_in) +
+         ",\"bytes_out\":" + std::to_string(snapshot.bytes_out) + "}\n";
+}
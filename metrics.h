@@ -0,0 +1,168 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "qr.h"
+
+// Hot-path instrumentation: per-stage timings with latency histograms,
+// symbols by version, error correction level and mask, payload and output
+// bytes, and rejected payloads by reason.
+//
+// Recording is compiled in only with QR_METRICS defined (the CMake option of
+// the same name, on by default). Without it every recording call below is an
+// empty inline function, and snapshots stay zero.
+//
+// Each thread adds into its own cache-line aligned slot with relaxed
+// single-writer stores, so a timed stage costs two steady_clock reads and a
+// few uncontended stores. A slot outlives its thread and is handed to the
+// next new thread; metrics_snapshot() sums every slot and may be taken at
+// any time.
+
+enum MetricStage {
+  SEGMENT_METRIC,
+  CODEWORD_METRIC,
+  ERROR_CORRECTION_METRIC,
+  PLACEMENT_METRIC,
+  MASK_METRIC,
+  ENCODE_METRIC,  // one whole encode_symbol() call
+  RENDER_METRIC,  // output of one symbol (stream formats, serve responses)
+  SERVE_METRIC,   // qr serve: request parsed until its response is queued
+  METRIC_STAGES,
+};
+
+// Histogram bucket i counts durations up to 2^(i + 7) ns (128 ns up to
+// 2^28 ns, about 0.27 s); the last bucket is unbounded.
+constexpr int LATENCY_BUCKETS = 23;
+constexpr int MAX_METRIC_VERSION = 40;
+
+struct MetricsSnapshot {
+  std::array<u_int64_t, METRIC_STAGES> stage_count{};
+  std::array<u_int64_t, METRIC_STAGES> stage_ns{};
+  std::array<std::array<u_int64_t, LATENCY_BUCKETS>, METRIC_STAGES>
+      stage_buckets{};
+  std::array<u_int64_t, MAX_METRIC_VERSION + 1> symbols_by_version{};
+  std::array<u_int64_t, 4> symbols_by_level{};
+  std::array<u_int64_t, 8> symbols_by_mask{};
+  u_int64_t bytes_in = 0;   // payload bytes of encoded symbols
+  u_int64_t bytes_out = 0;  // rendered or packed output bytes
+  std::array<u_int64_t, REJECT_REASONS> rejects{};
+};
+
+// "segment", "codewords", ...
+const char* metric_stage_name(int stage);
+// "capacity", "character", ... (RejectReason in qr.h)
+const char* reject_reason_name(int reason);
+
+MetricsSnapshot metrics_snapshot();
+// Zeroes every slot. Meant for tests; counts recorded concurrently may be
+// lost.
+void reset_metrics();
+// Prometheus text exposition format (qr_* metric families).
+void append_prometheus(const MetricsSnapshot& snapshot, std::string& out);
+// One JSON object.
+void append_metrics_json(const MetricsSnapshot& snapshot, std::string& out);
+
+#ifdef QR_METRICS
+constexpr bool METRICS_ENABLED = true;
+
+struct alignas(64) MetricSlot {
+  std::array<std::atomic<u_int64_t>, METRIC_STAGES> stage_count{};
+  std::array<std::atomic<u_int64_t>, METRIC_STAGES> stage_ns{};
+  std::array<std::array<std::atomic<u_int64_t>, LATENCY_BUCKETS>,
+             METRIC_STAGES>
+      stage_buckets{};
+  std::array<std::atomic<u_int64_t>, MAX_METRIC_VERSION + 1>
+      symbols_by_version{};
+  std::array<std::atomic<u_int64_t>, 4> symbols_by_level{};
+  std::array<std::atomic<u_int64_t>, 8> symbols_by_mask{};
+  std::atomic<u_int64_t> bytes_in{0};
+  std::atomic<u_int64_t> bytes_out{0};
+  std::array<std::atomic<u_int64_t>, REJECT_REASONS> rejects{};
+};
+
+// The calling thread's slot.
+MetricSlot& metric_slot();
+
+// 書くのはスロットを持つスレッドだけなので、不可分な加算はいらない
+inline void metric_add(std::atomic<u_int64_t>& counter, u_int64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+inline u_int64_t metrics_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline int latency_bucket(u_int64_t ns) {
+  return ns <= 128 ? 0
+                   : std::min(static_cast<int>(std::bit_width(ns - 1)) - 7,
+                              LATENCY_BUCKETS - 1);
+}
+
+inline void record_latency(MetricStage stage, u_int64_t ns) {
+  MetricSlot& slot = metric_slot();
+  metric_add(slot.stage_count[stage], 1);
+  metric_add(slot.stage_ns[stage], ns);
+  metric_add(slot.stage_buckets[stage][latency_bucket(ns)], 1);
+}
+
+inline void count_symbol(const Symbol& symbol, size_t payload_bytes) {
+  MetricSlot& slot = metric_slot();
+  metric_add(slot.symbols_by_version[std::clamp(symbol.version, 0,
+                                                MAX_METRIC_VERSION)],
+             1);
+  metric_add(slot.symbols_by_level[symbol.error_correction_level & 3], 1);
+  metric_add(slot.symbols_by_mask[symbol.mask_pattern & 7], 1);
+  metric_add(slot.bytes_in, payload_bytes);
+}
+
+inline void count_bytes_out(size_t bytes) {
+  metric_add(metric_slot().bytes_out, bytes);
+}
+
+inline void count_reject(RejectReason reason) {
+  metric_add(metric_slot().rejects[reason], 1);
+}
+
+// Records the time from construction to destruction under `stage`.
+class StageTimer {
+ public:
+  explicit StageTimer(MetricStage stage)
+      : stage(stage), start(metrics_now()) {}
+  ~StageTimer() { record_latency(stage, metrics_now() - start); }
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  MetricStage stage;
+  u_int64_t start;
+};
+#else
+constexpr bool METRICS_ENABLED = false;
+
+inline u_int64_t metrics_now() { return 0; }
+inline void record_latency(MetricStage, u_int64_t) {}
+inline void count_symbol(const Symbol&, size_t) {}
+inline void count_bytes_out(size_t) {}
+inline void count_reject(RejectReason) {}
+
+class StageTimer {
+ public:
+  explicit StageTimer(MetricStage) {}
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+};
+#endif  // QR_METRICS
+
+#endif  // METRICS_H
@@ -0,0 +1,142 @@
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+
+namespace {
+TEST(MetricsTest, RejectReasons) {
+  // 拒否理由は文言ではなく符号化器が返す理由コードで数える
+  EncodeOptions options{Q, 1, AUTO_MASK, ALNUM_MODE};
+  EXPECT_EQ(REJECT_CHARACTER,
+            encode_symbol("lower case", options).reject_reason);
+  EXPECT_EQ(REJECT_CAPACITY,
+            encode_symbol(std::string(100, 'A'), options).reject_reason);
+  options.version = 41;
+  EXPECT_EQ(REJECT_OPTION, encode_symbol("HELLO", options).reject_reason);
+  options.version = 1;
+  options.mask_byte = 9;
+  EXPECT_EQ(REJECT_OPTION, encode_symbol("HELLO", options).reject_reason);
+  options.mask_byte = AUTO_MASK;
+  EXPECT_EQ(REJECT_OTHER, reject_reason(std::runtime_error("disk on fire")));
+
+  ServeRequest request;
+  request.encode.mask_byte = 3;
+  request.payload = "HELLO";
+  std::string frame;
+  append_request(request, frame);
+  frame[FRAME_HEADER_SIZE + 6] = 8;  // 未知のマスク
+  try {
+    parse_request(std::string_view(frame).substr(FRAME_HEADER_SIZE), request);
+    ADD_FAILURE() << "mask 8 was accepted";
+  } catch (const std::invalid_argument& e) {
+    EXPECT_EQ(REJECT_OPTION, reject_reason(e));
+  }
+}
+
+TEST(MetricsTest, CountsEncodesPerThread) {
+  if (!METRICS_ENABLED) {
+    GTEST_SKIP() << "built without QR_METRICS";
+  }
+  reset_metrics();
+  // 4スレッドがそれぞれ版1の記号を25個と、失敗する入力を2つ符号化する
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([] {
+      EncodeOptions options{Q, 1, AUTO_MASK, ALNUM_MODE};
+      for (int i = 0; i < 25; i++) {
+        encode_symbol("HELLO " + std::to_string(i), options);
+      }
+      encode_symbol("lower case", options);
+      encode_symbol(std::string(100, 'A'), options);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const MetricsSnapshot snapshot = metrics_snapshot();
+  EXPECT_EQ(snapshot.stage_count[ENCODE_METRIC], 108u);
+  EXPECT_EQ(snapshot.stage_count[MASK_METRIC], 100u);
+  EXPECT_EQ(snapshot.symbols_by_version[1], 100u);
+  EXPECT_EQ(snapshot.symbols_by_level[Q], 100u);
+  u_int64_t masks = 0;
+  for (u_int64_t count : snapshot.symbols_by_mask) {
+    masks += count;
+  }
+  EXPECT_EQ(masks, 100u);
+  EXPECT_EQ(snapshot.rejects[REJECT_CHARACTER], 4u);
+  EXPECT_EQ(snapshot.rejects[REJECT_CAPACITY], 4u);
+  EXPECT_GT(snapshot.bytes_in, 4u * 25 * 7);
+  u_int64_t bucketed = 0;
+  for (u_int64_t count : snapshot.stage_buckets[ENCODE_METRIC]) {
+    bucketed += count;
+  }
+  EXPECT_EQ(bucketed, 108u);
+  EXPECT_GT(snapshot.stage_ns[ENCODE_METRIC],
+            snapshot.stage_ns[ERROR_CORRECTION_METRIC]);
+}
+
+TEST(MetricsTest, Exports) {
+  MetricsSnapshot snapshot;
+  snapshot.stage_count[SEGMENT_METRIC] = 3;
+  snapshot.stage_ns[SEGMENT_METRIC] = 1500;
+  snapshot.stage_buckets[SEGMENT_METRIC][0] = 1;
+  snapshot.stage_buckets[SEGMENT_METRIC][3] = 2;  // 1024 ns まで
+  snapshot.symbols_by_version[2] = 3;
+  snapshot.symbols_by_level[M] = 3;
+  snapshot.rejects[REJECT_CAPACITY] = 2;
+  snapshot.bytes_out = 900;
+
+  std::string text;
+  append_prometheus(snapshot, text);
+  for (const char* line :
+       {"# TYPE qr_stage_seconds histogram\n",
+        "qr_stage_seconds_bucket{stage=\"segment\",le=\"1.28e-07\"} 1\n",
+        "qr_stage_seconds_bucket{stage=\"segment\",le=\"5.12e-07\"} 1\n",
+        "qr_stage_seconds_bucket{stage=\"segment\",le=\"1.024e-06\"} 3\n",
+        "qr_stage_seconds_bucket{stage=\"segment\",le=\"+Inf\"} 3\n",
+        "qr_stage_seconds_sum{stage=\"segment\"} 0.000001500\n",
+        "qr_stage_seconds_count{stage=\"segment\"} 3\n",
+        "qr_symbols_by_version_total{version=\"2\"} 3\n",
+        "qr_symbols_by_level_total{level=\"M\"} 3\n",
+        "qr_rejects_total{reason=\"capacity\"} 2\n",
+        "qr_output_bytes_total 900\n"}) {
+    EXPECT_NE(text.find(line), std::string::npos) << line;
+  }
+
+  std::string json;
+  append_metrics_json(snapshot, json);
+  for (const char* field :
+       {"\"segment\":{\"count\":3,\"ns\":1500,\"buckets\":[1,0,0,2,",
+        "\"symbols_by_version\":[0,3,0,",
+        "\"symbols_by_level\":{\"L\":0,\"M\":3,",
+        "\"rejects\":{\"capacity\":2,", "\"bytes_out\":900}"}) {
+    EXPECT_NE(json.find(field), std::string::npos) << field;
+  }
+}
+
+TEST(MetricsTest, ServeResponse) {
+  std::string frame;
+  ServeRequest request;
+  request.id = 9;
+  request.format = ServeFormat::METRICS_JSON;
+  append_request(request, frame);
+  ServeRequest parsed;
+  parse_request(std::string_view(frame).substr(FRAME_HEADER_SIZE), parsed);
+  EXPECT_EQ(parsed.format, ServeFormat::METRICS_JSON);
+
+  frame.clear();
+  append_response(9, Symbol(), ServeFormat::METRICS, RenderOptions(), frame);
+  ServeResponse response;
+  parse_response(std::string_view(frame).substr(FRAME_HEADER_SIZE),
+                 response);
+  EXPECT_EQ(response.id, 9u);
+  EXPECT_TRUE(response.ok);
+  EXPECT_EQ(response.data.substr(0, 26), "# HELP qr_stage_seconds Ti");
+}
+}  // namespace
@@ -0,0 +1,198 @@
+#ifndef PENALTY_H
+#define PENALTY_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+
+#include "qr_tables.h"
+
+// penalty_score() (qr.h) with the row width as a constant (1 to
+// MAX_WORDS_PER_ROW words) so the per-word loops unroll. constexpr so that
+// qr::make (qr_static.h) scores its mask candidates with the same code.
+
+namespace penalty_detail {
+// Up to MAX_WORDS_PER_ROW words of one row or of a row-wise combination.
+// Bit j is column j; everything at or past `size` is kept zero by callers
+// through `valid`.
+struct BitRow {
+  u_int64_t w[MAX_WORDS_PER_ROW] = {};
+};
+
+// Shifts toward column 0 by k (1 <= k < 64): result[j] = row[j + k].
+constexpr BitRow shift_down(const BitRow& r, int k, int n) {
+  BitRow result;
+  for (int i = 0; i < n; i++) {
+    result.w[i] = r.w[i] >> k;
+    if (i + 1 < n) {
+      result.w[i] |= r.w[i + 1] << (64 - k);
+    }
+  }
+  return result;
+}
+
+// Shifts away from column 0 by k (1 <= k < 64): result[j] = row[j - k].
+constexpr BitRow shift_up(const BitRow& r, int k, int n) {
+  BitRow result;
+  for (int i = n - 1; i >= 0; i--) {
+    result.w[i] = r.w[i] << k;
+    if (i > 0) {
+      result.w[i] |= r.w[i - 1] >> (64 - k);
+    }
+  }
+  return result;
+}
+
+constexpr BitRow low_bits(int count, int n) {
+  BitRow result;
+  for (int i = 0; i < n; i++) {
+    int bits = std::min(std::max(count - 64 * i, 0), 64);
+    result.w[i] = bits == 64 ? ~u_int64_t{0} : (u_int64_t{1} << bits) - 1;
+  }
+  return result;
+}
+
+constexpr int popcount(const BitRow& r, int n) {
+  int result = 0;
+  for (int i = 0; i < n; i++) {
+    result += std::popcount(r.w[i]);
+  }
+  return result;
+}
+
+// 連続する5モジュール以上の同色: 3 + (長さ - 5)点。
+// t はその位置から5つ同色が続くビット。長さLの連なりでは L - 4 個立つので、
+// 連なりの先頭の数 x 2 を足すと 3 + (L - 5) になる
+constexpr int run_penalty(const BitRow& t, const BitRow& previous, int n) {
+  int result = 0;
+  for (int i = 0; i < n; i++) {
+    result += std::popcount(t.w[i]) +
+              2 * std::popcount(t.w[i] & ~previous.w[i]);
+  }
+  return result;
+}
+
+constexpr bool FINDER_LIKE[2][11] = {
+    {1, 0, 1, 1, 1, 0, 1, 0, 0, 0, 0},
+    {0, 0, 0, 0, 1, 0, 1, 1, 1, 0, 1},
+};
+}  // namespace penalty_detail
+
+// 1行の語数を定数にして、語ごとのループを展開させる
+template <int WordsPerRow>
+constexpr int penalty_score(const u_int64_t* modules, int size) {
+  using namespace penalty_detail;
+  static_assert(1 <= WordsPerRow && WordsPerRow <= MAX_WORDS_PER_ROW);
+  constexpr int n = WordsPerRow;
+  auto load = [&](int x) {
+    BitRow r;
+    for (int i = 0; i < n; i++) {
+      r.w[i] = modules[static_cast<size_t>(x) * n + i];
+    }
+    return r;
+  };
+  const BitRow valid = low_bits(size, n);
+  auto invert = [&](const BitRow& r) {
+    BitRow result;
+    for (int i = 0; i < n; i++) {
+      result.w[i] = ~r.w[i] & valid.w[i];
+    }
+    return result;
+  };
+
+  int runs = 0;
+  int blocks = 0;
+  int finders = 0;
+  int dark = 0;
+
+  // 横方向: 行ごとにシフトとANDで連なり・2x2・ファインダ類似を数える
+  const BitRow pair_valid = low_bits(size - 1, n);
+  // 両端に4つの明モジュールを足した行は size + 8 ビットなので1語増えうる
+  // (余分な語は0のまま)
+  constexpr int extended_words = std::min(n + 1, MAX_WORDS_PER_ROW);
+  const BitRow extended_valid = low_bits(size + 8, extended_words);
+  const BitRow window_valid = low_bits(size - 2, extended_words);
+  BitRow next = load(0);
+  for (int x = 0; x < size; x++) {
+    const BitRow row = next;
+    dark += popcount(row, n);
+    for (const BitRow& color : {row, invert(row)}) {
+      BitRow t = color;
+      for (int k = 1; k < 5; k++) {
+        BitRow s = shift_down(color, k, n);
+        for (int i = 0; i < n; i++) t.w[i] &= s.w[i];
+      }
+      runs += run_penalty(t, shift_up(t, 1, n), n);
+    }
+
+    const BitRow extended = shift_up(row, 4, extended_words);
+    BitRow extended_light;
+    for (int i = 0; i < extended_words; i++) {
+      extended_light.w[i] = ~extended.w[i] & extended_valid.w[i];
+    }
+    for (const auto& pattern : FINDER_LIKE) {
+      BitRow match = window_valid;
+      for (int j = 0; j < 11; j++) {
+        const BitRow& source = pattern[j] ? extended : extended_light;
+        BitRow s = j == 0 ? source : shift_down(source, j, extended_words);
+        for (int i = 0; i < extended_words; i++) match.w[i] &= s.w[i];
+      }
+      finders += popcount(match, extended_words);
+    }
+
+    if (x + 1 < size) {
+      next = load(x + 1);
+      BitRow same_vertical, same_horizontal;
+      BitRow shifted = shift_down(row, 1, n);
+      for (int i = 0; i < n; i++) {
+        same_vertical.w[i] = ~(row.w[i] ^ next.w[i]);
+        same_horizontal.w[i] = ~(row.w[i] ^ shifted.w[i]);
+      }
+      BitRow right = shift_down(same_vertical, 1, n);
+      for (int i = 0; i < n; i++) {
+        same_vertical.w[i] &= right.w[i] & same_horizontal.w[i] &
+                              pair_valid.w[i];
+      }
+      blocks += popcount(same_vertical, n);
+    }
+  }
+
+  // 縦方向: 各ビットが1列を表すので、行をまたいだANDがそのまま列方向の判定
+  for (int color = 0; color < 2; color++) {
+    BitRow previous;
+    for (int x = 0; x + 5 <= size; x++) {
+      BitRow t = valid;
+      for (int k = 0; k < 5; k++) {
+        BitRow r = load(x + k);
+        if (color == 1) r = invert(r);
+        for (int i = 0; i < n; i++) t.w[i] &= r.w[i];
+      }
+      runs += run_penalty(t, previous, n);
+      previous = t;
+    }
+  }
+  for (const auto& pattern : FINDER_LIKE) {
+    for (int x = -4; x + 11 <= size + 4; x++) {
+      BitRow match = valid;
+      for (int j = 0; j < 11; j++) {
+        int row_index = x + j;
+        BitRow r = (0 <= row_index && row_index < size) ? load(row_index)
+                                                        : BitRow{};
+        if (!pattern[j]) r = invert(r);
+        for (int i = 0; i < n; i++) match.w[i] &= r.w[i];
+      }
+      finders += popcount(match, n);
+    }
+  }
+
+  // 暗モジュールの比率が50%から5%ずれるごとに10点
+  const int total = size * size;
+  const int difference = dark * 20 - total * 10;
+  const int balance = (difference < 0 ? -difference : difference) / total;
+
+  return runs + blocks * 3 + finders * 40 + balance * 10;
+}
+
+#endif  // PENALTY_H
@@ -0,0 +1,188 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "metrics.h"
+
+const char* pipeline_stage_name(int stage) {
+  static const char* NAMES[] = {"segment",   "codewords", "ecc",
+                                "placement", "mask",      "render"};
+  return stage >= 0 && stage < PIPELINE_STAGES ? NAMES[stage] : "sink";
+}
+
+PipelineThreads parse_pipeline_threads(std::string_view text) {
+  PipelineThreads threads;
+  for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+    const size_t comma = text.find(',');
+    const std::string count(text.substr(0, comma));
+    size_t used = 0;
+    try {
+      threads[stage] = std::stoi(count, &used);
+    } catch (const std::exception&) {
+      used = 0;
+    }
+    if (used == 0 || used != count.size() || threads[stage] < 1 ||
+        (comma == std::string_view::npos) != (stage == PIPELINE_STAGES - 1)) {
+      throw std::invalid_argument(
+          "pipeline threads must be 6 positive counts (segment, codewords, "
+          "ecc, placement, mask, render) but got " +
+          std::string(text));
+    }
+    text.remove_prefix(comma == std::string_view::npos ? text.size()
+                                                       : comma + 1);
+  }
+  return threads;
+}
+
+EncodePipeline::EncodePipeline(const PipelineOptions& options, Render render,
+                               Sink sink)
+    : options(options), render(std::move(render)), sink(std::move(sink)) {
+  for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+    if (options.threads[stage] < 1) {
+      throw std::invalid_argument(
+          std::string("pipeline stage ") + pipeline_stage_name(stage) +
+          " needs at least one thread");
+    }
+  }
+  this->options.in_flight = std::max<size_t>(options.in_flight, 1);
+  // 環が全ジョブと終わりの印を収められれば、満杯の環で段同士が待ち合わない
+  this->options.ring_capacity =
+      std::max(options.ring_capacity, this->options.in_flight + 1);
+  for (size_t i = 0; i < this->options.in_flight; i++) {
+    jobs.push_back(std::make_unique<Job>());
+  }
+  for (int stage = 0; stage <= PIPELINE_STAGES; stage++) {
+    const int count = thread_count(stage - 1) * thread_count(stage);
+    for (int i = 0; i < count; i++) {
+      rings[stage].push_back(
+          std::make_unique<Ring>(this->options.ring_capacity));
+    }
+  }
+  for (int stage = 0; stage < PIPELINE_STAGES; stage++) {
+    for (int thread = 0; thread < options.threads[stage]; thread++) {
+      threads.emplace_back(&EncodePipeline::stage_loop, this, stage, thread);
+    }
+  }
+  threads.emplace_back(&EncodePipeline::sink_loop, this);
+}
+
+EncodePipeline::~EncodePipeline() {
+  try {
+    finish();
+  } catch (const std::exception&) {
+  }
+}
+
+void EncodePipeline::push(std::string_view payload) {
+  if (finished) {
+    throw std::logic_error("push() after finish()");
+  }
+  if (sink_failed.load(std::memory_order_acquire)) {
+    finish();  // シンクの例外をここで投げる
+  }
+  // 同じ枠を使う in_flight 個前のジョブがシンクを抜けるまで待つ
+  const size_t index = next_index++;
+  for (size_t done = completed.load(std::memory_order_acquire);
+       index - done >= options.in_flight;
+       done = completed.load(std::memory_order_acquire)) {
+    completed.wait(done, std::memory_order_acquire);
+  }
+  Job& job = *jobs[index % options.in_flight];
+  job.index = index;
+  job.payload.assign(payload);
+  job.symbol.error.clear();
+  job.rendered.clear();
+  ring(SEGMENT_STAGE, 0, index % thread_count(SEGMENT_STAGE)).push(&job);
+}
+
+void EncodePipeline::finish() {
+  if (finished) {
+    return;
+  }
+  finished = true;
+  // 終わりの印 (nullptr) は各段が後段の全スレッドへ伝える
+  for (int consumer = 0; consumer < thread_count(SEGMENT_STAGE); consumer++) {
+    ring(SEGMENT_STAGE, 0, consumer).push(nullptr);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (sink_error) {
+    std::rethrow_exception(sink_error);
+  }
+}
+
+void EncodePipeline::stage_loop(int stage, int thread) {
+  const int producers = thread_count(stage - 1);
+  const int threads_here = thread_count(stage);
+  const int consumers = thread_count(stage + 1);
+  // このスレッドの担当は index ≡ thread (mod threads_here)。前段で同じ
+  // index を担当したスレッドの環から、担当順に1つずつ取り出す
+  for (size_t index = thread;; index += threads_here) {
+    Job* job = ring(stage, index % producers, thread).pop();
+    if (job == nullptr) {
+      for (int consumer = 0; consumer < consumers; consumer++) {
+        ring(stage + 1, thread, consumer).push(nullptr);
+      }
+      return;
+    }
+    if (job->symbol.ok()) {
+      run_stage(stage, *job);
+    }
+    ring(stage + 1, thread, index % consumers).push(job);
+  }
+}
+
+void EncodePipeline::run_stage(int stage, Job& job) {
+  const EncodeOptions& encode = options.encode;
+  try {
+    switch (stage) {
+      case SEGMENT_STAGE:
+        segment_stage(job.payload, encode, job.scratch);
+        break;
+      case CODEWORD_STAGE:
+        codeword_stage(job.payload, encode, job.scratch);
+        break;
+      case ERROR_CORRECTION_STAGE:
+        error_correction_stage(encode, job.scratch);
+        break;
+      case PLACEMENT_STAGE:
+        placement_stage(encode, job.scratch);
+        break;
+      case MASK_STAGE:
+        mask_stage(encode, job.scratch, job.symbol);
+        count_symbol(job.symbol, job.payload.size());
+        break;
+      case RENDER_STAGE:
+        if (render) {
+          render(job.index, job.symbol, job.rendered);
+        }
+        break;
+    }
+  } catch (const std::exception& e) {
+    job.symbol.setError(e.what(), reject_reason(e));
+    job.rendered.clear();
+    count_reject(job.symbol.reject_reason);
+  }
+}
+
+void EncodePipeline::sink_loop() {
+  const int producers = thread_count(RENDER_STAGE);
+  for (size_t index = 0;; index++) {
+    Job* job = ring(PIPELINE_STAGES, index % producers, 0).pop();
+    if (job == nullptr) {
+      return;
+    }
+    if (!sink_failed.load(std::memory_order_relaxed)) {
+      try {
+        sink(job->index, job->symbol, job->rendered);
+      } catch (...) {
+        sink_error = std::current_exception();
+        sink_failed.store(true, std::memory_order_release);
+      }
+    }
+    completed.fetch_add(1, std::memory_order_release);
+    completed.notify_one();
+  }
+}
@@ -0,0 +1,122 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "qr.h"
+#include "spsc_ring.h"
+
+// Staged encoder: every payload passes segmentation -> codewords -> error
+// correction -> placement -> mask selection -> render on dedicated threads,
+// and reaches a single sink thread in input order. Consecutive stages are
+// connected by SpscRing queues, one per (producer thread, consumer thread)
+// pair. Payload i is handled by thread i % n of a stage with n threads, so
+// every ring keeps exactly one producer and one consumer, and the order is
+// restored without a reorder buffer.
+//
+// encode_batch() runs the whole chain per payload on one worker. The
+// pipeline instead lets the thread count follow the cost of each stage: a
+// PNG stream wants render threads, and error correction dominates for matrix
+// output. The sink writes while later payloads are still being encoded.
+
+enum PipelineStage {
+  SEGMENT_STAGE,
+  CODEWORD_STAGE,
+  ERROR_CORRECTION_STAGE,
+  PLACEMENT_STAGE,
+  MASK_STAGE,
+  RENDER_STAGE,
+  PIPELINE_STAGES,
+};
+
+using PipelineThreads = std::array<int, PIPELINE_STAGES>;
+
+// "segment", "codewords", ...
+const char* pipeline_stage_name(int stage);
+// Parses "1,1,2,1,2,4" (one count per stage, in order). Throws
+// std::invalid_argument.
+PipelineThreads parse_pipeline_threads(std::string_view text);
+
+struct PipelineOptions {
+  EncodeOptions encode;
+  PipelineThreads threads = {1, 1, 1, 1, 1, 1};  // each at least 1
+  size_t ring_capacity = 64;  // per ring; raised to in_flight + 1
+  size_t in_flight = 64;      // payloads between push() and the sink
+};
+
+class EncodePipeline {
+ public:
+  // Called on a render thread for every symbol that encoded; appends the
+  // output of symbol `index` to `out`. An exception fails that symbol.
+  using Render =
+      std::function<void(size_t index, const Symbol& symbol, std::string& out)>;
+  // Called on the sink thread in input order, also for failed symbols (their
+  // error is set and `rendered` is empty).
+  using Sink = std::function<void(size_t index, const Symbol& symbol,
+                                  std::string_view rendered)>;
+
+  // Starts every stage thread. `render` may be empty (nothing is rendered).
+  EncodePipeline(const PipelineOptions& options, Render render, Sink sink);
+  // Calls finish() if it was not called, discarding its exception.
+  ~EncodePipeline();
+  EncodePipeline(const EncodePipeline&) = delete;
+  EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+  // Queues a copy of `payload` as the next index. Blocks while
+  // options.in_flight payloads have not reached the sink. Call from one
+  // thread only. Throws the sink's exception once the sink has failed.
+  void push(std::string_view payload);
+  // Waits for every queued payload to reach the sink and stops the threads.
+  // Rethrows the first exception thrown by the sink; later payloads are
+  // still drained but no longer passed to it.
+  void finish();
+
+  size_t pushed() const { return next_index; }
+
+ private:
+  struct Job {
+    size_t index;
+    std::string payload;
+    EncodeScratch scratch;
+    Symbol symbol;
+    std::string rendered;
+  };
+  using Ring = SpscRing<Job*>;
+
+  // 段 stage の入力側の環: 前段の producer 番から、この段の consumer 番へ
+  Ring& ring(int stage, int producer, int consumer) {
+    return *rings[stage][static_cast<size_t>(producer) * thread_count(stage) +
+                         consumer];
+  }
+  // stage == PIPELINE_STAGES はシンク、-1 は push() する呼び出し側
+  int thread_count(int stage) const {
+    return stage < 0 || stage >= PIPELINE_STAGES ? 1 : options.threads[stage];
+  }
+  void stage_loop(int stage, int thread);
+  void run_stage(int stage, Job& job);
+  void sink_loop();
+
+  PipelineOptions options;
+  Render render;
+  Sink sink;
+  std::vector<std::unique_ptr<Job>> jobs;  // 添字 index % in_flight
+  // rings[s]: 段 s の入力 (s == PIPELINE_STAGES はシンクの入力)
+  std::array<std::vector<std::unique_ptr<Ring>>, PIPELINE_STAGES + 1> rings;
+  std::vector<std::thread> threads;
+  size_t next_index = 0;
+  std::atomic<size_t> completed{0};
+  std::atomic<bool> sink_failed{false};
+  std::exception_ptr sink_error;
+  bool finished = false;
+};
+
+#endif  // PIPELINE_H
@@ -0,0 +1,186 @@
+#include "pipeline.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stream.h"
+#include "symbol_cache.h"
+
+namespace {
+TEST(PipelineTest, RingKeepsOrderAcrossThreads) {
+  SpscRing<int> ring(3);
+  EXPECT_EQ(ring.capacity(), 4u);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(ring.tryPush(i));
+  }
+  EXPECT_FALSE(ring.tryPush(4));
+  int value;
+  ASSERT_TRUE(ring.tryPop(value));
+  EXPECT_EQ(value, 0);
+
+  // 小さい環で満杯・空の待ちを何度も通らせる
+  constexpr int COUNT = 100000;
+  std::thread producer([&] {
+    for (int i = 4; i < COUNT; i++) {
+      ring.push(i);
+    }
+  });
+  for (int i = 1; i < COUNT; i++) {
+    ASSERT_EQ(ring.pop(), i);
+  }
+  producer.join();
+  EXPECT_FALSE(ring.tryPop(value));
+}
+
+TEST(PipelineTest, ParseThreads) {
+  EXPECT_EQ(parse_pipeline_threads("1,1,2,1,2,4"),
+            (PipelineThreads{1, 1, 2, 1, 2, 4}));
+  for (const char* bad : {"", "1,1,1,1,1", "1,1,1,1,1,1,1", "1,1,0,1,1,1",
+                          "1,1,x,1,1,1", "1,1,2a,1,1,1", "1,1,,1,1,1"}) {
+    EXPECT_THROW(parse_pipeline_threads(bad), std::invalid_argument) << bad;
+  }
+}
+
+TEST(PipelineTest, MatchesEncodeSymbolInOrder) {
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 300; i++) {
+    payloads.push_back(i % 37 == 5 ? "lower case"
+                                   : std::string(1 + i * 7 % 900, 'Q'));
+  }
+  for (PipelineThreads threads :
+       {PipelineThreads{1, 1, 1, 1, 1, 1}, PipelineThreads{1, 2, 3, 1, 2, 4},
+        PipelineThreads{3, 1, 2, 2, 1, 1}}) {
+    PipelineOptions options;
+    options.threads = threads;
+    options.ring_capacity = 2;
+    options.in_flight = 9;
+    std::vector<size_t> indices;
+    std::vector<Symbol> symbols;
+    std::vector<std::string> rendered;
+    {
+      EncodePipeline pipeline(
+          options,
+          [](size_t index, const Symbol& symbol, std::string& out) {
+            out = std::to_string(index) + ':' + std::to_string(symbol.size);
+          },
+          [&](size_t index, const Symbol& symbol, std::string_view out) {
+            indices.push_back(index);
+            symbols.push_back(symbol);
+            rendered.emplace_back(out);
+          });
+      for (const std::string& payload : payloads) {
+        pipeline.push(payload);
+      }
+      pipeline.finish();
+      EXPECT_EQ(pipeline.pushed(), payloads.size());
+    }
+    ASSERT_EQ(symbols.size(), payloads.size());
+    for (size_t i = 0; i < payloads.size(); i++) {
+      Symbol expected = encode_symbol(payloads[i], options.encode);
+      EXPECT_EQ(indices[i], i);
+      EXPECT_EQ(symbols[i].error, expected.error) << i;
+      EXPECT_EQ(symbols[i].version, expected.version) << i;
+      EXPECT_EQ(symbols[i].mask_pattern, expected.mask_pattern) << i;
+      EXPECT_EQ(symbols[i].modules, expected.modules) << i;
+      EXPECT_EQ(rendered[i], expected.ok() ? std::to_string(i) + ':' +
+                                                 std::to_string(expected.size)
+                                           : "")
+          << i;
+    }
+  }
+}
+
+TEST(PipelineTest, FinishRethrowsSinkError) {
+  PipelineOptions options;
+  options.threads = {1, 1, 2, 1, 1, 2};
+  options.in_flight = 4;
+  size_t calls = 0;
+  EncodePipeline pipeline(options, nullptr,
+                          [&](size_t index, const Symbol&, std::string_view) {
+                            calls++;
+                            if (index == 3) {
+                              throw std::runtime_error("disk full");
+                            }
+                          });
+  EXPECT_THROW(
+      {
+        for (int i = 0; i < 100; i++) {
+          pipeline.push("HELLO");
+        }
+        pipeline.finish();
+      },
+      std::runtime_error);
+  EXPECT_EQ(calls, 4u);
+  EXPECT_THROW(pipeline.push("HELLO"), std::logic_error);
+}
+
+TEST(PipelineTest, StreamOutputMatchesBatchMode) {
+  std::string input;
+  for (int i = 0; i < 120; i++) {
+    input += i % 29 == 3 ? "lower case" : std::string(1 + i * 11 % 400, '7');
+    input += '\n';
+  }
+  auto run = [&](bool pipeline, OutputFormat format, std::string& errors) {
+    std::FILE* in = std::tmpfile();
+    std::fwrite(input.data(), 1, input.size(), in);
+    std::rewind(in);
+    const std::string out_path =
+        (std::filesystem::temp_directory_path() /
+         ("qr_pipeline_test_" + std::to_string(::getpid())))
+            .string();
+    std::FILE* error_file = std::tmpfile();
+    StreamOptions options;
+    options.format = format;
+    options.output_file = out_path;
+    options.block_records = 16;
+    options.pipeline = pipeline;
+    options.pipeline_threads = {1, 2, 2, 1, 2, 3};
+    StreamStats stats = run_stream(in, options, error_file);
+    EXPECT_EQ(stats.records, 120u);
+    EXPECT_EQ(stats.failed, 5u);
+    auto contents = [](std::FILE* file) {
+      std::rewind(file);
+      std::string result;
+      char buffer[4096];
+      size_t n;
+      while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        result.append(buffer, n);
+      }
+      std::fclose(file);
+      return result;
+    };
+    errors = contents(error_file);
+    std::fclose(in);
+    std::string output = contents(std::fopen(out_path.c_str(), "rb"));
+    std::remove(out_path.c_str());
+    return output;
+  };
+  for (OutputFormat format : {OutputFormat::BINARY, OutputFormat::PNG}) {
+    std::string batch_errors, pipeline_errors;
+    EXPECT_EQ(run(true, format, pipeline_errors),
+              run(false, format, batch_errors));
+    EXPECT_EQ(pipeline_errors, batch_errors);
+  }
+}
+
+TEST(PipelineTest, StreamRejectsCache) {
+  // パイプラインはキャッシュを通らないので、統計が0のまま黙って進めない
+  SymbolCache cache;
+  StreamOptions options;
+  options.pipeline = true;
+  options.batch.cache = &cache;
+  std::FILE* in = std::tmpfile();
+  std::fputs("HELLO\n", in);
+  std::rewind(in);
+  EXPECT_THROW(run_stream(in, options, stderr), std::invalid_argument);
+  std::fclose(in);
+  EXPECT_EQ(0u, cache.stats().misses);
+}
+}  // namespace
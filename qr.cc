@@ -2,21 +2,20 @@
 #include "qr.h"
 
 #include <algorithm>
+#include <array>
 #include <bitset>
 #include <iostream>
 #include <map>
-#include <sstream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
-// 文字数指示子
-const std::map<u_int8_t, u_int32_t> CHAR_LENGTH_SPECIFIER = {
-    {NUMBER_MODE, 10},
-    {ALNUM_MODE, 9},
-    {BYTE_MODE, 8},
-    {KANJI_MODE, 8},
-};
+#include "char_class.h"
+#include "metrics.h"
+#include "penalty.h"
+#include "segment.h"
+#include "symbol_layout.h"
 
 // 英数字モードの各文字に対応する値
 const std::map<char, u_int32_t> ALNUM_MODE_CHAR_MAPPING = {
@@ -46,30 +45,24 @@ std::vector<std::bitset<11>> from_string(const std::string& s,
                                          u_int8_t mode_specifier = ALNUM_MODE) {
   if (mode_specifier == ALNUM_MODE) {
     std::vector<std::bitset<11>> result;
+    result.reserve(s.size() / 2);
     // read two characters at a time
-    // if the length of the string is odd, add a # at the end
-    std::string s_ = s;
-    if (s_.size() % 2 == 1) {
-      s_.push_back('#');
-    }
-    for (size_t i = 0; i < s_.size(); i += 2) {
-      // std::cout << s_[i] << ' ' << s_[i + 1] << '\n';
-      char c1 = s_[i];
-      char c2 = s_[i + 1];
-      if (c2 == '#') {
-        if (ALNUM_MODE_CHAR_MAPPING.find(c1) == ALNUM_MODE_CHAR_MAPPING.end()) {
-          throw std::invalid_argument("Invalid character in the input string");
-        }
+    for (size_t i = 0; i < s.size(); i += 2) {
+      u_int8_t v1 = alnum_value(s[i]);
+      if (v1 == NOT_ALNUM) {
+        throw EncodeError(REJECT_CHARACTER,
+                          "Invalid character in the input string");
+      }
+      // 奇数長の最後の1文字(6ビット)はこの形式では表せない
+      if (i + 1 == s.size()) {
         throw std::logic_error("Not implemented yet");
-      } else {
-        if (ALNUM_MODE_CHAR_MAPPING.find(c1) == ALNUM_MODE_CHAR_MAPPING.end() ||
-            ALNUM_MODE_CHAR_MAPPING.find(c2) == ALNUM_MODE_CHAR_MAPPING.end()) {
-          throw std::invalid_argument("Invalid character in the input string");
-        }
-        u_int32_t v1 = ALNUM_MODE_CHAR_MAPPING.at(c1);
-        u_int32_t v2 = ALNUM_MODE_CHAR_MAPPING.at(c2);
-        result.push_back(eleven_bits_from_pair(v1, v2));
       }
+      u_int8_t v2 = alnum_value(s[i + 1]);
+      if (v2 == NOT_ALNUM) {
+        throw EncodeError(REJECT_CHARACTER,
+                          "Invalid character in the input string");
+      }
+      result.push_back(eleven_bits_from_pair(v1, v2));
     }
     return result;
   } else {
@@ -102,149 +95,214 @@ std::vector<bool> append_terminating_bits(const std::vector<bool>& bits,
   return result;
 }
 
-const std::map<ErrorCorrectionLevel, u_int32_t> COUNT_OF_CODE_WORDS = {
-    {L, 19},
-    {M, 16},
-    {Q, 13},
-    {H, 9},
-};
-
-std::vector<bool> convert_mode_specifier_into_vector_bool(
-    const u_int8_t mode_specifier, int32_t word_length) {
-  std::vector<bool> result;
-  // mode_spcifier is 4bits
-  for (int i = 0; i < 4; i++) {
-    result.push_back(mode_specifier & (1 << (3 - i)));
-  }
-  auto char_length_specifier = CHAR_LENGTH_SPECIFIER.at(mode_specifier);
-  u_int32_t bits = 0;
-  for (int i = 0; i < char_length_specifier; i++) {
-    u_int32_t value = 1 << (8 - i);
-    if (value <= word_length) {
-      result.push_back(true);
-      word_length -= value;
-    } else {
-      result.push_back(false);
-    }
+std::vector<u_int8_t> convert_to_codewords(
+    const std::vector<bool>& bits, ModeSpecifier mode_specifier,
+    ErrorCorrectionLevel correction_level, u_int32_t word_length,
+    int version) {
+  u_int32_t symbol_data_codewords = data_codewords(version, correction_level);
+  BitBuffer buffer(symbol_data_codewords * 8);
+  append_mode_header(mode_specifier, word_length, version, buffer);
+  for (bool bit : bits) {
+    buffer.append(bit, 1);
   }
+  // bitsは既に終端パターンを含むので、ここではバイト境界とパディングのみ
+  append_padding(symbol_data_codewords * 8, buffer);
+  return buffer.toBytes();
+}
 
+std::vector<u_int8_t> convert_string_into_codewords(
+    const std::string s, ModeSpecifier mode_specifier,
+    ErrorCorrectionLevel correction_level, int version) {
+  std::vector<u_int8_t> result(data_codewords(version, correction_level));
+  BitBuffer buffer(result.size() * 8);
+  build_data_codewords(s, mode_specifier, correction_level, version, buffer,
+                       result.data());
   return result;
 }
 
-std::vector<u_int8_t> convert_to_codewords(
-    const std::vector<bool>& bits_, ModeSpecifier mode_specifier,
-    ErrorCorrectionLevel correction_level, u_int32_t word_length) {
-  std::vector<u_int8_t> result;
-
-  std::vector<bool> bits =
-      convert_mode_specifier_into_vector_bool(mode_specifier, word_length);
-  for (auto bit : bits_) {
-    bits.push_back(bit);
+void build_data_codewords(std::string_view s, ModeSpecifier mode_specifier,
+                          ErrorCorrectionLevel correction_level, int version,
+                          BitBuffer& scratch, u_int8_t* out) {
+  u_int32_t symbol_data_codewords = data_codewords(version, correction_level);
+  scratch.clear();
+  if (mode_specifier == AUTO_MODE) {
+    append_segments(s, optimal_segments(s, version), version, scratch);
+  } else {
+    append_mode_header(mode_specifier, static_cast<u_int32_t>(s.size()),
+                       version, scratch);
+    append_data_bits(s, mode_specifier, scratch);
   }
-  // bitsを8bitごとに区切ります。
-  // 最後のビット列が８未満の場合は0で埋めます
-  // それをu_int8_tに変換してcodewordsに挿入します
-  for (int i = 0; i < bits.size() % 8; i++) {
-    bits.push_back(false);
+  append_terminator_and_padding(symbol_data_codewords, scratch);
+  scratch.copyBytesTo(out);
+}
+
+int select_version(std::string_view s, ModeSpecifier mode_specifier,
+                   ErrorCorrectionLevel correction_level) {
+  if (mode_specifier == AUTO_MODE) {
+    std::vector<Segment> segments;
+    return select_version_segments(s, correction_level, segments);
   }
-  std::cout << bits_.size() % 8 << "\n";
-  std::cout << bits_.size() << "\n";
-  std::cout << bits.size() << "\n";
-  for (int i = 0; i < bits.size() / 8; i++) {
-    u_int8_t byte = 0;
-    for (int j = 0; j < 8; j++) {
-      byte = (byte << 1) | bits[i * 8 + j];
+  auto length = static_cast<u_int32_t>(s.size());
+  u_int32_t data_bits = encoded_data_bits(length, mode_specifier);
+  for (int version = MIN_VERSION; version <= MAX_VERSION; version++) {
+    int count_bits = char_count_bits(mode_specifier, version);
+    u_int32_t capacity_bits = data_codewords(version, correction_level) * 8;
+    if ((length >> count_bits) == 0 &&
+        4 + count_bits + data_bits <= capacity_bits) {
+      return version;
     }
-    result.push_back(byte);
   }
+  throw EncodeError(REJECT_CAPACITY, "Input string is too long (" +
+                                         std::to_string(length) +
+                                         " characters)");
+}
 
-  // Add padding result if necessary
-  u_int8_t padding_codewords[] = {0b11101100, 0b00010001};
-  size_t padding_index = 0;
-  u_int32_t symbol_data_codewords = COUNT_OF_CODE_WORDS.at(correction_level);
-  while (result.size() < symbol_data_codewords) {
-    result.push_back(padding_codewords[padding_index]);
-    padding_index = (padding_index + 1) % 2;
+namespace {
+// バージョンごとに1度だけ作る、全シンボル共通のデータ
+struct VersionResources {
+  int words_per_plane = 0;  // size * words_per_row
+  // [modules | function modules] の初期状態。機能パターン・型番情報を描き、
+  // 形式情報の領域を予約済み。形式情報の値はシンボルごとに書き直す
+  std::vector<u_int64_t> function_template;
+  // データビットk番目を置くモジュールの位置 (modules面のビット番号
+  // x * wordsPerRow() * 64 + y)。剰余ビットを含めて raw_data_modules 個
+  std::vector<u_int32_t> placement_order;
+  // 8つのマスクパターン。機能パターンの位置は0にしてあるので、
+  // データ領域へのマスクは語ごとのXORだけで済む
+  std::vector<u_int64_t> mask_planes;
+
+  const u_int64_t* maskPlane(int pattern) const {
+    return mask_planes.data() +
+           static_cast<size_t>(pattern) * words_per_plane;
   }
+};
 
-  return result;
+void build_version_resources(int version, VersionResources& resources) {
+  const int size = symbol_size(version);
+  const int words_per_row = (size + 63) / 64;
+  resources.words_per_plane = size * words_per_row;
+  resources.function_template.assign(2 * resources.words_per_plane, 0);
+  const SymbolPlanes planes{
+      resources.function_template.data(),
+      resources.function_template.data() + resources.words_per_plane, size,
+      words_per_row};
+  draw_function_patterns(planes, version);
+
+  resources.placement_order.reserve(raw_data_modules(version));
+  for_each_data_module(planes, [&](int x, int y) {
+    resources.placement_order.push_back(
+        static_cast<u_int32_t>(x * words_per_row * 64 + y));
+  });
+
+  resources.mask_planes.resize(static_cast<size_t>(8) *
+                               resources.words_per_plane);
+  for (int p = 0; p < 8; p++) {
+    build_mask_plane(planes, p,
+                     resources.mask_planes.data() +
+                         static_cast<size_t>(p) * resources.words_per_plane);
+  }
 }
 
-std::vector<u_int8_t> convert_string_into_codewords(
-    const std::string s, ModeSpecifier mode_specifier,
-    ErrorCorrectionLevel correction_level) {
-  auto word_length = s.size();
-  auto bits = convert_string_into_bits(s, mode_specifier);
-  return convert_to_codewords(bits, mode_specifier, correction_level,
-                              word_length);
+// 行アクセサ越しに、共通の描画関数 (symbol_layout.h) へ渡す面
+SymbolPlanes symbol_planes(QrCode& qr) {
+  return {qr.row(0), qr.functionRow(0), qr.getSize(), qr.wordsPerRow()};
+}
+
+const VersionResources& version_resources(int version) {
+  static std::once_flag flags[MAX_VERSION + 1];
+  static VersionResources cache[MAX_VERSION + 1];
+  std::call_once(flags[version], [version] {
+    build_version_resources(version, cache[version]);
+  });
+  return cache[version];
 }
+}  // namespace
 
-QrCode::QrCode(int size, int version, int mask_byte, int mode_specifier,
+// 参照子は AUTO_MASK か 0-7 のみ。範囲外を下位3ビットに丸めて通さない
+void check_mask_byte(int mask_byte) {
+  if (mask_byte != AUTO_MASK && (mask_byte < 0 || mask_byte > 0b111)) {
+    throw EncodeError(REJECT_OPTION, "This mask is invalid (" +
+                                         std::to_string(mask_byte) + ")");
+  }
+}
+
+QrCode::QrCode(int version, int mask_byte, int mode_specifier,
                int error_correction_level, bool autoInitialize)
-    : size(size),
+    : size(symbol_size(version)),
       version(version),
       mask_byte(mask_byte),
+      auto_mask(mask_byte == AUTO_MASK),
       mode_specifier(mode_specifier),
       error_correction_level(error_correction_level),
-      matrix(size, std::vector<bool>(size, false)) {
-  if (!verify_size_and_version()) {
-    std::string error_message =
-        "size must be 21 but got " + std::to_string(size) +
-        "; version must be 1 but got " + std::to_string(version);
-    throw std::invalid_argument(error_message);
+      words_per_row((size + 63) / 64),
+      planes(static_cast<size_t>(2 * size * words_per_row), 0) {
+  if (!verify_version()) {
+    std::string error_message = "version must be in [1, 40] but got " +
+                                std::to_string(version);
+    throw EncodeError(REJECT_OPTION, error_message);
   }
+  check_mask_byte(mask_byte);
   if (autoInitialize) {
     initializeWithFinderPatterns();
   }
 }
 
 void QrCode::initializeWithFinderPatterns() {
-  addFinderPatterns(0, 0);         // Upper left
-  addFinderPatterns(size - 7, 0);  // Lower left
-  addFinderPatterns(0, size - 7);  // Upper right
-
-  for (int i = 8; i < size - 8; i++) {
-    setCell(6, i, i % 2 == 0);  // Horizontal timing pattern
-    setCell(i, 6, i % 2 == 0);  // Vertical timing pattern
-  }
+  // 同じバージョンのシンボルはすべて同じ雛形から始まる
+  const auto& resources = version_resources(version);
+  std::copy(resources.function_template.begin(),
+            resources.function_template.end(), planes.begin());
+  setFormatCells();
+}
 
-  setCell(13, 8);  // timing pattern
-  setModeCells();
+void QrCode::drawFunctionPatterns() {
+  draw_function_patterns(symbol_planes(*this), version);
   setFormatCells();
 }
 
-void QrCode::addFinderPatterns(int x, int y) {
-  for (int row = 0; row < 7; row++) {
-    setCell(x + row, y);
-    setCell(x + row, y + 6);
-  }
-  for (int col = 0; col < 7; col++) {
-    setCell(x, y + col);
-    setCell(x + 6, y + col);
-  }
+void QrCode::addAlignmentPattern(int x, int y) {
+  draw_alignment_pattern(symbol_planes(*this), x, y);
+}
 
-  for (int row = 2; row < 5; row++) {
-    for (int col = 2; col < 5; col++) {
-      setCell(x + row, y + col);
-    }
-  }
+void QrCode::setVersionCells() {
+  draw_version_information(symbol_planes(*this), version);
+}
+
+void QrCode::addFinderPatterns(int x, int y) {
+  draw_finder_pattern(symbol_planes(*this), x, y);
 }
 
 void QrCode::setCell(int x, int y, bool value) {
   if (x >= 0 && x < size && y >= 0 && y < size) {
-    matrix[x][y] = value;
+    setModule(x, y, value);
   }
 }
 
+bool QrCode::getCell(int x, int y) const {
+  return (row(x)[y / 64] >> (y % 64)) & 1;
+}
+
+bool QrCode::isFunctionModule(int x, int y) const {
+  return (functionRow(x)[y / 64] >> (y % 64)) & 1;
+}
+
+void QrCode::setModule(int x, int y, bool value) {
+  u_int64_t bit = u_int64_t{1} << (y % 64);
+  u_int64_t& word = row(x)[y / 64];
+  word = value ? (word | bit) : (word & ~bit);
+}
+
 std::string QrCode::toString() const {
-  std::ostringstream oss;
-  for (const auto& row : matrix) {
-    for (bool cell : row) {
-      oss << (cell ? "██" : "  ");
+  std::string result;
+  result.reserve(static_cast<size_t>(size) * (size * 6 + 1));
+  for (int x = 0; x < size; x++) {
+    const u_int64_t* words = row(x);
+    for (int y = 0; y < size; y++) {
+      result += ((words[y / 64] >> (y % 64)) & 1) ? "██" : "  ";
     }
-    oss << '\n';
+    result += '\n';
   }
-  return oss.str();
+  return result;
 }
 
 void QrCode::printCells() const {
@@ -257,10 +315,11 @@ void QrCode::printCells() const {
     std::cout << surrounding_string << surrounding_string << "\n";
   }
 
-  for (const auto& row : matrix) {
+  for (int x = 0; x < size; x++) {
+    const u_int64_t* words = row(x);
     std::cout << surrounding_string << surrounding_string;
-    for (bool cell : row) {
-      std::cout << (!cell ? "██" : "  ");
+    for (int y = 0; y < size; y++) {
+      std::cout << (((words[y / 64] >> (y % 64)) & 1) ? "  " : "██");
     }
     std::cout << surrounding_string << surrounding_string << "\n";
   }
@@ -276,169 +335,330 @@ void QrCode::printCells() const {
 
 bool QrCode::computeByMask(int x, int y, bool bit) const {
   int mask_of_mask = 0b101;
-  if (mask_byte == (0b000 ^ mask_of_mask)) {
-    return (x + y) % 2 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b001 ^ mask_of_mask)) {
-    return x % 2 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b010 ^ mask_of_mask)) {
-    return y % 3 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b011 ^ mask_of_mask)) {
-    return (x + y) % 3 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b100 ^ mask_of_mask)) {
-    return (x / 2 + y / 3) % 2 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b101 ^ mask_of_mask)) {
-    return (x * y) % 2 + (x * y) % 3 == 0 ? !bit : bit;
-  } else if (mask_byte == (0b110 ^ mask_of_mask)) {
-    return (((x * y) % 3 + x * y) % 2 == 0) ? !bit : bit;
-  } else if (mask_byte == (0b111 ^ mask_of_mask)) {
-    return ((x * y) % 3 + x + y) % 2 == 0 ? !bit : bit;
-  } else {
+  if (mask_byte < 0 || mask_byte > 0b111) {
     throw std::logic_error("This mask is invalid (" +
                            std::to_string(mask_byte) + ")");
   }
+  return mask_pattern_bit(mask_byte ^ mask_of_mask, x, y) ? !bit : bit;
 }
 
-void QrCode::setModeCells() {
-  if (mode_specifier == NUMBER_MODE) {
-    matrix[size - 2][size - 2] = true;
-  } else if (mode_specifier == ALNUM_MODE) {
-    matrix[size - 2][size - 2] = false;
-  } else {
-    matrix[size - 2][size - 2] = false;
-  }
+int QrCode::getCharSpecifierLength() {
+  return char_count_bits(mode_specifier, version);
 }
 
-void QrCode::setMaskingCells() {
-  for (int i = 0; i < size; i++) {
-    for (int j = 0; j < size; j++) {
-      if (!isInRange(i, j)) {
-        setCell(i, j, false);
-      }
+bool QrCode::isInRange(int x, int y) const {
+  return x < size && y < size && x >= 0 && y >= 0;
+}
+
+void QrCode::setFormatCells() {
+  // mask_byte is the pattern reference as it appears in the symbol, i.e. the
+  // pattern number XORed with the 0b101 of the format information mask.
+  draw_format_information(
+      symbol_planes(*this),
+      static_cast<ErrorCorrectionLevel>(error_correction_level),
+      getMaskPattern());
+}
+
+const std::vector<u_int32_t>& placement_order(int version) {
+  return version_resources(version).placement_order;
+}
+
+const u_int64_t* mask_plane(int version, int pattern) {
+  return version_resources(version).maskPlane(pattern);
+}
+
+void QrCode::placeCodewords(const u_int8_t* codewords, size_t count) {
+  const std::vector<u_int32_t>& order =
+      version_resources(version).placement_order;
+  if (count * 8 > order.size()) {
+    throw EncodeError(REJECT_CAPACITY,
+                      "Too many codewords (" + std::to_string(count) +
+                          ") for version " + std::to_string(version));
+  }
+  // データ領域を0に戻す (剰余ビットも0になる)
+  const int words = size * words_per_row;
+  const u_int64_t* reserved = functionRow(0);
+  for (int i = 0; i < words; i++) {
+    planes[i] &= reserved[i];
+  }
+  // 立っているビットだけを表に従って散らす。0のコードワードは丸ごと飛ばせる
+  u_int64_t* modules = planes.data();
+  for (size_t k = 0; k < count; k++) {
+    unsigned bits = codewords[k];
+    const u_int32_t* positions = order.data() + k * 8;
+    while (bits != 0) {
+      int msb = 31 - __builtin_clz(bits);
+      u_int32_t position = positions[7 - msb];
+      modules[position >> 6] |= u_int64_t{1} << (position & 63);
+      bits &= ~(1u << msb);
     }
   }
 }
 
-int QrCode::getCharSpecifierLength() {
-  return CHAR_LENGTH_SPECIFIER.at(mode_specifier);
+void QrCode::placeCodewords(const std::vector<u_int8_t>& codewords) {
+  placeCodewords(codewords.data(), codewords.size());
 }
 
-bool QrCode::isInRange(int x, int y) const {
-  return x < size && y < size && x >= 0 && y >= 0;
+static_assert(MAX_WORDS_PER_ROW == 3);
+
+int penalty_score(const u_int64_t* modules, int size, int words_per_row) {
+  switch (words_per_row) {
+    case 1:
+      return penalty_score<1>(modules, size);
+    case 2:
+      return penalty_score<2>(modules, size);
+    case 3:
+      return penalty_score<3>(modules, size);
+    default:
+      throw std::invalid_argument("Invalid words per row (" +
+                                  std::to_string(words_per_row) + ")");
+  }
 }
 
-std::tuple<int, int, bool> QrCode::writeZigZag(int x, int y,
-                                               const std::vector<bool>& values,
-                                               bool upward) {
-  int row = x;
-  int col = y;
-  for (size_t i = 0; i < values.size(); ++i) {
-    setCell(row, col, values[i]);
-    if (upward) {
-      if (col == 0 || row == size - 1) {
-        row++;
-        upward = false;
-      } else {
-        row--;
-        col--;
-      }
-    } else {
-      if (row == 0 || col == size - 1) {
-        row++;
-        upward = true;
-      } else {
-        row++;
-        col--;
-      }
+void QrCode::applyMask() {
+  const u_int64_t* plane =
+      version_resources(version).maskPlane(getMaskPattern());
+  for (int i = 0; i < size * words_per_row; i++) {
+    planes[i] ^= plane[i];
+  }
+}
+
+MaskSelection QrCode::selectMask() {
+  const VersionResources& resources = version_resources(version);
+  const int words = size * words_per_row;
+  MaskSelection best{0, -1};
+  for (int p = 0; p < 8; p++) {
+    const u_int64_t* plane = resources.maskPlane(p);
+    for (int i = 0; i < words; i++) planes[i] ^= plane[i];
+    mask_byte = p ^ 0b101;
+    setFormatCells();
+    int penalty = penalty_score(planes.data(), size, words_per_row);
+    if (best.penalty < 0 || penalty < best.penalty) {
+      best = {p, penalty};
     }
+    for (int i = 0; i < words; i++) planes[i] ^= plane[i];
   }
-  return std::make_tuple(row, col, upward);
+  mask_byte = best.pattern ^ 0b101;
+  applyMask();
+  setFormatCells();
+  return best;
 }
 
-void QrCode::setErrorCorrectionCells() {
-  error_correction_level ^= 0b10;  // 0b10 is in specification
-  if (error_correction_level & 0b10) {
-    matrix[8][0] = true;
+int QrCode::getMaskPattern() const { return (mask_byte ^ 0b101) & 0b111; }
+
+int QrCode::getPenaltyScore() const {
+  return penalty_score(planes.data(), size, words_per_row);
+}
+
+void QrCode::createQrCode(std::string_view raw_string) {
+  const auto ecl = static_cast<ErrorCorrectionLevel>(error_correction_level);
+  const BlockLayout layout = block_layout(version, ecl);
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> data;
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> codewords;
+  BitBuffer bits(layout.dataCodewords() * 8);
+  build_data_codewords(raw_string, static_cast<ModeSpecifier>(mode_specifier),
+                       ecl, version, bits, data.data());
+  encode_blocks(data.data(), layout, codewords.data());
+  placeAndMask(codewords.data(), layout.totalCodewords());
+}
+
+void QrCode::reset(int version, int error_correction_level) {
+  if (version < MIN_VERSION || version > MAX_VERSION) {
+    throw EncodeError(REJECT_OPTION, "version must be in [1, 40] but got " +
+                                         std::to_string(version));
   }
-  if (error_correction_level & 0b01) {
-    matrix[8][1] = true;
+  this->version = version;
+  this->error_correction_level = error_correction_level;
+  size = symbol_size(version);
+  words_per_row = (size + 63) / 64;
+  last_mask_selection = {-1, -1};
+  planes.reserve(2 * MAX_SYMBOL_WORDS);
+  planes.resize(static_cast<size_t>(2 * size * words_per_row));
+  initializeWithFinderPatterns();
+}
+
+void QrCode::setMaskByte(int mask_byte) {
+  check_mask_byte(mask_byte);
+  this->mask_byte = mask_byte;
+  auto_mask = mask_byte == AUTO_MASK;
+  setFormatCells();
+}
+
+void QrCode::placeAndMask(const u_int8_t* codewords, size_t count) {
+  placeCodewords(codewords, count);
+  if (auto_mask) {
+    last_mask_selection = selectMask();
+  } else {
+    applyMask();
   }
 }
 
-void QrCode::setFormatCells() {
-  // masking format
-  setMaskingCells();
-  setErrorCorrectionCells();
+EncodeScratch::EncodeScratch() {
+  bits.reserve(MAX_TOTAL_CODEWORDS * 8);
+  // 1区間は最短でもモード指示子4 + 文字数指示子9 + 数字1文字4ビット
+  segments.reserve(MAX_TOTAL_CODEWORDS * 8 / 17);
+  segment_work.reserve(4 * MAX_INPUT_CHARS);
+}
 
-  // TODO: remove hardcode and implement according to the spec
-  // upper-left
-  // below square
-  setCell(8, 7);
-  // right to square
-  setCell(0, 8);
-  setCell(2, 8);
-  setCell(5, 8);
+void segment_stage(std::string_view payload, const EncodeOptions& options,
+                   EncodeScratch& scratch) {
+  StageTimer timer(SEGMENT_METRIC);
+  const auto ecl = options.error_correction_level;
+  const ModeSpecifier mode = options.mode_specifier;
+  int version = options.version;
+  if (version > MAX_VERSION) {
+    throw EncodeError(REJECT_OPTION, "version must be in [1, 40] but got " +
+                                         std::to_string(version));
+  }
+  // 自動分割の区間と版はスクラッチ上で求め、一時的な vector を作らない
+  if (mode == AUTO_MODE) {
+    if (version > 0) {
+      optimal_segments(payload, version, scratch.segment_work,
+                       scratch.segments);
+    } else {
+      version = select_version_segments(payload, ecl, scratch.segment_work,
+                                        scratch.segments);
+    }
+  } else if (version <= 0) {
+    version = select_version(payload, mode, ecl);
+  }
+  const StructuredAppend& append = options.structured_append;
+  if (append.total != 0) {
+    if (append.total < 0 || append.total > MAX_STRUCTURED_APPEND_SYMBOLS ||
+        append.index < 0 || append.index >= append.total) {
+      throw EncodeError(
+          REJECT_OPTION,
+          "Structured Append position " + std::to_string(append.index) +
+              " of " + std::to_string(append.total) + " is out of range");
+    }
+    // 自動で選んだ版に見出しの20ビットが収まらなければ版を上げる
+    auto payload_bits = [&](int v) {
+      return mode == AUTO_MODE
+                 ? segments_bits(scratch.segments, v)
+                 : 4 + char_count_bits(mode, v) +
+                       encoded_data_bits(
+                           static_cast<u_int32_t>(payload.size()), mode);
+    };
+    while (options.version <= 0 && version < MAX_VERSION &&
+           payload_bits(version) + STRUCTURED_APPEND_HEADER_BITS >
+               static_cast<u_int32_t>(data_codewords(version, ecl)) * 8) {
+      version++;
+      if (mode == AUTO_MODE) {
+        optimal_segments(payload, version, scratch.segment_work,
+                         scratch.segments);
+      }
+    }
+  }
+  scratch.version = version;
+}
 
-  // upper-right
-  setCell(8, size - 1);
-  setCell(8, size - 3);
-  setCell(8, size - 6);
+void codeword_stage(std::string_view payload, const EncodeOptions& options,
+                    EncodeScratch& scratch) {
+  StageTimer timer(CODEWORD_METRIC);
+  const ModeSpecifier mode = options.mode_specifier;
+  const int version = scratch.version;
+  const StructuredAppend& append = options.structured_append;
+  BitBuffer& bits = scratch.bits;
+  bits.clear();
+  if (append.total != 0) {
+    bits.append(STRUCTURED_APPEND_MODE, 4);
+    bits.append(static_cast<u_int32_t>(append.index), 4);
+    bits.append(static_cast<u_int32_t>(append.total - 1), 4);
+    bits.append(append.parity, 8);
+  }
+  if (mode == AUTO_MODE) {
+    append_segments(payload, scratch.segments, version, bits);
+  } else {
+    append_mode_header(mode, static_cast<u_int32_t>(payload.size()), version,
+                       bits);
+    append_data_bits(payload, mode, bits);
+  }
+  append_terminator_and_padding(
+      block_layout(version, options.error_correction_level).dataCodewords(),
+      bits);
+  bits.copyBytesTo(scratch.data_codewords.data());
+}
 
-  // lower-left
-  setCell(size - 1, 8);
-  setCell(size - 3, 8);
-  setCell(size - 7, 8);
+void error_correction_stage(const EncodeOptions& options,
+                            EncodeScratch& scratch) {
+  StageTimer timer(ERROR_CORRECTION_METRIC);
+  encode_blocks(scratch.data_codewords.data(),
+                block_layout(scratch.version, options.error_correction_level),
+                scratch.codewords.data());
 }
 
-void QrCode::setCharLengthCells(int qr_string_length) {
-  int offset_x = 3;
-  int offset_y = 1;
-  std::vector<bool> bits_to_write = create_char_length_bits(qr_string_length);
-  // for (const auto &b : bits_to_write) {
-  //   std::cerr << b << ' ';
-  // }
-  // std::cerr << '\n';
-  // std::cerr << "size:" << bits_to_write.size() << '\n';
-  // std::cerr << offset_x << '\n';
-  // std::cerr << offset_y << '\n';
-  writeZigZag(size - offset_x, size - offset_y, bits_to_write);
+void placement_stage(const EncodeOptions& options, EncodeScratch& scratch) {
+  StageTimer timer(PLACEMENT_METRIC);
+  QrCode& qr = scratch.qr;
+  qr.setMaskByte(options.mask_byte);
+  qr.reset(scratch.version, options.error_correction_level);
+  qr.placeCodewords(
+      scratch.codewords.data(),
+      block_layout(scratch.version, options.error_correction_level)
+          .totalCodewords());
 }
 
-void QrCode::createQrCode(std::string raw_string) {
-  setCharLengthCells(static_cast<int>(raw_string.size()));
-  int start_offset = getCharSpecifierLength() +
-                     4;  // char length specifier(8) + mode specifier(4)
-  int start_x = size - 1 - start_offset / 2;
-  int start_y = size - 1 - start_offset % 2;
-  bool start_upward = true;
-  // std::cerr << start_x << ' ' << start_y << '\n';
-  auto bits_to_write = flatten_bits(from_string(raw_string, mode_specifier));
-  for (const auto& one_character_byte : bits_to_write) {
-    auto [x, y, upward] = writeZigZag(
-        start_x, start_y, std::vector<bool>{one_character_byte}, start_upward);
-    start_x = x;
-    start_y = y;
-    start_upward = upward;
+void mask_stage(const EncodeOptions& options, EncodeScratch& scratch,
+                Symbol& out) {
+  StageTimer timer(MASK_METRIC);
+  QrCode& qr = scratch.qr;
+  if (options.mask_byte == AUTO_MASK) {
+    qr.selectMask();
+  } else {
+    qr.applyMask();
   }
-  // TODO: implement error correction part
+  out.version = scratch.version;
+  out.error_correction_level = options.error_correction_level;
+  out.mask_pattern = qr.getMaskPattern();
+  out.size = qr.getSize();
+  out.words_per_row = qr.wordsPerRow();
+  out.modules.reserve(MAX_SYMBOL_WORDS);
+  out.modules.assign(qr.row(0), qr.row(0) + out.size * out.words_per_row);
+  out.error.clear();
 }
 
-bool QrCode::verify_size_and_version() {
-  return (size == 21) && (version == 1);
+void encode_symbol(std::string_view payload, const EncodeOptions& options,
+                   EncodeScratch& scratch, Symbol& out) {
+  StageTimer timer(ENCODE_METRIC);
+  out.error.clear();
+  try {
+    segment_stage(payload, options, scratch);
+    codeword_stage(payload, options, scratch);
+    error_correction_stage(options, scratch);
+    placement_stage(options, scratch);
+    mask_stage(options, scratch, out);
+  } catch (const std::exception& e) {
+    out.setError(e.what(), reject_reason(e));
+    count_reject(out.reject_reason);
+    return;
+  }
+  count_symbol(out, payload.size());
 }
 
-std::vector<bool> QrCode::create_char_length_bits(int x) {
-  std::vector<bool> result;
-  while (0 < x) {
-    result.push_back((x & 0b1) == 1);
-    x >>= 1;
-  }
-  while (result.size() < 8) {
-    result.push_back(false);
+std::string Symbol::toString() const {
+  std::string result;
+  result.reserve(static_cast<size_t>(size) * (size * 6 + 1));
+  for (int x = 0; x < size; x++) {
+    const u_int64_t* words = row(x);
+    for (int y = 0; y < size; y++) {
+      result += ((words[y / 64] >> (y % 64)) & 1) ? "██" : "  ";
+    }
+    result += '\n';
   }
-  std::reverse(result.begin(), result.end());
   return result;
 }
 
+Symbol encode_symbol(std::string_view payload, const EncodeOptions& options) {
+  EncodeScratch scratch;
+  Symbol result;
+  encode_symbol(payload, options, scratch, result);
+  return result;
+}
+
+bool QrCode::verify_version() {
+  return MIN_VERSION <= version && version <= MAX_VERSION;
+}
+
 /*
 class QrCode {
  public:
@@ -538,7 +758,6 @@ class QrCode {
       std::cout << surrounding_string;  // left border
       std::cout << surrounding_string;
       for (bool cell : row) {
-        // std::cout << (cell ? surrounding_string : "  ");
         std::cout << (!cell ? "██" : "  ");  // "██" if true, otherwise "  "
       }
       std::cout << surrounding_string;
@@ -595,8 +814,6 @@ class QrCode {
       for (int j = 1; j <= 2; j++) {
         matrix[size - i][size - j] =
             !computeByMask(i, j, matrix[size - i][size - j]);
-        // std::cerr << "(i, j): " << i << ' ' << j << '='
-        //           << matrix[size - i][size - j] << '\n';
       }
     }
   }
@@ -683,10 +900,7 @@ std::tuple<int, int, bool> writeZigZag(int x, int y,
   }
 
   // Iterate through the values and write them in the zigzag pattern
-  // std::cerr << "start\n";
   while (index < values.size()) {
-    // std::cerr << "index: " << index << ' ';
-    // std::cerr << "(x,y): " << x << ' ' << y << '\n';
     matrix[x][y] = computeByMask(x, y, values[index++]);
 
     // Determine the next cell in the zigzag pattern
@@ -765,13 +979,6 @@ void setCharLengthCells(int qr_string_length) {
   int offset_x = 3;
   int offset_y = 1;
   std::vector<bool> bits_to_write = create_char_length_bits(qr_string_length);
-  // for (const auto &b : bits_to_write) {
-  //   std::cerr << b << ' ';
-  // }
-  // std::cerr << '\n';
-  // std::cerr << "size:" << bits_to_write.size() << '\n';
-  // std::cerr << offset_x << '\n';
-  // std::cerr << offset_y << '\n';
   writeZigZag(size - offset_x, size - offset_y, bits_to_write);
 }
 
@@ -782,7 +989,6 @@ void createQrCode(std::string raw_string) {
   int start_x = size - 1 - start_offset / 2;
   int start_y = size - 1 - start_offset % 2;
   bool start_upward = true;
-  // std::cerr << start_x << ' ' << start_y << '\n';
   auto bits_to_write = from_string(raw_string);
   for (const auto &one_character_byte : bits_to_write) {
     auto [x, y, upward] =
@@ -1,21 +1,69 @@
 #ifndef QR_H
 #define QR_H
 
+#include <algorithm>
+#include <array>
 #include <bitset>
 #include <map>
+#include <stdexcept>
 #include <string>
-#include <tuple>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "bit_buffer.h"
+#include "char_class.h"
+#include "qr_tables.h"
+#include "reed_solomon.h"
+
 // モード指示子
 using ModeSpecifier = u_int8_t;
 constexpr ModeSpecifier NUMBER_MODE = 0b0001;
 constexpr ModeSpecifier ALNUM_MODE = 0b0010;
 constexpr ModeSpecifier BYTE_MODE = 0b0100;
 constexpr ModeSpecifier KANJI_MODE = 0b1000;
+// Structured Append の見出し (位置4ビット・総数4ビット・パリティ8ビットが続く)
+constexpr ModeSpecifier STRUCTURED_APPEND_MODE = 0b0011;
+// Not a mode indicator: split the input into optimal numeric, alphanumeric
+// and byte segments (see segment.h).
+constexpr ModeSpecifier AUTO_MODE = 0xFF;
+
+// Why the encoder refused a payload (Symbol::reject_reason, and the reject
+// counters of metrics.h).
+enum RejectReason {
+  REJECT_CAPACITY,   // the payload does not fit
+  REJECT_CHARACTER,  // a character the requested mode cannot encode
+  REJECT_OPTION,     // an invalid version, level, mask or append header
+  REJECT_VERIFY,     // the symbol did not decode back (--verify)
+  REJECT_OTHER,
+  REJECT_REASONS,
+};
+
+// The std::invalid_argument the encoder throws for input it refuses, with
+// the reason as a code so callers need not read the message.
+class EncodeError : public std::invalid_argument {
+ public:
+  EncodeError(RejectReason reason, const std::string& message)
+      : std::invalid_argument(message), reason(reason) {}
+  RejectReason getReason() const { return reason; }
+
+ private:
+  RejectReason reason;
+};
+
+// EncodeError::getReason(), or REJECT_OTHER for any other exception.
+inline RejectReason reject_reason(const std::exception& e) {
+  const auto* error = dynamic_cast<const EncodeError*>(&e);
+  return error != nullptr ? error->getReason() : REJECT_OTHER;
+}
+
+// A run of the input encoded in one mode: s.substr(begin, length).
+struct Segment {
+  ModeSpecifier mode_specifier;
+  u_int32_t begin;
+  u_int32_t length;
+};
 
-// 文字数指示子
-extern const std::map<u_int8_t, u_int32_t> CHAR_LENGTH_SPECIFIER;
 extern const std::map<char, u_int32_t> ALNUM_MODE_CHAR_MAPPING;
 
 std::bitset<11> eleven_bits_from_pair(u_int32_t v1, u_int32_t v2);
@@ -28,6 +76,96 @@ std::vector<bool> convert_string_into_bits(const std::string& s,
 std::vector<bool> append_terminating_bits(const std::vector<bool>& bits,
                                           int length);
 
+// BitBuffer writers used by the encoder. Each mode encoder appends its packed
+// groups straight into `out`; nothing is materialised per bit. They are
+// usable in constant expressions (qr_static.h), where the table-only kernels
+// of char_class.h replace the vectorised ones.
+constexpr void append_numeric_bits(std::string_view s, BitBuffer& out) {
+  // 先に全体を1度で検査し、詰める処理では文字を確かめない
+  const u_int8_t classes = std::is_constant_evaluated()
+                               ? classify_block_scalar(s)
+                               : classify_block(s);
+  if (!(classes & CHAR_NUMERIC)) {
+    throw EncodeError(REJECT_CHARACTER,
+                      "Invalid character in the input string");
+  }
+  if (std::is_constant_evaluated()) {
+    pack_numeric_scalar(s, out);
+  } else {
+    pack_numeric(s, out);
+  }
+}
+constexpr void append_alnum_bits(std::string_view s, BitBuffer& out) {
+  const u_int8_t classes = std::is_constant_evaluated()
+                               ? classify_block_scalar(s)
+                               : classify_block(s);
+  if (!(classes & CHAR_ALNUM)) {
+    throw EncodeError(REJECT_CHARACTER,
+                      "Invalid character in the input string");
+  }
+  if (std::is_constant_evaluated()) {
+    pack_alnum_scalar(s, out);
+  } else {
+    pack_alnum(s, out);
+  }
+}
+// Raw bytes of `s` (UTF-8 passes through as is, without an ECI header).
+constexpr void append_byte_bits(std::string_view s, BitBuffer& out) {
+  for (char c : s) {
+    out.append(static_cast<u_int8_t>(c), 8);
+  }
+}
+constexpr void append_data_bits(std::string_view s,
+                                ModeSpecifier mode_specifier, BitBuffer& out) {
+  switch (mode_specifier) {
+    case NUMBER_MODE:
+      append_numeric_bits(s, out);
+      break;
+    case ALNUM_MODE:
+      append_alnum_bits(s, out);
+      break;
+    case BYTE_MODE:
+      append_byte_bits(s, out);
+      break;
+    default:
+      throw std::logic_error("Not implemented yet");
+  }
+}
+// mode indicator (4 bits) + character count indicator, whose width depends on
+// the version
+constexpr void append_mode_header(ModeSpecifier mode_specifier,
+                                  u_int32_t char_count, int version,
+                                  BitBuffer& out) {
+  const int char_length_specifier = char_count_bits(mode_specifier, version);
+  if (char_count >> char_length_specifier != 0) {
+    throw EncodeError(REJECT_CAPACITY, "Input string is too long (" +
+                                           std::to_string(char_count) +
+                                           " characters)");
+  }
+  out.append(mode_specifier, 4);
+  out.append(char_count, char_length_specifier);
+}
+// Bits the data of `char_count` characters occupies, without the header.
+constexpr u_int32_t encoded_data_bits(u_int32_t char_count,
+                                      ModeSpecifier mode_specifier) {
+  switch (mode_specifier) {
+    case NUMBER_MODE:
+      return char_count / 3 * 10 + (char_count % 3 == 0   ? 0
+                                    : char_count % 3 == 1 ? 4
+                                                          : 7);
+    case ALNUM_MODE:
+      return char_count / 2 * 11 + char_count % 2 * 6;
+    case BYTE_MODE:
+      return char_count * 8;
+    case KANJI_MODE:
+      return char_count * 13;
+    default:
+      throw EncodeError(REJECT_OPTION, "Invalid mode specifier (" +
+                                           std::to_string(mode_specifier) +
+                                           ")");
+  }
+}
+
 // エラー訂正レベル
 using ErrorCorrectionLevel = u_int8_t;
 constexpr ErrorCorrectionLevel L = 0b00;
@@ -35,47 +173,292 @@ constexpr ErrorCorrectionLevel M = 0b01;
 constexpr ErrorCorrectionLevel Q = 0b10;
 constexpr ErrorCorrectionLevel H = 0b11;
 
+// Zero fill to a byte boundary and the alternating 0xEC/0x11 pad codewords
+// up to `capacity_bits`.
+constexpr void append_padding(size_t capacity_bits, BitBuffer& out) {
+  out.append(0, static_cast<int>((8 - out.size() % 8) % 8));
+  constexpr u_int8_t PADDING_CODEWORDS[] = {0b11101100, 0b00010001};
+  size_t padding_index = 0;
+  while (out.size() < capacity_bits) {
+    out.append(PADDING_CODEWORDS[padding_index], 8);
+    padding_index ^= 1;
+  }
+}
+
+// Terminator (up to 4 zero bits), then append_padding() up to
+// `data_codewords`.
+constexpr void append_terminator_and_padding(u_int32_t data_codewords,
+                                             BitBuffer& out) {
+  const size_t capacity_bits = static_cast<size_t>(data_codewords) * 8;
+  if (out.size() > capacity_bits) {
+    throw EncodeError(REJECT_CAPACITY, "Data does not fit in " +
+                                           std::to_string(data_codewords) +
+                                           " codewords");
+  }
+  out.append(0,
+             static_cast<int>(std::min<size_t>(4, capacity_bits - out.size())));
+  append_padding(capacity_bits, out);
+}
+
 std::vector<u_int8_t> convert_to_codewords(
     const std::vector<bool>& bits, ModeSpecifier mode_specifier,
-    ErrorCorrectionLevel correction_level, u_int32_t word_length);
+    ErrorCorrectionLevel correction_level, u_int32_t word_length,
+    int version = 1);
 
 std::vector<u_int8_t> convert_string_into_codewords(
     const std::string s, ModeSpecifier mode_specifier,
-    ErrorCorrectionLevel correction_level);
+    ErrorCorrectionLevel correction_level, int version = 1);
+
+// The smallest version whose data capacity at `correction_level` holds `s`.
+// With AUTO_MODE the optimal segmentation is used for each version. Throws
+// std::invalid_argument if even version 40 is too small.
+int select_version(std::string_view s, ModeSpecifier mode_specifier,
+                   ErrorCorrectionLevel correction_level);
+
+// Writes the data_codewords(version, correction_level) data codewords of `s`
+// to `out`, using `scratch` as the bit stream (cleared first, capacity kept).
+void build_data_codewords(std::string_view s, ModeSpecifier mode_specifier,
+                          ErrorCorrectionLevel correction_level, int version,
+                          BitBuffer& scratch, u_int8_t* out);
+
+// マスクパターン参照子 (0-7) の位置 (x, y) のマスク値
+constexpr bool mask_pattern_bit(int pattern, int x, int y) {
+  switch (pattern) {
+    case 0b000:
+      return (x + y) % 2 == 0;
+    case 0b001:
+      return x % 2 == 0;
+    case 0b010:
+      return y % 3 == 0;
+    case 0b011:
+      return (x + y) % 3 == 0;
+    case 0b100:
+      return (x / 2 + y / 3) % 2 == 0;
+    case 0b101:
+      return (x * y) % 2 + (x * y) % 3 == 0;
+    case 0b110:
+      return ((x * y) % 3 + x * y) % 2 == 0;
+    case 0b111:
+      return ((x * y) % 3 + x + y) % 2 == 0;
+    default:
+      throw std::logic_error("This mask is invalid (" +
+                             std::to_string(pattern) + ")");
+  }
+}
+
+// Penalty of a finished symbol per ISO/IEC 18004 7.8.3: runs of 5+ same
+// colour modules, 2x2 blocks, 1:1:3:1:1 finder-like patterns with 4 light
+// modules on one side (outside the symbol counts as light) and dark ratio.
+// `modules` is a row-major bitplane as exposed by QrCode::row().
+int penalty_score(const u_int64_t* modules, int size, int words_per_row);
+// penalty.h has the same with the row width as a template argument.
+
+// Module visited by the k-th data bit of `version`, as a bit index
+// x * wordsPerRow() * 64 + y into the module plane. Covers all
+// raw_data_modules(version) modules in zigzag order, skipping reserved ones.
+const std::vector<u_int32_t>& placement_order(int version);
+// Mask `pattern` (0-7) of `version` in the module plane layout, zero on
+// function modules: XORing it onto a symbol masks or unmasks its data.
+const u_int64_t* mask_plane(int version, int pattern);
+
+struct MaskSelection {
+  int pattern;  // マスクパターン参照子 (0-7)
+  int penalty;
+};
+
+// Pass as mask_byte to pick the mask with the lowest penalty.
+constexpr int AUTO_MASK = -1;
+// Throws EncodeError (REJECT_OPTION) unless mask_byte is AUTO_MASK or 0-7.
+void check_mask_byte(int mask_byte);
 
 class QrCode {
  public:
-  QrCode(int size = 21, int version = 1, int mask_byte = 0b100,
-         int mode_specifier = ALNUM_MODE, int error_correction_level = 0b00,
+  // The symbol is symbol_size(version) modules wide.
+  // mask_byte is the mask reference as written in the symbol (the pattern
+  // number XOR 0b101) or AUTO_MASK. Throws std::invalid_argument for a
+  // version outside [1, 40] or a mask_byte outside [0, 7].
+  QrCode(int version = 1, int mask_byte = AUTO_MASK,
+         int mode_specifier = ALNUM_MODE, int error_correction_level = L,
          bool autoInitialize = true);
 
+  // Copies this version's cached function-pattern template into the matrix
+  // and writes the format information.
   void initializeWithFinderPatterns();
+  // Draws finder/timing/alignment patterns, version information and reserves
+  // the format area from scratch (used to build the per-version template).
+  void drawFunctionPatterns();
   void addFinderPatterns(int x, int y);
+  void addAlignmentPattern(int x, int y);
+  void setVersionCells();
   void setCell(int x, int y, bool value = true);
+  bool getCell(int x, int y) const;
+  // 機能パターン(ファインダ・タイミング・形式情報など)として予約済みか
+  bool isFunctionModule(int x, int y) const;
   std::string toString() const;
   void printCells() const;
   bool computeByMask(int x, int y, bool bit) const;
-  void setModeCells();
-  void setMaskingCells();
   int getCharSpecifierLength();
   bool isInRange(int x, int y) const;
-  std::tuple<int, int, bool> writeZigZag(int x, int y,
-                                         const std::vector<bool>& values,
-                                         bool upward = true);
-  void setErrorCorrectionCells();
   void setFormatCells();
-  void setCharLengthCells(int qr_string_length);
-  void createQrCode(std::string raw_string);
+  // 最終コードワード列(データ+誤り訂正)を予約外のモジュールへ配置する。
+  // 配置順はバージョンごとに1度だけ求めた placement_order() を使う
+  void placeCodewords(const u_int8_t* codewords, size_t count);
+  void placeCodewords(const std::vector<u_int8_t>& codewords);
+  // Applies the current mask to the data region.
+  void applyMask();
+  // Scores all eight masks over the placed data, keeps the best one and
+  // writes its format information.
+  MaskSelection selectMask();
+  // Places final codewords and applies the fixed or automatically chosen mask.
+  void placeAndMask(const u_int8_t* codewords, size_t count);
+  void createQrCode(std::string_view raw_string);
+
+  // Reinitialises this object as an empty symbol of `version` at
+  // `error_correction_level`, keeping the mask setting and the mode. The
+  // planes are reserved for version 40 once, so reuse never reallocates.
+  void reset(int version, int error_correction_level);
+  // mask_byte as in the constructor (AUTO_MASK selects automatically).
+  // Throws std::invalid_argument for a mask_byte outside [0, 7].
+  void setMaskByte(int mask_byte);
+
+  int getSize() const { return size; }
+  int getVersion() const { return version; }
+  int getMaskByte() const { return mask_byte; }
+  int getMaskPattern() const;
+  int getPenaltyScore() const;
+  // The result of the automatic selection made by the last createQrCode().
+  MaskSelection getMaskSelection() const { return last_mask_selection; }
+
+  // Row-major bitplane access. Row x holds wordsPerRow() words; module (x, y)
+  // is bit y % 64 of word y / 64. Bits past `size` in the last word are zero.
+  int wordsPerRow() const { return words_per_row; }
+  const u_int64_t* row(int x) const {
+    return planes.data() + static_cast<size_t>(x) * words_per_row;
+  }
+  u_int64_t* row(int x) {
+    return planes.data() + static_cast<size_t>(x) * words_per_row;
+  }
+  // Parallel plane marking reserved (function) modules.
+  const u_int64_t* functionRow(int x) const { return row(size + x); }
+  u_int64_t* functionRow(int x) { return row(size + x); }
 
  private:
   int size;
   int version;
   int mask_byte;
+  bool auto_mask;
+  MaskSelection last_mask_selection{-1, -1};
   int mode_specifier;
   int error_correction_level;
-  bool verify_size_and_version();
-  std::vector<std::vector<bool>> matrix;
-  std::vector<bool> create_char_length_bits(int x);
+  int words_per_row;
+  // モジュール面と予約面を1つの連続領域に持つ: [modules | function modules]
+  std::vector<u_int64_t> planes;
+  bool verify_version();
+  // 範囲チェックなしの書き込み
+  void setModule(int x, int y, bool value);
+};
+
+// An encoded, masked symbol detached from QrCode: the module bitplane in the
+// same layout as QrCode::row(). `error` is set instead when encoding failed.
+struct Symbol {
+  int version = 0;
+  int error_correction_level = L;
+  int mask_pattern = -1;
+  int size = 0;
+  int words_per_row = 0;
+  std::vector<u_int64_t> modules;
+  std::string error;
+  RejectReason reject_reason = REJECT_OTHER;  // only while !ok()
+
+  bool ok() const { return error.empty(); }
+  // Empties the symbol and records why encoding failed.
+  void setError(const std::string& message,
+                RejectReason reason = REJECT_OTHER) {
+    version = 0;
+    mask_pattern = -1;
+    size = 0;
+    modules.clear();
+    error = message;
+    reject_reason = reason;
+  }
+  bool getCell(int x, int y) const {
+    return (modules[static_cast<size_t>(x) * words_per_row + y / 64] >>
+            (y % 64)) &
+           1;
+  }
+  const u_int64_t* row(int x) const {
+    return modules.data() + static_cast<size_t>(x) * words_per_row;
+  }
+  // Same rendering as QrCode::toString()
+  std::string toString() const;
+};
+
+constexpr int MAX_STRUCTURED_APPEND_SYMBOLS = 16;
+constexpr int STRUCTURED_APPEND_HEADER_BITS = 4 + 4 + 4 + 8;
+
+// Position of a symbol in a Structured Append sequence (ISO/IEC 18004, 7.4)
+// and the parity of the whole message (see structured_append.h).
+struct StructuredAppend {
+  int index = 0;
+  int total = 0;  // 0: a standalone symbol without the header
+  u_int8_t parity = 0;
+};
+
+// XOR of every byte of the whole message, carried by each symbol's header.
+constexpr u_int8_t structured_append_parity(std::string_view message) {
+  u_int8_t parity = 0;
+  for (char c : message) {
+    parity ^= static_cast<u_int8_t>(c);
+  }
+  return parity;
+}
+
+struct EncodeOptions {
+  ErrorCorrectionLevel error_correction_level = L;
+  int version = 0;  // 0: the smallest version that fits
+  int mask_byte = AUTO_MASK;
+  ModeSpecifier mode_specifier = ALNUM_MODE;
+  StructuredAppend structured_append;
 };
 
+// Buffers reused across encodes by one thread. Everything is sized for
+// version 40 up front, so once `out` has been used too, encode_symbol()
+// performs no heap allocation for any payload that fits.
+struct EncodeScratch {
+  EncodeScratch();
+
+  BitBuffer bits;
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> data_codewords;
+  std::array<u_int8_t, MAX_TOTAL_CODEWORDS> codewords;
+  std::vector<Segment> segments;
+  std::vector<u_int8_t> segment_work;  // optimal_segments() の DP 表
+  QrCode qr;
+  int version = 0;  // segment_stage() が選んだ版
+};
+
+// Encodes `payload` into `out`. Errors are reported through out.error rather
+// than thrown, so one bad payload does not abort a batch. out.modules keeps
+// a version 40 capacity, so a reused Symbol is never reallocated.
+void encode_symbol(std::string_view payload, const EncodeOptions& options,
+                   EncodeScratch& scratch, Symbol& out);
+Symbol encode_symbol(std::string_view payload,
+                     const EncodeOptions& options = {});
+
+// encode_symbol() as five stages, for callers that run them on different
+// threads (pipeline.h). Each stage continues from what the previous one left
+// in `scratch` and throws std::invalid_argument where encode_symbol() would
+// set out.error.
+//   segment_stage: version and segments     codeword_stage: data codewords
+//   error_correction_stage: final codewords placement_stage: scratch.qr
+//   mask_stage: masks and copies the symbol to `out`
+void segment_stage(std::string_view payload, const EncodeOptions& options,
+                   EncodeScratch& scratch);
+void codeword_stage(std::string_view payload, const EncodeOptions& options,
+                    EncodeScratch& scratch);
+void error_correction_stage(const EncodeOptions& options,
+                            EncodeScratch& scratch);
+void placement_stage(const EncodeOptions& options, EncodeScratch& scratch);
+void mask_stage(const EncodeOptions& options, EncodeScratch& scratch,
+                Symbol& out);
+
 #endif  // QR_H
@@ -0,0 +1,614 @@
+// Microbenchmarks for every encoding stage plus end-to-end encodes.
+//   ./qr_bench --benchmark_filter=Encode
+// Counters: items_per_second = symbols/s, bytes_per_second = payload (or
+// output) bytes/s, allocs/encode = operator new calls per iteration.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "archive.h"
+#include "batch.h"
+#include "char_class.h"
+#include "decoder.h"
+#include "pipeline.h"
+#include "qr.h"
+#include "qr_symbol.h"
+#include "render.h"
+#include "scanner.h"
+#include "segment.h"
+#include "structured_append.h"
+#include "svg.h"
+#include "symbol_cache.h"
+
+namespace {
+std::atomic<size_t> allocation_count{0};
+}  // namespace
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+// 版の大小・内容の種類が混ざったコーパス
+std::vector<std::string> make_corpus(int kind) {
+  std::vector<std::string> corpus;
+  for (int i = 0; i < 64; i++) {
+    switch (kind) {
+      case 0:  // 小さい版: 短い英数字
+        corpus.push_back("LOT-" + std::to_string(1000 + i * 37));
+        break;
+      case 1:  // 大きい版: 長い英数字
+        corpus.push_back(std::string(800 + i * 20, "ABC123 $:"[i % 9]));
+        break;
+      default:  // 混在: URL + 長い数字列、ラベル
+        corpus.push_back(
+            i % 2 ? "https://example.com/track?id=" + std::to_string(i) +
+                        std::string(40 + i, '0' + i % 10)
+                  : "ORDER-2026/" + std::to_string(1000000000 + i * 7919));
+        break;
+    }
+  }
+  return corpus;
+}
+
+const char* CORPUS_NAMES[] = {"small", "large", "mixed"};
+
+void set_allocation_counter(benchmark::State& state, size_t before) {
+  state.counters["allocs/encode"] = benchmark::Counter(
+      static_cast<double>(allocation_count.load() - before),
+      benchmark::Counter::kAvgIterations);
+}
+
+Symbol symbol_for(int version, ErrorCorrectionLevel ecl) {
+  EncodeOptions options{ecl, version};
+  return encode_symbol(std::string(data_codewords(version, ecl), 'Q').substr(
+                           0, data_codewords(version, ecl)),
+                       options);
+}
+
+// ---- input stage ----
+
+void BM_FromString(benchmark::State& state) {
+  const std::string s(state.range(0), 'A');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(from_string(s, ALNUM_MODE));
+  }
+  state.SetBytesProcessed(state.iterations() * s.size());
+}
+BENCHMARK(BM_FromString)->Arg(16)->Arg(1024);
+
+void BM_ClassifyAndPack(benchmark::State& state) {
+  const std::string s(state.range(0), state.range(1) ? '7' : 'Q');
+  BitBuffer bits(s.size() * 11);
+  for (auto _ : state) {
+    bits.clear();
+    append_data_bits(s, state.range(1) ? NUMBER_MODE : ALNUM_MODE, bits);
+    benchmark::DoNotOptimize(bits.data().data());
+  }
+  state.SetBytesProcessed(state.iterations() * s.size());
+  state.SetLabel(char_kernel_name());
+}
+BENCHMARK(BM_ClassifyAndPack)
+    ->ArgNames({"bytes", "numeric"})
+    ->Args({1024, 0})
+    ->Args({1024, 1})
+    ->Args({1 << 20, 0})
+    ->Args({1 << 20, 1});
+
+void BM_OptimalSegments(benchmark::State& state) {
+  const auto corpus = make_corpus(2);
+  std::vector<Segment> segments;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    for (const auto& s : corpus) {
+      optimal_segments(s, 10, segments);
+      bytes += s.size();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_OptimalSegments);
+
+// ---- codewords and ECC ----
+
+void BM_BuildDataCodewords(benchmark::State& state) {
+  const int version = state.range(0);
+  const std::string s(data_codewords(version, M) * 8 / 11 * 2 - 8, 'Q');
+  BitBuffer scratch;
+  std::vector<u_int8_t> out(data_codewords(version, M));
+  for (auto _ : state) {
+    build_data_codewords(s, ALNUM_MODE, M, version, scratch, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * s.size());
+}
+BENCHMARK(BM_BuildDataCodewords)->Arg(1)->Arg(10)->Arg(40);
+
+void BM_ErrorCorrection(benchmark::State& state) {
+  const int version = state.range(0);
+  const auto ecl = static_cast<ErrorCorrectionLevel>(state.range(1));
+  const BlockLayout layout = block_layout(version, ecl);
+  std::vector<u_int8_t> data(layout.dataCodewords());
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<u_int8_t>(i * 31 + 7);
+  }
+  std::vector<u_int8_t> out(layout.totalCodewords());
+  for (auto _ : state) {
+    encode_blocks(data.data(), layout, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.SetLabel(gf_kernel_name());
+}
+BENCHMARK(BM_ErrorCorrection)
+    ->ArgNames({"version", "ecl"})
+    ->ArgsProduct({{1, 10, 25, 40}, {L, H}});
+
+// ---- matrix stages ----
+
+std::vector<u_int8_t> codewords_for(int version) {
+  std::vector<u_int8_t> codewords(total_codewords(version));
+  for (size_t i = 0; i < codewords.size(); i++) {
+    codewords[i] = static_cast<u_int8_t>(i * 131 + 17);
+  }
+  return codewords;
+}
+
+void BM_PlaceCodewords(benchmark::State& state) {
+  const int version = state.range(0);
+  const auto codewords = codewords_for(version);
+  QrCode qr(version, 0, ALNUM_MODE, M);
+  for (auto _ : state) {
+    qr.placeCodewords(codewords.data(), codewords.size());
+    benchmark::DoNotOptimize(qr.row(0));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PlaceCodewords)->Arg(1)->Arg(10)->Arg(40);
+
+void BM_ApplyMask(benchmark::State& state) {
+  const int version = state.range(0);
+  QrCode qr(version, 0, ALNUM_MODE, M);
+  for (auto _ : state) {
+    qr.applyMask();
+    benchmark::DoNotOptimize(qr.row(0));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ApplyMask)->Arg(1)->Arg(10)->Arg(40);
+
+void BM_PenaltyScore(benchmark::State& state) {
+  const Symbol symbol = symbol_for(state.range(0), M);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(penalty_score(symbol.modules.data(), symbol.size,
+                                           symbol.words_per_row));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PenaltyScore)->Arg(1)->Arg(10)->Arg(40);
+
+// 配置し直してから8マスクを評価する (配置は全体の数%)
+void BM_SelectMask(benchmark::State& state) {
+  const int version = state.range(0);
+  const auto codewords = codewords_for(version);
+  QrCode qr(version, AUTO_MASK, ALNUM_MODE, M);
+  for (auto _ : state) {
+    qr.placeCodewords(codewords.data(), codewords.size());
+    benchmark::DoNotOptimize(qr.selectMask());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SelectMask)->Arg(1)->Arg(10)->Arg(40);
+
+// ---- renderers ----
+
+void BM_Render(benchmark::State& state) {
+  const Symbol symbol = symbol_for(state.range(0), M);
+  const auto format = static_cast<ImageFormat>(state.range(1));
+  RenderOptions options;
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    render_image(symbol, format, options, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * out.size());
+  state.SetLabel(std::string(render_kernel_name()) + " " +
+                 std::to_string(out.size()) + " B");
+}
+BENCHMARK(BM_Render)
+    ->ArgNames({"version", "format"})
+    ->ArgsProduct({{2, 10, 40},
+                   {static_cast<int>(ImageFormat::PBM),
+                    static_cast<int>(ImageFormat::PGM),
+                    static_cast<int>(ImageFormat::PNG)}});
+
+void BM_RenderSvg(benchmark::State& state) {
+  const Symbol symbol = symbol_for(state.range(0), M);
+  SvgOptions options;
+  std::vector<char> out(svg_max_size(symbol.size, options));
+  size_t length = 0;
+  for (auto _ : state) {
+    length = write_svg(module_matrix(symbol), options, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * length);
+  state.SetLabel(std::to_string(length) + " B");
+}
+BENCHMARK(BM_RenderSvg)->Arg(2)->Arg(10)->Arg(40);
+
+void BM_SymbolToString(benchmark::State& state) {
+  const Symbol symbol = symbol_for(state.range(0), M);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(symbol.toString());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SymbolToString)->Arg(2)->Arg(40);
+
+// ---- decoder ----
+
+// 符号化済みシンボルの読み戻し (--verify の追加分)。BM_EncodeSymbol と比べる
+void BM_DecodeSymbol(benchmark::State& state) {
+  const auto corpus = make_corpus(state.range(0));
+  EncodeOptions options;
+  options.error_correction_level =
+      static_cast<ErrorCorrectionLevel>(state.range(1));
+  options.mode_specifier = AUTO_MODE;
+  std::vector<Symbol> symbols;
+  for (const auto& s : corpus) {
+    symbols.push_back(encode_symbol(s, options));
+  }
+  DecodeResult decoded;
+  for (const auto& symbol : symbols) {
+    decode_symbol(symbol, decoded);
+  }
+  size_t bytes = 0;
+  size_t index = 0;
+  const size_t before = allocation_count.load();
+  for (auto _ : state) {
+    decode_symbol(symbols[index++ % symbols.size()], decoded);
+    if (!decoded.ok()) {
+      state.SkipWithError(decoded.error.c_str());
+      break;
+    }
+    bytes += decoded.text.size();
+  }
+  set_allocation_counter(state, before);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+  state.SetLabel(CORPUS_NAMES[state.range(0)]);
+}
+BENCHMARK(BM_DecodeSymbol)
+    ->ArgNames({"corpus", "ecl"})
+    ->ArgsProduct({{0, 1, 2}, {L, Q}});
+
+// ---- scanner ----
+
+// render_image() の PGM (4画素/モジュール) を読み戻す。pixels は入力画素/s
+GrayImage rendered_image(int version) {
+  std::string pgm;
+  render_image(symbol_for(version, M), ImageFormat::PGM, RenderOptions{},
+               pgm);
+  return read_netpbm(pgm);
+}
+
+void set_pixel_rate(benchmark::State& state, const GrayImage& image) {
+  state.counters["pixels"] = benchmark::Counter(
+      static_cast<double>(state.iterations()) * image.width * image.height,
+      benchmark::Counter::kIsRate);
+  state.SetLabel(std::string(scan_kernel_name()) + " " +
+                 std::to_string(image.width) + "x" +
+                 std::to_string(image.height));
+}
+
+void BM_Binarize(benchmark::State& state) {
+  const GrayImage image = rendered_image(state.range(0));
+  ScanScratch scratch;
+  for (auto _ : state) {
+    binarize(image, scratch);
+    benchmark::DoNotOptimize(scratch.binary.data());
+  }
+  set_pixel_rate(state, image);
+}
+BENCHMARK(BM_Binarize)->Arg(2)->Arg(10)->Arg(40);
+
+void BM_ScanImage(benchmark::State& state) {
+  const GrayImage image = rendered_image(state.range(0));
+  ScanScratch scratch;
+  ScanResult result;
+  scan_image(image, scratch, result);
+  for (auto _ : state) {
+    scan_image(image, scratch, result);
+    if (!result.ok()) {
+      state.SkipWithError(result.decoded.error.c_str());
+      break;
+    }
+  }
+  set_pixel_rate(state, image);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ScanImage)->Arg(2)->Arg(10)->Arg(40);
+
+// ---- end to end ----
+
+void BM_EncodeSymbol(benchmark::State& state) {
+  const auto corpus = make_corpus(state.range(0));
+  EncodeOptions options;
+  options.error_correction_level =
+      static_cast<ErrorCorrectionLevel>(state.range(1));
+  options.mode_specifier = AUTO_MODE;
+  EncodeScratch scratch;
+  Symbol symbol;
+  size_t bytes = 0;
+  size_t index = 0;
+  // 定常状態にしてから数える
+  for (const auto& s : corpus) {
+    encode_symbol(s, options, scratch, symbol);
+  }
+  const size_t before = allocation_count.load();
+  for (auto _ : state) {
+    const std::string& s = corpus[index++ % corpus.size()];
+    encode_symbol(s, options, scratch, symbol);
+    if (!symbol.ok()) {
+      state.SkipWithError(symbol.error.c_str());
+      break;
+    }
+    bytes += s.size();
+  }
+  set_allocation_counter(state, before);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+  state.SetLabel(CORPUS_NAMES[state.range(0)]);
+}
+BENCHMARK(BM_EncodeSymbol)
+    ->ArgNames({"corpus", "ecl"})
+    ->ArgsProduct({{0, 1, 2}, {L, M, Q, H}});
+
+// 固定版の比較: 実行時の汎用経路と QrSymbol<Version, Ecl> の特殊化
+constexpr char FIXED_VERSION_PAYLOAD[] = "https://example.com/item/0123456789";
+
+void BM_EncodeSymbolFixedVersion(benchmark::State& state) {
+  const EncodeOptions options{M, static_cast<int>(state.range(0)), AUTO_MASK,
+                              AUTO_MODE};
+  EncodeScratch scratch;
+  Symbol symbol;
+  for (auto _ : state) {
+    encode_symbol(FIXED_VERSION_PAYLOAD, options, scratch, symbol);
+    benchmark::DoNotOptimize(symbol.modules.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EncodeSymbolFixedVersion)->Arg(3)->Arg(10)->Arg(25);
+
+template <int Version>
+void BM_QrSymbol(benchmark::State& state) {
+  auto symbol = std::make_unique<QrSymbol<Version, M>>();
+  for (auto _ : state) {
+    symbol->encode(FIXED_VERSION_PAYLOAD);
+    benchmark::DoNotOptimize(symbol->row(0));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QrSymbol<3>);
+BENCHMARK(BM_QrSymbol<10>);
+BENCHMARK(BM_QrSymbol<25>);
+
+void BM_CreateQrCode(benchmark::State& state) {
+  const auto corpus = make_corpus(state.range(0));
+  size_t bytes = 0;
+  size_t index = 0;
+  const size_t before = allocation_count.load();
+  for (auto _ : state) {
+    const std::string& s = corpus[index++ % corpus.size()];
+    QrCode qr(select_version(s, AUTO_MODE, M), AUTO_MASK, AUTO_MODE, M);
+    qr.createQrCode(s);
+    benchmark::DoNotOptimize(qr.row(0));
+    bytes += s.size();
+  }
+  set_allocation_counter(state, before);
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+  state.SetLabel(CORPUS_NAMES[state.range(0)]);
+}
+BENCHMARK(BM_CreateQrCode)->Arg(0)->Arg(1)->Arg(2);
+
+void BM_EncodeBatch(benchmark::State& state) {
+  auto corpus = make_corpus(2);
+  for (const auto& s : make_corpus(1)) {
+    corpus.push_back(s);
+  }
+  std::vector<std::string_view> views(corpus.begin(), corpus.end());
+  BatchOptions options;
+  options.encode.mode_specifier = AUTO_MODE;
+  options.chunk_size = state.range(1);
+  options.verify = state.range(2) != 0;
+  WorkStealingPool pool(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(encode_batch(views, options, pool));
+  }
+  state.SetItemsProcessed(state.iterations() * views.size());
+}
+BENCHMARK(BM_EncodeBatch)
+    ->ArgNames({"threads", "chunk", "verify"})
+    ->Args({1, 16, 0})
+    ->Args({1, 16, 1})
+    ->Args({4, 1, 0})
+    ->Args({4, 16, 0})
+    ->Args({4, 16, 1})
+    ->UseRealTime();
+
+// 要求の repeat_percent % が8個の人気ペイロードの繰り返し、残りは一度きり
+void BM_EncodeCached(benchmark::State& state) {
+  const auto hot = make_corpus(2);
+  const int repeat_percent = static_cast<int>(state.range(0));
+  std::vector<std::string> requests;
+  for (int i = 0; i < 4096; i++) {
+    if ((i * 37) % 100 < repeat_percent) {
+      requests.push_back(hot[i % 8]);
+    } else {
+      requests.push_back("https://example.com/ticket/" +
+                         std::to_string(1000000 + i * 7919));
+    }
+  }
+  EncodeOptions options;
+  options.mode_specifier = AUTO_MODE;
+  EncodeScratch scratch;
+  Symbol symbol;
+  SymbolCache cache;
+  size_t index = 0;
+  for (auto _ : state) {
+    // 一度きりの要求がいつまでも当たらないよう、一巡ごとに空にする
+    if (index % requests.size() == 0) {
+      cache.clear();
+    }
+    encode_symbol_cached(requests[index++ % requests.size()], options, scratch,
+                         cache, symbol);
+    benchmark::DoNotOptimize(symbol.modules.data());
+  }
+  const SymbolCacheStats stats = cache.stats();
+  state.counters["hit_rate"] =
+      static_cast<double>(stats.hits) / (stats.hits + stats.misses);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EncodeCached)
+    ->ArgName("repeat_percent")
+    ->Arg(0)
+    ->Arg(40)
+    ->Arg(90);
+
+// 版40に近い1つのメッセージを、版 max_version 以下の Structured Append に
+// 分けて並列に符号化する (max_version 40 は分けない場合)
+void BM_StructuredAppend(benchmark::State& state) {
+  std::string payload;
+  for (int i = 0; payload.size() < 2400; i++) {
+    payload += "https://example.com/item/" + std::to_string(1000000 + i * 37) +
+               "?lot=A" + std::to_string(i % 97) + "\n";
+  }
+  BatchOptions options;
+  options.encode.mode_specifier = AUTO_MODE;
+  WorkStealingPool pool(state.range(1));
+  size_t symbols = 0;
+  for (auto _ : state) {
+    const std::vector<Symbol> result = encode_structured_append(
+        payload, options, static_cast<int>(state.range(0)), pool);
+    if (!result[0].ok()) {
+      state.SkipWithError(result[0].error.c_str());
+      break;
+    }
+    symbols = result.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * payload.size());
+  state.SetLabel(std::to_string(symbols) + " symbols");
+}
+BENCHMARK(BM_StructuredAppend)
+    ->ArgNames({"max_version", "threads"})
+    ->ArgsProduct({{10, 40}, {1, 4}})
+    ->UseRealTime();
+
+// PNG まで描画するストリーム。ecc と render の段のスレッド数を変え、
+// 1スレッドずつの場合と比べる
+void BM_Pipeline(benchmark::State& state) {
+  auto corpus = make_corpus(2);
+  for (const auto& s : make_corpus(1)) {
+    corpus.push_back(s);
+  }
+  PipelineOptions options;
+  options.encode.mode_specifier = AUTO_MODE;
+  options.threads[ERROR_CORRECTION_STAGE] = static_cast<int>(state.range(0));
+  options.threads[RENDER_STAGE] = static_cast<int>(state.range(1));
+  RenderOptions render;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    EncodePipeline pipeline(
+        options,
+        [&](size_t, const Symbol& symbol, std::string& out) {
+          render_image(symbol, ImageFormat::PNG, render, out);
+        },
+        [&](size_t, const Symbol&, std::string_view rendered) {
+          bytes += rendered.size();
+        });
+    for (const std::string& payload : corpus) {
+      pipeline.push(payload);
+    }
+    pipeline.finish();
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_Pipeline)
+    ->ArgNames({"ecc", "render"})
+    ->Args({1, 1})
+    ->Args({2, 4})
+    ->UseRealTime();
+
+// 符号化済みの記号を threads 本の書き手でアーカイブへ詰め、読む側は
+// 無作為な番号の記号を1つ取り出してモジュールを1つ読む
+void BM_ArchiveWrite(benchmark::State& state) {
+  const auto corpus = make_corpus(2);
+  std::vector<Symbol> symbols;
+  for (const std::string& payload : corpus) {
+    symbols.push_back(encode_symbol(payload, EncodeOptions{M, 0, AUTO_MASK,
+                                                           AUTO_MODE}));
+  }
+  constexpr size_t RECORDS = 16384;
+  const std::string path = "/tmp/qr_bench_archive.qra";
+  WorkStealingPool pool(state.range(0));
+  for (auto _ : state) {
+    ArchiveWriter writer(path);
+    pool.parallelFor(RECORDS, 256, [&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; i++) {
+        writer.add(i, symbols[i % symbols.size()], corpus[i % corpus.size()]);
+      }
+    });
+    writer.finish();
+  }
+  state.SetItemsProcessed(state.iterations() * RECORDS);
+  std::remove(path.c_str());
+}
+BENCHMARK(BM_ArchiveWrite)->ArgName("threads")->Arg(1)->Arg(4)->UseRealTime();
+
+void BM_ArchiveRead(benchmark::State& state) {
+  const auto corpus = make_corpus(2);
+  constexpr size_t RECORDS = 16384;
+  const std::string path = "/tmp/qr_bench_archive_read.qra";
+  {
+    ArchiveWriter writer(path);
+    for (size_t i = 0; i < RECORDS; i++) {
+      const std::string& payload = corpus[i % corpus.size()];
+      writer.add(i, encode_symbol(payload, {M, 0, AUTO_MASK, AUTO_MODE}),
+                 payload);
+    }
+    writer.finish();
+  }
+  ArchiveReader reader(path);
+  u_int64_t index = 12345;
+  for (auto _ : state) {
+    index = index * 6364136223846793005ULL + 1442695040888963407ULL;
+    const ArchiveSymbol symbol = reader.at((index >> 33) % RECORDS);
+    benchmark::DoNotOptimize(symbol.getCell(8, 8));
+  }
+  state.SetItemsProcessed(state.iterations());
+  std::remove(path.c_str());
+}
+BENCHMARK(BM_ArchiveRead);
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,216 @@
+// Load generator for `qr serve`: keeps up to --depth requests in flight on
+// each of --connections connections and reports throughput and latency
+// percentiles.
+//   ./qr serve --socket /tmp/qr.sock &
+//   ./qr_load --socket /tmp/qr.sock --connections 8 --depth 16
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+  std::string socket_path;
+  int connections = 4;
+  size_t depth = 8;
+  size_t requests = 20000;  // 全接続の合計
+  ServeFormat format = ServeFormat::MATRIX;
+  ErrorCorrectionLevel ecl = M;
+  // 負荷の後でサーバーの metrics を取って表示する (METRICS / METRICS_JSON)
+  bool metrics = false;
+  ServeFormat metrics_format = ServeFormat::METRICS;
+};
+
+void print_usage(const char* program) {
+  std::cerr << "usage: " << program << " --socket PATH [options]\n"
+            << "options:\n"
+            << "  --connections N     concurrent connections (default: 4)\n"
+            << "  --depth N           requests in flight per connection "
+               "(default: 8)\n"
+            << "  --requests N        total requests (default: 20000)\n"
+            << "  --format matrix|pbm|pgm|png|svg (default: matrix)\n"
+            << "  --ecl L|M|Q|H       error correction level (default: M)\n"
+            << "  --metrics prometheus|json  print the server's metrics "
+               "afterwards\n";
+}
+
+LoadOptions parse_options(int argc, char* argv[]) {
+  LoadOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::invalid_argument(arg + " needs a value");
+      }
+      return argv[++i];
+    };
+    if (arg == "--socket") {
+      options.socket_path = value();
+    } else if (arg == "--connections") {
+      options.connections = std::max(std::stoi(value()), 1);
+    } else if (arg == "--depth") {
+      options.depth = std::max<size_t>(std::stoul(value()), 1);
+    } else if (arg == "--requests") {
+      options.requests = std::stoul(value());
+    } else if (arg == "--format") {
+      static const char* NAMES[] = {"matrix", "pbm", "pgm", "png", "svg"};
+      const std::string format = value();
+      auto found = std::find(std::begin(NAMES), std::end(NAMES), format);
+      if (found == std::end(NAMES)) {
+        throw std::invalid_argument("unknown format: " + format);
+      }
+      options.format = static_cast<ServeFormat>(found - std::begin(NAMES));
+    } else if (arg == "--ecl") {
+      static const std::string LEVELS = "LMQH";
+      const std::string level = value();
+      if (level.size() != 1 || LEVELS.find(level[0]) == std::string::npos) {
+        throw std::invalid_argument("unknown error correction level: " +
+                                    level);
+      }
+      options.ecl = static_cast<ErrorCorrectionLevel>(LEVELS.find(level[0]));
+    } else if (arg == "--metrics") {
+      const std::string format = value();
+      if (format != "prometheus" && format != "json") {
+        throw std::invalid_argument("unknown metrics format: " + format);
+      }
+      options.metrics = true;
+      options.metrics_format = format == "json" ? ServeFormat::METRICS_JSON
+                                                : ServeFormat::METRICS;
+    } else {
+      throw std::invalid_argument("unknown option: " + arg);
+    }
+  }
+  if (options.socket_path.empty()) {
+    throw std::invalid_argument("--socket is required");
+  }
+  return options;
+}
+
+// 1接続ぶん。応答は送った順に返るので、id は送信時刻の添字になる
+void run_connection(const LoadOptions& options, int connection, size_t count,
+                    std::vector<double>& latencies, size_t& failed) {
+  EncodeClient client(options.socket_path);
+  std::vector<Clock::time_point> sent_at(count);
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 64; i++) {
+    // 短いラベルと URL が混ざるチケット風の入力
+    payloads.push_back(i % 2 ? "https://example.com/ticket/" +
+                                   std::to_string(connection * 1000 + i)
+                             : "ORDER-" + std::to_string(1000000 + i * 7919));
+  }
+  ServeRequest request;
+  request.encode = {options.ecl, 0, AUTO_MASK, AUTO_MODE};
+  request.format = options.format;
+  std::string frames;
+  ServeResponse response;
+  size_t sent = 0;
+  for (size_t received = 0; received < count; received++) {
+    frames.clear();
+    const Clock::time_point now = Clock::now();
+    for (; sent < count && sent - received < options.depth; sent++) {
+      request.id = static_cast<u_int32_t>(sent);
+      request.payload = payloads[sent % payloads.size()];
+      append_request(request, frames);
+      sent_at[sent] = now;
+    }
+    if (!frames.empty()) {
+      client.send(frames);
+    }
+    if (!client.receive(response)) {
+      throw std::runtime_error("the server closed the connection");
+    }
+    const std::chrono::duration<double, std::micro> latency =
+        Clock::now() - sent_at[response.id];
+    latencies.push_back(latency.count());
+    failed += response.ok ? 0 : 1;
+  }
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1,
+                         static_cast<size_t>(p * sorted.size()))];
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  LoadOptions options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    print_usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<std::vector<double>> latencies(options.connections);
+  std::vector<size_t> failed(options.connections);
+  std::mutex error_mutex;
+  std::string error;
+  std::vector<std::thread> threads;
+  const Clock::time_point start = Clock::now();
+  for (int c = 0; c < options.connections; c++) {
+    const size_t count = options.requests / options.connections +
+                         (static_cast<size_t>(c) <
+                          options.requests % options.connections);
+    threads.emplace_back([&, c, count] {
+      try {
+        run_connection(options, c, count, latencies[c], failed[c]);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        error = e.what();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+  if (!error.empty()) {
+    std::cerr << error << "\n";
+    return 1;
+  }
+
+  std::vector<double> all;
+  size_t failures = 0;
+  for (int c = 0; c < options.connections; c++) {
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    failures += failed[c];
+  }
+  std::sort(all.begin(), all.end());
+  std::printf("%zu requests (%zu failed) in %.3f s: %.0f requests/s\n",
+              all.size(), failures, elapsed.count(),
+              all.size() / elapsed.count());
+  std::printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+              percentile(all, 0.50), percentile(all, 0.90),
+              percentile(all, 0.99), all.empty() ? 0.0 : all.back());
+  if (options.metrics) {
+    try {
+      EncodeClient client(options.socket_path);
+      ServeRequest request;
+      request.format = options.metrics_format;
+      client.send(request);
+      ServeResponse response;
+      if (!client.receive(response) || !response.ok) {
+        throw std::runtime_error("the server sent no metrics");
+      }
+      std::fwrite(response.data.data(), 1, response.data.size(), stdout);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+  }
+  return failures == 0 ? 0 : 3;
+}
@@ -0,0 +1,137 @@
+#ifndef QR_STATIC_H
+#define QR_STATIC_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "bit_buffer.h"
+#include "penalty.h"
+#include "qr.h"
+#include "qr_tables.h"
+#include "reed_solomon.h"
+#include "segment.h"
+#include "symbol_layout.h"
+
+// Compile-time encoding for payloads fixed at build time:
+//
+//   static constexpr auto SUPPORT = qr::make<"https://example.com/s", Q>();
+//
+// The masked symbol ends up as a std::array in read-only data and no encoder
+// code runs at run time. There is no second encoder here: every step is the
+// constexpr function the run-time encoder calls, so the result is bit for bit
+// what encode_symbol() produces with AUTO_MODE and AUTO_MASK.
+namespace qr {
+
+// String literal usable as a template argument.
+template <size_t N>
+struct FixedString {
+  char chars[N] = {};
+
+  constexpr FixedString(const char (&s)[N]) { std::copy_n(s, N, chars); }
+  constexpr std::string_view view() const { return {chars, N - 1}; }
+};
+
+// The smallest version at `correction_level` that holds `s`, or 0 when even
+// version 40 is too small.
+constexpr int select_version(std::string_view s,
+                             ErrorCorrectionLevel correction_level) {
+  std::vector<u_int8_t> work;
+  std::vector<Segment> segments;
+  return find_version_segments(s, correction_level, work, segments);
+}
+
+// A symbol whose version is part of its type. Same bitplane layout as
+// Symbol::modules and QrCode::row().
+template <int Version>
+struct StaticSymbol {
+  static_assert(MIN_VERSION <= Version && Version <= MAX_VERSION);
+  static constexpr int version = Version;
+  static constexpr int size = symbol_size(Version);
+  static constexpr int words_per_row = (size + 63) / 64;
+
+  ErrorCorrectionLevel error_correction_level = L;
+  int mask_pattern = -1;
+  std::array<u_int64_t, static_cast<size_t>(size) * words_per_row> modules{};
+
+  constexpr bool getCell(int x, int y) const {
+    return (modules[static_cast<size_t>(x) * words_per_row + y / 64] >>
+            (y % 64)) &
+           1;
+  }
+  constexpr const u_int64_t* row(int x) const {
+    return modules.data() + static_cast<size_t>(x) * words_per_row;
+  }
+  // Copy into a run-time Symbol (for render_image() and friends).
+  Symbol toSymbol() const {
+    Symbol symbol;
+    symbol.version = version;
+    symbol.error_correction_level = error_correction_level;
+    symbol.mask_pattern = mask_pattern;
+    symbol.size = size;
+    symbol.words_per_row = words_per_row;
+    symbol.modules.assign(modules.begin(), modules.end());
+    return symbol;
+  }
+};
+
+// Encodes `s` into a version `Version` symbol with the lowest-penalty mask.
+// The same steps as encode_symbol(): optimal_segments() and the bit writers
+// (segment.h, qr.h), encode_blocks() (reed_solomon.h), and placement and
+// masking from FIXED_VERSION_TABLES (symbol_layout.h).
+template <int Version>
+constexpr StaticSymbol<Version> encode(std::string_view s,
+                                       ErrorCorrectionLevel correction_level) {
+  const FixedVersionTables<Version>& tables = FIXED_VERSION_TABLES<Version>;
+  const BlockLayout layout = block_layout(Version, correction_level);
+  std::vector<u_int8_t> work;
+  std::vector<Segment> segments;
+  optimal_segments(s, Version, work, segments);
+  BitBuffer bits(layout.dataCodewords() * 8);
+  append_segments(s, segments, Version, bits);
+  append_terminator_and_padding(layout.dataCodewords(), bits);
+  std::vector<u_int8_t> data(layout.dataCodewords());
+  bits.copyBytesTo(data.data());
+  std::vector<u_int8_t> codewords(layout.totalCodewords());
+  encode_blocks(data.data(), layout, codewords.data());
+
+  StaticSymbol<Version> symbol;
+  symbol.error_correction_level = correction_level;
+  symbol.modules = tables.function_template;
+  tables.placeCodewords(codewords.data(), layout.totalCodewords(),
+                        symbol.modules);
+  // QrCode::selectMask() と同じ: 各マスクを掛けて採点し、掛け戻す
+  int best_pattern = 0;
+  int best_penalty = -1;
+  for (int p = 0; p < 8; p++) {
+    tables.applyMask(p, symbol.modules);
+    tables.setFormatCells(correction_level, p, symbol.modules);
+    const int penalty = penalty_score<StaticSymbol<Version>::words_per_row>(
+        symbol.modules.data(), StaticSymbol<Version>::size);
+    if (best_penalty < 0 || penalty < best_penalty) {
+      best_pattern = p;
+      best_penalty = penalty;
+    }
+    tables.applyMask(p, symbol.modules);
+  }
+  tables.applyMask(best_pattern, symbol.modules);
+  tables.setFormatCells(correction_level, best_pattern, symbol.modules);
+  symbol.mask_pattern = best_pattern;
+  return symbol;
+}
+
+// The smallest symbol holding `Payload` at `Ecl`, computed by the compiler.
+template <FixedString Payload, ErrorCorrectionLevel Ecl = M>
+consteval auto make() {
+  constexpr int version = select_version(Payload.view(), Ecl);
+  static_assert(version != 0, "payload does not fit in a version 40 symbol");
+  return encode<version == 0 ? MIN_VERSION : version>(Payload.view(), Ecl);
+}
+
+}  // namespace qr
+
+#endif  // QR_STATIC_H
@@ -0,0 +1,112 @@
+#include "qr_static.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "char_class.h"
+
+namespace {
+// コンパイル時に作られ、読み取り専用データに置かれるシンボル
+constexpr auto FIRMWARE_URL =
+    qr::make<"https://example.com/firmware/v2.1.7?device=QX-2044", Q>();
+constexpr auto DEVICE_CLASS = qr::make<"DEVICE CLASS 0417", H>();
+constexpr auto SERIAL = qr::make<"00012345678901234567890123456789">();
+
+static_assert(DEVICE_CLASS.version == 2);
+static_assert(DEVICE_CLASS.size == 25);
+static_assert(SERIAL.error_correction_level == M);
+static_assert(FIRMWARE_URL.modules.size() ==
+              static_cast<size_t>(FIRMWARE_URL.size) *
+                  FIRMWARE_URL.words_per_row);
+static_assert(qr::select_version("HELLO WORLD", M) == 1);
+static_assert(qr::select_version(std::string_view(), L) == 1);
+
+template <int Version>
+void expect_same_as_runtime(const qr::StaticSymbol<Version>& symbol,
+                            std::string_view payload, int version = 0) {
+  Symbol expected = encode_symbol(
+      payload, EncodeOptions{symbol.error_correction_level, version,
+                             AUTO_MASK, AUTO_MODE});
+  ASSERT_TRUE(expected.ok()) << expected.error;
+  EXPECT_EQ(expected.version, symbol.version) << payload;
+  EXPECT_EQ(expected.mask_pattern, symbol.mask_pattern) << payload;
+  EXPECT_EQ(expected.modules,
+            std::vector<u_int64_t>(symbol.modules.begin(),
+                                   symbol.modules.end()))
+      << payload;
+}
+
+TEST(QrStaticTest, MatchesRuntimeEncoder) {
+  expect_same_as_runtime(
+      FIRMWARE_URL, "https://example.com/firmware/v2.1.7?device=QX-2044");
+  expect_same_as_runtime(DEVICE_CLASS, "DEVICE CLASS 0417");
+  expect_same_as_runtime(SERIAL, "00012345678901234567890123456789");
+
+  Symbol copy = SERIAL.toSymbol();
+  EXPECT_EQ(SERIAL.version, copy.version);
+  EXPECT_EQ(SERIAL.getCell(0, 0), copy.getCell(0, 0));
+  EXPECT_EQ(encode_symbol("00012345678901234567890123456789",
+                          EncodeOptions{M, 0, AUTO_MASK, AUTO_MODE})
+                .toString(),
+            copy.toString());
+}
+
+TEST(QrStaticTest, ConstexprPipelineAtRunTime) {
+  // 同じ constexpr 関数を実行時にも呼べる。版の範囲をまたいで比べる
+  std::mt19937 random(7);
+  const std::string alphabet = "0123456789ABCXYZ $%:/abcxyz!?";
+  EncodeScratch scratch;
+  for (int trial = 0; trial < 60; trial++) {
+    std::string payload;
+    const int length = static_cast<int>(random() % 900);
+    for (int i = 0; i < length; i++) {
+      payload += alphabet[random() % alphabet.size()];
+    }
+    const auto ecl = static_cast<ErrorCorrectionLevel>(trial % 4);
+    const int version = qr::select_version(payload, ecl);
+    Symbol expected = encode_symbol(
+        payload, EncodeOptions{ecl, 0, AUTO_MASK, AUTO_MODE});
+    if (!expected.ok()) {
+      EXPECT_EQ(0, version) << payload;
+      continue;
+    }
+    ASSERT_EQ(expected.version, version) << payload;
+
+    // qr::make がコンパイル時に通る表引きの経路と、実行時のSIMD経路を比べる
+    std::vector<u_int8_t> simd(payload.size());
+    std::vector<u_int8_t> scalar(payload.size());
+    classify_chars(payload, simd.data());
+    classify_chars_scalar(payload, scalar.data());
+    EXPECT_EQ(simd, scalar) << payload;
+
+    const BlockLayout layout = block_layout(version, ecl);
+    std::vector<u_int8_t> data(layout.dataCodewords());
+    build_data_codewords(payload, AUTO_MODE, ecl, version, scratch.bits,
+                         data.data());
+    const int ec = layout.ec_codewords_per_block;
+    int offset = 0;
+    for (int b = 0; b < layout.blockCount(); b++) {
+      const int length =
+          layout.short_block_data + (b < layout.short_blocks ? 0 : 1);
+      u_int8_t expected_ecc[MAX_EC_CODEWORDS_PER_BLOCK];
+      u_int8_t ecc[MAX_EC_CODEWORDS_PER_BLOCK];
+      rs_encode_block(data.data() + offset, length, ec, expected_ecc);
+      rs_encode_block_scalar(data.data() + offset, length, ec, ecc);
+      EXPECT_TRUE(std::equal(ecc, ecc + ec, expected_ecc)) << payload;
+      offset += length;
+    }
+  }
+
+  // 版を固定した場合 (型番情報のある版、最大の版)
+  const std::string digits(1200, '9');
+  expect_same_as_runtime(qr::encode<7>("ABC1234567890abc", L),
+                         "ABC1234567890abc", 7);
+  expect_same_as_runtime(qr::encode<27>(digits, H), digits, 27);
+  expect_same_as_runtime(qr::encode<40>(digits + "abc", M), digits + "abc",
+                         40);
+}
+}  // namespace
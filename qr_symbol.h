@@ -0,0 +1,239 @@
+#ifndef QR_SYMBOL_H
+#define QR_SYMBOL_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <exception>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "bit_buffer.h"
+#include "penalty.h"
+#include "qr.h"
+#include "qr_tables.h"
+#include "reed_solomon.h"
+#include "segment.h"
+#include "symbol_layout.h"
+
+// Encoders specialised for one (version, error correction level) at compile
+// time. Services that only ever emit a few symbol sizes list them in a
+// SymbolDispatcher:
+//
+//   SymbolDispatcher<QrSymbol<2, M>, QrSymbol<5, Q>, QrSymbol<10, M>> encoder;
+//   encoder.encode(payload, options, symbol);
+//
+// Every buffer is a std::array and every loop bound (blocks, codewords,
+// words per plane, words per row) is a constant, so the compiler unrolls and
+// vectorises placement, masking, error correction and penalty scoring. The
+// output is identical to encode_symbol() at the same version.
+
+template <int Version, ErrorCorrectionLevel Ecl>
+class QrSymbol {
+ public:
+  static_assert(MIN_VERSION <= Version && Version <= MAX_VERSION);
+  static_assert(Ecl <= H);
+  static constexpr int VERSION = Version;
+  static constexpr ErrorCorrectionLevel ERROR_CORRECTION_LEVEL = Ecl;
+  static constexpr int SIZE = symbol_size(Version);
+  static constexpr int WORDS_PER_ROW = (SIZE + 63) / 64;
+  static constexpr int WORDS = SIZE * WORDS_PER_ROW;
+  static constexpr BlockLayout LAYOUT = block_layout(Version, Ecl);
+  static constexpr int DATA_CODEWORDS = LAYOUT.dataCodewords();
+  static constexpr int TOTAL_CODEWORDS = LAYOUT.totalCodewords();
+
+  QrSymbol() {
+    bits.reserve(DATA_CODEWORDS * 8);
+    segments.reserve(DATA_CODEWORDS * 8 / 17);
+  }
+
+  // Encodes `payload` (mode_specifier and mask_byte as in EncodeOptions).
+  // Throws std::invalid_argument when it does not fit this version or the
+  // mask is invalid.
+  void encode(std::string_view payload,
+              ModeSpecifier mode_specifier = AUTO_MODE,
+              int mask_byte = AUTO_MASK) {
+    check_mask_byte(mask_byte);
+    buildDataCodewords(payload, mode_specifier);
+    encodeBlocks();
+    placeCodewords();
+    if (mask_byte == AUTO_MASK) {
+      selectMask();
+    } else {
+      mask_pattern = (mask_byte ^ 0b101) & 0b111;
+      applyMask(mask_pattern);
+      setFormatCells(mask_pattern);
+    }
+  }
+
+  static constexpr int getVersion() { return Version; }
+  static constexpr int getSize() { return SIZE; }
+  static constexpr int wordsPerRow() { return WORDS_PER_ROW; }
+  int getMaskPattern() const { return mask_pattern; }
+  const u_int64_t* row(int x) const {
+    return matrix.data() + static_cast<size_t>(x) * WORDS_PER_ROW;
+  }
+  bool getCell(int x, int y) const { return (row(x)[y / 64] >> (y % 64)) & 1; }
+
+  // Copies the symbol into `out`, keeping a version 40 capacity.
+  void copyTo(Symbol& out) const {
+    out.version = Version;
+    out.error_correction_level = Ecl;
+    out.mask_pattern = mask_pattern;
+    out.size = SIZE;
+    out.words_per_row = WORDS_PER_ROW;
+    out.modules.reserve(MAX_SYMBOL_WORDS);
+    out.modules.assign(matrix.begin(), matrix.end());
+    out.error.clear();
+  }
+
+ private:
+  static constexpr const FixedVersionTables<Version>& tables() {
+    return FIXED_VERSION_TABLES<Version>;
+  }
+
+  void buildDataCodewords(std::string_view payload,
+                          ModeSpecifier mode_specifier) {
+    bits.clear();
+    if (mode_specifier == AUTO_MODE) {
+      optimal_segments(payload, Version, segment_work, segments);
+      append_segments(payload, segments, Version, bits);
+    } else {
+      append_mode_header(mode_specifier,
+                         static_cast<u_int32_t>(payload.size()), Version, bits);
+      append_data_bits(payload, mode_specifier, bits);
+    }
+    append_terminator_and_padding(DATA_CODEWORDS, bits);
+    bits.copyBytesTo(data.data());
+  }
+
+  // encode_blocks() with the layout as constants
+  void encodeBlocks() {
+    constexpr int blocks = LAYOUT.blockCount();
+    constexpr int ec = LAYOUT.ec_codewords_per_block;
+    constexpr int short_data = LAYOUT.short_block_data;
+    u_int8_t ecc[ec];
+    int offset = 0;
+    for (int b = 0; b < blocks; b++) {
+      const u_int8_t* block = data.data() + offset;
+      for (int i = 0; i < short_data; i++) {
+        codewords[i * blocks + b] = block[i];
+      }
+      if (b < LAYOUT.short_blocks) {
+        rs_encode_block_fixed<ec, short_data>(block, ecc);
+        offset += short_data;
+      } else {
+        codewords[short_data * blocks + (b - LAYOUT.short_blocks)] =
+            block[short_data];
+        rs_encode_block_fixed<ec, short_data + 1>(block, ecc);
+        offset += short_data + 1;
+      }
+      for (int i = 0; i < ec; i++) {
+        codewords[DATA_CODEWORDS + i * blocks + b] = ecc[i];
+      }
+    }
+  }
+
+  void placeCodewords() {
+    matrix = tables().function_template;
+    tables().placeCodewords(codewords.data(), TOTAL_CODEWORDS, matrix);
+  }
+
+  void applyMask(int pattern) { tables().applyMask(pattern, matrix); }
+
+  void setFormatCells(int pattern) {
+    tables().setFormatCells(Ecl, pattern, matrix);
+  }
+
+  // QrCode::selectMask() の固定長版
+  void selectMask() {
+    int best_pattern = 0;
+    int best_penalty = -1;
+    for (int p = 0; p < 8; p++) {
+      applyMask(p);
+      setFormatCells(p);
+      const int penalty = penalty_score<WORDS_PER_ROW>(matrix.data(), SIZE);
+      if (best_penalty < 0 || penalty < best_penalty) {
+        best_pattern = p;
+        best_penalty = penalty;
+      }
+      applyMask(p);
+    }
+    mask_pattern = best_pattern;
+    applyMask(best_pattern);
+    setFormatCells(best_pattern);
+  }
+
+  BitBuffer bits;
+  std::vector<Segment> segments;
+  std::vector<u_int8_t> segment_work;
+  std::array<u_int8_t, DATA_CODEWORDS> data;
+  std::array<u_int8_t, TOTAL_CODEWORDS> codewords;
+  std::array<u_int64_t, WORDS> matrix{};
+  int mask_pattern = -1;
+};
+
+// Maps (version, error correction level) at run time onto the matching
+// QrSymbol among `Symbols`; every other combination, and every Structured
+// Append part, goes to encode_symbol().
+template <typename... Symbols>
+class SymbolDispatcher {
+ public:
+  static constexpr bool supports(int version, ErrorCorrectionLevel ecl) {
+    return ((Symbols::VERSION == version &&
+             Symbols::ERROR_CORRECTION_LEVEL == ecl) ||
+            ...);
+  }
+
+  // Same contract as encode_symbol(): errors are reported through out.error.
+  void encode(std::string_view payload, const EncodeOptions& options,
+              Symbol& out) {
+    // QrSymbol は Structured Append の見出しを書かないので、版の選択ごと
+    // encode_symbol() に任せる
+    if (options.structured_append.total != 0) {
+      encode_symbol(payload, options, fallback, out);
+      return;
+    }
+    out.error.clear();
+    try {
+      const auto ecl = options.error_correction_level;
+      int version = options.version;
+      if (version <= 0) {
+        version = options.mode_specifier == AUTO_MODE
+                      ? select_version_segments(payload, ecl,
+                                                fallback.segment_work,
+                                                fallback.segments)
+                      : select_version(payload, options.mode_specifier, ecl);
+      }
+      const bool specialised =
+          (encodeWith<Symbols>(version, payload, options, out) || ...);
+      if (!specialised) {
+        EncodeOptions fixed = options;
+        fixed.version = version;
+        encode_symbol(payload, fixed, fallback, out);
+      }
+    } catch (const std::exception& e) {
+      out.setError(e.what(), reject_reason(e));
+    }
+  }
+
+ private:
+  template <typename S>
+  bool encodeWith(int version, std::string_view payload,
+                  const EncodeOptions& options, Symbol& out) {
+    if (S::VERSION != version ||
+        S::ERROR_CORRECTION_LEVEL != options.error_correction_level) {
+      return false;
+    }
+    S& symbol = std::get<S>(symbols);
+    symbol.encode(payload, options.mode_specifier, options.mask_byte);
+    symbol.copyTo(out);
+    return true;
+  }
+
+  std::tuple<Symbols...> symbols;
+  EncodeScratch fallback;
+};
+
+#endif  // QR_SYMBOL_H
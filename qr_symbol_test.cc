@@ -0,0 +1,132 @@
+#include "qr_symbol.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+namespace {
+std::string random_payload(std::mt19937& random, int max_length) {
+  const std::string alphabet = "0123456789ABCXYZ $%:/abcxyz!?";
+  std::string payload;
+  const int length = static_cast<int>(random() % (max_length + 1));
+  for (int i = 0; i < length; i++) {
+    payload += alphabet[random() % alphabet.size()];
+  }
+  return payload;
+}
+
+void expect_same_symbol(const Symbol& expected, const Symbol& actual) {
+  EXPECT_EQ(expected.error, actual.error);
+  EXPECT_EQ(expected.version, actual.version);
+  EXPECT_EQ(expected.error_correction_level, actual.error_correction_level);
+  EXPECT_EQ(expected.mask_pattern, actual.mask_pattern);
+  EXPECT_EQ(expected.modules, actual.modules);
+}
+
+template <int Version, ErrorCorrectionLevel Ecl>
+void expect_matches_encode_symbol(std::mt19937& random) {
+  static_assert(QrSymbol<Version, Ecl>::SIZE == symbol_size(Version));
+  auto symbol = std::make_unique<QrSymbol<Version, Ecl>>();
+  Symbol actual;
+  const int max_length = data_codewords(Version, Ecl) * 2;
+  const EncodeOptions modes[] = {
+      {Ecl, Version, AUTO_MASK, AUTO_MODE},
+      {Ecl, Version, 0b101 ^ 6, AUTO_MODE},
+      {Ecl, Version, AUTO_MASK, BYTE_MODE},
+  };
+  for (int trial = 0; trial < 8; trial++) {
+    const std::string payload = random_payload(random, max_length);
+    for (const EncodeOptions& options : modes) {
+      Symbol expected = encode_symbol(payload, options);
+      if (!expected.ok()) {
+        EXPECT_THROW(symbol->encode(payload, options.mode_specifier,
+                                    options.mask_byte),
+                     std::invalid_argument);
+        continue;
+      }
+      symbol->encode(payload, options.mode_specifier, options.mask_byte);
+      symbol->copyTo(actual);
+      expect_same_symbol(expected, actual);
+      EXPECT_EQ(expected.getCell(8, 8), symbol->getCell(8, 8));
+    }
+  }
+}
+
+TEST(QrSymbolTest, MatchesEncodeSymbol) {
+  std::mt19937 random(5);
+  // 1ブロック, 長短ブロック混在, 型番情報あり, 3語の行
+  expect_matches_encode_symbol<1, L>(random);
+  expect_matches_encode_symbol<2, H>(random);
+  expect_matches_encode_symbol<5, Q>(random);
+  expect_matches_encode_symbol<7, M>(random);
+  expect_matches_encode_symbol<14, L>(random);
+  expect_matches_encode_symbol<27, H>(random);
+  expect_matches_encode_symbol<40, M>(random);
+}
+
+TEST(QrSymbolTest, DispatcherFallsBackOutsideItsList) {
+  using Dispatcher =
+      SymbolDispatcher<QrSymbol<1, M>, QrSymbol<2, M>, QrSymbol<10, Q>>;
+  static_assert(Dispatcher::supports(2, M));
+  static_assert(!Dispatcher::supports(2, Q));
+  static_assert(!Dispatcher::supports(3, M));
+
+  auto dispatcher = std::make_unique<Dispatcher>();
+  std::mt19937 random(9);
+  Symbol actual;
+  for (int trial = 0; trial < 60; trial++) {
+    const auto ecl = trial % 2 ? M : Q;
+    const std::string payload = random_payload(random, trial * 5);
+    const EncodeOptions options{ecl, 0, AUTO_MASK, AUTO_MODE};
+    dispatcher->encode(payload, options, actual);
+    expect_same_symbol(encode_symbol(payload, options), actual);
+  }
+
+  const EncodeOptions fixed{Q, 10, 0b101 ^ 1, ALNUM_MODE};
+  dispatcher->encode("DISPATCHED TO VERSION 10", fixed, actual);
+  expect_same_symbol(encode_symbol("DISPATCHED TO VERSION 10", fixed), actual);
+
+  dispatcher->encode("lower case", EncodeOptions{M, 1, AUTO_MASK, ALNUM_MODE},
+                     actual);
+  EXPECT_FALSE(actual.ok());
+  EXPECT_EQ(0, actual.version);
+  dispatcher->encode(std::string(3000, 'a'), EncodeOptions{M}, actual);
+  EXPECT_FALSE(actual.ok());
+
+  // 範囲外のマスクは特殊化した版でも下位3ビットに丸めず拒否する
+  dispatcher->encode("HELLO", EncodeOptions{M, 2, 9, ALNUM_MODE}, actual);
+  EXPECT_FALSE(actual.ok());
+  EXPECT_EQ(REJECT_OPTION, actual.reject_reason);
+}
+
+TEST(QrSymbolTest, DispatcherKeepsStructuredAppend) {
+  SymbolDispatcher<QrSymbol<1, M>, QrSymbol<2, M>> dispatcher;
+  Symbol actual;
+  EncodeOptions options{M, 2, AUTO_MASK, AUTO_MODE};
+  options.structured_append = {1, 3, 0x5A};
+  dispatcher.encode("HELLO", options, actual);
+  ASSERT_TRUE(actual.ok()) << actual.error;
+  expect_same_symbol(encode_symbol("HELLO", options), actual);
+  const DecodeResult decoded = decode_symbol(actual);
+  ASSERT_TRUE(decoded.ok()) << decoded.error;
+  EXPECT_EQ(1, decoded.structured_append.index);
+  EXPECT_EQ(3, decoded.structured_append.total);
+  EXPECT_EQ(0x5A, decoded.structured_append.parity);
+  EXPECT_EQ("HELLO", decoded.text);
+
+  // 版1に14バイトは入るが、見出しの20ビットを足すと版2が要る
+  options.version = 0;
+  options.structured_append = {0, 2, 1};
+  const std::string payload = "abcdefghijklmn";
+  dispatcher.encode(payload, options, actual);
+  ASSERT_TRUE(actual.ok()) << actual.error;
+  EXPECT_EQ(2, actual.version);
+  expect_same_symbol(encode_symbol(payload, options), actual);
+  EXPECT_EQ(2, decode_symbol(actual).structured_append.total);
+}
+}  // namespace
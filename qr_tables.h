@@ -0,0 +1,194 @@
+#ifndef QR_TABLES_H
+#define QR_TABLES_H
+
+#include <sys/types.h>
+
+#include "reed_solomon.h"
+
+// Per-version constants from ISO/IEC 18004. Every table is indexed by
+// [error correction level][version] or [version]; index 0 is unused.
+
+constexpr int MIN_VERSION = 1;
+constexpr int MAX_VERSION = 40;
+
+constexpr int symbol_size(int version) { return version * 4 + 17; }
+// 1行を64ビット語で表したときの最大語数 (バージョン40: 177モジュール)
+constexpr int MAX_WORDS_PER_ROW = (symbol_size(MAX_VERSION) + 63) / 64;
+
+// 1ブロックあたりの誤り訂正コードワード数 [L, M, Q, H][version]
+constexpr int8_t ECC_CODEWORDS_PER_BLOCK[4][MAX_VERSION + 1] = {
+    // L
+    {-1, 7,  10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26,
+     30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    // M
+    {-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22,
+     24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28,
+     28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},
+    // Q
+    {-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24,
+     20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    // H
+    {-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22,
+     24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+};
+
+// 誤り訂正ブロック数 [L, M, Q, H][version]
+constexpr int8_t NUM_ERROR_CORRECTION_BLOCKS[4][MAX_VERSION + 1] = {
+    // L
+    {-1, 1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,
+     4,  6,  6,  6,  6,  7,  8,  8,  9,  9,  10, 12, 12, 12,
+     13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},
+    // M
+    {-1, 1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,
+     9,  10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25,
+     26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},
+    // Q
+    {-1, 1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8,  10, 12,
+     16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34,
+     35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},
+    // H
+    {-1, 1,  1,  2,  4,  4,  4,  5,  6,  8,  8,  11, 11, 16,
+     16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40,
+     42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},
+};
+
+// 位置合わせパターンの中心座標 (行・列共通, 0終端)
+constexpr u_int8_t ALIGNMENT_PATTERN_POSITIONS[MAX_VERSION + 1][8] = {
+    {},
+    {},
+    {6, 18},
+    {6, 22},
+    {6, 26},
+    {6, 30},
+    {6, 34},
+    {6, 22, 38},
+    {6, 24, 42},
+    {6, 26, 46},
+    {6, 28, 50},
+    {6, 30, 54},
+    {6, 32, 58},
+    {6, 34, 62},
+    {6, 26, 46, 66},
+    {6, 26, 48, 70},
+    {6, 26, 50, 74},
+    {6, 30, 54, 78},
+    {6, 30, 56, 82},
+    {6, 30, 58, 86},
+    {6, 34, 62, 90},
+    {6, 28, 50, 72, 94},
+    {6, 26, 50, 74, 98},
+    {6, 30, 54, 78, 102},
+    {6, 28, 54, 80, 106},
+    {6, 32, 58, 84, 110},
+    {6, 30, 58, 86, 114},
+    {6, 34, 62, 90, 118},
+    {6, 26, 50, 74, 98, 122},
+    {6, 30, 54, 78, 102, 126},
+    {6, 26, 52, 78, 104, 130},
+    {6, 30, 56, 82, 108, 134},
+    {6, 34, 60, 86, 112, 138},
+    {6, 30, 58, 86, 114, 142},
+    {6, 34, 62, 90, 118, 146},
+    {6, 30, 54, 78, 102, 126, 150},
+    {6, 24, 50, 76, 102, 128, 154},
+    {6, 28, 54, 80, 106, 132, 158},
+    {6, 32, 58, 84, 110, 136, 162},
+    {6, 26, 54, 82, 110, 138, 166},
+    {6, 30, 58, 86, 114, 142, 170},
+};
+
+constexpr int alignment_pattern_count(int version) {
+  int n = 0;
+  while (n < 8 && ALIGNMENT_PATTERN_POSITIONS[version][n] != 0) {
+    n++;
+  }
+  return n;
+}
+
+// 型番情報: 6ビットの型番 + BCH(18,6)。バージョン7以上のみ
+constexpr u_int32_t VERSION_INFORMATION_BITS[MAX_VERSION + 1] = {
+    0x00000, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000, 0x00000, 0x07C94,
+    0x085BC, 0x09A99, 0x0A4D3, 0x0BBF6, 0x0C762, 0x0D847, 0x0E60D, 0x0F928,
+    0x10B78, 0x1145D, 0x12A17, 0x13532, 0x149A6, 0x15683, 0x168C9, 0x177EC,
+    0x18EC4, 0x191E1, 0x1AFAB, 0x1B08E, 0x1CC1A, 0x1D33F, 0x1ED75, 0x1F250,
+    0x209D5, 0x216F0, 0x228BA, 0x2379F, 0x24B0B, 0x2542E, 0x26A64, 0x27541,
+    0x28C69,
+};
+
+// 形式情報: 誤り訂正レベル(2) + マスクパターン参照子(3) + BCH(15,5),
+// 0x5412でXOR済み [L, M, Q, H][mask pattern]
+constexpr u_int16_t FORMAT_INFORMATION_BITS[4][8] = {
+    {0x77C4, 0x72F3, 0x7DAA, 0x789D, 0x662F, 0x6318, 0x6C41, 0x6976},  // L
+    {0x5412, 0x5125, 0x5E7C, 0x5B4B, 0x45F9, 0x40CE, 0x4F97, 0x4AA0},  // M
+    {0x355F, 0x3068, 0x3F31, 0x3A06, 0x24B4, 0x2183, 0x2EDA, 0x2BED},  // Q
+    {0x1689, 0x13BE, 0x1CE7, 0x19D0, 0x0762, 0x0255, 0x0D0C, 0x083B},  // H
+};
+
+// 文字数指示子のビット数 [mode][1-9, 10-26, 27-40]
+// mode index: 数字, 英数字, 8ビットバイト, 漢字
+constexpr u_int8_t CHAR_COUNT_BITS[4][3] = {
+    {10, 12, 14},
+    {9, 11, 13},
+    {8, 16, 16},
+    {8, 10, 12},
+};
+
+constexpr int version_range_index(int version) {
+  return version <= 9 ? 0 : (version <= 26 ? 1 : 2);
+}
+
+// `mode_specifier` is the 4-bit mode indicator (NUMBER_MODE ... KANJI_MODE)
+constexpr int char_count_bits(int mode_specifier, int version) {
+  int mode_index = mode_specifier == 0b0001   ? 0
+                   : mode_specifier == 0b0010 ? 1
+                   : mode_specifier == 0b0100 ? 2
+                                              : 3;
+  return CHAR_COUNT_BITS[mode_index][version_range_index(version)];
+}
+
+// 機能パターンを除いたデータ+誤り訂正モジュール数 (剰余ビットを含む)
+constexpr int raw_data_modules(int version) {
+  int result = (16 * version + 128) * version + 64;
+  if (version >= 2) {
+    int n = version / 7 + 2;
+    result -= (25 * n - 10) * n - 55;
+    if (version >= 7) {
+      result -= 36;
+    }
+  }
+  return result;
+}
+
+constexpr int total_codewords(int version) {
+  return raw_data_modules(version) / 8;
+}
+
+constexpr int ec_codewords(int version, int ecl) {
+  return ECC_CODEWORDS_PER_BLOCK[ecl][version] *
+         NUM_ERROR_CORRECTION_BLOCKS[ecl][version];
+}
+
+constexpr int data_codewords(int version, int ecl) {
+  return total_codewords(version) - ec_codewords(version, ecl);
+}
+
+// バージョン40の値。1シンボル分の作業領域をこの固定長で確保すれば、
+// どのバージョンでも再確保が起きない
+constexpr int MAX_TOTAL_CODEWORDS = total_codewords(MAX_VERSION);
+constexpr int MAX_SYMBOL_WORDS = symbol_size(MAX_VERSION) * MAX_WORDS_PER_ROW;
+// 最も詰め込める数字モードで40-Lに入る文字数
+constexpr int MAX_INPUT_CHARS = 7089;
+
+constexpr BlockLayout block_layout(int version, int ecl) {
+  int blocks = NUM_ERROR_CORRECTION_BLOCKS[ecl][version];
+  int ec = ECC_CODEWORDS_PER_BLOCK[ecl][version];
+  int total = total_codewords(version);
+  int long_blocks = total % blocks;
+  int short_block_data = total / blocks - ec;
+  return BlockLayout{ec, blocks - long_blocks, short_block_data, long_blocks};
+}
+
+#endif  // QR_TABLES_H
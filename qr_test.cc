@@ -2,7 +2,30 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <bitset>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Every heap allocation in this test binary goes through here, so a test can
+// check that a code path does not allocate.
+static std::atomic<size_t> heap_allocations{0};
+
+void* operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
 
 namespace {
 TEST(QrTest, BitManipulation) {
@@ -73,4 +96,345 @@ TEST(QrTest, BitManipulation) {
   EXPECT_EQ(expected_codewords,
             convert_string_into_codewords("ABCDE123", ALNUM_MODE, H));
 }
-}  // namespace
\ No newline at end of file
+
+TEST(QrTest, BitBuffer) {
+  BitBuffer buffer;
+  buffer.append(0b0010, 4);
+  buffer.append(8, 9);
+  EXPECT_EQ(13u, buffer.size());
+  EXPECT_EQ(0b00100000, buffer.byteAt(0));
+  EXPECT_EQ(0b01000000, buffer.byteAt(1));
+
+  // crossing a 64-bit word boundary
+  BitBuffer wide;
+  wide.append(0, 30);
+  wide.append(0, 30);
+  wide.append(0b10110011, 8);
+  EXPECT_EQ(68u, wide.size());
+  EXPECT_EQ(0b00001011, wide.byteAt(7));
+  EXPECT_EQ(0b00110000, wide.byteAt(8));
+  EXPECT_TRUE(wide[60]);
+  EXPECT_FALSE(wide[61]);
+  wide.appendWide(0xF00000000000000Full, 64);
+  EXPECT_EQ(132u, wide.size());
+  EXPECT_EQ(0b00111111, wide.byteAt(8));
+  EXPECT_FALSE(wide[72]);
+  EXPECT_FALSE(wide[127]);
+  EXPECT_TRUE(wide[128]);
+  EXPECT_TRUE(wide[131]);
+
+  // odd-length alphanumeric input ends with a 6-bit group
+  BitBuffer alnum;
+  append_alnum_bits("AC-42", alnum);
+  EXPECT_EQ(11u * 2 + 6, alnum.size());
+  BitBuffer expected;
+  expected.append(10 * 45 + 12, 11);
+  expected.append(41 * 45 + 4, 11);
+  expected.append(2, 6);
+  EXPECT_EQ(expected.toBytes(), alnum.toBytes());
+
+  EXPECT_THROW(append_alnum_bits("ab", alnum), std::invalid_argument);
+}
+
+TEST(QrTest, ModuleBitplane) {
+  QrCode qr;
+  ASSERT_EQ(21, qr.getSize());
+  ASSERT_EQ(1, qr.wordsPerRow());
+  // finder pattern in the upper-left corner: top row is dark, separator light
+  EXPECT_EQ(0b1111111u, qr.row(0)[0] & 0xFF);
+  EXPECT_TRUE(qr.isFunctionModule(7, 7));
+  EXPECT_FALSE(qr.getCell(7, 7));
+  // horizontal timing pattern alternates starting with dark at column 8
+  for (int y = 8; y < 13; y++) {
+    EXPECT_EQ(y % 2 == 0, qr.getCell(6, y));
+    EXPECT_TRUE(qr.isFunctionModule(6, y));
+  }
+  // dark module
+  EXPECT_TRUE(qr.getCell(13, 8));
+  // the data region is not reserved
+  EXPECT_FALSE(qr.isFunctionModule(20, 20));
+  // no stray bits beyond the symbol width
+  for (int x = 0; x < qr.getSize(); x++) {
+    EXPECT_EQ(0u, qr.row(x)[0] >> 21);
+    EXPECT_EQ(0u, qr.functionRow(x)[0] >> 21);
+  }
+
+  qr.setCell(20, 20);
+  EXPECT_TRUE(qr.getCell(20, 20));
+  EXPECT_EQ(u_int64_t{1} << 20, qr.row(20)[0] & (u_int64_t{1} << 20));
+  qr.setCell(20, 20, false);
+  EXPECT_FALSE(qr.getCell(20, 20));
+}
+
+TEST(QrTest, VersionTables) {
+  EXPECT_EQ(19, data_codewords(1, L));
+  EXPECT_EQ(9, data_codewords(1, H));
+  EXPECT_EQ(216, data_codewords(10, M));
+  EXPECT_EQ(2956, data_codewords(40, L));
+  EXPECT_EQ(1276, data_codewords(40, H));
+  EXPECT_EQ(3706, total_codewords(40));
+
+  BlockLayout layout = block_layout(5, Q);
+  EXPECT_EQ(18, layout.ec_codewords_per_block);
+  EXPECT_EQ(2, layout.short_blocks);
+  EXPECT_EQ(15, layout.short_block_data);
+  EXPECT_EQ(2, layout.long_blocks);
+  for (int version = MIN_VERSION; version <= MAX_VERSION; version++) {
+    for (int ecl : {L, M, Q, H}) {
+      EXPECT_EQ(total_codewords(version),
+                block_layout(version, ecl).totalCodewords());
+    }
+  }
+
+  EXPECT_EQ(9, char_count_bits(ALNUM_MODE, 9));
+  EXPECT_EQ(11, char_count_bits(ALNUM_MODE, 10));
+  EXPECT_EQ(16, char_count_bits(BYTE_MODE, 27));
+  EXPECT_EQ(3, alignment_pattern_count(7));
+  EXPECT_EQ(0x07C94u, VERSION_INFORMATION_BITS[7]);
+
+  // version 1-L holds 25 alphanumeric characters
+  EXPECT_EQ(1, select_version(std::string(25, 'A'), ALNUM_MODE, L));
+  EXPECT_EQ(2, select_version(std::string(26, 'A'), ALNUM_MODE, L));
+  EXPECT_EQ(40, select_version(std::string(4296, 'A'), ALNUM_MODE, L));
+  EXPECT_THROW(select_version(std::string(4297, 'A'), ALNUM_MODE, L),
+               std::invalid_argument);
+}
+
+TEST(QrTest, LargerVersions) {
+  EXPECT_THROW(QrCode(0), std::invalid_argument);
+  EXPECT_THROW(QrCode(41), std::invalid_argument);
+
+  QrCode qr(7, 0b101 ^ 3, ALNUM_MODE, M);
+  EXPECT_EQ(45, qr.getSize());
+  // alignment pattern centred at (22, 22), none over the finder patterns
+  EXPECT_TRUE(qr.getCell(22, 22));
+  EXPECT_FALSE(qr.getCell(21, 22));
+  EXPECT_TRUE(qr.getCell(20, 22));
+  EXPECT_TRUE(qr.isFunctionModule(38, 38));
+  // version information, upper-right block, read back LSB first
+  u_int32_t version_bits = 0;
+  for (int i = 17; i >= 0; i--) {
+    version_bits = version_bits << 1 | qr.getCell(i / 3, 45 - 11 + i % 3);
+  }
+  EXPECT_EQ(VERSION_INFORMATION_BITS[7], version_bits);
+  // format information next to the upper-left finder, bits 0..5 down column 8
+  u_int32_t format_bits = 0;
+  for (int i = 5; i >= 0; i--) {
+    format_bits = format_bits << 1 | qr.getCell(i, 8);
+  }
+  EXPECT_EQ(FORMAT_INFORMATION_BITS[M][3] & 0x3Fu, format_bits);
+
+  std::string payload(100, 'Z');
+  qr.createQrCode(payload);
+  EXPECT_THROW(qr.createQrCode(std::string(200, 'Z')), std::invalid_argument);
+}
+
+TEST(QrTest, PenaltyScore) {
+  // all light 21x21: 21 + 21 runs of 21 (19 each), 20 * 20 2x2 blocks and
+  // a dark ratio of 0%
+  std::vector<u_int64_t> light(21, 0);
+  EXPECT_EQ(42 * 19 + 400 * 3 + 100, penalty_score(light.data(), 21, 1));
+
+
+  // cross-checked against an independent per-module implementation
+  QrCode qr(1, AUTO_MASK, ALNUM_MODE, M);
+  qr.createQrCode("HELLO WORLD 123");
+  EXPECT_EQ(2, qr.getMaskSelection().pattern);
+  EXPECT_EQ(1054, qr.getMaskSelection().penalty);
+}
+
+TEST(QrTest, MaskSelection) {
+  const std::string payload = "HELLO WORLD 0123456789";
+  for (int version : {2, 10}) {
+    QrCode automatic(version, AUTO_MASK, ALNUM_MODE, Q);
+    automatic.createQrCode(payload);
+    MaskSelection selection = automatic.getMaskSelection();
+    ASSERT_GE(selection.pattern, 0);
+    EXPECT_EQ(selection.pattern, automatic.getMaskPattern());
+    EXPECT_EQ(selection.penalty, automatic.getPenaltyScore());
+
+    for (int pattern = 0; pattern < 8; pattern++) {
+      QrCode fixed(version, pattern ^ 0b101, ALNUM_MODE, Q);
+      fixed.createQrCode(payload);
+      EXPECT_LE(selection.penalty, fixed.getPenaltyScore());
+      if (pattern == selection.pattern) {
+        EXPECT_EQ(automatic.toString(), fixed.toString());
+      }
+    }
+  }
+
+  // the mask planes agree with the per-module definition
+  QrCode masked(2, 0b101 ^ 6, ALNUM_MODE, L);
+  QrCode plain(2, 0b101 ^ 6, ALNUM_MODE, L);
+  masked.applyMask();
+  for (int x = 0; x < masked.getSize(); x++) {
+    for (int y = 0; y < masked.getSize(); y++) {
+      bool expected = plain.isFunctionModule(x, y)
+                          ? plain.getCell(x, y)
+                          : plain.computeByMask(x, y, plain.getCell(x, y));
+      EXPECT_EQ(expected, masked.getCell(x, y)) << x << ' ' << y;
+    }
+  }
+
+  // out-of-range mask references are rejected, not reduced to 3 bits
+  for (int mask_byte : {8, 9, 255, -2}) {
+    EXPECT_THROW(QrCode(1, mask_byte, ALNUM_MODE, L), std::invalid_argument)
+        << mask_byte;
+    EXPECT_THROW(masked.setMaskByte(mask_byte), std::invalid_argument)
+        << mask_byte;
+    Symbol symbol = encode_symbol("HELLO", {L, 0, mask_byte, ALNUM_MODE});
+    EXPECT_FALSE(symbol.ok()) << mask_byte;
+    EXPECT_EQ("This mask is invalid (" + std::to_string(mask_byte) + ")",
+              symbol.error);
+  }
+  EXPECT_EQ(0b101 ^ 6, masked.getMaskByte());
+  EXPECT_TRUE(encode_symbol("HELLO", {L, 0, 7, ALNUM_MODE}).ok());
+}
+
+TEST(QrTest, FunctionPatternTemplate) {
+  for (int version : {1, 2, 7, 21, 40}) {
+    QrCode cached(version, 0b101 ^ 3, ALNUM_MODE, M);
+    QrCode drawn(version, 0b101 ^ 3, ALNUM_MODE, M, false);
+    drawn.drawFunctionPatterns();
+    drawn.setFormatCells();
+    for (int x = 0; x < cached.getSize(); x++) {
+      for (int i = 0; i < cached.wordsPerRow(); i++) {
+        EXPECT_EQ(drawn.row(x)[i], cached.row(x)[i]) << version << ' ' << x;
+        EXPECT_EQ(drawn.functionRow(x)[i], cached.functionRow(x)[i])
+            << version << ' ' << x;
+      }
+    }
+  }
+
+  // symbols of the same version do not share state through the template
+  QrCode first(3);
+  first.createQrCode("FIRST");
+  QrCode second(3);
+  second.createQrCode("SECOND");
+  QrCode again(3);
+  again.createQrCode("FIRST");
+  EXPECT_EQ(first.toString(), again.toString());
+  EXPECT_NE(first.toString(), second.toString());
+}
+
+TEST(QrTest, PlacementOrder) {
+  for (int version : {1, 7, 40}) {
+    QrCode qr(version, 0b101, ALNUM_MODE, L);
+    const auto& order = placement_order(version);
+    ASSERT_EQ(static_cast<size_t>(raw_data_modules(version)), order.size());
+    const int stride = qr.wordsPerRow() * 64;
+    std::vector<bool> seen(static_cast<size_t>(qr.getSize()) * stride);
+    for (u_int32_t position : order) {
+      int x = position / stride;
+      int y = position % stride;
+      ASSERT_LT(y, qr.getSize());
+      EXPECT_FALSE(qr.isFunctionModule(x, y));
+      EXPECT_FALSE(seen[position]);
+      seen[position] = true;
+    }
+  }
+
+  // version 1 starts upward in the rightmost column pair
+  const auto& order = placement_order(1);
+  const u_int32_t expected[] = {20 * 64 + 20, 20 * 64 + 19, 19 * 64 + 20,
+                                19 * 64 + 19};
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(expected[i], order[i]);
+  }
+
+  // placing again clears the previous data
+  QrCode qr(1, 0b101, ALNUM_MODE, L);
+  qr.placeCodewords(std::vector<u_int8_t>(26, 0xFF));
+  qr.placeCodewords(std::vector<u_int8_t>{0x80});
+  EXPECT_TRUE(qr.getCell(20, 20));
+  EXPECT_FALSE(qr.getCell(20, 19));
+  EXPECT_FALSE(qr.getCell(0, 9));
+  EXPECT_THROW(qr.placeCodewords(std::vector<u_int8_t>(27, 0)),
+               std::invalid_argument);
+}
+
+TEST(QrTest, ResetReusesObject) {
+  QrCode reused(5, AUTO_MASK, ALNUM_MODE, L);
+  reused.createQrCode("FIRST");
+  for (int version : {1, 40, 7}) {
+    for (int ecl : {L, H}) {
+      reused.reset(version, ecl);
+      reused.createQrCode("HELLO");
+      QrCode fresh(version, AUTO_MASK, ALNUM_MODE, ecl);
+      fresh.createQrCode("HELLO");
+      EXPECT_EQ(fresh.getSize(), reused.getSize());
+      EXPECT_EQ(fresh.getMaskPattern(), reused.getMaskPattern());
+      EXPECT_EQ(fresh.toString(), reused.toString()) << version << ' ' << ecl;
+    }
+  }
+
+  reused.setMaskByte(0b101 ^ 4);
+  reused.reset(2, M);
+  reused.createQrCode("FIXED");
+  QrCode fixed(2, 0b101 ^ 4, ALNUM_MODE, M);
+  fixed.createQrCode("FIXED");
+  EXPECT_EQ(4, reused.getMaskPattern());
+  EXPECT_EQ(fixed.toString(), reused.toString());
+
+  EXPECT_THROW(reused.reset(41, L), std::invalid_argument);
+  EXPECT_THROW(reused.reset(0, L), std::invalid_argument);
+}
+
+TEST(QrTest, EncodeWithoutAllocation) {
+  // 版・モード・誤り訂正レベルが入り混じる入力。最大容量ちょうどのものも含む
+  const std::string payloads[] = {
+      "HELLO WORLD",
+      "0123456789",
+      "https://example.com/device/1234?serial=ABCDEF",
+      std::string(500, 'Q') + "0123456789012345678901234567890",
+      std::string(MAX_INPUT_CHARS, '7'),
+      std::string(1000, 'a'),
+      "A",
+  };
+  const EncodeOptions options[] = {
+      {L, 0, AUTO_MASK, AUTO_MODE},
+      {H, 0, AUTO_MASK, AUTO_MODE},
+      {M, 0, 0b101 ^ 2, AUTO_MODE},
+      {Q, 0, AUTO_MASK, BYTE_MODE},
+      {M, 25, AUTO_MASK, AUTO_MODE},
+  };
+  EncodeScratch scratch;
+  Symbol symbol;
+  // 収まらない組み合わせは例外経由でエラー文字列を作るので計測から除く
+  std::vector<std::pair<const EncodeOptions*, const std::string*>> fitting;
+  for (const EncodeOptions& option : options) {
+    for (const std::string& payload : payloads) {
+      encode_symbol(payload, option, scratch, symbol);
+      if (symbol.ok()) {
+        fitting.emplace_back(&option, &payload);
+      }
+    }
+  }
+  ASSERT_GT(fitting.size(), 20u);
+  // 1周目で Symbol の領域を確保したあとは、どの入力でも確保しない
+  const size_t before = heap_allocations.load();
+  for (int round = 0; round < 2; round++) {
+    for (const auto& [option, payload] : fitting) {
+      encode_symbol(*payload, *option, scratch, symbol);
+      EXPECT_TRUE(symbol.ok());
+    }
+  }
+  EXPECT_EQ(before, heap_allocations.load());
+
+  EXPECT_EQ(40, select_version(payloads[4], NUMBER_MODE, L));
+  EXPECT_THROW(select_version(payloads[4] + "7", NUMBER_MODE, L),
+               std::invalid_argument);
+
+  // 使い回した結果は新しく作った Symbol と同じ
+  for (const EncodeOptions& option : options) {
+    for (const std::string& payload : payloads) {
+      encode_symbol(payload, option, scratch, symbol);
+      Symbol fresh = encode_symbol(payload, option);
+      EXPECT_EQ(fresh.error, symbol.error);
+      EXPECT_EQ(fresh.version, symbol.version);
+      EXPECT_EQ(fresh.mask_pattern, symbol.mask_pattern);
+      EXPECT_EQ(fresh.modules, symbol.modules);
+    }
+  }
+}
+}  // namespace
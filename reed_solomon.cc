@@ -0,0 +1,304 @@
+#include "reed_solomon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define QR_X86_SIMD 1
+#endif
+
+#ifdef QR_X86_SIMD
+namespace {
+__attribute__((target("ssse3"))) void gf_mul_add_region_ssse3(
+    u_int8_t* dst, const u_int8_t* src, u_int8_t c, size_t n) {
+  const __m128i lo =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(GF_NIBBLE.lo[c]));
+  const __m128i hi =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(GF_NIBBLE.hi[c]));
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i product = _mm_xor_si128(
+        _mm_shuffle_epi8(lo, _mm_and_si128(s, nibble)),
+        _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), nibble)));
+    __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+    _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), product));
+  }
+  gf_mul_add_region_scalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2"))) void gf_mul_add_region_avx2(
+    u_int8_t* dst, const u_int8_t* src, u_int8_t c, size_t n) {
+  // VPSHUFB looks up within each 128-bit lane, so both lanes get the table.
+  const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(GF_NIBBLE.lo[c])));
+  const __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(GF_NIBBLE.hi[c])));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i product = _mm256_xor_si256(
+        _mm256_shuffle_epi8(lo, _mm256_and_si256(s, nibble)),
+        _mm256_shuffle_epi8(hi,
+                            _mm256_and_si256(_mm256_srli_epi64(s, 4), nibble)));
+    __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+    _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), product));
+  }
+  // 16バイトの端数もここで(VEX符号化のまま)処理する。SSSE3版へ渡すと
+  // 上位レーンが汚れたままレガシーSSE命令を実行し、遷移ペナルティで
+  // RSブロック1つあたり数十倍遅くなる
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i product = _mm_xor_si128(
+        _mm_shuffle_epi8(_mm256_castsi256_si128(lo),
+                         _mm_and_si128(s, _mm256_castsi256_si128(nibble))),
+        _mm_shuffle_epi8(_mm256_castsi256_si128(hi),
+                         _mm_and_si128(_mm_srli_epi64(s, 4),
+                                       _mm256_castsi256_si128(nibble))));
+    __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+    _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), product));
+  }
+  _mm256_zeroupper();
+  gf_mul_add_region_scalar(dst + i, src + i, c, n - i);
+}
+}  // namespace
+#endif
+
+namespace {
+using GfMulAddRegion = void (*)(u_int8_t*, const u_int8_t*, u_int8_t, size_t);
+
+struct GfKernel {
+  GfMulAddRegion function;
+  const char* name;
+};
+
+GfKernel select_gf_kernel() {
+#ifdef QR_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {gf_mul_add_region_avx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return {gf_mul_add_region_ssse3, "ssse3"};
+  }
+#endif
+  return {gf_mul_add_region_scalar, "scalar"};
+}
+
+const GfKernel& gf_kernel() {
+  static const GfKernel kernel = select_gf_kernel();
+  return kernel;
+}
+}  // namespace
+
+void gf_mul_add_region(u_int8_t* dst, const u_int8_t* src, u_int8_t c,
+                       size_t n) {
+  gf_kernel().function(dst, src, c, n);
+}
+
+const char* gf_kernel_name() { return gf_kernel().name; }
+
+void rs_encode_block(const u_int8_t* data, size_t n, int ec_length,
+                     u_int8_t* ecc) {
+  if (ec_length < 0 || ec_length > MAX_EC_CODEWORDS_PER_BLOCK ||
+      n + ec_length > 255) {
+    throw std::invalid_argument("Invalid Reed-Solomon block (" +
+                                std::to_string(n) + " data, " +
+                                std::to_string(ec_length) + " ec codewords)");
+  }
+  // 多項式の割り算をその場で行う。各ステップで先頭の係数を消し、
+  // 後続の(0埋めした)生成多項式幅ぶんに c * g(x) を足し込む。
+  const RsGenerator& generator = RS_GENERATORS[ec_length];
+  const size_t width = ec_length <= 16 ? 16 : RS_GENERATOR_STRIDE;
+  u_int8_t work[255 + RS_GENERATOR_STRIDE + 1] = {};
+  std::memcpy(work, data, n);
+  const GfMulAddRegion mul_add = gf_kernel().function;
+  for (size_t i = 0; i < n; i++) {
+    u_int8_t factor = work[i];
+    if (factor != 0) {
+      mul_add(work + i + 1, generator.data(), factor, width);
+    }
+  }
+  std::memcpy(ecc, work + n, ec_length);
+}
+
+namespace {
+u_int8_t gf_div(u_int8_t a, u_int8_t b) {
+  return a == 0 ? 0 : GF.exp[GF.log[a] + 255 - GF.log[b]];
+}
+
+// p(x) = p[0] + p[1] x + ... + p[length - 1] x^(length - 1) の x での値
+u_int8_t poly_eval(const u_int8_t* p, int length, u_int8_t x) {
+  u_int8_t y = 0;
+  for (int i = length; i-- > 0;) {
+    y = gf_mul(y, x) ^ p[i];
+  }
+  return y;
+}
+
+// S_j = r(a^j) (j < ec_length)。受信語 r(x) は block[0] が最高次。
+// すべて0 (誤りなし) なら true
+bool compute_syndromes(const u_int8_t* block, size_t n, int ec_length,
+                       u_int8_t* syndromes) {
+  u_int8_t any = 0;
+  for (int j = 0; j < ec_length; j++) {
+    const u_int8_t root = GF.exp[j];
+    u_int8_t s = 0;
+    for (size_t i = 0; i < n; i++) {
+      s = gf_mul(s, root) ^ block[i];
+    }
+    syndromes[j] = s;
+    any |= s;
+  }
+  return any == 0;
+}
+
+// 位置 i の誤り位置 X = a^(n-1-i)
+u_int8_t error_locator(size_t n, size_t i) { return GF.exp[n - 1 - i]; }
+}  // namespace
+
+int rs_decode_block(u_int8_t* block, size_t n, int ec_length,
+                    const int* erasures, size_t erasure_count) {
+  if (ec_length <= 0 || ec_length > MAX_EC_CODEWORDS_PER_BLOCK ||
+      n < static_cast<size_t>(ec_length) || n > 255) {
+    throw std::invalid_argument("Invalid Reed-Solomon block (" +
+                                std::to_string(n) + " codewords, " +
+                                std::to_string(ec_length) + " ec codewords)");
+  }
+  // 誤りがなければ r(x) は g(x) で割り切れる。ほとんどのブロックはこれで
+  // 終わるので、符号化と同じ SIMD の割り算で剰余だけを調べる
+  if (n + ec_length <= 255) {
+    u_int8_t remainder[MAX_EC_CODEWORDS_PER_BLOCK];
+    rs_encode_block(block, n, ec_length, remainder);
+    if (std::all_of(remainder, remainder + ec_length,
+                    [](u_int8_t c) { return c == 0; })) {
+      return 0;
+    }
+  }
+  u_int8_t syndromes[MAX_EC_CODEWORDS_PER_BLOCK];
+  if (compute_syndromes(block, n, ec_length, syndromes)) {
+    return 0;
+  }
+  if (erasure_count > static_cast<size_t>(ec_length)) {
+    return -1;
+  }
+
+  // 誤り位置多項式 Λ(x) = Π(1 + X_k x) (係数は低次から)。消失の位置で
+  // 初期化した Berlekamp-Massey 法で残りの誤りの位置を加える
+  u_int8_t lambda[MAX_EC_CODEWORDS_PER_BLOCK + 1] = {1};
+  int degree = 0;
+  for (size_t k = 0; k < erasure_count; k++) {
+    if (erasures[k] < 0 || static_cast<size_t>(erasures[k]) >= n) {
+      throw std::invalid_argument("Erasure position out of range (" +
+                                  std::to_string(erasures[k]) + ")");
+    }
+    const u_int8_t x = error_locator(n, erasures[k]);
+    for (int i = ++degree; i > 0; i--) {
+      lambda[i] ^= gf_mul(lambda[i - 1], x);
+    }
+  }
+  const int e = static_cast<int>(erasure_count);
+  u_int8_t previous[MAX_EC_CODEWORDS_PER_BLOCK + 1];
+  std::copy(lambda, lambda + ec_length + 1, previous);
+  u_int8_t previous_discrepancy = 1;
+  int shift = 1;
+  for (int r = e; r < ec_length; r++) {
+    u_int8_t discrepancy = syndromes[r];
+    for (int i = 1; i <= degree; i++) {
+      discrepancy ^= gf_mul(lambda[i], syndromes[r - i]);
+    }
+    if (discrepancy == 0) {
+      shift++;
+      continue;
+    }
+    const u_int8_t scale = gf_div(discrepancy, previous_discrepancy);
+    u_int8_t saved[MAX_EC_CODEWORDS_PER_BLOCK + 1];
+    std::copy(lambda, lambda + ec_length + 1, saved);
+    for (int i = 0; i + shift <= ec_length; i++) {
+      lambda[i + shift] ^= gf_mul(scale, previous[i]);
+    }
+    if (2 * degree <= r + e) {
+      degree = r + 1 + e - degree;
+      std::copy(saved, saved + ec_length + 1, previous);
+      previous_discrepancy = discrepancy;
+      shift = 1;
+    } else {
+      shift++;
+    }
+  }
+  if (2 * degree - e > ec_length) {
+    return -1;
+  }
+
+  // Chien 探索: Λ(X^-1) = 0 となる位置が誤り (消失を含む)
+  int positions[MAX_EC_CODEWORDS_PER_BLOCK];
+  int found = 0;
+  for (size_t i = 0; i < n && found <= degree; i++) {
+    const u_int8_t inverse = GF.exp[255 - GF.log[error_locator(n, i)]];
+    if (poly_eval(lambda, degree + 1, inverse) == 0) {
+      if (found == degree) {
+        return -1;
+      }
+      positions[found++] = static_cast<int>(i);
+    }
+  }
+  if (found != degree) {
+    return -1;
+  }
+
+  // Forney: Ω(x) = S(x) Λ(x) mod x^ec_length, 値 = X Ω(X^-1) / Λ'(X^-1)
+  u_int8_t omega[MAX_EC_CODEWORDS_PER_BLOCK] = {};
+  for (int k = 0; k < ec_length; k++) {
+    for (int i = 0; i <= std::min(k, degree); i++) {
+      omega[k] ^= gf_mul(lambda[i], syndromes[k - i]);
+    }
+  }
+  // 標数2なので形式微分は奇数次の項だけが残る
+  u_int8_t derivative[MAX_EC_CODEWORDS_PER_BLOCK] = {};
+  for (int i = 1; i <= degree; i += 2) {
+    derivative[i - 1] = lambda[i];
+  }
+  u_int8_t magnitudes[MAX_EC_CODEWORDS_PER_BLOCK];
+  for (int k = 0; k < found; k++) {
+    const u_int8_t x = error_locator(n, positions[k]);
+    const u_int8_t inverse = GF.exp[255 - GF.log[x]];
+    const u_int8_t denominator = poly_eval(derivative, degree, inverse);
+    if (denominator == 0) {
+      return -1;
+    }
+    magnitudes[k] = gf_div(gf_mul(x, poly_eval(omega, ec_length, inverse)),
+                           denominator);
+  }
+
+  int corrected = 0;
+  for (int k = 0; k < found; k++) {
+    block[positions[k]] ^= magnitudes[k];
+    corrected += magnitudes[k] != 0;
+  }
+  // 訂正能力を超えた誤りは別の符号語へ誤訂正され得るので確かめる
+  if (!compute_syndromes(block, n, ec_length, syndromes)) {
+    for (int k = 0; k < found; k++) {
+      block[positions[k]] ^= magnitudes[k];
+    }
+    return -1;
+  }
+  return corrected;
+}
+
+std::vector<u_int8_t> add_error_correction(const std::vector<u_int8_t>& data,
+                                           const BlockLayout& layout) {
+  if (static_cast<int>(data.size()) != layout.dataCodewords()) {
+    throw std::invalid_argument(
+        "Expected " + std::to_string(layout.dataCodewords()) +
+        " data codewords but got " + std::to_string(data.size()));
+  }
+  std::vector<u_int8_t> result(layout.totalCodewords());
+  encode_blocks(data.data(), layout, result.data());
+  return result;
+}
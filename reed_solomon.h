@@ -0,0 +1,250 @@
+#ifndef REED_SOLOMON_H
+#define REED_SOLOMON_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// GF(256) with primitive polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D).
+constexpr int GF_PRIMITIVE_POLYNOMIAL = 0x11D;
+// 1ブロックあたりの誤り訂正コードワード数の最大値 (仕様上は30)
+constexpr int MAX_EC_CODEWORDS_PER_BLOCK = 30;
+// 生成多項式の係数は16バイト単位に0で埋めて保持する
+constexpr int RS_GENERATOR_STRIDE = 32;
+
+struct GaloisField {
+  // exp is doubled so exp[log a + log b] needs no modulo
+  u_int8_t exp[512];
+  u_int8_t log[256];
+};
+
+constexpr GaloisField make_galois_field() {
+  GaloisField field{};
+  int x = 1;
+  for (int i = 0; i < 255; i++) {
+    field.exp[i] = static_cast<u_int8_t>(x);
+    field.log[x] = static_cast<u_int8_t>(i);
+    x <<= 1;
+    if (x & 0x100) {
+      x ^= GF_PRIMITIVE_POLYNOMIAL;
+    }
+  }
+  for (int i = 255; i < 512; i++) {
+    field.exp[i] = field.exp[i - 255];
+  }
+  return field;
+}
+
+inline constexpr GaloisField GF = make_galois_field();
+
+constexpr u_int8_t gf_mul(u_int8_t a, u_int8_t b) {
+  return (a == 0 || b == 0) ? 0 : GF.exp[GF.log[a] + GF.log[b]];
+}
+
+// Split-nibble product tables: c * v == lo[c][v & 15] ^ hi[c][v >> 4].
+// One 16-byte row per multiplier, which is exactly a PSHUFB lookup table.
+struct GfNibbleTables {
+  alignas(16) u_int8_t lo[256][16];
+  alignas(16) u_int8_t hi[256][16];
+};
+
+constexpr GfNibbleTables make_gf_nibble_tables() {
+  GfNibbleTables tables{};
+  for (int c = 0; c < 256; c++) {
+    for (int v = 0; v < 16; v++) {
+      tables.lo[c][v] =
+          gf_mul(static_cast<u_int8_t>(c), static_cast<u_int8_t>(v));
+      tables.hi[c][v] =
+          gf_mul(static_cast<u_int8_t>(c), static_cast<u_int8_t>(v << 4));
+    }
+  }
+  return tables;
+}
+
+inline constexpr GfNibbleTables GF_NIBBLE = make_gf_nibble_tables();
+
+// Generator polynomial g(x) = (x - a^0)(x - a^1)...(x - a^(degree-1)) without
+// its leading 1: coefficients of x^(degree-1) ... x^0, zero padded.
+using RsGenerator = std::array<u_int8_t, RS_GENERATOR_STRIDE>;
+
+constexpr RsGenerator make_rs_generator(int degree) {
+  RsGenerator result{};
+  if (degree == 0) {
+    return result;
+  }
+  result[degree - 1] = 1;
+  u_int8_t root = 1;
+  for (int i = 0; i < degree; i++) {
+    for (int j = 0; j < degree; j++) {
+      result[j] = gf_mul(result[j], root);
+      if (j + 1 < degree) {
+        result[j] ^= result[j + 1];
+      }
+    }
+    root = gf_mul(root, 0x02);
+  }
+  return result;
+}
+
+constexpr std::array<RsGenerator, MAX_EC_CODEWORDS_PER_BLOCK + 1>
+make_rs_generators() {
+  std::array<RsGenerator, MAX_EC_CODEWORDS_PER_BLOCK + 1> result{};
+  for (int degree = 0; degree <= MAX_EC_CODEWORDS_PER_BLOCK; degree++) {
+    result[degree] = make_rs_generator(degree);
+  }
+  return result;
+}
+
+// 仕様で使われる誤り訂正コードワード数(7〜30)すべての生成多項式
+inline constexpr std::array<RsGenerator, MAX_EC_CODEWORDS_PER_BLOCK + 1>
+    RS_GENERATORS = make_rs_generators();
+
+// dst[i] ^= c * src[i] for i < n. Dispatches once to the widest kernel the CPU
+// supports (AVX2, SSSE3, or scalar).
+void gf_mul_add_region(u_int8_t* dst, const u_int8_t* src, u_int8_t c,
+                       size_t n);
+constexpr void gf_mul_add_region_scalar(u_int8_t* dst, const u_int8_t* src,
+                                        u_int8_t c, size_t n) {
+  const u_int8_t* lo = GF_NIBBLE.lo[c];
+  const u_int8_t* hi = GF_NIBBLE.hi[c];
+  for (size_t i = 0; i < n; i++) {
+    dst[i] ^= lo[src[i] & 0x0F] ^ hi[src[i] >> 4];
+  }
+}
+// "avx2", "ssse3" or "scalar"
+const char* gf_kernel_name();
+
+// Writes the `ec_length` Reed-Solomon remainder codewords of `data` into
+// `ecc`. Requires n + ec_length <= 255 and ec_length <= 30.
+void rs_encode_block(const u_int8_t* data, size_t n, int ec_length,
+                     u_int8_t* ecc);
+// Same with the scalar kernel, for constant expressions. Does not check its
+// arguments.
+constexpr void rs_encode_block_scalar(const u_int8_t* data, size_t n,
+                                      int ec_length, u_int8_t* ecc) {
+  const RsGenerator& generator = RS_GENERATORS[ec_length];
+  u_int8_t work[255 + MAX_EC_CODEWORDS_PER_BLOCK] = {};
+  for (size_t i = 0; i < n; i++) {
+    work[i] = data[i];
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (work[i] != 0) {
+      gf_mul_add_region_scalar(work + i + 1, generator.data(), work[i],
+                               static_cast<size_t>(ec_length));
+    }
+  }
+  for (int i = 0; i < ec_length; i++) {
+    ecc[i] = work[n + i];
+  }
+}
+
+// Corrects a received block in place. `block` holds n codewords laid out as
+// rs_encode_block() writes them: the data followed by its ec_length remainder
+// codewords. `erasures` lists distinct positions (0 to n-1) known to be
+// unreliable. t errors and e erasures are corrected while 2t + e <= ec_length.
+// Returns the number of codewords changed, or -1 (block left as received)
+// when the block is beyond repair.
+int rs_decode_block(u_int8_t* block, size_t n, int ec_length,
+                    const int* erasures = nullptr, size_t erasure_count = 0);
+
+// c * g(x) for every multiplier c, g being the generator of degree EcLength:
+// one EcLength-byte row per c. With it a division step is a fixed-width XOR.
+template <int EcLength>
+struct RsProductTable {
+  u_int8_t rows[256][EcLength];
+};
+
+template <int EcLength>
+constexpr RsProductTable<EcLength> make_rs_product_table() {
+  RsProductTable<EcLength> table{};
+  for (int c = 0; c < 256; c++) {
+    for (int j = 0; j < EcLength; j++) {
+      table.rows[c][j] = gf_mul(static_cast<u_int8_t>(c),
+                                RS_GENERATORS[EcLength][j]);
+    }
+  }
+  return table;
+}
+
+template <int EcLength>
+inline constexpr RsProductTable<EcLength> RS_PRODUCTS =
+    make_rs_product_table<EcLength>();
+
+// rs_encode_block() for a length known at compile time: the remainder stays
+// in registers and every step is a constant-length shift and XOR.
+template <int EcLength, int DataLength>
+void rs_encode_block_fixed(const u_int8_t* data, u_int8_t* ecc) {
+  static_assert(0 < EcLength && EcLength <= MAX_EC_CODEWORDS_PER_BLOCK);
+  static_assert(DataLength + EcLength <= 255);
+  u_int8_t remainder[EcLength] = {};
+  for (int i = 0; i < DataLength; i++) {
+    const u_int8_t* row = RS_PRODUCTS<EcLength>.rows[data[i] ^ remainder[0]];
+    for (int j = 0; j + 1 < EcLength; j++) {
+      remainder[j] = remainder[j + 1] ^ row[j];
+    }
+    remainder[EcLength - 1] = row[EcLength - 1];
+  }
+  for (int j = 0; j < EcLength; j++) {
+    ecc[j] = remainder[j];
+  }
+}
+
+// Block structure of one symbol: `short_blocks` blocks of `short_block_data`
+// data codewords followed by `long_blocks` blocks with one more, each with
+// `ec_codewords_per_block` error correction codewords.
+struct BlockLayout {
+  int ec_codewords_per_block;
+  int short_blocks;
+  int short_block_data;
+  int long_blocks;
+
+  constexpr int blockCount() const { return short_blocks + long_blocks; }
+  constexpr int dataCodewords() const {
+    return short_blocks * short_block_data +
+           long_blocks * (short_block_data + 1);
+  }
+  constexpr int totalCodewords() const {
+    return dataCodewords() + blockCount() * ec_codewords_per_block;
+  }
+};
+
+// Splits `data` (layout.dataCodewords() bytes) into blocks, computes each
+// block's ECC and writes the interleaved final sequence
+// (layout.totalCodewords() bytes) to `out`. Usable in constant expressions,
+// where the remainders come from rs_encode_block_scalar().
+constexpr void encode_blocks(const u_int8_t* data, const BlockLayout& layout,
+                             u_int8_t* out) {
+  const int blocks = layout.blockCount();
+  const int ec = layout.ec_codewords_per_block;
+  const int data_total = layout.dataCodewords();
+  u_int8_t ecc[MAX_EC_CODEWORDS_PER_BLOCK];
+  int offset = 0;
+  for (int b = 0; b < blocks; b++) {
+    int length = layout.short_block_data + (b < layout.short_blocks ? 0 : 1);
+    // データ部のインターリーブ: i番目のコードワードはブロック順に並ぶ
+    for (int i = 0; i < layout.short_block_data; i++) {
+      out[i * blocks + b] = data[offset + i];
+    }
+    if (length > layout.short_block_data) {
+      // 長いブロックの最後の1つは短いブロックの分が尽きた後に並ぶ
+      out[layout.short_block_data * blocks + (b - layout.short_blocks)] =
+          data[offset + layout.short_block_data];
+    }
+    if (std::is_constant_evaluated()) {
+      rs_encode_block_scalar(data + offset, length, ec, ecc);
+    } else {
+      rs_encode_block(data + offset, length, ec, ecc);
+    }
+    for (int i = 0; i < ec; i++) {
+      out[data_total + i * blocks + b] = ecc[i];
+    }
+    offset += length;
+  }
+}
+std::vector<u_int8_t> add_error_correction(const std::vector<u_int8_t>& data,
+                                           const BlockLayout& layout);
+
+#endif  // REED_SOLOMON_H
@@ -0,0 +1,160 @@
+#include "reed_solomon.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+TEST(ReedSolomonTest, GaloisField) {
+  EXPECT_EQ(1, GF.exp[0]);
+  EXPECT_EQ(0x1D, GF.exp[8]);  // x^8 = x^4 + x^3 + x^2 + 1
+  for (int a = 1; a < 256; a++) {
+    EXPECT_EQ(a, GF.exp[GF.log[a]]);
+    EXPECT_EQ(1, gf_mul(a, GF.exp[255 - GF.log[a]]));
+  }
+  EXPECT_EQ(0, gf_mul(0, 0x53));
+}
+
+TEST(ReedSolomonTest, GeneratorPolynomial) {
+  // g(x) for 7 EC codewords: a^0 x^7 + a^87 x^6 + a^229 x^5 + a^146 x^4 +
+  // a^149 x^3 + a^238 x^2 + a^102 x + a^21
+  const int exponents[] = {87, 229, 146, 149, 238, 102, 21};
+  for (int i = 0; i < 7; i++) {
+    EXPECT_EQ(GF.exp[exponents[i]], RS_GENERATORS[7][i]);
+  }
+  for (int i = 7; i < RS_GENERATOR_STRIDE; i++) {
+    EXPECT_EQ(0, RS_GENERATORS[7][i]);
+  }
+}
+
+TEST(ReedSolomonTest, MulAddKernelMatchesScalar) {
+  std::mt19937 rng(42);
+  std::vector<u_int8_t> src(100), dst(100);
+  for (auto& v : src) v = rng();
+  for (auto& v : dst) v = rng();
+  for (int c : {0, 1, 2, 0x53, 0xFF}) {
+    for (size_t n : {0, 1, 15, 16, 31, 32, 33, 100}) {
+      auto expected = dst;
+      auto actual = dst;
+      for (size_t i = 0; i < n; i++) {
+        expected[i] ^= gf_mul(c, src[i]);
+      }
+      gf_mul_add_region(actual.data(), src.data(), c, n);
+      EXPECT_EQ(expected, actual) << gf_kernel_name() << " c=" << c
+                                  << " n=" << n;
+    }
+  }
+}
+
+TEST(ReedSolomonTest, EncodeBlock) {
+  // "HELLO WORLD" 1-M
+  std::vector<u_int8_t> data = {32,  91, 11, 120, 209, 114, 220, 77,
+                                67,  64, 236, 17, 236, 17,  236, 17};
+  std::vector<u_int8_t> expected = {196, 35, 39, 119, 235,
+                                    215, 231, 226, 93, 23};
+  std::vector<u_int8_t> ecc(10);
+  rs_encode_block(data.data(), data.size(), 10, ecc.data());
+  EXPECT_EQ(expected, ecc);
+
+  EXPECT_THROW(rs_encode_block(data.data(), data.size(), 31, ecc.data()),
+               std::invalid_argument);
+}
+
+template <int EcLength, int DataLength>
+void expect_fixed_matches(std::mt19937& random) {
+  u_int8_t data[DataLength];
+  for (u_int8_t& byte : data) {
+    byte = static_cast<u_int8_t>(random());
+  }
+  u_int8_t expected[EcLength];
+  u_int8_t actual[EcLength];
+  rs_encode_block(data, DataLength, EcLength, expected);
+  rs_encode_block_fixed<EcLength, DataLength>(data, actual);
+  for (int i = 0; i < EcLength; i++) {
+    EXPECT_EQ(expected[i], actual[i]) << EcLength << ' ' << DataLength;
+  }
+}
+
+TEST(ReedSolomonTest, FixedLengthEncodeBlock) {
+  std::mt19937 random(11);
+  for (int trial = 0; trial < 20; trial++) {
+    expect_fixed_matches<7, 19>(random);
+    expect_fixed_matches<10, 16>(random);
+    expect_fixed_matches<17, 9>(random);
+    expect_fixed_matches<28, 1>(random);
+    expect_fixed_matches<30, 118>(random);
+    expect_fixed_matches<30, 225>(random);
+  }
+  EXPECT_EQ(gf_mul(0x53, RS_GENERATORS[10][3]), RS_PRODUCTS<10>.rows[0x53][3]);
+}
+
+TEST(ReedSolomonTest, DecodeBlock) {
+  std::mt19937 random(5);
+  for (int trial = 0; trial < 200; trial++) {
+    const int ec = 7 + static_cast<int>(random() % 24);
+    const size_t n = ec + 1 + random() % 120;
+    std::vector<u_int8_t> codeword(n);
+    for (size_t i = 0; i < n - ec; i++) {
+      codeword[i] = static_cast<u_int8_t>(random());
+    }
+    rs_encode_block(codeword.data(), n - ec, ec, codeword.data() + n - ec);
+
+    // 2t + e <= ec の範囲で誤りと消失を混ぜる
+    const int erasure_count = static_cast<int>(random() % (ec + 1));
+    const int error_count =
+        static_cast<int>(random() % ((ec - erasure_count) / 2 + 1));
+    std::vector<int> positions(n);
+    for (size_t i = 0; i < n; i++) {
+      positions[i] = static_cast<int>(i);
+    }
+    std::shuffle(positions.begin(), positions.end(), random);
+    auto received = codeword;
+    int changed = 0;
+    for (int k = 0; k < erasure_count + error_count; k++) {
+      const auto value = static_cast<u_int8_t>(random());
+      changed += value != received[positions[k]];
+      received[positions[k]] = value;
+    }
+    EXPECT_EQ(changed, rs_decode_block(received.data(), n, ec,
+                                       positions.data(), erasure_count))
+        << "ec=" << ec << " n=" << n << " erasures=" << erasure_count
+        << " errors=" << error_count;
+    EXPECT_EQ(codeword, received);
+  }
+
+  // 訂正能力を超えた誤りは -1 を返し、受信語を変えない
+  std::vector<u_int8_t> block(26);
+  rs_encode_block(block.data(), 16, 10, block.data() + 16);
+  for (int i = 0; i < 6; i++) {
+    block[i * 4] ^= 0x5A;
+  }
+  const auto received = block;
+  EXPECT_EQ(-1, rs_decode_block(block.data(), block.size(), 10));
+  EXPECT_EQ(received, block);
+  EXPECT_THROW(rs_decode_block(block.data(), 5, 10), std::invalid_argument);
+}
+
+TEST(ReedSolomonTest, Interleave) {
+  // two short blocks of 2 and one long block of 3, 2 EC codewords each
+  BlockLayout layout{2, 2, 2, 1};
+  ASSERT_EQ(7, layout.dataCodewords());
+  ASSERT_EQ(13, layout.totalCodewords());
+  std::vector<u_int8_t> data = {1, 2, 3, 4, 5, 6, 7};
+  auto result = add_error_correction(data, layout);
+  std::vector<u_int8_t> interleaved_data = {1, 3, 5, 2, 4, 6, 7};
+  EXPECT_EQ(interleaved_data,
+            std::vector<u_int8_t>(result.begin(), result.begin() + 7));
+  u_int8_t ecc[3][2];
+  rs_encode_block(&data[0], 2, 2, ecc[0]);
+  rs_encode_block(&data[2], 2, 2, ecc[1]);
+  rs_encode_block(&data[4], 3, 2, ecc[2]);
+  std::vector<u_int8_t> interleaved_ecc = {ecc[0][0], ecc[1][0], ecc[2][0],
+                                           ecc[0][1], ecc[1][1], ecc[2][1]};
+  EXPECT_EQ(interleaved_ecc,
+            std::vector<u_int8_t>(result.begin() + 7, result.end()));
+
+  EXPECT_THROW(add_error_correction({1, 2}, layout), std::invalid_argument);
+}
+}  // namespace
@@ -0,0 +1,247 @@
+#include "render.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define QR_X86_SIMD 1
+#endif
+
+namespace {
+using ExpandBits = void (*)(const u_int64_t*, int, u_int8_t, u_int8_t,
+                            u_int8_t*);
+using PackPixels = void (*)(const u_int8_t*, int, u_int8_t*);
+
+// 1モジュール1バイトに展開する。16バイト単位で書くので末尾は最大15バイト
+// はみ出す。
+void expand_bits_scalar(const u_int64_t* row, int count, u_int8_t dark,
+                        u_int8_t light, u_int8_t* out) {
+  for (int y = 0; y < count; y++) {
+    out[y] = ((row[y / 64] >> (y % 64)) & 1) ? dark : light;
+  }
+}
+
+void pack_pixels_scalar(const u_int8_t* pixels, int width, u_int8_t* out) {
+  for (int i = 0; i < width; i += 8) {
+    u_int8_t byte = 0;
+    for (int j = 0; j < 8 && i + j < width; j++) {
+      byte |= (pixels[i + j] >> 7) << (7 - j);
+    }
+    out[i / 8] = byte;
+  }
+}
+
+#ifdef QR_X86_SIMD
+__attribute__((target("ssse3"))) void expand_bits_ssse3(
+    const u_int64_t* row, int count, u_int8_t dark, u_int8_t light,
+    u_int8_t* out) {
+  // 16ビットを各バイトへ配り、そのバイトが受け持つビットを取り出して比較する
+  const __m128i spread =
+      _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+  const __m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+                                    16, 32, 64, -128);
+  const __m128i dark_bytes = _mm_set1_epi8(static_cast<char>(dark));
+  const __m128i light_bytes = _mm_set1_epi8(static_cast<char>(light));
+  for (int y = 0; y < count; y += 16) {
+    int bits = static_cast<int>((row[y / 64] >> (y % 64)) & 0xFFFF);
+    __m128i v = _mm_shuffle_epi8(_mm_cvtsi32_si128(bits), spread);
+    __m128i set = _mm_cmpeq_epi8(_mm_and_si128(v, bit), bit);
+    __m128i pixels = _mm_or_si128(_mm_and_si128(set, dark_bytes),
+                                  _mm_andnot_si128(set, light_bytes));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + y), pixels);
+  }
+}
+
+__attribute__((target("ssse3"))) void pack_pixels_ssse3(
+    const u_int8_t* pixels, int width, u_int8_t* out) {
+  // PMOVMSKBはバイト0を最下位ビットに置くので、8バイトごとに順序を反転する
+  const __m128i reverse =
+      _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+    int mask = _mm_movemask_epi8(_mm_shuffle_epi8(v, reverse));
+    out[i / 8] = static_cast<u_int8_t>(mask);
+    out[i / 8 + 1] = static_cast<u_int8_t>(mask >> 8);
+  }
+  pack_pixels_scalar(pixels + i, width - i, out + i / 8);
+}
+#endif
+
+struct RenderKernel {
+  ExpandBits expand;
+  PackPixels pack;
+  const char* name;
+};
+
+RenderKernel select_render_kernel() {
+#ifdef QR_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return {expand_bits_ssse3, pack_pixels_ssse3, "sse2/ssse3"};
+  }
+#endif
+  return {expand_bits_scalar, pack_pixels_scalar, "scalar"};
+}
+
+const RenderKernel& render_kernel() {
+  static const RenderKernel kernel = select_render_kernel();
+  return kernel;
+}
+
+
+void append_repeated(std::string& out, const u_int8_t* row, size_t length,
+                     int times) {
+  for (int i = 0; i < times; i++) {
+    out.append(reinterpret_cast<const char*>(row), length);
+  }
+}
+
+void append_be32(std::string& out, u_int32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((value >> shift) & 0xFF));
+  }
+}
+
+void append_png_chunk(std::string& out, const char type[4],
+                      const std::string& data) {
+  append_be32(out, static_cast<u_int32_t>(data.size()));
+  const size_t start = out.size();
+  out.append(type, 4);
+  out += data;
+  append_be32(out, crc32_update(0,
+                                reinterpret_cast<const u_int8_t*>(out.data()) +
+                                    start,
+                                out.size() - start));
+}
+}  // namespace
+
+void check_render_options(int symbol_size, const RenderOptions& options) {
+  if (options.scale < 1 || options.quiet_zone < 0) {
+    throw std::invalid_argument("scale must be >= 1 and quiet zone >= 0");
+  }
+  // int では --scale 100000000 などがあふれるので64ビットで見積もる
+  const int64_t side =
+      (static_cast<int64_t>(symbol_size) + 2 * int64_t{options.quiet_zone}) *
+      options.scale;
+  if (side > MAX_IMAGE_SIDE) {
+    throw std::invalid_argument("image would be " + std::to_string(side) +
+                                " pixels wide (limit " +
+                                std::to_string(MAX_IMAGE_SIDE) + ")");
+  }
+}
+
+int image_size(int symbol_size, const RenderOptions& options) {
+  return (symbol_size + 2 * options.quiet_zone) * options.scale;
+}
+
+void expand_module_row(const u_int64_t* row, int size,
+                       const RenderOptions& options, u_int8_t dark,
+                       u_int8_t light, u_int8_t* out) {
+  const int scale = options.scale;
+  const int margin = options.quiet_zone * scale;
+  if (scale == 1) {
+    render_kernel().expand(row, size, dark, light, out + margin);
+  } else {
+    u_int8_t modules[MAX_WORDS_PER_ROW * 64 + 16];
+    render_kernel().expand(row, size, dark, light, modules);
+    u_int8_t* p = out + margin;
+    for (int y = 0; y < size; y++, p += scale) {
+      std::memset(p, modules[y], scale);
+    }
+  }
+  // 余白は展開のはみ出しを上書きするので最後に書く
+  std::memset(out, light, margin);
+  std::memset(out + margin + size * scale, light, margin);
+}
+
+void pack_pixels(const u_int8_t* pixels, int width, u_int8_t* out) {
+  render_kernel().pack(pixels, width, out);
+}
+
+const char* render_kernel_name() { return render_kernel().name; }
+
+void render_image(const ModuleMatrix& matrix, ImageFormat format,
+                  const RenderOptions& options, std::string& out) {
+  check_render_options(matrix.size, options);
+  const int width = image_size(matrix.size, options);
+  const int scale = options.scale;
+  const int margin_rows = options.quiet_zone * scale;
+  const size_t row_bytes = (static_cast<size_t>(width) + 7) / 8;
+  std::vector<u_int8_t> pixels(width + 16);
+  std::vector<u_int8_t> packed(row_bytes + 1);
+
+  switch (format) {
+    case ImageFormat::PBM: {
+      out += "P4\n" + std::to_string(width) + " " + std::to_string(width) +
+             "\n";
+      out.reserve(out.size() + row_bytes * width);
+      out.append(row_bytes * margin_rows, '\0');
+      for (int x = 0; x < matrix.size; x++) {
+        expand_module_row(matrix.row(x), matrix.size, options, 0xFF, 0x00,
+                          pixels.data());
+        pack_pixels(pixels.data(), width, packed.data());
+        append_repeated(out, packed.data(), row_bytes, scale);
+      }
+      out.append(row_bytes * margin_rows, '\0');
+      break;
+    }
+    case ImageFormat::PGM: {
+      out += "P5\n" + std::to_string(width) + " " + std::to_string(width) +
+             "\n255\n";
+      out.reserve(out.size() + static_cast<size_t>(width) * width);
+      out.append(static_cast<size_t>(width) * margin_rows, '\xFF');
+      for (int x = 0; x < matrix.size; x++) {
+        expand_module_row(matrix.row(x), matrix.size, options, 0x00, 0xFF,
+                          pixels.data());
+        append_repeated(out, pixels.data(), width, scale);
+      }
+      out.append(static_cast<size_t>(width) * margin_rows, '\xFF');
+      break;
+    }
+    case ImageFormat::PNG: {
+      // 走査線 = フィルタ種別(0) + 1ビット/画素 (1 = 白)
+      const size_t stride = row_bytes + 1;
+      std::vector<u_int8_t> raw(stride * width);
+      std::vector<u_int8_t> light_row(stride, 0xFF);
+      light_row[0] = 0;
+      if (width % 8 != 0) {
+        light_row[stride - 1] = static_cast<u_int8_t>(0xFF00 >> (width % 8));
+      }
+      u_int8_t* p = raw.data();
+      for (int i = 0; i < margin_rows; i++, p += stride) {
+        std::memcpy(p, light_row.data(), stride);
+      }
+      for (int x = 0; x < matrix.size; x++) {
+        expand_module_row(matrix.row(x), matrix.size, options, 0x00, 0xFF,
+                          pixels.data());
+        p[0] = 0;
+        pack_pixels(pixels.data(), width, p + 1);
+        for (int i = 1; i < scale; i++) {
+          std::memcpy(p + i * stride, p, stride);
+        }
+        p += stride * scale;
+      }
+      for (int i = 0; i < margin_rows; i++, p += stride) {
+        std::memcpy(p, light_row.data(), stride);
+      }
+
+      std::string header;
+      append_be32(header, width);
+      append_be32(header, width);
+      header += std::string("\x01\x00\x00\x00\x00", 5);  // 1ビット, グレー
+      std::string idat;
+      zlib_append(raw.data(), raw.size(), options.png_compression, stride,
+                  idat);
+      out += "\x89PNG\r\n\x1A\n";
+      append_png_chunk(out, "IHDR", header);
+      append_png_chunk(out, "IDAT", idat);
+      append_png_chunk(out, "IEND", std::string());
+      break;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+#include "deflate.h"
+#include "qr.h"
+
+enum class ImageFormat {
+  PBM,  // binary "P4", 1 bit per pixel, 1 = dark
+  PGM,  // binary "P5", 8 bits per pixel, 0 = dark
+  PNG,  // 1-bit grayscale
+};
+
+struct RenderOptions {
+  int scale = 4;       // pixels per module
+  int quiet_zone = 4;  // light modules around the symbol
+  DeflateMode png_compression = DeflateMode::FIXED;
+};
+
+// Module rows in the packed layout of QrCode::row() / Symbol::row().
+struct ModuleMatrix {
+  const u_int64_t* modules;
+  int size;
+  int words_per_row;
+
+  const u_int64_t* row(int x) const {
+    return modules + static_cast<size_t>(x) * words_per_row;
+  }
+};
+
+inline ModuleMatrix module_matrix(const Symbol& symbol) {
+  return {symbol.modules.data(), symbol.size, symbol.words_per_row};
+}
+inline ModuleMatrix module_matrix(const QrCode& qr) {
+  return {qr.row(0), qr.getSize(), qr.wordsPerRow()};
+}
+
+// Largest image width (= height) render_image() produces; a PGM of this
+// side is 1 GiB.
+constexpr int MAX_IMAGE_SIDE = 32768;
+
+// Throws std::invalid_argument unless scale >= 1, quiet_zone >= 0 and the
+// image of a `symbol_size` symbol is at most MAX_IMAGE_SIDE pixels wide.
+void check_render_options(int symbol_size, const RenderOptions& options);
+// Image width (= height) in pixels, for options check_render_options()
+// accepts.
+int image_size(int symbol_size, const RenderOptions& options);
+
+// Expands one module row into one byte per pixel: `dark` / `light` for each of
+// the scale pixels of a module, with quiet_zone * scale light pixels on both
+// sides. `out` needs image_size() bytes (plus 16 bytes of slack).
+void expand_module_row(const u_int64_t* row, int size,
+                       const RenderOptions& options, u_int8_t dark,
+                       u_int8_t light, u_int8_t* out);
+// Packs `width` pixels of 0x00/0xFF (as written by expand_module_row) into
+// (width + 7) / 8 bytes, first pixel in the MSB, 0xFF -> 1.
+void pack_pixels(const u_int8_t* pixels, int width, u_int8_t* out);
+
+// "sse2/ssse3" or "scalar"
+const char* render_kernel_name();
+
+// Appends the complete image file to `out`.
+void render_image(const ModuleMatrix& matrix, ImageFormat format,
+                  const RenderOptions& options, std::string& out);
+inline void render_image(const Symbol& symbol, ImageFormat format,
+                         const RenderOptions& options, std::string& out) {
+  render_image(module_matrix(symbol), format, options, out);
+}
+
+#endif  // RENDER_H
@@ -0,0 +1,150 @@
+#include "render.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+u_int32_t read_be32(const std::string& s, size_t offset) {
+  return (static_cast<u_int8_t>(s[offset]) << 24) |
+         (static_cast<u_int8_t>(s[offset + 1]) << 16) |
+         (static_cast<u_int8_t>(s[offset + 2]) << 8) |
+         static_cast<u_int8_t>(s[offset + 3]);
+}
+
+TEST(RenderTest, Checksums) {
+  const std::string check = "123456789";
+  const auto* data = reinterpret_cast<const u_int8_t*>(check.data());
+  EXPECT_EQ(crc32_update(0, data, check.size()), 0xCBF43926u);
+  // 分割して渡しても同じ
+  EXPECT_EQ(crc32_update(crc32_update(0, data, 4), data + 4, 5), 0xCBF43926u);
+  const std::string wikipedia = "Wikipedia";
+  EXPECT_EQ(adler32_update(
+                1, reinterpret_cast<const u_int8_t*>(wikipedia.data()), 9),
+            0x11E60398u);
+  std::vector<u_int8_t> large(100000, 0xFF);
+  u_int32_t a = 1 + 100000u * 0xFF % 65521;
+  u_int32_t b = 0;
+  for (size_t i = 1; i <= large.size(); i++) {
+    b = (b + 1 + i * 0xFF) % 65521;
+  }
+  EXPECT_EQ(adler32_update(1, large.data(), large.size()),
+            (b << 16) | (a % 65521));
+}
+
+TEST(RenderTest, StoredDeflate) {
+  std::vector<u_int8_t> data(70000);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<u_int8_t>(i * 7);
+  }
+  std::string out;
+  deflate_append(data.data(), data.size(), DeflateMode::STORED, 0, out);
+  ASSERT_EQ(out.size(), data.size() + 10);
+  EXPECT_EQ(out[0], 0);  // BFINAL=0, BTYPE=00
+  EXPECT_EQ(static_cast<u_int8_t>(out[1]), 0xFF);
+  EXPECT_EQ(static_cast<u_int8_t>(out[2]), 0xFF);
+  EXPECT_EQ(out[5 + 65535], 1);
+  EXPECT_EQ(out.substr(5 + 65535 + 5), std::string(data.begin() + 65535,
+                                                    data.end()));
+}
+
+TEST(RenderTest, ExpandAndPack) {
+  Symbol symbol = encode_symbol("HELLO WORLD", EncodeOptions{Q});
+  for (int scale : {1, 3}) {
+    RenderOptions options{scale, 2};
+    const int width = image_size(symbol.size, options);
+    ASSERT_EQ(width, (21 + 4) * scale);
+    std::vector<u_int8_t> pixels(width + 16);
+    std::vector<u_int8_t> packed((width + 7) / 8);
+    for (int x = 0; x < symbol.size; x++) {
+      expand_module_row(symbol.row(x), symbol.size, options, 0xFF, 0x00,
+                        pixels.data());
+      pack_pixels(pixels.data(), width, packed.data());
+      for (int p = 0; p < width; p++) {
+        int y = p / scale - 2;
+        bool dark = 0 <= y && y < symbol.size && symbol.getCell(x, y);
+        ASSERT_EQ(pixels[p], dark ? 0xFF : 0x00) << x << ", " << p;
+        ASSERT_EQ((packed[p / 8] >> (7 - p % 8)) & 1, dark) << x << ", " << p;
+      }
+      if (width % 8 != 0) {
+        EXPECT_EQ(packed.back() & (0xFF >> (width % 8)), 0);
+      }
+    }
+  }
+}
+
+TEST(RenderTest, Netpbm) {
+  Symbol symbol = encode_symbol("HELLO WORLD", EncodeOptions{M});
+  RenderOptions options{2, 1};
+  std::string pbm;
+  render_image(symbol, ImageFormat::PBM, options, pbm);
+  const std::string pbm_header = "P4\n46 46\n";
+  ASSERT_EQ(pbm.size(), pbm_header.size() + 46 * 6);
+  EXPECT_EQ(pbm.substr(0, pbm_header.size()), pbm_header);
+  std::string pgm;
+  render_image(symbol, ImageFormat::PGM, options, pgm);
+  const std::string pgm_header = "P5\n46 46\n255\n";
+  ASSERT_EQ(pgm.size(), pgm_header.size() + 46 * 46);
+  for (int r = 0; r < 46; r++) {
+    for (int c = 0; c < 46; c++) {
+      int x = r / 2 - 1;
+      int y = c / 2 - 1;
+      bool dark = 0 <= x && x < 21 && 0 <= y && y < 21 && symbol.getCell(x, y);
+      u_int8_t bits = pbm[pbm_header.size() + r * 6 + c / 8];
+      ASSERT_EQ((bits >> (7 - c % 8)) & 1, dark) << r << ", " << c;
+      ASSERT_EQ(static_cast<u_int8_t>(pgm[pgm_header.size() + r * 46 + c]),
+                dark ? 0 : 255);
+    }
+  }
+}
+
+TEST(RenderTest, RejectsOversizedImages) {
+  // (21 + 2 * 4) * 1130 = 32770 > MAX_IMAGE_SIDE; int でもあふれる倍率も断る
+  EXPECT_NO_THROW(check_render_options(21, RenderOptions{1129, 4}));
+  EXPECT_THROW(check_render_options(21, RenderOptions{1130, 4}),
+               std::invalid_argument);
+  EXPECT_THROW(check_render_options(21, RenderOptions{100000000, 4}),
+               std::invalid_argument);
+  EXPECT_THROW(check_render_options(21, RenderOptions{4, 2000000000}),
+               std::invalid_argument);
+  EXPECT_THROW(check_render_options(21, RenderOptions{0, 4}),
+               std::invalid_argument);
+  const Symbol symbol = encode_symbol("HELLO", EncodeOptions{M});
+  std::string out;
+  EXPECT_THROW(render_image(symbol, ImageFormat::PNG,
+                            RenderOptions{100000000, 4}, out),
+               std::invalid_argument);
+  EXPECT_TRUE(out.empty());
+}
+
+TEST(RenderTest, PngChunks) {
+  Symbol symbol = encode_symbol("HELLO WORLD", EncodeOptions{M});
+  std::string stored, fixed;
+  RenderOptions options{8, 4};
+  options.png_compression = DeflateMode::STORED;
+  render_image(symbol, ImageFormat::PNG, options, stored);
+  options.png_compression = DeflateMode::FIXED;
+  render_image(symbol, ImageFormat::PNG, options, fixed);
+  // 走査線の複製が距離 stride の一致になるので大きく縮む
+  EXPECT_LT(fixed.size() * 10, stored.size());
+  for (const std::string& png : {stored, fixed}) {
+    ASSERT_EQ(png.substr(0, 8), "\x89PNG\r\n\x1A\n");
+    size_t offset = 8;
+    std::vector<std::string> types;
+    while (offset < png.size()) {
+      u_int32_t length = read_be32(png, offset);
+      types.push_back(png.substr(offset + 4, 4));
+      u_int32_t crc = crc32_update(
+          0, reinterpret_cast<const u_int8_t*>(png.data()) + offset + 4,
+          length + 4);
+      EXPECT_EQ(read_be32(png, offset + 8 + length), crc);
+      offset += 12 + length;
+    }
+    EXPECT_EQ(offset, png.size());
+    EXPECT_EQ(types, (std::vector<std::string>{"IHDR", "IDAT", "IEND"}));
+    EXPECT_EQ(read_be32(png, 16), 232u);  // (21 + 8) * 8
+  }
+}
+}  // namespace
@@ -0,0 +1,978 @@
+#include "scanner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define QR_X86_SIMD 1
+#endif
+
+namespace {
+// ---- Netpbm ----
+
+// 空白とコメントを飛ばしてヘッダの次の10進数を読む
+int read_header_number(std::string_view data, size_t& position) {
+  while (position < data.size()) {
+    if (data[position] == '#') {
+      while (position < data.size() && data[position] != '\n') {
+        position++;
+      }
+    } else if (std::isspace(static_cast<unsigned char>(data[position]))) {
+      position++;
+    } else {
+      break;
+    }
+  }
+  int value = 0;
+  const size_t start = position;
+  while (position < data.size() && data[position] >= '0' &&
+         data[position] <= '9') {
+    value = value * 10 + (data[position++] - '0');
+    if (value > (1 << 20)) {
+      throw std::invalid_argument("Netpbm header value is too large");
+    }
+  }
+  if (position == start) {
+    throw std::invalid_argument("Malformed Netpbm header");
+  }
+  return value;
+}
+
+// ---- kernels ----
+
+// 8x8 画素ブロックの輝度の和・最小・最大
+struct BlockStats {
+  u_int32_t sum;
+  u_int8_t min;
+  u_int8_t max;
+};
+
+using BlockStatsFn = BlockStats (*)(const u_int8_t*, int);
+// out[i] = pixels[i] <= thresholds[i] (1 = dark)
+using ThresholdRowFn = void (*)(const u_int8_t*, const u_int8_t*, int,
+                                u_int8_t*);
+// 色が変わる位置 i (binary[i] != binary[i - 1]) を昇順に書き、個数を返す
+using TransitionsFn = int (*)(const u_int8_t*, int, int*);
+
+BlockStats block_stats_scalar(const u_int8_t* pixels, int stride) {
+  BlockStats stats{0, 255, 0};
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      const u_int8_t v = pixels[y * stride + x];
+      stats.sum += v;
+      stats.min = std::min(stats.min, v);
+      stats.max = std::max(stats.max, v);
+    }
+  }
+  return stats;
+}
+
+void threshold_row_scalar(const u_int8_t* pixels, const u_int8_t* thresholds,
+                          int width, u_int8_t* out) {
+  for (int i = 0; i < width; i++) {
+    out[i] = pixels[i] <= thresholds[i];
+  }
+}
+
+int transitions_scalar(const u_int8_t* binary, int width, int* positions) {
+  int count = 0;
+  for (int i = 1; i < width; i++) {
+    if (binary[i] != binary[i - 1]) {
+      positions[count++] = i;
+    }
+  }
+  return count;
+}
+
+#ifdef QR_X86_SIMD
+__attribute__((target("sse2"))) BlockStats block_stats_sse2(
+    const u_int8_t* pixels, int stride) {
+  // 2行を1つのレジスタに載せ、和は PSADBW、最小・最大は畳み込みで求める
+  __m128i low = _mm_set1_epi8(-1);
+  __m128i high = _mm_setzero_si128();
+  __m128i sum = _mm_setzero_si128();
+  for (int y = 0; y < 8; y += 2) {
+    const __m128i v = _mm_unpacklo_epi64(
+        _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(pixels + y * stride)),
+        _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(pixels + (y + 1) * stride)));
+    low = _mm_min_epu8(low, v);
+    high = _mm_max_epu8(high, v);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(v, _mm_setzero_si128()));
+  }
+  low = _mm_min_epu8(low, _mm_srli_si128(low, 8));
+  low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+  low = _mm_min_epu8(low, _mm_srli_si128(low, 2));
+  low = _mm_min_epu8(low, _mm_srli_si128(low, 1));
+  high = _mm_max_epu8(high, _mm_srli_si128(high, 8));
+  high = _mm_max_epu8(high, _mm_srli_si128(high, 4));
+  high = _mm_max_epu8(high, _mm_srli_si128(high, 2));
+  high = _mm_max_epu8(high, _mm_srli_si128(high, 1));
+  sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+  return {static_cast<u_int32_t>(_mm_cvtsi128_si32(sum)),
+          static_cast<u_int8_t>(_mm_cvtsi128_si32(low)),
+          static_cast<u_int8_t>(_mm_cvtsi128_si32(high))};
+}
+
+__attribute__((target("sse2"))) void threshold_row_sse2(
+    const u_int8_t* pixels, const u_int8_t* thresholds, int width,
+    u_int8_t* out) {
+  const __m128i one = _mm_set1_epi8(1);
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const __m128i p =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+    const __m128i t =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds + i));
+    // 符号なしの p <= t は min(p, t) == p
+    const __m128i dark = _mm_cmpeq_epi8(_mm_min_epu8(p, t), p);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_and_si128(dark, one));
+  }
+  threshold_row_scalar(pixels + i, thresholds + i, width - i, out + i);
+}
+
+__attribute__((target("sse2"))) int transitions_sse2(const u_int8_t* binary,
+                                                     int width,
+                                                     int* positions) {
+  // 隣の画素と比べた16画素分の不一致をビットマスクにし、立っているビットだけ
+  // 取り出す。モジュールの幅だけ同じ色が続くので、ほとんどの語は0
+  int count = 0;
+  int i = 1;
+  for (; i + 16 <= width; i += 16) {
+    const __m128i current =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(binary + i));
+    const __m128i previous =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(binary + i - 1));
+    unsigned mask = ~static_cast<unsigned>(
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(current, previous))) &
+                    0xFFFF;
+    while (mask != 0) {
+      positions[count++] = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  for (; i < width; i++) {
+    if (binary[i] != binary[i - 1]) {
+      positions[count++] = i;
+    }
+  }
+  return count;
+}
+#endif
+
+struct ScanKernel {
+  BlockStatsFn block_stats;
+  ThresholdRowFn threshold_row;
+  TransitionsFn transitions;
+  const char* name;
+};
+
+ScanKernel select_scan_kernel() {
+#ifdef QR_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    return {block_stats_sse2, threshold_row_sse2, transitions_sse2, "sse2"};
+  }
+#endif
+  return {block_stats_scalar, threshold_row_scalar, transitions_scalar,
+          "scalar"};
+}
+
+const ScanKernel& scan_kernel() {
+  static const ScanKernel kernel = select_scan_kernel();
+  return kernel;
+}
+}  // namespace
+
+const char* scan_kernel_name() { return scan_kernel().name; }
+
+void read_netpbm(std::string_view data, GrayImage& out) {
+  if (data.size() < 2 || data[0] != 'P' || (data[1] != '4' && data[1] != '5')) {
+    throw std::invalid_argument("Not a binary PGM (P5) or PBM (P4) image");
+  }
+  const bool bitmap = data[1] == '4';
+  size_t position = 2;
+  const int width = read_header_number(data, position);
+  const int height = read_header_number(data, position);
+  const int maxval = bitmap ? 1 : read_header_number(data, position);
+  if (width == 0 || height == 0 || maxval == 0 || maxval > 255) {
+    throw std::invalid_argument("Unsupported Netpbm image (" +
+                                std::to_string(width) + "x" +
+                                std::to_string(height) + ", maxval " +
+                                std::to_string(maxval) + ")");
+  }
+  // ヘッダと画素の間は空白1文字
+  if (position >= data.size() ||
+      !std::isspace(static_cast<unsigned char>(data[position]))) {
+    throw std::invalid_argument("Malformed Netpbm header");
+  }
+  position++;
+  const size_t row_bytes = bitmap ? (width + 7) / 8 : width;
+  if (data.size() - position < row_bytes * height) {
+    throw std::invalid_argument("Truncated Netpbm image");
+  }
+  const auto* in = reinterpret_cast<const u_int8_t*>(data.data()) + position;
+  out.width = width;
+  out.height = height;
+  out.pixels.resize(static_cast<size_t>(width) * height);
+  for (int y = 0; y < height; y++) {
+    const u_int8_t* source = in + y * row_bytes;
+    u_int8_t* target = out.row(y);
+    if (bitmap) {
+      for (int x = 0; x < width; x++) {
+        target[x] = ((source[x / 8] >> (7 - x % 8)) & 1) ? 0 : 255;
+      }
+    } else if (maxval == 255) {
+      std::memcpy(target, source, width);
+    } else {
+      for (int x = 0; x < width; x++) {
+        target[x] = static_cast<u_int8_t>(
+            std::min(source[x], static_cast<u_int8_t>(maxval)) * 255 / maxval);
+      }
+    }
+  }
+}
+
+GrayImage read_netpbm(std::string_view data) {
+  GrayImage image;
+  read_netpbm(data, image);
+  return image;
+}
+
+void binarize(const GrayImage& image, ScanScratch& scratch) {
+  constexpr int BLOCK = 8;
+  // これ以下の明暗差しかないブロックは一様とみなす
+  constexpr int MIN_DYNAMIC_RANGE = 24;
+  const ScanKernel& kernel = scan_kernel();
+  const int width = image.width;
+  const int height = image.height;
+  std::vector<u_int8_t>& out = scratch.binary;
+  std::vector<u_int8_t>& threshold_row = scratch.threshold_row;
+  out.resize(static_cast<size_t>(width) * height);
+  threshold_row.resize(width);
+
+  if (width < 5 * BLOCK || height < 5 * BLOCK) {
+    // 小さい画像は全体で1つの閾値
+    const auto [lo, hi] =
+        std::minmax_element(image.pixels.begin(), image.pixels.end());
+    const int threshold = *hi - *lo > MIN_DYNAMIC_RANGE ? (*lo + *hi) / 2 : -1;
+    if (threshold < 0) {
+      std::fill(out.begin(), out.end(), 0);
+      return;
+    }
+    std::fill(threshold_row.begin(), threshold_row.end(), threshold);
+    for (int y = 0; y < height; y++) {
+      kernel.threshold_row(image.row(y), threshold_row.data(), width,
+                           out.data() + static_cast<size_t>(y) * width);
+    }
+    return;
+  }
+
+  // ブロックごとの代表値。端のブロックは画像の内側へずらして 8x8 を保つ
+  const int blocks_x = (width + BLOCK - 1) / BLOCK;
+  const int blocks_y = (height + BLOCK - 1) / BLOCK;
+  std::vector<u_int8_t>& averages = scratch.block_averages;
+  averages.resize(static_cast<size_t>(blocks_x) * blocks_y);
+  for (int by = 0; by < blocks_y; by++) {
+    const int y0 = std::min(by * BLOCK, height - BLOCK);
+    for (int bx = 0; bx < blocks_x; bx++) {
+      const int x0 = std::min(bx * BLOCK, width - BLOCK);
+      const BlockStats stats =
+          kernel.block_stats(image.row(y0) + x0, image.width);
+      int average = static_cast<int>(stats.sum / (BLOCK * BLOCK));
+      if (stats.max - stats.min <= MIN_DYNAMIC_RANGE) {
+        // 一様なブロックは明るい側とみなし、暗い隣があればそれに合わせる
+        average = stats.min / 2;
+        if (by > 0 && bx > 0) {
+          const int neighbours =
+              (averages[(by - 1) * blocks_x + bx] +
+               2 * averages[by * blocks_x + bx - 1] +
+               averages[(by - 1) * blocks_x + bx - 1]) /
+              4;
+          if (stats.min < neighbours) {
+            average = neighbours;
+          }
+        }
+      }
+      averages[by * blocks_x + bx] = static_cast<u_int8_t>(average);
+    }
+  }
+
+  // 各ブロックの閾値は周り 5x5 ブロックの平均 (窓は画像の内側に収める)
+  std::vector<u_int8_t>& thresholds = scratch.block_thresholds;
+  thresholds.resize(averages.size());
+  for (int by = 0; by < blocks_y; by++) {
+    const int cy = std::clamp(by, 2, blocks_y - 3);
+    for (int bx = 0; bx < blocks_x; bx++) {
+      const int cx = std::clamp(bx, 2, blocks_x - 3);
+      int sum = 0;
+      for (int dy = -2; dy <= 2; dy++) {
+        const u_int8_t* row = averages.data() + (cy + dy) * blocks_x;
+        sum += row[cx - 2] + row[cx - 1] + row[cx] + row[cx + 1] + row[cx + 2];
+      }
+      thresholds[by * blocks_x + bx] = static_cast<u_int8_t>(sum / 25);
+    }
+  }
+
+  for (int by = 0; by < blocks_y; by++) {
+    for (int x = 0; x < width; x++) {
+      threshold_row[x] = thresholds[by * blocks_x + x / BLOCK];
+    }
+    for (int y = by * BLOCK; y < std::min(by * BLOCK + BLOCK, height); y++) {
+      kernel.threshold_row(image.row(y), threshold_row.data(), width,
+                           out.data() + static_cast<size_t>(y) * width);
+    }
+  }
+}
+
+namespace {
+// ---- finder patterns ----
+
+struct Point {
+  double x;
+  double y;
+};
+
+double distance(const Point& a, const Point& b) {
+  return std::hypot(a.x - b.x, a.y - b.y);
+}
+
+class Bitmap {
+ public:
+  Bitmap(const u_int8_t* bits, int width, int height)
+      : bits(bits), width(width), height(height) {}
+
+  bool contains(int x, int y) const {
+    return 0 <= x && x < width && 0 <= y && y < height;
+  }
+  bool dark(int x, int y) const {
+    return bits[static_cast<size_t>(y) * width + x] != 0;
+  }
+  const u_int8_t* row(int y) const {
+    return bits + static_cast<size_t>(y) * width;
+  }
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+
+  // (x, y) から (dx, dy) 方向へ `dark` の色が続く画素数 (limit で打ち切り)
+  int run(int x, int y, int dx, int dy, bool dark, int limit) const {
+    int n = 0;
+    while (n < limit && contains(x + n * dx, y + n * dy) &&
+           this->dark(x + n * dx, y + n * dy) == dark) {
+      n++;
+    }
+    return n;
+  }
+
+ private:
+  const u_int8_t* bits;
+  int width;
+  int height;
+};
+
+// 暗・明・暗・明・暗の5区間が 1:1:3:1:1 か (各区間の誤差は半モジュールまで)
+bool is_finder_ratio(const int counts[5]) {
+  const int total =
+      counts[0] + counts[1] + counts[2] + counts[3] + counts[4];
+  if (total < 7) {
+    return false;
+  }
+  const float module = total / 7.0f;
+  const float variance = module / 2;
+  return std::abs(module - counts[0]) < variance &&
+         std::abs(module - counts[1]) < variance &&
+         std::abs(3 * module - counts[2]) < 3 * variance &&
+         std::abs(module - counts[3]) < variance &&
+         std::abs(module - counts[4]) < variance;
+}
+
+// (x, y) を含む暗い区間から (dx, dy) の両方向へ 1:1:3:1:1 を数え直す。
+// 合えば中心の座標 (その軸の画素境界基準) と全体の長さを返す
+bool cross_check_finder(const Bitmap& bitmap, int x, int y, int dx, int dy,
+                        int max_count, int expected_total, double& center,
+                        int& total) {
+  if (!bitmap.contains(x, y) || !bitmap.dark(x, y)) {
+    return false;
+  }
+  int counts[5];
+  const int limit = max_count + 1;
+  const int back = bitmap.run(x, y, -dx, -dy, true, 4 * limit);
+  counts[1] = bitmap.run(x - back * dx, y - back * dy, -dx, -dy, false, limit);
+  counts[0] = bitmap.run(x - (back + counts[1]) * dx,
+                         y - (back + counts[1]) * dy, -dx, -dy, true, limit);
+  const int forward = bitmap.run(x + dx, y + dy, dx, dy, true, 4 * limit);
+  const int after = forward + 1;
+  counts[3] =
+      bitmap.run(x + after * dx, y + after * dy, dx, dy, false, limit);
+  counts[4] = bitmap.run(x + (after + counts[3]) * dx,
+                         y + (after + counts[3]) * dy, dx, dy, true, limit);
+  counts[2] = back + forward;
+  for (int i : {0, 1, 3, 4}) {
+    if (counts[i] == 0 || counts[i] > max_count) {
+      return false;
+    }
+  }
+  total = counts[0] + counts[1] + counts[2] + counts[3] + counts[4];
+  if (5 * std::abs(total - expected_total) >= 2 * expected_total ||
+      !is_finder_ratio(counts)) {
+    return false;
+  }
+  center = (forward - back) / 2.0 + 1;
+  return true;
+}
+
+// 近い候補があれば重み付き平均でまとめる
+void add_candidate(std::vector<FinderPattern>& candidates, float x, float y,
+                   float module_size) {
+  for (FinderPattern& c : candidates) {
+    if (std::abs(x - c.x) <= c.module_size &&
+        std::abs(y - c.y) <= c.module_size &&
+        std::abs(module_size - c.module_size) <=
+            std::max(1.0f, c.module_size)) {
+      const float n = static_cast<float>(c.hits);
+      c.x = (c.x * n + x) / (n + 1);
+      c.y = (c.y * n + y) / (n + 1);
+      c.module_size = (c.module_size * n + module_size) / (n + 1);
+      c.hits++;
+      return;
+    }
+  }
+  candidates.push_back({x, y, module_size, 1});
+}
+
+// 行の区間 counts (末尾が x = end の直前) から縦・横に確かめて候補に加える
+void confirm_finder(const Bitmap& bitmap, const int counts[5], int end, int y,
+                    std::vector<FinderPattern>& candidates) {
+  const int row_total =
+      counts[0] + counts[1] + counts[2] + counts[3] + counts[4];
+  const int column = end - counts[4] - counts[3] - (counts[2] + 1) / 2;
+  double center_y;
+  int column_total;
+  if (!cross_check_finder(bitmap, column, y, 0, 1, counts[2], row_total,
+                          center_y, column_total)) {
+    return;
+  }
+  const int cy = y + static_cast<int>(std::floor(center_y));
+  double center_x;
+  int check_total;
+  if (!cross_check_finder(bitmap, column, cy, 1, 0, counts[2], row_total,
+                          center_x, check_total)) {
+    return;
+  }
+  add_candidate(candidates, static_cast<float>(column + center_x),
+                static_cast<float>(y + center_y),
+                (check_total + column_total) / 14.0f);
+}
+
+// `step` 行ごとに走査して 1:1:3:1:1 の候補を集める
+void find_finder_candidates(const Bitmap& bitmap, int step,
+                            std::vector<int>& transitions,
+                            std::vector<FinderPattern>& candidates) {
+  const int width = bitmap.getWidth();
+  transitions.resize(width + 1);
+  const TransitionsFn find_transitions = scan_kernel().transitions;
+  for (int y = step / 2; y < bitmap.getHeight(); y += step) {
+    const u_int8_t* row = bitmap.row(y);
+    const int count = find_transitions(row, width, transitions.data());
+    transitions[count] = width;
+    // 区間 j は [start, transitions[j])、色は交互
+    int counts[5] = {0, 0, 0, 0, 0};
+    int start = 0;
+    bool dark = row[0] != 0;
+    for (int j = 0; j <= count; j++) {
+      const int end = transitions[j];
+      std::copy(counts + 1, counts + 5, counts);
+      counts[4] = end - start;
+      if (dark && j >= 4 && is_finder_ratio(counts)) {
+        confirm_finder(bitmap, counts, end, y, candidates);
+      }
+      start = end;
+      dark = !dark;
+    }
+  }
+}
+
+// 直角二等辺三角形に最も近い3つを選び、左上・右上・左下の順に並べる
+bool select_finders(std::vector<FinderPattern>& candidates,
+                    FinderPattern finders[3]) {
+  std::sort(candidates.begin(), candidates.end(),
+            [](const FinderPattern& a, const FinderPattern& b) {
+              return a.hits > b.hits;
+            });
+  const int n = std::min<int>(static_cast<int>(candidates.size()), 12);
+  // 1回しか検出していない候補はたいてい雑音なので、3つとも2回以上検出した
+  // 組があればそちらを選ぶ
+  constexpr double MAX_SCORE = 0.5;
+  double best_score = MAX_SCORE;
+  bool best_weak = true;
+  int best[3] = {-1, -1, -1};
+  for (int i = 0; i < n; i++) {
+    for (int j = i + 1; j < n; j++) {
+      for (int k = j + 1; k < n; k++) {
+        const FinderPattern* p[3] = {&candidates[i], &candidates[j],
+                                     &candidates[k]};
+        const float smallest = std::min(
+            {p[0]->module_size, p[1]->module_size, p[2]->module_size});
+        const float largest = std::max(
+            {p[0]->module_size, p[1]->module_size, p[2]->module_size});
+        if (largest > 1.5f * smallest) {
+          continue;
+        }
+        double sides[3];
+        for (int s = 0; s < 3; s++) {
+          const FinderPattern& a = *p[(s + 1) % 3];
+          const FinderPattern& b = *p[(s + 2) % 3];
+          sides[s] = (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+        }
+        std::sort(sides, sides + 3);
+        // 中心間は版1でも14モジュール
+        const double minimum_leg = 10.0 * smallest;
+        if (sides[0] < minimum_leg * minimum_leg) {
+          continue;
+        }
+        const double score = std::abs(sides[2] - sides[0] - sides[1]) /
+                                 sides[2] +
+                             (1 - sides[0] / sides[1]);
+        const bool weak = candidates[k].hits == 1;  // hits の降順
+        if (score < MAX_SCORE && (best[0] < 0 || (best_weak && !weak) ||
+                                  (weak == best_weak && score < best_score))) {
+          best_score = score;
+          best_weak = weak;
+          best[0] = i, best[1] = j, best[2] = k;
+        }
+      }
+    }
+  }
+  if (best[0] < 0) {
+    return false;
+  }
+  FinderPattern p[3] = {candidates[best[0]], candidates[best[1]],
+                        candidates[best[2]]};
+  // 最長辺の向かいが左上
+  auto squared = [](const FinderPattern& a, const FinderPattern& b) {
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+  };
+  const float opposite[3] = {squared(p[1], p[2]), squared(p[0], p[2]),
+                             squared(p[0], p[1])};
+  const int corner = static_cast<int>(
+      std::max_element(opposite, opposite + 3) - opposite);
+  FinderPattern top_left = p[corner];
+  FinderPattern a = p[(corner + 1) % 3];
+  FinderPattern b = p[(corner + 2) % 3];
+  // 画像座標 (y は下向き) で左上→右上 × 左上→左下 が正になる向き
+  const float cross = (a.x - top_left.x) * (b.y - top_left.y) -
+                      (a.y - top_left.y) * (b.x - top_left.x);
+  if (cross < 0) {
+    std::swap(a, b);
+  }
+  finders[0] = top_left;
+  finders[1] = a;
+  finders[2] = b;
+  return true;
+}
+
+// ---- alignment pattern ----
+
+// 明・暗・明が 1:1:1 (各区間の誤差は半モジュールまで)
+bool is_alignment_ratio(const int counts[3], float module_size) {
+  const float variance = std::max(module_size / 2, 1.5f);
+  for (int i = 0; i < 3; i++) {
+    if (std::abs(module_size - counts[i]) >= variance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool cross_check_alignment(const Bitmap& bitmap, int x, int y, int dx, int dy,
+                           float module_size, double& center) {
+  if (!bitmap.contains(x, y) || !bitmap.dark(x, y)) {
+    return false;
+  }
+  const int limit = static_cast<int>(2 * module_size) + 1;
+  const int back = bitmap.run(x, y, -dx, -dy, true, limit);
+  const int forward = bitmap.run(x + dx, y + dy, dx, dy, true, limit);
+  int counts[3];
+  counts[0] =
+      bitmap.run(x - back * dx, y - back * dy, -dx, -dy, false, limit);
+  counts[1] = back + forward;
+  counts[2] = bitmap.run(x + (forward + 1) * dx, y + (forward + 1) * dy, dx,
+                         dy, false, limit);
+  if (!is_alignment_ratio(counts, module_size)) {
+    return false;
+  }
+  // 明の輪の外は暗い外周。データ領域の孤立した暗モジュールをここで落とす
+  const int outer = back + counts[0];
+  const int after = forward + 1 + counts[2];
+  if (!bitmap.contains(x - outer * dx, y - outer * dy) ||
+      !bitmap.dark(x - outer * dx, y - outer * dy) ||
+      !bitmap.contains(x + after * dx, y + after * dy) ||
+      !bitmap.dark(x + after * dx, y + after * dy)) {
+    return false;
+  }
+  center = (forward - back) / 2.0 + 1;
+  return true;
+}
+
+// 推定位置の周り radius 画素の窓で右下の位置合わせパターンを探し、推定に
+// 近い順に最大 MAX_ALIGNMENT_CANDIDATES 個を返す。台形に歪むと推定がずれて
+// データ領域の似た模様の方が近くなることがあるので、1つに決めない
+constexpr int MAX_ALIGNMENT_CANDIDATES = 3;
+
+int find_alignments(const Bitmap& bitmap, const Point& estimate,
+                    float module_size, float radius, Point found[]) {
+  const int left = std::max(0, static_cast<int>(estimate.x - radius));
+  const int right = std::min(bitmap.getWidth() - 1,
+                             static_cast<int>(estimate.x + radius));
+  const int top = std::max(0, static_cast<int>(estimate.y - radius));
+  const int bottom = std::min(bitmap.getHeight() - 1,
+                              static_cast<int>(estimate.y + radius));
+  if (right - left < 3 * module_size || bottom - top < 3 * module_size) {
+    return 0;
+  }
+  int count = 0;
+  double distances[MAX_ALIGNMENT_CANDIDATES];
+  for (int y = top; y <= bottom; y++) {
+    // 窓の中の区間を左から: 明・暗・明 が揃うたびに確かめる
+    int counts[3] = {0, 0, 0};
+    int x = left;
+    while (x <= right) {
+      const bool dark = bitmap.dark(x, y);
+      const int length = bitmap.run(x, y, 1, 0, dark, right + 1 - x);
+      std::copy(counts + 1, counts + 3, counts);
+      counts[2] = dark ? -length : length;
+      x += length;
+      if (!dark && counts[0] > 0 && counts[1] < 0) {
+        const int runs[3] = {counts[0], -counts[1], counts[2]};
+        if (!is_alignment_ratio(runs, module_size)) {
+          continue;
+        }
+        const int column = x - runs[2] - (runs[1] + 1) / 2;
+        double center_y;
+        if (!cross_check_alignment(bitmap, column, y, 0, 1, module_size,
+                                   center_y)) {
+          continue;
+        }
+        double center_x;
+        const int row = y + static_cast<int>(std::floor(center_y));
+        if (!cross_check_alignment(bitmap, column, row, 1, 0, module_size,
+                                   center_x)) {
+          continue;
+        }
+        const Point point{column + center_x, y + center_y};
+        // 同じパターンを別の行で見つけたものは数えない
+        bool seen = false;
+        for (int i = 0; i < count; i++) {
+          seen = seen || distance(found[i], point) < module_size;
+        }
+        const double d = distance(point, estimate);
+        if (seen ||
+            (count == MAX_ALIGNMENT_CANDIDATES && d >= distances[count - 1])) {
+          continue;
+        }
+        int i = std::min(count, MAX_ALIGNMENT_CANDIDATES - 1);
+        for (; i > 0 && distances[i - 1] > d; i--) {
+          found[i] = found[i - 1];
+          distances[i] = distances[i - 1];
+        }
+        found[i] = point;
+        distances[i] = d;
+        count = std::min(count + 1, MAX_ALIGNMENT_CANDIDATES);
+      }
+    }
+  }
+  return count;
+}
+
+// ---- module size ----
+
+// finder の中心から (dx, dy) 方向へ 暗・明・暗 を抜けて明るい画素に出るまでの
+// 距離 (3.5モジュール分)。向きによらずモジュールの大きさが分かる
+double finder_extent(const Bitmap& bitmap, const Point& center, double dx,
+                     double dy, double limit) {
+  const double length = std::hypot(dx, dy);
+  dx /= length;
+  dy /= length;
+  int state = 0;  // 0: 中心の暗, 1: 明, 2: 外周の暗
+  // 境界は最後の暗い点と最初の明るい点の間にあるので、刻みの半分を引く
+  constexpr double STEP = 0.25;
+  for (double t = 0; t < limit; t += STEP) {
+    const int x = static_cast<int>(std::floor(center.x + t * dx));
+    const int y = static_cast<int>(std::floor(center.y + t * dy));
+    if (!bitmap.contains(x, y)) {
+      return state == 2 ? t - STEP / 2 : -1;
+    }
+    const bool dark = bitmap.dark(x, y);
+    if (dark == (state == 1)) {
+      if (state == 2) {
+        return t - STEP / 2;
+      }
+      state++;
+    }
+  }
+  return -1;
+}
+
+// 2つの finder を結ぶ線に沿って測ったモジュールの大きさ (測れなければ0)
+double module_size_between(const Bitmap& bitmap, const FinderPattern& a,
+                           const FinderPattern& b) {
+  const Point pa{a.x, a.y};
+  const Point pb{b.x, b.y};
+  const double dx = b.x - a.x;
+  const double dy = b.y - a.y;
+  const double limit = 10.0 * std::max(a.module_size, b.module_size);
+  const double extents[4] = {finder_extent(bitmap, pa, dx, dy, limit),
+                             finder_extent(bitmap, pa, -dx, -dy, limit),
+                             finder_extent(bitmap, pb, -dx, -dy, limit),
+                             finder_extent(bitmap, pb, dx, dy, limit)};
+  // 雑音で途中の画素が反転した測定は、走査で見た大きさとかけ離れるので捨てる
+  // (走査の大きさは45度で最大 √2 倍)
+  const double scanned = (a.module_size + b.module_size) / 2 * 3.5;
+  double sum = 0;
+  int count = 0;
+  for (double extent : extents) {
+    if (scanned * 0.55 < extent && extent < scanned * 1.25) {
+      sum += extent;
+      count++;
+    }
+  }
+  return count == 0 ? 0 : sum / count / 3.5;
+}
+
+// ---- perspective ----
+
+// (u, v) -> ((a u + b v + c) / (g u + h v + 1), (d u + e v + f) / (...))
+struct Perspective {
+  double m[8];
+
+  Point map(double u, double v) const {
+    const double w = m[6] * u + m[7] * v + 1;
+    return {(m[0] * u + m[1] * v + m[2]) / w, (m[3] * u + m[4] * v + m[5]) / w};
+  }
+};
+
+// 4点の対応から8元連立方程式を部分ピボット付きの消去法で解く
+bool solve_perspective(const Point from[4], const Point to[4],
+                       Perspective& out) {
+  double a[8][9];
+  for (int i = 0; i < 4; i++) {
+    const double u = from[i].x, v = from[i].y;
+    const double x = to[i].x, y = to[i].y;
+    const double rows[2][9] = {{u, v, 1, 0, 0, 0, -u * x, -v * x, x},
+                               {0, 0, 0, u, v, 1, -u * y, -v * y, y}};
+    std::copy(rows[0], rows[0] + 9, a[2 * i]);
+    std::copy(rows[1], rows[1] + 9, a[2 * i + 1]);
+  }
+  for (int col = 0; col < 8; col++) {
+    int pivot = col;
+    for (int r = col + 1; r < 8; r++) {
+      if (std::abs(a[r][col]) > std::abs(a[pivot][col])) {
+        pivot = r;
+      }
+    }
+    if (std::abs(a[pivot][col]) < 1e-12) {
+      return false;
+    }
+    std::swap(a[col], a[pivot]);
+    for (int r = 0; r < 8; r++) {
+      if (r == col) {
+        continue;
+      }
+      const double factor = a[r][col] / a[col][col];
+      for (int c = col; c < 9; c++) {
+        a[r][c] -= factor * a[col][c];
+      }
+    }
+  }
+  for (int i = 0; i < 8; i++) {
+    out.m[i] = a[i][8] / a[i][i];
+  }
+  return true;
+}
+
+// モジュール中心ごとに2値画像を読んで Symbol の面へ詰める
+void sample_grid(const Bitmap& bitmap, const Perspective& transform,
+                 int dimension, Symbol& out) {
+  out.version = (dimension - 17) / 4;
+  out.size = dimension;
+  out.words_per_row = (dimension + 63) / 64;
+  out.modules.reserve(MAX_SYMBOL_WORDS);
+  out.modules.assign(static_cast<size_t>(dimension) * out.words_per_row, 0);
+  out.error.clear();
+  for (int x = 0; x < dimension; x++) {
+    u_int64_t* row = out.modules.data() + x * out.words_per_row;
+    for (int y = 0; y < dimension; y++) {
+      // 行列の x は行 (画像の縦)、y は列 (画像の横)
+      const Point p = transform.map(y + 0.5, x + 0.5);
+      const int px = static_cast<int>(std::floor(p.x));
+      const int py = static_cast<int>(std::floor(p.y));
+      if (bitmap.contains(px, py) && bitmap.dark(px, py)) {
+        row[y / 64] |= u_int64_t{1} << (y % 64);
+      }
+    }
+  }
+}
+
+// 推定した3通りと、型番情報から分かった一辺
+constexpr int MAX_DIMENSION_TRIES = 4;
+
+// 大きさの推定を中心に、近い順に有効な一辺 (4n + 17) を並べる
+int candidate_dimensions(double modules, int out[3]) {
+  const int nearest = static_cast<int>(std::lround((modules - 17) / 4));
+  int count = 0;
+  for (int version : {nearest, nearest - 1, nearest + 1}) {
+    if (MIN_VERSION <= version && version <= MAX_VERSION) {
+      out[count++] = symbol_size(version);
+    }
+  }
+  return count;
+}
+
+void scan(const GrayImage& image, ScanScratch& scratch, ScanResult& out) {
+  if (image.width <= 0 || image.height <= 0 ||
+      image.pixels.size() != static_cast<size_t>(image.width) * image.height) {
+    throw std::runtime_error("Empty or inconsistent image");
+  }
+  binarize(image, scratch);
+  const Bitmap bitmap(scratch.binary.data(), image.width, image.height);
+
+  // 版40が画像の高さ一杯でも中心の3モジュールを数回は横切る間隔で走査し、
+  // 見つからなければ全行を見直す
+  std::vector<FinderPattern>& candidates = scratch.candidates;
+  candidates.clear();
+  const int step = std::max(1, 3 * image.height / (4 * symbol_size(40)));
+  find_finder_candidates(bitmap, step, scratch.transitions, candidates);
+  bool found = select_finders(candidates, out.finders);
+  if (!found && step > 1) {
+    candidates.clear();
+    find_finder_candidates(bitmap, 1, scratch.transitions, candidates);
+    found = select_finders(candidates, out.finders);
+  }
+  if (!found) {
+    throw std::runtime_error("No finder patterns found");
+  }
+
+  const FinderPattern* f = out.finders;
+  const Point top_left{f[0].x, f[0].y};
+  const Point top_right{f[1].x, f[1].y};
+  const Point bottom_left{f[2].x, f[2].y};
+  // 行・列の走査で測った大きさは回転すると伸びるので、finder 同士を結ぶ
+  // 線に沿って測り直す
+  const double along[2] = {module_size_between(bitmap, f[0], f[1]),
+                           module_size_between(bitmap, f[0], f[2])};
+  double module_size = along[0] > 0 && along[1] > 0
+                           ? (along[0] + along[1]) / 2
+                           : std::max(along[0], along[1]);
+  if (module_size <= 0) {
+    module_size = (f[0].module_size + f[1].module_size + f[2].module_size) / 3;
+  }
+  const double across = (distance(top_left, top_right) +
+                         distance(top_left, bottom_left)) /
+                        2;
+  int dimensions[MAX_DIMENSION_TRIES];
+  int dimension_count =
+      candidate_dimensions(across / module_size + 7, dimensions);
+  if (dimension_count == 0) {
+    throw std::runtime_error("Finder patterns do not span a valid symbol");
+  }
+
+  for (int d = 0; d < dimension_count; d++) {
+    const int dimension = dimensions[d];
+    const double far = dimension - 3.5;
+    const Point parallelogram{top_right.x - top_left.x + bottom_left.x,
+                              top_right.y - top_left.y + bottom_left.y};
+    Point corners[2][4] = {
+        {{3.5, 3.5}, {far, 3.5}, {3.5, far}, {far, far}},
+        {top_left, top_right, bottom_left, parallelogram}};
+    // 版2以上は右下の位置合わせパターン (中心は端から6.5モジュール) を使う
+    Point alignments[MAX_ALIGNMENT_CANDIDATES];
+    int alignment_count = 0;
+    if (dimension > symbol_size(1)) {
+      const double modules_between = dimension - 7;
+      const double pitch = across / modules_between;
+      // 傾いた格子を行・列で横切ると1モジュールが長く見える
+      const double run =
+          pitch * distance(top_left, top_right) /
+          std::max(std::abs(top_right.x - top_left.x),
+                   std::abs(top_right.y - top_left.y));
+      const double correction = 1 - 3 / modules_between;
+      const Point estimate{
+          top_left.x + correction * (parallelogram.x - top_left.x),
+          top_left.y + correction * (parallelogram.y - top_left.y)};
+      for (float allowance : {4.0f, 8.0f, 16.0f}) {
+        alignment_count = find_alignments(
+            bitmap, estimate, static_cast<float>(run),
+            allowance * static_cast<float>(pitch), alignments);
+        if (alignment_count > 0) {
+          break;
+        }
+      }
+    }
+    // 位置合わせパターンの候補を順に、最後に平行四辺形の角を試す
+    for (int attempt = 0; attempt <= alignment_count; attempt++) {
+      if (attempt < alignment_count) {
+        corners[0][3] = {dimension - 6.5, dimension - 6.5};
+        corners[1][3] = alignments[attempt];
+      } else {
+        corners[0][3] = {far, far};
+        corners[1][3] = parallelogram;
+      }
+      Perspective transform;
+      if (!solve_perspective(corners[0], corners[1], transform)) {
+        continue;
+      }
+      sample_grid(bitmap, transform, dimension, out.symbol);
+      // 版7以上なら型番情報が読めれば一辺が分かる。推定と違えば次に試す
+      const int hinted = read_version_information(
+          out.symbol.modules.data(), dimension, out.symbol.words_per_row);
+      if (hinted != 0 && dimension_count < MAX_DIMENSION_TRIES &&
+          std::find(dimensions, dimensions + dimension_count,
+                    symbol_size(hinted)) == dimensions + dimension_count) {
+        std::copy_backward(dimensions + d + 1, dimensions + dimension_count,
+                           dimensions + dimension_count + 1);
+        dimensions[d + 1] = symbol_size(hinted);
+        dimension_count++;
+      }
+      decode_symbol(out.symbol, out.decoded);
+      if (out.decoded.ok()) {
+        out.symbol.error_correction_level = out.decoded.error_correction_level;
+        out.symbol.mask_pattern = out.decoded.mask_pattern;
+        return;
+      }
+    }
+  }
+  // どの射影も解けなければ decode_symbol() は一度も呼ばれていない。
+  // 空の理由で投げると ok() が成功を返してしまう
+  throw std::runtime_error(out.decoded.error.empty()
+                               ? "No perspective transform found"
+                               : out.decoded.error);
+}
+}  // namespace
+
+void scan_image(const GrayImage& image, ScanScratch& scratch,
+                ScanResult& out) {
+  out.decoded.error.clear();
+  try {
+    scan(image, scratch, out);
+  } catch (const std::exception& e) {
+    out.symbol.setError(e.what());
+    out.decoded.version = 0;
+    out.decoded.text.clear();
+    out.decoded.error = e.what();
+  }
+}
+
+ScanResult scan_image(const GrayImage& image) {
+  ScanScratch scratch;
+  ScanResult result;
+  scan_image(image, scratch, result);
+  return result;
+}
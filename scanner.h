@@ -0,0 +1,89 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "decoder.h"
+#include "qr.h"
+
+// Reads a symbol back from a scanned or rendered image:
+//   1. local-threshold binarisation over 8x8 pixel blocks,
+//   2. finder pattern search: every scanned row is turned into run lengths
+//      from a SIMD transition mask and tested for 1:1:3:1:1, then confirmed
+//      by vertical and horizontal cross-checks,
+//   3. a perspective transform from the three finders and the bottom-right
+//      alignment pattern (or the parallelogram corner for version 1),
+//   4. sampling every module centre into a Symbol and decode_matrix(); the
+//      size estimated from the finders is corrected from the version
+//      information when the first guess is off.
+// One symbol per image, upright or rotated by any angle; mirrored symbols are
+// not read.
+
+// 8-bit grayscale pixels, row-major, 0 = black (the PGM convention).
+struct GrayImage {
+  int width = 0;
+  int height = 0;
+  std::vector<u_int8_t> pixels;
+
+  const u_int8_t* row(int y) const {
+    return pixels.data() + static_cast<size_t>(y) * width;
+  }
+  u_int8_t* row(int y) {
+    return pixels.data() + static_cast<size_t>(y) * width;
+  }
+};
+
+// Parses a binary PGM ("P5", maxval up to 255) or PBM ("P4") file such as
+// render_image() writes, comments included. Throws std::invalid_argument when
+// `data` is not such a file.
+void read_netpbm(std::string_view data, GrayImage& out);
+GrayImage read_netpbm(std::string_view data);
+
+// Centre of a finder pattern in pixels (x: column, y: row).
+struct FinderPattern {
+  float x = 0;
+  float y = 0;
+  float module_size = 0;
+  int hits = 0;  // 検出した走査の数
+};
+
+// Buffers reused across scans by one thread.
+struct ScanScratch {
+  std::vector<u_int8_t> binary;  // binarize() の結果
+  // binarize() の作業域: ブロックごとの代表値と閾値、1行分の閾値
+  std::vector<u_int8_t> block_averages;
+  std::vector<u_int8_t> block_thresholds;
+  std::vector<u_int8_t> threshold_row;
+  std::vector<int> transitions;
+  std::vector<FinderPattern> candidates;
+};
+
+// Fills scratch.binary with one byte per pixel, 1 where the pixel is darker
+// than the mean of the 5x5 blocks of 8x8 pixels around it. Flat blocks
+// follow their neighbours, so quiet zones and gradients do not turn into
+// noise. Allocates only while the image grows.
+void binarize(const GrayImage& image, ScanScratch& scratch);
+
+struct ScanResult {
+  // top-left, top-right and bottom-left as seen in the symbol
+  FinderPattern finders[3];
+  Symbol symbol;  // the sampled module matrix
+  DecodeResult decoded;
+
+  bool ok() const { return decoded.ok(); }
+};
+
+// Finds, samples and decodes the symbol in `image`. Errors (nothing found,
+// unreadable) are reported through out.decoded.error, not thrown.
+void scan_image(const GrayImage& image, ScanScratch& scratch, ScanResult& out);
+ScanResult scan_image(const GrayImage& image);
+
+// "sse2" or "scalar"
+const char* scan_kernel_name();
+
+#endif  // SCANNER_H
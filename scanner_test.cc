@@ -0,0 +1,212 @@
+#include "scanner.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "render.h"
+
+namespace {
+using namespace std::literals;
+
+GrayImage render_gray(const Symbol& symbol, int scale) {
+  std::string pgm;
+  render_image(symbol, ImageFormat::PGM, RenderOptions{scale, 4}, pgm);
+  return read_netpbm(pgm);
+}
+
+// 紙に印刷して撮ったような画像: 回転・台形の歪み・照明のむら・雑音
+struct Distortion {
+  double degrees = 0;
+  double keystone = 0;  // 上辺を縮める割合
+  int noise = 0;        // 画素ごとの一様雑音の振幅
+  double shading = 0;   // 左上から右下への減光の割合
+};
+
+GrayImage distort(const GrayImage& source, const Distortion& d,
+                  unsigned seed) {
+  std::mt19937 random(seed);
+  const int canvas =
+      static_cast<int>(std::max(source.width, source.height) * 1.5);
+  GrayImage out;
+  out.width = out.height = canvas;
+  out.pixels.resize(static_cast<size_t>(canvas) * canvas);
+  const double angle = d.degrees * M_PI / 180;
+  const double c = std::cos(angle), s = std::sin(angle);
+  for (int y = 0; y < canvas; y++) {
+    for (int x = 0; x < canvas; x++) {
+      // 出力の画素から元画像の座標へ逆にたどる
+      double u = x + 0.5 - canvas / 2.0;
+      double v = y + 0.5 - canvas / 2.0;
+      const double rx = c * u + s * v;
+      const double ry = -s * u + c * v;
+      // 下辺に近づくほど手前に来るように傾けた射影
+      const double w = 1 + d.keystone * ry / canvas;
+      const double sx = rx / w + source.width / 2.0;
+      const double sy = ry / w + source.height / 2.0;
+      double value = 255;
+      if (0 <= sx && sx < source.width && 0 <= sy && sy < source.height) {
+        value = source.row(static_cast<int>(sy))[static_cast<int>(sx)];
+      }
+      value = value * (1 - d.shading * (x + y) / (2.0 * canvas)) + 20;
+      if (d.noise > 0) {
+        value += static_cast<int>(random() % (2 * d.noise + 1)) - d.noise;
+      }
+      out.row(y)[x] =
+          static_cast<u_int8_t>(std::clamp(static_cast<int>(value), 0, 255));
+    }
+  }
+  return out;
+}
+
+void expect_scans(const GrayImage& image, const std::string& payload,
+                  const std::string& label) {
+  ScanResult result = scan_image(image);
+  ASSERT_TRUE(result.ok()) << label << ": " << result.decoded.error;
+  EXPECT_EQ(payload, result.decoded.text) << label;
+}
+
+TEST(ScannerTest, Netpbm) {
+  Symbol symbol = encode_symbol("HELLO WORLD", EncodeOptions{M});
+  std::string pbm;
+  render_image(symbol, ImageFormat::PBM, RenderOptions{2, 1}, pbm);
+  GrayImage from_pbm = read_netpbm(pbm);
+  GrayImage from_pgm = render_gray(symbol, 2);
+  ASSERT_EQ(46, from_pbm.width);
+  ASSERT_EQ(46, from_pbm.height);
+  EXPECT_EQ(0, from_pbm.row(2)[2]);
+  EXPECT_EQ(255, from_pbm.row(0)[0]);
+  EXPECT_EQ(from_pgm.width - 6 * 2, from_pbm.width);
+
+  GrayImage commented =
+      read_netpbm("P5\n# scanner 3\n2 1 # size\n15\n\x0f\x00"sv);
+  ASSERT_EQ(2, commented.width);
+  EXPECT_EQ(255, commented.pixels[0]);
+  EXPECT_EQ(0, commented.pixels[1]);
+
+  EXPECT_THROW(read_netpbm("P6\n1 1\n255\n\0\0\0"sv), std::invalid_argument);
+  EXPECT_THROW(read_netpbm("P5\n4 4\n255\n\x01"), std::invalid_argument);
+  EXPECT_THROW(read_netpbm("P5\nx"), std::invalid_argument);
+}
+
+TEST(ScannerTest, Binarize) {
+  // 右へ行くほど明るくなる背景に暗い縞。縞だけが暗くなる
+  GrayImage image;
+  image.width = 96;
+  image.height = 64;
+  image.pixels.resize(96 * 64);
+  for (int y = 0; y < 64; y++) {
+    for (int x = 0; x < 96; x++) {
+      const int background = 130 + x;
+      image.row(y)[x] = (x / 4) % 4 == 0 ? background - 100 : background;
+    }
+  }
+  ScanScratch scratch;
+  binarize(image, scratch);
+  for (int y = 0; y < 64; y++) {
+    for (int x = 0; x < 96; x++) {
+      ASSERT_EQ((x / 4) % 4 == 0, scratch.binary[y * 96 + x] != 0)
+          << x << ", " << y << " " << scan_kernel_name();
+    }
+  }
+}
+
+TEST(ScannerTest, ReadsRenderedSymbols) {
+  const std::string payloads[] = {
+      "HELLO WORLD", "https://example.com/label/0001?lot=A7",
+      std::string(300, '7') + "ABC", std::string(900, 'Z')};
+  for (const std::string& payload : payloads) {
+    for (int scale : {2, 5}) {
+      Symbol symbol = encode_symbol(payload, {Q, 0, AUTO_MASK, AUTO_MODE});
+      ASSERT_TRUE(symbol.ok()) << symbol.error;
+      const std::string label =
+          "v" + std::to_string(symbol.version) + " x" + std::to_string(scale);
+      ScanResult result = scan_image(render_gray(symbol, scale));
+      ASSERT_TRUE(result.ok()) << label << ": " << result.decoded.error;
+      EXPECT_EQ(payload, result.decoded.text) << label;
+      EXPECT_EQ(symbol.modules, result.symbol.modules) << label;
+      EXPECT_EQ(Q, result.symbol.error_correction_level);
+    }
+  }
+}
+
+TEST(ScannerTest, RotatedNoisyAndSkewed) {
+  const std::string payload = "https://example.com/audit/2026-10/0042";
+  for (ErrorCorrectionLevel ecl : {L, H}) {
+    Symbol symbol = encode_symbol(payload, {ecl, 0, AUTO_MASK, AUTO_MODE});
+    const GrayImage image = render_gray(symbol, 6);
+    for (double degrees : {0.0, 12.0, 45.0, 90.0, 163.0, 270.0, 311.0}) {
+      Distortion d;
+      d.degrees = degrees;
+      d.noise = 40;
+      d.shading = 0.5;
+      expect_scans(distort(image, d, static_cast<unsigned>(degrees)), payload,
+                   "ecl " + std::to_string(ecl) + " rotated " +
+                       std::to_string(degrees));
+    }
+    Distortion skew;
+    skew.degrees = 8;
+    skew.keystone = 0.12;
+    skew.noise = 20;
+    expect_scans(distort(image, skew, 1), payload, "keystone");
+  }
+}
+
+TEST(ScannerTest, ReportsMissingSymbol) {
+  GrayImage blank;
+  blank.width = 200;
+  blank.height = 120;
+  blank.pixels.assign(200 * 120, 230);
+  ScanResult result = scan_image(blank);
+  EXPECT_FALSE(result.ok());
+  EXPECT_FALSE(result.symbol.ok());
+
+  GrayImage empty;
+  EXPECT_FALSE(scan_image(empty).ok());
+}
+
+TEST(ScannerTest, ReportsFindersWithoutSymbol) {
+  // ファインダパターンだけの版2相当の配置。見つかっても読めない
+  constexpr int SCALE = 4;
+  constexpr int QUIET = 8;
+  constexpr int SIZE = 25;
+  GrayImage image;
+  image.width = image.height = (SIZE + 2 * QUIET) * SCALE;
+  image.pixels.assign(static_cast<size_t>(image.width) * image.height, 235);
+  for (const auto [fx, fy] : {std::pair{0, 0}, std::pair{SIZE - 7, 0},
+                              std::pair{0, SIZE - 7}}) {
+    for (int x = 0; x < 7; x++) {
+      for (int y = 0; y < 7; y++) {
+        const int ring = std::max(std::abs(x - 3), std::abs(y - 3));
+        if (ring == 2) {
+          continue;
+        }
+        for (int py = 0; py < SCALE; py++) {
+          u_int8_t* row = image.row((QUIET + fy + y) * SCALE + py);
+          std::fill_n(row + (QUIET + fx + x) * SCALE, SCALE, 20);
+        }
+      }
+    }
+  }
+
+  // 読めた結果を入れた ScanResult と ScanScratch を使い回しても成功にならない
+  ScanScratch scratch;
+  ScanResult result;
+  Symbol symbol = encode_symbol("HELLO", {M, 0, AUTO_MASK, AUTO_MODE});
+  scan_image(render_gray(symbol, 3), scratch, result);
+  ASSERT_TRUE(result.ok()) << result.decoded.error;
+
+  scan_image(image, scratch, result);
+  EXPECT_FALSE(result.ok());
+  EXPECT_FALSE(result.decoded.error.empty());
+  EXPECT_NE("No finder patterns found", result.decoded.error);
+  EXPECT_TRUE(result.decoded.text.empty());
+  EXPECT_FALSE(result.symbol.ok());
+}
+}  // namespace
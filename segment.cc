@@ -0,0 +1,37 @@
+#include "segment.h"
+
+#include <stdexcept>
+#include <string>
+
+void optimal_segments(std::string_view s, int version,
+                      std::vector<Segment>& out) {
+  std::vector<u_int8_t> work;
+  optimal_segments(s, version, work, out);
+}
+
+std::vector<Segment> optimal_segments(std::string_view s, int version) {
+  std::vector<Segment> result;
+  optimal_segments(s, version, result);
+  return result;
+}
+
+int select_version_segments(std::string_view s,
+                            ErrorCorrectionLevel correction_level,
+                            std::vector<Segment>& segments) {
+  std::vector<u_int8_t> work;
+  return select_version_segments(s, correction_level, work, segments);
+}
+
+int select_version_segments(std::string_view s,
+                            ErrorCorrectionLevel correction_level,
+                            std::vector<u_int8_t>& work,
+                            std::vector<Segment>& segments) {
+  const int version =
+      find_version_segments(s, correction_level, work, segments);
+  if (version == 0) {
+    throw EncodeError(REJECT_CAPACITY, "Input string is too long (" +
+                                           std::to_string(s.size()) +
+                                           " characters)");
+  }
+  return version;
+}
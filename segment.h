@@ -0,0 +1,170 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "char_class.h"
+#include "qr.h"
+
+// The constexpr functions below also run at compile time: qr::make
+// (qr_static.h) segments with the same DP as encode_symbol().
+
+// Header plus data bits of one segment at `version`.
+constexpr u_int32_t segment_bits(const Segment& segment, int version) {
+  return 4 + char_count_bits(segment.mode_specifier, version) +
+         encoded_data_bits(segment.length, segment.mode_specifier);
+}
+constexpr u_int32_t segments_bits(const std::vector<Segment>& segments,
+                                  int version) {
+  u_int32_t total = 0;
+  for (const Segment& segment : segments) {
+    total += segment_bits(segment, version);
+  }
+  return total;
+}
+
+// Splits `s` into numeric, alphanumeric and byte segments so that the total
+// bit length at `version` is minimal. Linear-time DP over the three modes;
+// switching modes costs the 4-bit mode indicator plus the version-dependent
+// character count indicator. Segments longer than their count indicator
+// allows are split. The result only depends on the version range (1-9,
+// 10-26, 27-40). The DP tables live in `work` (4 bytes per character;
+// capacity is kept, so a reused buffer makes this allocation free).
+constexpr void optimal_segments(std::string_view s, int version,
+                                std::vector<u_int8_t>& work,
+                                std::vector<Segment>& out) {
+  // 候補のモード (DPの状態の順)
+  constexpr ModeSpecifier MODES[3] = {NUMBER_MODE, ALNUM_MODE, BYTE_MODE};
+  // 1文字あたりのビット数の6倍 (数字 10/3, 英数字 11/2, バイト 8)
+  constexpr u_int32_t CHAR_COST[3] = {20, 33, 48};
+  // char_class() のうち各モードで符号化できることを示すビット
+  constexpr u_int8_t MODE_CLASS[3] = {CHAR_NUMERIC, CHAR_ALNUM, 0};
+  constexpr u_int32_t INFINITE = ~u_int32_t{0} / 2;
+  out.clear();
+  const size_t n = s.size();
+  if (n == 0) {
+    return;
+  }
+  u_int32_t header[3] = {};
+  for (int m = 0; m < 3; m++) {
+    header[m] = (4 + char_count_bits(MODES[m], version)) * 6;
+  }
+  // cost[m]: 先頭から i 文字を、最後の文字をモード m で符号化したときの最小
+  // ビット数(の6倍, 端数あり)。from[i * 3 + m]: そのときの i-1 文字目のモード
+  work.resize(4 * n);
+  u_int8_t* classes = work.data();
+  u_int8_t* from = work.data() + n;
+  if (std::is_constant_evaluated()) {
+    classify_chars_scalar(s, classes);
+  } else {
+    classify_chars(s, classes);
+  }
+  u_int32_t cost[3] = {header[0], header[1], header[2]};
+  for (size_t i = 0; i < n; i++) {
+    u_int32_t next[3] = {};
+    for (int m = 0; m < 3; m++) {
+      next[m] = INFINITE;
+      if ((classes[i] & MODE_CLASS[m]) != MODE_CLASS[m]) {
+        continue;
+      }
+      // 同じモードを続けるか、端数を切り上げて新しい区間を始める
+      u_int32_t best = cost[m];
+      u_int8_t best_from = static_cast<u_int8_t>(m);
+      for (int k = 0; k < 3; k++) {
+        if (k == m || cost[k] >= INFINITE || i == 0) {
+          continue;
+        }
+        u_int32_t switched = (cost[k] + 5) / 6 * 6 + header[m];
+        if (switched < best) {
+          best = switched;
+          best_from = static_cast<u_int8_t>(k);
+        }
+      }
+      next[m] = best + CHAR_COST[m];
+      from[i * 3 + m] = best_from;
+    }
+    std::copy(next, next + 3, cost);
+  }
+
+  int mode = static_cast<int>(std::min_element(cost, cost + 3) - cost);
+  // 末尾から辿って区間に分ける
+  size_t end = n;
+  for (size_t i = n; i-- > 0;) {
+    int previous = from[i * 3 + mode];
+    if (i == 0 || previous != mode) {
+      out.push_back({MODES[mode], static_cast<u_int32_t>(i),
+                     static_cast<u_int32_t>(end - i)});
+      end = i;
+      mode = previous;
+    }
+  }
+  std::reverse(out.begin(), out.end());
+
+  // 文字数指示子に収まらない区間は分割する
+  for (size_t i = 0; i < out.size(); i++) {
+    const u_int32_t limit =
+        (u_int32_t{1} << char_count_bits(out[i].mode_specifier, version)) - 1;
+    if (out[i].length > limit) {
+      Segment rest = out[i];
+      rest.begin += limit;
+      rest.length -= limit;
+      out[i].length = limit;
+      out.insert(out.begin() + i + 1, rest);
+    }
+  }
+}
+void optimal_segments(std::string_view s, int version,
+                      std::vector<Segment>& out);
+std::vector<Segment> optimal_segments(std::string_view s, int version);
+
+// Appends every segment (mode indicator, count, data) of `s` to `out`.
+constexpr void append_segments(std::string_view s,
+                               const std::vector<Segment>& segments,
+                               int version, BitBuffer& out) {
+  for (const Segment& segment : segments) {
+    append_mode_header(segment.mode_specifier, segment.length, version, out);
+    append_data_bits(s.substr(segment.begin, segment.length),
+                     segment.mode_specifier, out);
+  }
+}
+
+// The smallest version at `correction_level` whose optimal segmentation of
+// `s` fits, with that segmentation in `segments`; 0 when even version 40 is
+// too small.
+constexpr int find_version_segments(std::string_view s,
+                                    ErrorCorrectionLevel correction_level,
+                                    std::vector<u_int8_t>& work,
+                                    std::vector<Segment>& segments) {
+  // 各版の範囲で文字数指示子の長さは同じなので代表の版で計算する
+  constexpr int RANGE_FIRST_VERSION[3] = {1, 10, 27};
+  constexpr int RANGE_LAST_VERSION[3] = {9, 26, 40};
+  for (int range = 0; range < 3; range++) {
+    optimal_segments(s, RANGE_FIRST_VERSION[range], work, segments);
+    const u_int32_t bits = segments_bits(segments, RANGE_FIRST_VERSION[range]);
+    for (int version = RANGE_FIRST_VERSION[range];
+         version <= RANGE_LAST_VERSION[range]; version++) {
+      if (bits <= static_cast<u_int32_t>(
+                      data_codewords(version, correction_level)) *
+                      8) {
+        return version;
+      }
+    }
+  }
+  return 0;
+}
+
+// Same, but throws std::invalid_argument if even version 40 is too small.
+int select_version_segments(std::string_view s,
+                            ErrorCorrectionLevel correction_level,
+                            std::vector<Segment>& segments);
+int select_version_segments(std::string_view s,
+                            ErrorCorrectionLevel correction_level,
+                            std::vector<u_int8_t>& work,
+                            std::vector<Segment>& segments);
+
+#endif  // SEGMENT_H
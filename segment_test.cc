@@ -0,0 +1,139 @@
+#include "segment.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+std::string bit_string(const BitBuffer& bits) {
+  std::string result;
+  for (size_t i = 0; i < bits.size(); i++) {
+    result += bits[i] ? '1' : '0';
+  }
+  return result;
+}
+
+TEST(SegmentTest, NumericAndByteBits) {
+  BitBuffer numeric;
+  append_data_bits("01234567", NUMBER_MODE, numeric);
+  // ISO/IEC 18004 7.4.3 の例: 012 345 67
+  EXPECT_EQ(bit_string(numeric), "0000001100" "0101011001" "1000011");
+  BitBuffer single;
+  append_numeric_bits("8", single);
+  EXPECT_EQ(bit_string(single), "1000");
+  EXPECT_THROW(append_numeric_bits("12a", single), std::invalid_argument);
+
+  BitBuffer bytes;
+  append_data_bits("a\xE3", BYTE_MODE, bytes);
+  EXPECT_EQ(bit_string(bytes), "01100001" "11100011");
+  EXPECT_EQ(encoded_data_bits(8, NUMBER_MODE), numeric.size());
+}
+
+// Cheapest bit length over every assignment of modes to characters.
+u_int32_t brute_force_bits(const std::string& s, int version) {
+  const ModeSpecifier modes[3] = {NUMBER_MODE, ALNUM_MODE, BYTE_MODE};
+  u_int32_t best = ~0u;
+  std::vector<int> choice(s.size());
+  for (;;) {
+    std::vector<Segment> segments;
+    bool valid = true;
+    for (size_t i = 0; i < s.size(); i++) {
+      ModeSpecifier mode = modes[choice[i]];
+      if ((mode == NUMBER_MODE && !std::isdigit(s[i])) ||
+          (mode == ALNUM_MODE && !ALNUM_MODE_CHAR_MAPPING.count(s[i]))) {
+        valid = false;
+        break;
+      }
+      if (!segments.empty() && segments.back().mode_specifier == mode) {
+        segments.back().length++;
+      } else {
+        segments.push_back({mode, static_cast<u_int32_t>(i), 1});
+      }
+    }
+    if (valid) {
+      best = std::min(best, segments_bits(segments, version));
+    }
+    size_t i = 0;
+    while (i < choice.size() && ++choice[i] == 3) {
+      choice[i++] = 0;
+    }
+    if (i == choice.size()) {
+      return best;
+    }
+  }
+}
+
+TEST(SegmentTest, OptimalAgainstBruteForce) {
+  std::mt19937 random(7);
+  const std::string alphabet = "0123456789ABC-/a";
+  for (int trial = 0; trial < 200; trial++) {
+    std::string s;
+    int length = 1 + trial % 7;
+    for (int i = 0; i < length; i++) {
+      // 数字が多めになるように偏らせる
+      s += alphabet[random() % 3 == 0 ? random() % alphabet.size()
+                                      : random() % 10];
+    }
+    for (int version : {1, 10, 27}) {
+      auto segments = optimal_segments(s, version);
+      u_int32_t covered = 0;
+      for (const Segment& segment : segments) {
+        ASSERT_EQ(segment.begin, covered);
+        covered += segment.length;
+      }
+      ASSERT_EQ(covered, s.size());
+      ASSERT_EQ(segments_bits(segments, version), brute_force_bits(s, version))
+          << s << " @ " << version;
+    }
+  }
+}
+
+TEST(SegmentTest, MixedInputsGetSmaller) {
+  struct Case {
+    std::string payload;
+    ModeSpecifier single_mode;
+  };
+  const Case cases[] = {
+      {"ORDER-2026/0000012345", ALNUM_MODE},
+      {"https://example.com/track?id=12345678901234567890123456789012",
+       BYTE_MODE},
+  };
+  for (const auto& c : cases) {
+    int single = select_version(c.payload, c.single_mode, M);
+    int mixed = select_version(c.payload, AUTO_MODE, M);
+    EXPECT_LE(mixed, single) << c.payload;
+    auto segments = optimal_segments(c.payload, mixed);
+    EXPECT_GT(segments.size(), 1u);
+    EXPECT_LT(segments_bits(segments, mixed),
+              segment_bits({c.single_mode, 0, static_cast<u_int32_t>(
+                                                   c.payload.size())},
+                           mixed));
+    EXPECT_EQ(segments.back().mode_specifier, NUMBER_MODE);
+
+    // 混在モードの符号化はシンボル全体で正しく収まる
+    Symbol symbol = encode_symbol(c.payload, EncodeOptions{M, 0, AUTO_MASK,
+                                                           AUTO_MODE});
+    ASSERT_TRUE(symbol.ok()) << symbol.error;
+    EXPECT_EQ(symbol.version, mixed);
+  }
+  EXPECT_LT(select_version("ORDER-2026/0000012345", AUTO_MODE, M),
+            select_version("ORDER-2026/0000012345", ALNUM_MODE, M));
+  EXPECT_EQ(select_version("", AUTO_MODE, H), 1);
+}
+
+TEST(SegmentTest, SplitsAtCountLimit) {
+  // バージョン1-9のバイトモードの文字数指示子は8ビット
+  std::string s(600, 'x');
+  auto segments = optimal_segments(s, 1);
+  ASSERT_EQ(segments.size(), 3u);
+  EXPECT_EQ(segments[0].length, 255u);
+  EXPECT_EQ(segments[1].begin, 255u);
+  EXPECT_EQ(segments[2].length, 90u);
+  BitBuffer bits;
+  append_segments(s, segments, 1, bits);
+  EXPECT_EQ(bits.size(), segments_bits(segments, 1));
+  EXPECT_EQ(optimal_segments(s, 10).size(), 1u);
+}
+}  // namespace
@@ -0,0 +1,625 @@
+#include "server.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "stream.h"
+#include "svg.h"
+#include "symbol_cache.h"
+
+namespace {
+void put_u32(u_int32_t value, char* out) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+u_int32_t get_u32(const char* in) {
+  u_int32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<u_int32_t>(static_cast<u_int8_t>(in[i])) << (8 * i);
+  }
+  return value;
+}
+
+std::runtime_error system_error(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+sockaddr_un socket_address(const std::string& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("invalid socket path: " + path);
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+  return address;
+}
+
+// 枠の長さを書き戻せるよう、本体の前に4バイト空けておく
+size_t begin_frame(std::string& out) {
+  const size_t offset = out.size();
+  out.resize(offset + FRAME_HEADER_SIZE);
+  return offset;
+}
+
+void end_frame(size_t offset, std::string& out) {
+  put_u32(static_cast<u_int32_t>(out.size() - offset - FRAME_HEADER_SIZE),
+          out.data() + offset);
+}
+
+constexpr int MAX_EVENTS = 64;
+constexpr size_t READ_SIZE = 1 << 16;
+constexpr u_int64_t LISTENER = 0;
+constexpr u_int64_t STOP_EVENT = 1;
+}  // namespace
+
+size_t complete_frame_size(std::string_view buffer) {
+  if (buffer.size() < FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  const size_t size = FRAME_HEADER_SIZE + get_u32(buffer.data());
+  return buffer.size() >= size ? size : 0;
+}
+
+void append_request(const ServeRequest& request, std::string& out) {
+  const size_t offset = begin_frame(out);
+  char header[SERVE_REQUEST_HEADER_SIZE];
+  put_u32(request.id, header);
+  header[4] = static_cast<char>(request.encode.error_correction_level);
+  header[5] = static_cast<char>(request.encode.version);
+  header[6] = static_cast<char>(request.encode.mask_byte == AUTO_MASK
+                                    ? SERVE_AUTO
+                                    : request.encode.mask_byte);
+  header[7] = static_cast<char>(request.encode.mode_specifier);
+  header[8] = static_cast<char>(request.format);
+  header[9] = static_cast<char>(request.render.scale);
+  header[10] = static_cast<char>(request.render.quiet_zone);
+  header[11] = 0;
+  out.append(header, sizeof(header));
+  out += request.payload;
+  end_frame(offset, out);
+}
+
+void parse_request(std::string_view body, ServeRequest& request,
+                   int max_image_side) {
+  if (body.size() < 4) {
+    throw std::invalid_argument("request without an id");
+  }
+  request.id = get_u32(body.data());
+  if (body.size() < SERVE_REQUEST_HEADER_SIZE) {
+    throw std::invalid_argument("request header is too short");
+  }
+  const auto* header = reinterpret_cast<const u_int8_t*>(body.data());
+  if (header[4] > H) {
+    throw EncodeError(REJECT_OPTION, "unknown error correction level");
+  }
+  if (header[8] > static_cast<u_int8_t>(ServeFormat::METRICS_JSON)) {
+    throw EncodeError(REJECT_OPTION, "unknown output format");
+  }
+  if (header[6] != SERVE_AUTO && header[6] > 0b111) {
+    throw EncodeError(REJECT_OPTION,
+                      "unknown mask " + std::to_string(header[6]));
+  }
+  if (header[9] < 1) {
+    throw EncodeError(REJECT_OPTION, "scale must be >= 1");
+  }
+  const auto format = static_cast<ServeFormat>(header[8]);
+  if (format == ServeFormat::PBM || format == ServeFormat::PGM ||
+      format == ServeFormat::PNG) {
+    // 版が自動なら最大の版で見積もる。u8 同士の積でも int に収まる
+    const int version =
+        header[5] == 0 ? MAX_VERSION : std::min<int>(header[5], MAX_VERSION);
+    const int side = (symbol_size(version) + 2 * header[10]) * header[9];
+    if (side > max_image_side) {
+      throw EncodeError(REJECT_OPTION,
+                        "image would be " + std::to_string(side) +
+                            " pixels wide (limit " +
+                            std::to_string(max_image_side) + ")");
+    }
+  }
+  request.encode = {static_cast<ErrorCorrectionLevel>(header[4]), header[5],
+                    header[6] == SERVE_AUTO ? AUTO_MASK : header[6],
+                    header[7]};
+  request.format = format;
+  request.render.scale = header[9];
+  request.render.quiet_zone = header[10];
+  request.payload = body.substr(SERVE_REQUEST_HEADER_SIZE);
+}
+
+void append_response(u_int32_t id, const Symbol& symbol, ServeFormat format,
+                     const RenderOptions& render, std::string& out) {
+  if (format == ServeFormat::METRICS || format == ServeFormat::METRICS_JSON) {
+    append_metrics_response(id, format, out);
+    return;
+  }
+  const size_t offset = begin_frame(out);
+  char header[SERVE_RESPONSE_HEADER_SIZE];
+  put_u32(id, header);
+  header[4] = symbol.ok() ? 0 : 1;
+  header[5] = static_cast<char>(symbol.version);
+  header[6] = static_cast<char>(symbol.error_correction_level);
+  header[7] = static_cast<char>(symbol.mask_pattern);
+  out.append(header, sizeof(header));
+  if (!symbol.ok()) {
+    out += symbol.error;
+  } else {
+    StageTimer timer(RENDER_METRIC);
+    const size_t output = out.size();
+    switch (format) {
+      case ServeFormat::MATRIX:
+        append_packed_rows(symbol, out);
+        break;
+      case ServeFormat::PBM:
+        render_image(symbol, ImageFormat::PBM, render, out);
+        break;
+      case ServeFormat::PGM:
+        render_image(symbol, ImageFormat::PGM, render, out);
+        break;
+      case ServeFormat::PNG:
+        render_image(symbol, ImageFormat::PNG, render, out);
+        break;
+      case ServeFormat::SVG: {
+        SvgOptions svg;
+        svg.quiet_zone = render.quiet_zone;
+        render_svg(module_matrix(symbol), svg, out);
+        break;
+      }
+      case ServeFormat::METRICS:  // 上で append_metrics_response() へ回す
+      case ServeFormat::METRICS_JSON:
+        break;
+    }
+    count_bytes_out(out.size() - output);
+  }
+  end_frame(offset, out);
+}
+
+void append_metrics_response(u_int32_t id, ServeFormat format,
+                             std::string& out) {
+  const size_t offset = begin_frame(out);
+  char header[SERVE_RESPONSE_HEADER_SIZE] = {};
+  put_u32(id, header);
+  out.append(header, sizeof(header));
+  const MetricsSnapshot snapshot = metrics_snapshot();
+  if (format == ServeFormat::METRICS_JSON) {
+    append_metrics_json(snapshot, out);
+  } else {
+    append_prometheus(snapshot, out);
+  }
+  end_frame(offset, out);
+}
+
+void parse_response(std::string_view body, ServeResponse& response) {
+  if (body.size() < SERVE_RESPONSE_HEADER_SIZE) {
+    throw std::invalid_argument("response header is too short");
+  }
+  const auto* header = reinterpret_cast<const u_int8_t*>(body.data());
+  response.id = get_u32(body.data());
+  response.ok = header[4] == 0;
+  response.version = header[5];
+  response.error_correction_level = header[6];
+  response.mask_pattern = static_cast<int8_t>(header[7]);
+  response.data = body.substr(SERVE_RESPONSE_HEADER_SIZE);
+}
+
+EncodeServer::EncodeServer(const ServeOptions& options)
+    : options(options),
+      next_serial(STOP_EVENT + 1),
+      pool(options.threads),
+      scratch(pool.threadCount()),
+      symbols(pool.threadCount()) {
+  const sockaddr_un address = socket_address(options.socket_path);
+  std::error_code ignored;
+  if (std::filesystem::is_socket(options.socket_path, ignored)) {
+    std::filesystem::remove(options.socket_path, ignored);
+  }
+  listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  epoll = ::epoll_create1(EPOLL_CLOEXEC);
+  stop_event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (listener < 0 || epoll < 0 || stop_event < 0 ||
+      ::bind(listener, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(listener, SOMAXCONN) != 0) {
+    const std::runtime_error error =
+        system_error("cannot listen on " + options.socket_path);
+    for (int fd : {listener, epoll, stop_event}) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+    throw error;
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = LISTENER;
+  ::epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+  event.data.u64 = STOP_EVENT;
+  ::epoll_ctl(epoll, EPOLL_CTL_ADD, stop_event, &event);
+}
+
+EncodeServer::~EncodeServer() {
+  for (auto& [serial, connection] : connections) {
+    ::close(connection.fd);
+  }
+  for (int fd : {listener, epoll, stop_event}) {
+    ::close(fd);
+  }
+  ::unlink(options.socket_path.c_str());
+}
+
+void EncodeServer::stop() {
+  stopping.store(true);
+  const u_int64_t one = 1;
+  [[maybe_unused]] ssize_t n = ::write(stop_event, &one, sizeof(one));
+}
+
+void EncodeServer::run() {
+  epoll_event events[MAX_EVENTS];
+  while (!stopping.load()) {
+    // 待ちがあれば溜まった分だけ読んで、すぐ符号化に回す
+    const int n =
+        ::epoll_wait(epoll, events, MAX_EVENTS, pending.empty() ? -1 : 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw system_error("epoll_wait failed");
+    }
+    for (int i = 0; i < n; i++) {
+      const u_int64_t serial = events[i].data.u64;
+      if (serial == LISTENER) {
+        accept_connections();
+        continue;
+      }
+      if (serial == STOP_EVENT) {
+        return;
+      }
+      auto found = connections.find(serial);
+      if (found == connections.end()) {
+        continue;
+      }
+      Connection& connection = found->second;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        if (!(events[i].events & EPOLLIN)) {
+          close_connection(serial);
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLOUT) {
+        write_to(connection);
+        if (connection.finished()) {
+          close_connection(serial);
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLIN) {
+        read_from(serial, connection);
+      } else if (may_read(connection)) {
+        // 書き出しが進んで受信を再開できる。読み溜めた枠から処理する
+        parse_frames(serial, connection);
+      }
+      if (connections.count(serial) != 0) {
+        update_interest(serial, connection);
+      }
+    }
+    if (!pending.empty()) {
+      encode_pending();
+    }
+  }
+}
+
+void EncodeServer::accept_connections() {
+  while (true) {
+    const int fd =
+        ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return;
+      }
+      if (errno == EMFILE || errno == ENFILE || errno == ECONNABORTED) {
+        return;  // 接続は backlog に残り、次の通知で受け付け直す
+      }
+      throw system_error("accept failed");
+    }
+    const u_int64_t serial = next_serial++;
+    Connection& connection = connections[serial];
+    connection.fd = fd;
+    connection.events = EPOLLIN;
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = serial;
+    ::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+    counters.connections++;
+  }
+}
+
+bool EncodeServer::may_read(const Connection& connection) const {
+  return !connection.peer_closed && pending.size() < options.max_pending &&
+         connection.output.size() - connection.output_begin <
+             options.max_output_bytes;
+}
+
+void EncodeServer::read_from(u_int64_t serial, Connection& connection) {
+  // 1回の通知で読むのは数回まで。他の接続を待たせない
+  for (int reads = 0; reads < 4 && may_read(connection); reads++) {
+    std::string& input = connection.input;
+    const size_t used = input.size();
+    input.resize(used + READ_SIZE);
+    const ssize_t n = ::read(connection.fd, input.data() + used, READ_SIZE);
+    input.resize(used + std::max<ssize_t>(n, 0));
+    if (n > 0) {
+      parse_frames(serial, connection);
+      if (connections.count(serial) == 0) {
+        return;
+      }
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return;
+    }
+    if (n < 0) {
+      close_connection(serial);
+      return;
+    }
+    // 相手が書き終えた。残りの応答を返してから閉じる
+    connection.peer_closed = true;
+    if (connection.finished()) {
+      close_connection(serial);
+    }
+    return;
+  }
+}
+
+void EncodeServer::parse_frames(u_int64_t serial, Connection& connection) {
+  std::string& input = connection.input;
+  while (pending.size() < options.max_pending) {
+    const std::string_view rest =
+        std::string_view(input).substr(connection.input_begin);
+    if (rest.size() >= FRAME_HEADER_SIZE &&
+        get_u32(rest.data()) > options.max_request_bytes) {
+      close_connection(serial);  // 同期を失った相手とはやり取りできない
+      return;
+    }
+    const size_t frame = complete_frame_size(rest);
+    if (frame == 0) {
+      break;
+    }
+    Pending& request = pending.emplace_back();
+    request.connection = serial;
+    request.received_ns = metrics_now();
+    try {
+      parse_request(rest.substr(FRAME_HEADER_SIZE, frame - FRAME_HEADER_SIZE),
+                    request.request, options.max_image_side);
+      request.payload = request.request.payload;
+    } catch (const std::invalid_argument& e) {
+      request.error = e.what();
+      request.error_reason = reject_reason(e);
+    }
+    request.request.payload = {};
+    connection.in_flight++;
+    connection.input_begin += frame;
+  }
+  // 読み終えた分を捨てる
+  if (connection.input_begin == input.size()) {
+    input.clear();
+    connection.input_begin = 0;
+  } else if (connection.input_begin > READ_SIZE) {
+    input.erase(0, connection.input_begin);
+    connection.input_begin = 0;
+  }
+}
+
+void EncodeServer::write_to(Connection& connection) {
+  std::string& output = connection.output;
+  while (connection.output_begin < output.size()) {
+    const std::string_view rest =
+        std::string_view(output).substr(connection.output_begin);
+    const ssize_t n =
+        ::send(connection.fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;  // EAGAIN は EPOLLOUT を待つ。切断は EPOLLERR で分かる
+    }
+    connection.output_begin += n;
+  }
+  // 書き終えた分が半分を超えたら詰める
+  if (connection.output_begin * 2 >= output.size()) {
+    output.erase(0, connection.output_begin);
+    connection.output_begin = 0;
+  }
+}
+
+void EncodeServer::update_interest(u_int64_t serial, Connection& connection) {
+  const bool reading = may_read(connection);
+  const u_int32_t events =
+      (reading ? EPOLLIN : 0) |
+      (connection.output_begin < connection.output.size() ? EPOLLOUT : 0);
+  if (!reading && (connection.events & EPOLLIN) && !connection.peer_closed) {
+    paused.push_back(serial);
+    counters.paused++;
+  }
+  if (events != connection.events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = serial;
+    ::epoll_ctl(epoll, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+  }
+}
+
+void EncodeServer::close_connection(u_int64_t serial) {
+  auto found = connections.find(serial);
+  if (found == connections.end()) {
+    return;
+  }
+  // 待ち行列に残った分は、応答を返す先がないので結果ごと捨てられる
+  ::close(found->second.fd);
+  connections.erase(found);
+}
+
+void EncodeServer::encode_pending() {
+  const size_t n = std::min(pending.size(), options.max_batch);
+  if (frames.size() < n) {
+    frames.resize(n);
+  }
+  pool.parallelFor(n, 4, [&](size_t begin, size_t end, int worker) {
+    Symbol& symbol = symbols[worker];
+    for (size_t i = begin; i < end; i++) {
+      Pending& request = pending[i];
+      frames[i].clear();
+      const ServeFormat format = request.request.format;
+      if (request.error.empty() && (format == ServeFormat::METRICS ||
+                                    format == ServeFormat::METRICS_JSON)) {
+        append_metrics_response(request.request.id, format, frames[i]);
+        continue;
+      }
+      // 1件の失敗 (メモリ不足など) は、その応答のエラーにしてデーモンは続ける
+      try {
+        if (!request.error.empty()) {
+          symbol.setError(request.error, request.error_reason);
+          count_reject(request.error_reason);
+        } else if (options.cache != nullptr) {
+          encode_symbol_cached(request.payload, request.request.encode,
+                               scratch[worker], *options.cache, symbol);
+        } else {
+          encode_symbol(request.payload, request.request.encode,
+                        scratch[worker], symbol);
+        }
+        append_response(request.request.id, symbol, format,
+                        request.request.render, frames[i]);
+      } catch (const std::exception& e) {
+        frames[i].clear();
+        symbol.setError(e.what(), reject_reason(e));
+        count_reject(symbol.reject_reason);
+        append_response(request.request.id, symbol, format,
+                        request.request.render, frames[i]);
+      }
+      record_latency(SERVE_METRIC, metrics_now() - request.received_ns);
+    }
+  });
+  counters.batches++;
+  counters.requests += n;
+
+  // 応答は受け付け順に各接続へ積み、書けるだけ書く
+  std::vector<u_int64_t> touched;
+  for (size_t i = 0; i < n; i++) {
+    if (frames[i][FRAME_HEADER_SIZE + 4] != 0) {  // 応答の status
+      counters.failed++;
+    }
+    auto found = connections.find(pending[i].connection);
+    if (found == connections.end()) {
+      continue;
+    }
+    Connection& connection = found->second;
+    connection.output += frames[i];
+    connection.in_flight--;
+    if (touched.empty() || touched.back() != found->first) {
+      touched.push_back(found->first);
+    }
+  }
+  pending.erase(pending.begin(), pending.begin() + n);
+  for (u_int64_t serial : touched) {
+    auto found = connections.find(serial);
+    if (found == connections.end()) {
+      continue;
+    }
+    Connection& connection = found->second;
+    write_to(connection);
+    if (connection.finished()) {
+      close_connection(serial);
+      continue;
+    }
+    update_interest(serial, connection);
+  }
+
+  // 背圧で止めた接続は、余裕ができたら溜まっている枠から再開する。
+  // 再開しても枠を読んで再び止まれば、update_interest() が登録し直す
+  std::vector<u_int64_t> waiting;
+  waiting.swap(paused);
+  for (u_int64_t serial : waiting) {
+    auto found = connections.find(serial);
+    if (found == connections.end()) {
+      continue;
+    }
+    Connection& connection = found->second;
+    if (!may_read(connection)) {
+      paused.push_back(serial);
+      continue;
+    }
+    parse_frames(serial, connection);
+    if (connections.count(serial) != 0) {
+      update_interest(serial, connection);
+    }
+  }
+}
+
+EncodeClient::EncodeClient(const std::string& socket_path) {
+  const sockaddr_un address = socket_address(socket_path);
+  fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw system_error("cannot create a socket");
+  }
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) != 0) {
+    ::close(fd);
+    throw system_error("cannot connect to " + socket_path);
+  }
+}
+
+EncodeClient::~EncodeClient() { ::close(fd); }
+
+void EncodeClient::send(std::string_view frames) {
+  while (!frames.empty()) {
+    const ssize_t n = ::send(fd, frames.data(), frames.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw system_error("send failed");
+    }
+    frames.remove_prefix(n);
+  }
+}
+
+void EncodeClient::send(const ServeRequest& request) {
+  this->request.clear();
+  append_request(request, this->request);
+  send(this->request);
+}
+
+bool EncodeClient::receive(ServeResponse& response) {
+  size_t frame;
+  while ((frame = complete_frame_size(
+              std::string_view(buffer).substr(begin))) == 0) {
+    // 返し終えた枠を捨ててから読み足す
+    buffer.erase(0, begin);
+    begin = 0;
+    const size_t used = buffer.size();
+    buffer.resize(used + READ_SIZE);
+    const ssize_t n = ::read(fd, buffer.data() + used, READ_SIZE);
+    buffer.resize(used + std::max<ssize_t>(n, 0));
+    if (n == 0) {
+      return false;
+    }
+    if (n < 0 && errno != EINTR) {
+      throw system_error("receive failed");
+    }
+  }
+  parse_response(std::string_view(buffer).substr(
+                     begin + FRAME_HEADER_SIZE, frame - FRAME_HEADER_SIZE),
+                 response);
+  begin += frame;
+  return true;
+}
@@ -0,0 +1,212 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "qr.h"
+#include "render.h"
+#include "thread_pool.h"
+
+class SymbolCache;
+
+// Local encoding daemon (`qr serve --socket PATH`) and its wire protocol.
+//
+// Every message on the Unix domain stream socket is a frame: a little-endian
+// u32 body length, then the body. Requests on one connection may be
+// pipelined; responses come back in request order.
+//
+// Request body: u32 id, u8 error correction level (0-3 = L, M, Q, H),
+//   u8 version (0: the smallest that fits), u8 mask (0-7, 0xFF: automatic),
+//   u8 mode (a mode indicator, 0xFF: automatic segmentation),
+//   u8 format (ServeFormat), u8 scale, u8 quiet zone, u8 reserved (0),
+//   then the payload.
+// Response body: u32 id, u8 status (0: ok, 1: error), u8 version,
+//   u8 error correction level, u8 mask pattern, then the output (ok) or an
+//   error message.
+
+enum class ServeFormat : u_int8_t {
+  MATRIX,  // append_packed_rows(): size rows of (size + 7) / 8 bytes
+  PBM,     // render_image() with scale and quiet zone from the request
+  PGM,
+  PNG,
+  SVG,     // render_svg() with the quiet zone from the request
+  // No symbol: the payload is ignored and the output is a snapshot of the
+  // server's metrics (metrics.h) in Prometheus text or JSON.
+  METRICS,
+  METRICS_JSON,
+};
+
+constexpr size_t FRAME_HEADER_SIZE = 4;
+constexpr size_t SERVE_REQUEST_HEADER_SIZE = 12;
+constexpr size_t SERVE_RESPONSE_HEADER_SIZE = 8;
+constexpr u_int8_t SERVE_AUTO = 0xFF;
+
+struct ServeRequest {
+  u_int32_t id = 0;
+  EncodeOptions encode;
+  ServeFormat format = ServeFormat::MATRIX;
+  RenderOptions render;
+  std::string_view payload;
+};
+
+struct ServeResponse {
+  u_int32_t id = 0;
+  bool ok = false;
+  int version = 0;
+  int error_correction_level = 0;
+  int mask_pattern = 0;
+  std::string_view data;  // the output, or the error message
+};
+
+// Size of the complete frame at the front of `buffer`, or 0 while it is still
+// incomplete.
+size_t complete_frame_size(std::string_view buffer);
+// Appends one request frame.
+void append_request(const ServeRequest& request, std::string& out);
+// Default for ServeOptions::max_image_side.
+constexpr int SERVE_MAX_IMAGE_SIDE = 4096;
+
+// Parses a request body; payload views into `body`. Throws
+// std::invalid_argument when the header is short, and EncodeError with
+// REJECT_OPTION when a field is out of range or
+// a PBM, PGM or PNG image of the requested version (version 40 when
+// automatic), scale and quiet zone would be wider than `max_image_side`
+// pixels (request.id is set whenever the body holds one).
+void parse_request(std::string_view body, ServeRequest& request,
+                   int max_image_side = SERVE_MAX_IMAGE_SIDE);
+// Appends the response frame for `symbol`: its output in `format`, or
+// symbol.error when it failed (METRICS formats ignore `symbol`).
+void append_response(u_int32_t id, const Symbol& symbol, ServeFormat format,
+                     const RenderOptions& render, std::string& out);
+// Appends the response frame to a METRICS or METRICS_JSON request.
+void append_metrics_response(u_int32_t id, ServeFormat format,
+                             std::string& out);
+// Parses a response body; data views into `body`. Throws
+// std::invalid_argument when the body is shorter than its header.
+void parse_response(std::string_view body, ServeResponse& response);
+
+struct ServeOptions {
+  std::string socket_path;
+  int threads = 0;                 // encoder threads; 0: all cores
+  SymbolCache* cache = nullptr;    // optional, see symbol_cache.h
+  size_t max_batch = 256;          // requests encoded together per round
+  // Backpressure: sockets are not read while this many requests wait for the
+  // encoder, nor a client whose unread responses exceed max_output_bytes.
+  size_t max_pending = 4096;
+  size_t max_output_bytes = size_t{4} << 20;
+  size_t max_request_bytes = size_t{1} << 16;  // larger frames close the link
+  // Wider rendered images are refused (see parse_request()), which bounds
+  // the memory one request can make the encoder threads allocate.
+  int max_image_side = SERVE_MAX_IMAGE_SIDE;
+};
+
+struct ServeStats {
+  u_int64_t connections = 0;
+  u_int64_t requests = 0;
+  u_int64_t failed = 0;
+  u_int64_t batches = 0;
+  u_int64_t paused = 0;  // times a connection stopped being read
+};
+
+// Single-threaded epoll loop: it accepts connections, reads every frame that
+// has arrived, encodes the waiting requests as one parallelFor() batch on the
+// pool and queues the responses, writing what each socket accepts.
+class EncodeServer {
+ public:
+  // Binds and listens (a stale socket file at the path is replaced). Throws
+  // std::runtime_error when the socket cannot be set up.
+  explicit EncodeServer(const ServeOptions& options);
+  ~EncodeServer();
+  EncodeServer(const EncodeServer&) = delete;
+  EncodeServer& operator=(const EncodeServer&) = delete;
+
+  // Serves until stop(); requests still waiting are dropped.
+  void run();
+  // Safe from any thread and from a signal handler.
+  void stop();
+  // Only consistent once run() has returned.
+  ServeStats stats() const { return counters; }
+
+ private:
+  struct Connection {
+    int fd;
+    std::string input;
+    size_t input_begin = 0;
+    std::string output;
+    size_t output_begin = 0;
+    size_t in_flight = 0;  // 符号化待ちのリクエスト数
+    u_int32_t events = 0;  // epoll に登録中のイベント
+    bool peer_closed = false;
+
+    // 相手が書き終え、応答もすべて送り終えた
+    bool finished() const {
+      return peer_closed && in_flight == 0 && output_begin == output.size();
+    }
+  };
+  struct Pending {
+    u_int64_t connection;
+    ServeRequest request;  // payload は下の文字列を指し直して使う
+    std::string payload;
+    std::string error;     // 解析に失敗したリクエストは符号化しない
+    RejectReason error_reason = REJECT_OTHER;
+    u_int64_t received_ns;  // metrics_now()
+  };
+
+  void accept_connections();
+  void read_from(u_int64_t serial, Connection& connection);
+  void parse_frames(u_int64_t serial, Connection& connection);
+  void write_to(Connection& connection);
+  void encode_pending();
+  // 受信を続けてよいか、書き残しがあるかで epoll の登録を直す
+  void update_interest(u_int64_t serial, Connection& connection);
+  void close_connection(u_int64_t serial);
+  bool may_read(const Connection& connection) const;
+
+  ServeOptions options;
+  int listener = -1;
+  int epoll = -1;
+  int stop_event = -1;
+  std::atomic<bool> stopping{false};
+  u_int64_t next_serial;
+  std::unordered_map<u_int64_t, Connection> connections;
+  std::vector<u_int64_t> paused;  // 背圧で受信を止めた接続
+  std::deque<Pending> pending;
+  WorkStealingPool pool;
+  std::vector<EncodeScratch> scratch;
+  std::vector<Symbol> symbols;      // ワーカーごと
+  std::vector<std::string> frames;  // バッチ内のリクエストごと
+  ServeStats counters;
+};
+
+// Blocking client for the protocol above, one connection per instance.
+class EncodeClient {
+ public:
+  // Throws std::runtime_error when the server cannot be reached.
+  explicit EncodeClient(const std::string& socket_path);
+  ~EncodeClient();
+  EncodeClient(const EncodeClient&) = delete;
+  EncodeClient& operator=(const EncodeClient&) = delete;
+
+  // Sends every frame in `frames` (one or more appended requests).
+  void send(std::string_view frames);
+  void send(const ServeRequest& request);
+  // Waits for the next response; its data stays valid until the next call.
+  // Returns false once the server has closed the connection.
+  bool receive(ServeResponse& response);
+
+ private:
+  int fd;
+  std::string buffer;
+  size_t begin = 0;
+  std::string request;
+};
+
+#endif  // SERVER_H
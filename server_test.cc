@@ -0,0 +1,263 @@
+#include "server.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stream.h"
+#include "symbol_cache.h"
+
+namespace {
+std::string socket_path(const char* name) {
+  return "/tmp/qr_" + std::string(name) + "_" + std::to_string(::getpid()) +
+         ".sock";
+}
+
+// run() を別スレッドで回し、抜けるときに止める
+class RunningServer {
+ public:
+  explicit RunningServer(const ServeOptions& options)
+      : server(options), thread([this] { server.run(); }) {}
+  ~RunningServer() { stop(); }
+  ServeStats stop() {
+    if (thread.joinable()) {
+      server.stop();
+      thread.join();
+    }
+    return server.stats();
+  }
+
+ private:
+  EncodeServer server;
+  std::thread thread;
+};
+
+ServeRequest request_for(u_int32_t id, std::string_view payload,
+                         ServeFormat format) {
+  ServeRequest request;
+  request.id = id;
+  request.encode = {M, 0, AUTO_MASK, AUTO_MODE};
+  request.format = format;
+  request.render.scale = 2;
+  request.render.quiet_zone = 1;
+  request.payload = payload;
+  return request;
+}
+
+TEST(ServerTest, Protocol) {
+  ServeRequest request = request_for(0x01020304, "HELLO", ServeFormat::PNG);
+  request.encode.mask_byte = 5;
+  std::string frame;
+  append_request(request, frame);
+  ASSERT_EQ(FRAME_HEADER_SIZE + SERVE_REQUEST_HEADER_SIZE + 5, frame.size());
+  EXPECT_EQ(0u, complete_frame_size(frame.substr(0, frame.size() - 1)));
+  ASSERT_EQ(frame.size(), complete_frame_size(frame + "next"));
+
+  ServeRequest parsed;
+  parse_request(std::string_view(frame).substr(FRAME_HEADER_SIZE), parsed);
+  EXPECT_EQ(request.id, parsed.id);
+  EXPECT_EQ(M, parsed.encode.error_correction_level);
+  EXPECT_EQ(5, parsed.encode.mask_byte);
+  EXPECT_EQ(AUTO_MODE, parsed.encode.mode_specifier);
+  EXPECT_EQ(ServeFormat::PNG, parsed.format);
+  EXPECT_EQ(2, parsed.render.scale);
+  EXPECT_EQ(1, parsed.render.quiet_zone);
+  EXPECT_EQ("HELLO", parsed.payload);
+
+  std::string bad = frame.substr(FRAME_HEADER_SIZE);
+  bad[8] = 9;  // 未知の出力形式
+  EXPECT_THROW(parse_request(bad, parsed), std::invalid_argument);
+  EXPECT_EQ(request.id, parsed.id);
+  EXPECT_THROW(parse_request("abc", parsed), std::invalid_argument);
+
+  // マスク参照子は 0-7 か自動 (0xFF) だけ
+  for (u_int8_t mask : {8, 9, 0x80, 0xFE}) {
+    bad = frame.substr(FRAME_HEADER_SIZE);
+    bad[6] = static_cast<char>(mask);
+    EXPECT_THROW(parse_request(bad, parsed), std::invalid_argument) << +mask;
+  }
+
+  // 画像の一辺の上限。版を指定しなければ版40 (177モジュール) で見積もる
+  ServeRequest large = request_for(1, "HELLO", ServeFormat::PGM);
+  large.render.scale = 255;
+  large.render.quiet_zone = 255;
+  std::string large_frame;
+  append_request(large, large_frame);
+  const std::string_view large_body =
+      std::string_view(large_frame).substr(FRAME_HEADER_SIZE);
+  EXPECT_THROW(parse_request(large_body, parsed), std::invalid_argument);
+  large.render.scale = 4;
+  large.render.quiet_zone = 4;
+  large_frame.clear();
+  append_request(large, large_frame);
+  EXPECT_THROW(parse_request(std::string_view(large_frame)
+                                 .substr(FRAME_HEADER_SIZE),
+                             parsed, (177 + 8) * 4 - 1),
+               std::invalid_argument);
+  parse_request(std::string_view(large_frame).substr(FRAME_HEADER_SIZE),
+                parsed, (177 + 8) * 4);
+  large.encode.version = 1;
+  large_frame.clear();
+  append_request(large, large_frame);
+  parse_request(std::string_view(large_frame).substr(FRAME_HEADER_SIZE),
+                parsed, (21 + 8) * 4);
+  // 行列と SVG は scale を使わない
+  large.format = ServeFormat::MATRIX;
+  large.render.scale = 255;
+  large_frame.clear();
+  append_request(large, large_frame);
+  parse_request(std::string_view(large_frame).substr(FRAME_HEADER_SIZE),
+                parsed, 100);
+
+  const Symbol symbol = encode_symbol("HELLO", request.encode);
+  std::string response;
+  append_response(7, symbol, ServeFormat::MATRIX, {}, response);
+  ServeResponse decoded;
+  parse_response(std::string_view(response).substr(FRAME_HEADER_SIZE),
+                 decoded);
+  EXPECT_EQ(7u, decoded.id);
+  EXPECT_TRUE(decoded.ok);
+  EXPECT_EQ(symbol.version, decoded.version);
+  EXPECT_EQ(symbol.mask_pattern, decoded.mask_pattern);
+  std::string rows;
+  append_packed_rows(symbol, rows);
+  EXPECT_EQ(rows, decoded.data);
+}
+
+TEST(ServerTest, ServesPipelinedRequestsInOrder) {
+  ServeOptions options;
+  options.socket_path = socket_path("serve");
+  options.threads = 3;
+  SymbolCache cache;
+  options.cache = &cache;
+  RunningServer server(options);
+
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 300; i++) {
+    payloads.push_back(i == 17 ? std::string(5000, 'x')  // 版40に入らない
+                               : "https://example.com/ticket/" +
+                                     std::to_string(i % 40));
+  }
+  const ServeFormat formats[] = {ServeFormat::MATRIX, ServeFormat::PNG,
+                                 ServeFormat::SVG};
+  // 複数の接続から同時に、応答を待たずに全部送る
+  auto client = [&](int c) {
+    EncodeClient connection(options.socket_path);
+    std::string frames;
+    for (size_t i = 0; i < payloads.size(); i++) {
+      append_request(request_for(i, payloads[i], formats[(i + c) % 3]),
+                     frames);
+    }
+    connection.send(frames);
+    ServeResponse response;
+    for (size_t i = 0; i < payloads.size(); i++) {
+      ASSERT_TRUE(connection.receive(response));
+      ASSERT_EQ(i, response.id);
+      if (i == 17) {
+        EXPECT_FALSE(response.ok);
+        EXPECT_FALSE(response.data.empty());
+        continue;
+      }
+      ASSERT_TRUE(response.ok) << response.data;
+      const ServeRequest request =
+          request_for(i, payloads[i], formats[(i + c) % 3]);
+      const Symbol symbol = encode_symbol(payloads[i], request.encode);
+      EXPECT_EQ(symbol.version, response.version);
+      std::string expected;
+      append_response(i, symbol, request.format, request.render, expected);
+      EXPECT_EQ(std::string_view(expected).substr(
+                    FRAME_HEADER_SIZE + SERVE_RESPONSE_HEADER_SIZE),
+                response.data)
+          << i;
+    }
+  };
+  std::vector<std::thread> clients;
+  for (int c = 0; c < 4; c++) {
+    clients.emplace_back(client, c);
+  }
+  for (std::thread& thread : clients) {
+    thread.join();
+  }
+  const ServeStats stats = server.stop();
+  EXPECT_EQ(4u, stats.connections);
+  EXPECT_EQ(4 * payloads.size(), stats.requests);
+  EXPECT_EQ(4u, stats.failed);
+  // 同時に届いたリクエストはまとめて符号化される
+  EXPECT_LT(stats.batches, stats.requests);
+  EXPECT_GT(cache.stats().hits, 0u);
+}
+
+TEST(ServerTest, BackpressureAndBrokenFrames) {
+  ServeOptions options;
+  options.socket_path = socket_path("backpressure");
+  options.threads = 2;
+  options.max_batch = 4;
+  options.max_pending = 8;
+  options.max_output_bytes = 4096;
+  options.max_request_bytes = 1024;
+  RunningServer server(options);
+
+  // 応答を読まずに送り続けても、受信が止まるだけで何も失われない
+  EncodeClient client(options.socket_path);
+  std::string frames;
+  const int count = 2000;
+  for (int i = 0; i < count; i++) {
+    append_request(request_for(i, "LOT-" + std::to_string(i),
+                               ServeFormat::PGM),
+                   frames);
+  }
+  std::thread sender([&] { client.send(frames); });
+  ServeResponse response;
+  for (int i = 0; i < count; i++) {
+    ASSERT_TRUE(client.receive(response));
+    ASSERT_EQ(static_cast<u_int32_t>(i), response.id);
+    ASSERT_TRUE(response.ok);
+  }
+  sender.join();
+
+  // 上限を超える長さの枠は接続ごと閉じられる
+  EncodeClient broken(options.socket_path);
+  const std::string large(2000, '7');
+  broken.send(request_for(1, large, ServeFormat::MATRIX));
+  EXPECT_FALSE(broken.receive(response));
+
+  // 解析できない枠はエラーの応答になり、接続は続く
+  std::string bad;
+  append_request(request_for(5, "X", ServeFormat::MATRIX), bad);
+  bad[FRAME_HEADER_SIZE + 4] = 7;  // 誤り訂正レベル
+  client.send(bad);
+  ASSERT_TRUE(client.receive(response));
+  EXPECT_EQ(5u, response.id);
+  EXPECT_FALSE(response.ok);
+  client.send(request_for(6, "X", ServeFormat::MATRIX));
+  ASSERT_TRUE(client.receive(response));
+  EXPECT_TRUE(response.ok);
+
+  // 巨大な画像と範囲外のマスクもエラーの応答になり、デーモンは落ちない
+  ServeRequest huge = request_for(7, "X", ServeFormat::PNG);
+  huge.render.scale = 255;
+  huge.render.quiet_zone = 255;
+  client.send(huge);
+  ASSERT_TRUE(client.receive(response));
+  EXPECT_EQ(7u, response.id);
+  EXPECT_FALSE(response.ok);
+  EXPECT_NE(std::string_view::npos, response.data.find("pixels wide"));
+  ServeRequest masked = request_for(8, "X", ServeFormat::MATRIX);
+  masked.encode.mask_byte = 9;
+  client.send(masked);
+  ASSERT_TRUE(client.receive(response));
+  EXPECT_EQ(8u, response.id);
+  EXPECT_FALSE(response.ok);
+  client.send(request_for(9, "X", ServeFormat::PNG));
+  ASSERT_TRUE(client.receive(response));
+  EXPECT_TRUE(response.ok);
+
+  const ServeStats stats = server.stop();
+  EXPECT_GT(stats.paused, 0u);
+  EXPECT_GT(stats.batches, static_cast<u_int64_t>(count / 4) - 1);
+}
+}  // namespace
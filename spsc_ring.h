@@ -0,0 +1,87 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and keeps a cached copy of the other, so
+// the shared cache lines are only touched when the cached copy says the ring
+// looks full or empty. push() and pop() spin briefly and then sleep in
+// std::atomic::wait(), so idle stages of a pipeline do not burn a core.
+template <typename T>
+class SpscRing {
+ public:
+  // The capacity is rounded up to a power of two (at least 2).
+  explicit SpscRing(size_t capacity)
+      : slots(std::bit_ceil(std::max<size_t>(capacity, 2))),
+        mask(slots.size() - 1) {}
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  size_t capacity() const { return slots.size(); }
+
+  // Producer side.
+  bool tryPush(const T& value) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cached_head == slots.size()) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t - cached_head == slots.size()) {
+        return false;
+      }
+    }
+    slots[t & mask] = value;
+    tail.store(t + 1, std::memory_order_release);
+    tail.notify_one();
+    return true;
+  }
+  // 満杯なら消費側が取り出すまで待つ
+  void push(const T& value) {
+    for (int spin = 0; !tryPush(value); spin++) {
+      if (spin >= SPIN_LIMIT) {
+        head.wait(cached_head, std::memory_order_acquire);
+      }
+    }
+  }
+
+  // Consumer side.
+  bool tryPop(T& value) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == cached_tail) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h == cached_tail) {
+        return false;
+      }
+    }
+    value = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    head.notify_one();
+    return true;
+  }
+  // 空なら生産側が入れるまで待つ
+  T pop() {
+    T value;
+    for (int spin = 0; !tryPop(value); spin++) {
+      if (spin >= SPIN_LIMIT) {
+        tail.wait(cached_tail, std::memory_order_acquire);
+      }
+    }
+    return value;
+  }
+
+ private:
+  static constexpr int SPIN_LIMIT = 64;
+
+  std::vector<T> slots;
+  size_t mask;
+  // 消費側が書く行と生産側が書く行を分け、偽共有を避ける
+  alignas(64) std::atomic<size_t> head{0};
+  size_t cached_tail = 0;
+  alignas(64) std::atomic<size_t> tail{0};
+  size_t cached_head = 0;
+};
+
+#endif  // SPSC_RING_H
@@ -0,0 +1,439 @@
+#include "stream.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+#include "archive.h"
+#include "metrics.h"
+#include "symbol_cache.h"
+
+RecordReader::RecordReader(std::FILE* file, char delimiter)
+    : file(file), delimiter(delimiter) {}
+
+bool RecordReader::fill() {
+  constexpr size_t READ_SIZE = 1 << 16;
+  if (eof) {
+    return false;
+  }
+  if (buffer.size() < end + READ_SIZE) {
+    buffer.resize(std::max(buffer.size() * 2, end + READ_SIZE));
+  }
+  size_t n = std::fread(buffer.data() + end, 1, READ_SIZE, file);
+  end += n;
+  if (n < READ_SIZE) {
+    if (std::ferror(file)) {
+      throw std::runtime_error(std::string("read failed: ") +
+                               std::strerror(errno));
+    }
+    eof = std::feof(file) != 0;
+  }
+  return n > 0 || !eof;
+}
+
+bool RecordReader::readBlock(size_t max_records,
+                             std::vector<std::string_view>& records) {
+  records.clear();
+  spans.clear();
+  // 前回のブロックは使い終わっているので、残りを先頭へ詰める
+  if (begin > 0) {
+    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+  }
+  size_t scan = begin;
+  while (spans.size() < max_records) {
+    const void* found =
+        std::memchr(buffer.data() + scan, delimiter, end - scan);
+    if (found != nullptr) {
+      size_t position = static_cast<const char*>(found) - buffer.data();
+      spans.emplace_back(begin, position);
+      begin = scan = position + 1;
+      continue;
+    }
+    scan = end;
+    if (!fill()) {
+      if (begin < end) {
+        spans.emplace_back(begin, end);
+        begin = end;
+      }
+      break;
+    }
+  }
+  // fill() may have reallocated the buffer, so views are made last.
+  for (auto [first, last] : spans) {
+    if (delimiter == '\n' && last > first && buffer[last - 1] == '\r') {
+      last--;
+    }
+    records.emplace_back(buffer.data() + first, last - first);
+  }
+  return !records.empty();
+}
+
+namespace {
+constexpr std::array<u_int8_t, 256> make_bit_reverse_table() {
+  std::array<u_int8_t, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    int reversed = 0;
+    for (int b = 0; b < 8; b++) {
+      reversed |= ((i >> b) & 1) << (7 - b);
+    }
+    table[i] = static_cast<u_int8_t>(reversed);
+  }
+  return table;
+}
+
+constexpr std::array<u_int8_t, 256> BIT_REVERSE = make_bit_reverse_table();
+}  // namespace
+
+size_t binary_record_size(int version) {
+  size_t size = symbol_size(version);
+  return BINARY_RECORD_HEADER_SIZE + size * ((size + 7) / 8);
+}
+
+void append_binary_record(size_t index, const Symbol& symbol,
+                          std::string& out) {
+  const size_t offset = out.size();
+  out.resize(offset + BINARY_RECORD_HEADER_SIZE);
+  u_int8_t* p = reinterpret_cast<u_int8_t*>(out.data()) + offset;
+  for (int i = 0; i < 4; i++) {
+    p[i] = static_cast<u_int8_t>(index >> (8 * i));
+  }
+  p[4] = static_cast<u_int8_t>(symbol.version);
+  p[5] = static_cast<u_int8_t>(symbol.error_correction_level);
+  p[6] = static_cast<u_int8_t>(symbol.mask_pattern);
+  p[7] = 0;
+  append_packed_rows(symbol, out);
+}
+
+void append_packed_rows(const Symbol& symbol, std::string& out) {
+  const size_t offset = out.size();
+  const int row_bytes = (symbol.size + 7) / 8;
+  out.resize(offset + static_cast<size_t>(symbol.size) * row_bytes);
+  pack_rows(symbol, reinterpret_cast<u_int8_t*>(out.data()) + offset);
+}
+
+void pack_rows(const Symbol& symbol, u_int8_t* p) {
+  const int row_bytes = (symbol.size + 7) / 8;
+  // 行の語はLSBが左端なので、バイト単位でビット順を反転するだけでよい
+  const u_int8_t last_mask =
+      static_cast<u_int8_t>(0xFF00 >> (((symbol.size - 1) & 7) + 1));
+  for (int x = 0; x < symbol.size; x++) {
+    const u_int64_t* words = symbol.row(x);
+    for (int j = 0; j < row_bytes; j++) {
+      p[j] = BIT_REVERSE[(words[j / 8] >> (8 * (j % 8))) & 0xFF];
+    }
+    p[row_bytes - 1] &= last_mask;
+    p += row_bytes;
+  }
+}
+
+namespace {
+void write_all(std::FILE* file, std::string_view data) {
+  if (std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+    throw std::runtime_error(std::string("write failed: ") +
+                             std::strerror(errno));
+  }
+}
+
+// 出力先: ディレクトリ(1レコード1ファイル)か、1本のストリーム
+class OutputSink {
+ public:
+  explicit OutputSink(const StreamOptions& options)
+      : format(options.format),
+        render(options.render),
+        directory(options.output_dir),
+        cache(options.batch.cache) {
+    if (render.scale < 1 || render.quiet_zone < 0) {
+      throw std::invalid_argument("scale must be >= 1 and quiet zone >= 0");
+    }
+    if (render.quiet_zone > 0xFF || render.scale >= (1 << 19)) {
+      cache = nullptr;  // render_variant() に収まらない設定は描画を覚えない
+    }
+    if (format == OutputFormat::ARCHIVE) {
+      if (!directory.empty() || options.output_file.empty() ||
+          options.output_file == "-") {
+        throw std::invalid_argument("--format archive needs --output FILE");
+      }
+      archive = std::make_unique<ArchiveWriter>(options.output_file);
+    } else if (!directory.empty()) {
+      std::filesystem::create_directories(directory);
+    } else if (options.output_file.empty() || options.output_file == "-") {
+      file = stdout;
+    } else {
+      file = std::fopen(options.output_file.c_str(), "wb");
+      if (file == nullptr) {
+        throw std::runtime_error("cannot open " + options.output_file + ": " +
+                                 std::strerror(errno));
+      }
+      owns_file = true;
+    }
+  }
+  ~OutputSink() {
+    if (owns_file) {
+      std::fclose(file);
+    }
+  }
+  OutputSink(const OutputSink&) = delete;
+  OutputSink& operator=(const OutputSink&) = delete;
+
+  // アーカイブは archiveWriter() へ並列に書くので、ここでは何もしない
+  void write(size_t index, const Symbol& symbol) {
+    if (archive) {
+      return;
+    }
+    if (directory.empty()) {
+      renderSymbol(index, symbol, pending);
+      return;
+    }
+    std::string contents;
+    renderSymbol(index, symbol, contents);
+    write_file(index, contents);
+  }
+
+  ArchiveWriter* archiveWriter() { return archive.get(); }
+  // 全レコードを書いた後に一度だけ呼ぶ (アーカイブの索引と見出しを書く)
+  void finish() {
+    if (archive) {
+      archive->finish();
+    }
+  }
+
+  // renderSymbol() 済みの出力を書く (パイプラインのシンク)
+  void writeRendered(size_t index, std::string_view rendered) {
+    if (directory.empty()) {
+      pending += rendered;
+      return;
+    }
+    write_file(index, rendered);
+  }
+
+  // 描画結果はキャッシュを通す。BINARY はレコード番号を含むので対象外
+  void renderSymbol(size_t index, const Symbol& symbol,
+                    std::string& out) const {
+    StageTimer timer(RENDER_METRIC);
+    const size_t offset = out.size();
+    if (cache == nullptr || format == OutputFormat::BINARY) {
+      render_into(index, symbol, out);
+    } else if (const u_int32_t variant = render_variant();
+               !cache->lookupRendered(symbol, variant, out)) {
+      render_into(index, symbol, out);
+      cache->insertRendered(symbol, variant,
+                            std::string_view(out).substr(offset));
+    }
+    count_bytes_out(out.size() - offset);
+  }
+
+  // ブロック単位でまとめて書き出す
+  void flush() {
+    if (file != nullptr) {
+      write_all(file, pending);
+      std::fflush(file);
+    }
+    pending.clear();
+  }
+
+ private:
+  void write_file(size_t index, std::string_view contents) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%08zu.%s", index, extension());
+    std::filesystem::path path = directory / name;
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    if (out == nullptr) {
+      throw std::runtime_error("cannot open " + path.string() + ": " +
+                               std::strerror(errno));
+    }
+    write_all(out, contents);
+    std::fclose(out);
+  }
+
+  // 出力形式と描画設定を1語に詰めたもの
+  u_int32_t render_variant() const {
+    return static_cast<u_int32_t>(format) |
+           static_cast<u_int32_t>(render.png_compression) << 3 |
+           static_cast<u_int32_t>(render.quiet_zone & 0xFF) << 5 |
+           static_cast<u_int32_t>(render.scale) << 13;
+  }
+
+  void render_into(size_t index, const Symbol& symbol,
+                   std::string& out) const {
+    switch (format) {
+      case OutputFormat::TEXT:
+        out += symbol.toString();
+        out += '\n';
+        break;
+      case OutputFormat::BINARY:
+        append_binary_record(index, symbol, out);
+        break;
+      case OutputFormat::PBM:
+        render_image(symbol, ImageFormat::PBM, render, out);
+        break;
+      case OutputFormat::PGM:
+        render_image(symbol, ImageFormat::PGM, render, out);
+        break;
+      case OutputFormat::PNG:
+        render_image(symbol, ImageFormat::PNG, render, out);
+        break;
+      case OutputFormat::SVG: {
+        SvgOptions svg;
+        svg.quiet_zone = render.quiet_zone;
+        render_svg(module_matrix(symbol), svg, out);
+        break;
+      }
+      case OutputFormat::ARCHIVE:  // ArchiveWriter が書く
+        break;
+    }
+  }
+
+  const char* extension() const {
+    switch (format) {
+      case OutputFormat::TEXT:
+        return "txt";
+      case OutputFormat::BINARY:
+        return "bin";
+      case OutputFormat::PBM:
+        return "pbm";
+      case OutputFormat::PGM:
+        return "pgm";
+      case OutputFormat::PNG:
+        return "png";
+      case OutputFormat::SVG:
+        return "svg";
+      case OutputFormat::ARCHIVE:
+        return "qra";
+    }
+    return "";
+  }
+
+  OutputFormat format;
+  RenderOptions render;
+  std::filesystem::path directory;
+  SymbolCache* cache;
+  std::FILE* file = nullptr;
+  bool owns_file = false;
+  std::string pending;
+  std::unique_ptr<ArchiveWriter> archive;
+};
+
+// 符号化の各段と描画・書き出しを、段ごとのスレッドで流す
+StreamStats run_pipelined(RecordReader& reader, OutputSink& sink,
+                          const StreamOptions& options, std::FILE* errors) {
+  if (options.batch.verify) {
+    throw std::invalid_argument("--verify is not supported with --pipeline");
+  }
+  if (options.format == OutputFormat::ARCHIVE) {
+    throw std::invalid_argument(
+        "--format archive is not supported with --pipeline");
+  }
+  // 段ごとのスレッドはキャッシュを引かないので、黙って無視せずに断る
+  if (options.batch.cache != nullptr) {
+    throw std::invalid_argument("--cache-mb is not supported with --pipeline");
+  }
+  PipelineOptions pipeline_options;
+  pipeline_options.encode = options.batch.encode;
+  pipeline_options.threads = options.pipeline_threads;
+  const size_t block = std::max<size_t>(options.block_records, 1);
+  StreamStats stats;
+  std::string error_lines;
+  size_t unflushed = 0;
+  auto flush = [&] {
+    sink.flush();
+    if (!error_lines.empty()) {
+      write_all(errors, error_lines);
+      std::fflush(errors);
+      error_lines.clear();
+    }
+    unflushed = 0;
+  };
+  EncodePipeline pipeline(
+      pipeline_options,
+      [&](size_t index, const Symbol& symbol, std::string& out) {
+        sink.renderSymbol(index, symbol, out);
+      },
+      [&](size_t index, const Symbol& symbol, std::string_view rendered) {
+        if (symbol.ok()) {
+          sink.writeRendered(index, rendered);
+        } else {
+          error_lines += std::to_string(index) + '\t' + symbol.error + '\n';
+          stats.failed++;
+        }
+        if (++unflushed == block) {
+          flush();
+        }
+      });
+  std::vector<std::string_view> records;
+  while (reader.readBlock(block, records)) {
+    for (std::string_view record : records) {
+      pipeline.push(record);
+    }
+  }
+  pipeline.finish();
+  flush();
+  stats.records = pipeline.pushed();
+  return stats;
+}
+}  // namespace
+
+StreamStats run_stream(std::FILE* input, const StreamOptions& options,
+                       std::FILE* errors) {
+  RecordReader reader(input, options.delimiter);
+  OutputSink sink(options);
+  if (options.pipeline) {
+    return run_pipelined(reader, sink, options, errors);
+  }
+  WorkStealingPool pool(options.batch.threads);
+  StreamStats stats;
+  std::vector<std::string_view> records;
+  std::future<void> writing;
+  std::string error_lines;
+
+  auto write_block = [&](std::vector<Symbol> symbols, size_t first_index) {
+    error_lines.clear();
+    for (size_t i = 0; i < symbols.size(); i++) {
+      const Symbol& symbol = symbols[i];
+      if (symbol.ok()) {
+        sink.write(first_index + i, symbol);
+      } else {
+        error_lines += std::to_string(first_index + i) + '\t' + symbol.error +
+                       '\n';
+        stats.failed++;
+      }
+    }
+    sink.flush();
+    if (!error_lines.empty()) {
+      write_all(errors, error_lines);
+      std::fflush(errors);
+    }
+  };
+
+  const size_t block = std::max<size_t>(options.block_records, 1);
+  while (reader.readBlock(block, records)) {
+    std::vector<Symbol> symbols = encode_batch(records, options.batch, pool);
+    const size_t first_index = stats.records;
+    if (ArchiveWriter* archive = sink.archiveWriter()) {
+      // 書き手ごとにファイルの別の範囲を予約するので、ブロックごと並列に書く
+      pool.parallelFor(symbols.size(), options.batch.chunk_size,
+                       [&](size_t begin, size_t end, int) {
+                         for (size_t i = begin; i < end; i++) {
+                           archive->add(first_index + i, symbols[i],
+                                        records[i]);
+                         }
+                       });
+    }
+    stats.records += records.size();
+    if (writing.valid()) {
+      writing.get();
+    }
+    writing = std::async(std::launch::async, write_block, std::move(symbols),
+                         first_index);
+  }
+  if (writing.valid()) {
+    writing.get();
+  }
+  sink.finish();
+  return stats;
+}
@@ -0,0 +1,93 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "batch.h"
+#include "pipeline.h"
+#include "qr.h"
+#include "render.h"
+#include "svg.h"
+
+// Splits a byte stream into delimiter-terminated records. A final record
+// without a trailing delimiter is still returned; with '\n' a trailing '\r' is
+// dropped as well.
+class RecordReader {
+ public:
+  RecordReader(std::FILE* file, char delimiter);
+
+  // Reads up to `max_records` records. The views stay valid until the next
+  // call. Returns false once the input is exhausted and nothing was read.
+  bool readBlock(size_t max_records, std::vector<std::string_view>& records);
+
+ private:
+  bool fill();
+
+  std::FILE* file;
+  char delimiter;
+  std::string buffer;
+  size_t begin = 0;  // 未処理データの先頭
+  size_t end = 0;
+  bool eof = false;
+  std::vector<std::pair<size_t, size_t>> spans;
+};
+
+enum class OutputFormat {
+  TEXT,     // Symbol::toString(), records separated by an empty line
+  BINARY,   // append_binary_record()
+  PBM,      // render_image() with StreamOptions::render
+  PGM,
+  PNG,
+  SVG,      // write_svg() with the quiet zone of StreamOptions::render
+  ARCHIVE,  // ArchiveWriter into output_file (archive.h); not with pipeline
+};
+
+// Binary record layout (all records concatenated in input order):
+//   u32 record index (little endian), u8 version, u8 error correction level,
+//   u8 mask pattern, u8 reserved (0), then `size` rows of (size + 7) / 8
+//   bytes, MSB first, 1 = dark (the PBM P4 row packing).
+constexpr size_t BINARY_RECORD_HEADER_SIZE = 8;
+size_t binary_record_size(int version);
+void append_binary_record(size_t index, const Symbol& symbol, std::string& out);
+// Only the rows of a binary record.
+void append_packed_rows(const Symbol& symbol, std::string& out);
+// The same rows written to `out`, which must hold size * ((size + 7) / 8)
+// bytes.
+void pack_rows(const Symbol& symbol, u_int8_t* out);
+
+struct StreamOptions {
+  BatchOptions batch;
+  char delimiter = '\n';
+  OutputFormat format = OutputFormat::TEXT;
+  RenderOptions render;  // image formats only
+  // Exactly one sink is used: output_dir (one file per record named by its
+  // zero-padded index), else output_file ("-" or empty: stdout).
+  std::string output_dir;
+  std::string output_file;
+  size_t block_records = 4096;  // records read and encoded per round
+  // Encode through an EncodePipeline with pipeline_threads per stage instead
+  // of one encode_batch() call per block; batch.threads and chunk_size are
+  // then unused, and batch.verify and batch.cache are rejected. Output is
+  // still written in input order, flushed every block_records records.
+  bool pipeline = false;
+  PipelineThreads pipeline_threads = {1, 1, 1, 1, 1, 1};
+};
+
+struct StreamStats {
+  size_t records = 0;
+  size_t failed = 0;
+};
+
+// Encodes every record of `input` and writes the symbols in input order.
+// Failed records are reported to `errors` as "<index>\t<message>\n" and
+// skipped in the output. Reading and encoding of one block overlaps with
+// writing the previous one. Throws std::runtime_error on I/O failures.
+StreamStats run_stream(std::FILE* input, const StreamOptions& options,
+                       std::FILE* errors);
+
+#endif  // STREAM_H
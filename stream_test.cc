@@ -0,0 +1,135 @@
+#include "stream.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+std::FILE* file_with(const std::string& contents) {
+  std::FILE* file = std::tmpfile();
+  std::fwrite(contents.data(), 1, contents.size(), file);
+  std::rewind(file);
+  return file;
+}
+
+std::string read_file(std::FILE* file) {
+  std::rewind(file);
+  std::string result;
+  char buffer[4096];
+  size_t n;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    result.append(buffer, n);
+  }
+  return result;
+}
+
+TEST(StreamTest, RecordReader) {
+  std::FILE* file = file_with("AB\r\n\nC D\nLAST");
+  RecordReader reader(file, '\n');
+  std::vector<std::string_view> records;
+  ASSERT_TRUE(reader.readBlock(2, records));
+  EXPECT_EQ(records, (std::vector<std::string_view>{"AB", ""}));
+  ASSERT_TRUE(reader.readBlock(10, records));
+  EXPECT_EQ(records, (std::vector<std::string_view>{"C D", "LAST"}));
+  EXPECT_FALSE(reader.readBlock(10, records));
+  std::fclose(file);
+
+  // ブロック境界をまたぐ長いレコードとNUL区切り
+  std::string long_record(200000, 'A');
+  file = file_with(long_record + '\0' + "X\nY" + '\0');
+  RecordReader nul_reader(file, '\0');
+  ASSERT_TRUE(nul_reader.readBlock(10, records));
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0], long_record);
+  EXPECT_EQ(records[1], "X\nY");
+  EXPECT_FALSE(nul_reader.readBlock(10, records));
+  std::fclose(file);
+}
+
+TEST(StreamTest, BinaryRecord) {
+  Symbol symbol = encode_symbol("HELLO WORLD", EncodeOptions{M});
+  ASSERT_TRUE(symbol.ok());
+  std::string out;
+  append_binary_record(0x01020304, symbol, out);
+  ASSERT_EQ(out.size(), binary_record_size(1));
+  ASSERT_EQ(out.size(), 8u + 21 * 3);
+  EXPECT_EQ(out.substr(0, 4), "\x04\x03\x02\x01");
+  EXPECT_EQ(out[4], 1);
+  EXPECT_EQ(out[5], M);
+  EXPECT_EQ(out[6], symbol.mask_pattern);
+  for (int x = 0; x < 21; x++) {
+    for (int y = 0; y < 24; y++) {
+      bool bit = (static_cast<u_int8_t>(out[8 + x * 3 + y / 8]) >>
+                  (7 - y % 8)) & 1;
+      EXPECT_EQ(bit, y < 21 && symbol.getCell(x, y)) << x << ", " << y;
+    }
+  }
+}
+
+TEST(StreamTest, RunStreamKeepsOrderAndReportsErrors) {
+  std::ostringstream input;
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 50; i++) {
+    payloads.push_back(i == 7 ? "lower case" : std::string(1 + i * 13, 'Q'));
+    input << payloads.back() << '\n';
+  }
+  std::FILE* in = file_with(input.str());
+  std::FILE* errors = std::tmpfile();
+  auto path = std::filesystem::temp_directory_path() /
+              ("qr_stream_test_" + std::to_string(::getpid()));
+  StreamOptions options;
+  options.format = OutputFormat::BINARY;
+  options.output_dir = path.string();
+  options.block_records = 8;
+  options.batch.threads = 3;
+  options.batch.chunk_size = 2;
+  StreamStats stats = run_stream(in, options, errors);
+  EXPECT_EQ(stats.records, 50u);
+  EXPECT_EQ(stats.failed, 1u);
+  EXPECT_EQ(read_file(errors).substr(0, 2), "7\t");
+  EXPECT_FALSE(std::filesystem::exists(path / "00000007.bin"));
+  for (int i : {0, 8, 49}) {
+    std::ifstream file(path / ("000000" + std::string(i < 10 ? "0" : "") +
+                               std::to_string(i) + ".bin"),
+                       std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+    std::string expected;
+    append_binary_record(i, encode_symbol(payloads[i]), expected);
+    EXPECT_EQ(contents, expected) << i;
+  }
+  std::filesystem::remove_all(path);
+  std::fclose(in);
+  std::fclose(errors);
+
+  // 単一ストリームへの連結出力
+  in = file_with(input.str());
+  errors = std::tmpfile();
+  options.output_dir.clear();
+  char out_path[] = "/tmp/qr_stream_test_XXXXXX";
+  int fd = mkstemp(out_path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  options.output_file = out_path;
+  stats = run_stream(in, options, errors);
+  EXPECT_EQ(stats.failed, 1u);
+  std::FILE* written = std::fopen(out_path, "rb");
+  std::string expected;
+  for (int i = 0; i < 50; i++) {
+    if (i != 7) {
+      append_binary_record(i, encode_symbol(payloads[i]), expected);
+    }
+  }
+  EXPECT_EQ(read_file(written), expected);
+  std::fclose(written);
+  std::remove(out_path);
+  std::fclose(in);
+  std::fclose(errors);
+}
+}  // namespace
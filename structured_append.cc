@@ -0,0 +1,127 @@
+#include "structured_append.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "segment.h"
+
+namespace {
+// 区間 segment の先頭から、残り avail ビットに見出しごと収まる最大の文字数
+u_int32_t fitting_chars(const Segment& segment, int version, u_int32_t avail) {
+  const u_int32_t max_count =
+      (u_int32_t{1} << char_count_bits(segment.mode_specifier, version)) - 1;
+  u_int32_t low = 0;
+  u_int32_t high = std::min(segment.length, max_count);
+  while (low < high) {
+    const u_int32_t middle = (low + high + 1) / 2;
+    const Segment piece{segment.mode_specifier, segment.begin, middle};
+    if (segment_bits(piece, version) <= avail) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+}  // namespace
+
+void split_structured_append(std::string_view payload,
+                             const EncodeOptions& options, int max_version,
+                             std::vector<std::string_view>& parts) {
+  if (max_version < MIN_VERSION || max_version > MAX_VERSION) {
+    throw EncodeError(REJECT_OPTION, "version must be in [1, 40] but got " +
+                                         std::to_string(max_version));
+  }
+  std::vector<Segment> segments;
+  // モードを固定すると encode_symbol() は1シンボルを1区間で符号化する
+  const bool fixed_mode = options.mode_specifier != AUTO_MODE;
+  if (!fixed_mode) {
+    optimal_segments(payload, max_version, segments);
+  } else {
+    segments.push_back({options.mode_specifier, 0,
+                        static_cast<u_int32_t>(payload.size())});
+  }
+  const u_int32_t capacity =
+      static_cast<u_int32_t>(
+          data_codewords(max_version, options.error_correction_level)) *
+          8 -
+      STRUCTURED_APPEND_HEADER_BITS;
+
+  // 先頭から詰められるだけ詰める。区間が収まりきらなければ、その区間を
+  // 文字の境目で切って残りを次のシンボルへ回す
+  parts.clear();
+  size_t part_begin = 0;
+  u_int32_t used = 0;
+  for (const Segment& segment : segments) {
+    Segment rest = segment;
+    while (rest.length > 0) {
+      const u_int32_t take =
+          fixed_mode && used > 0
+              ? 0
+              : fitting_chars(rest, max_version, capacity - used);
+      if (take == 0) {
+        if (used == 0) {
+          throw EncodeError(REJECT_CAPACITY,
+                            "Version " + std::to_string(max_version) +
+                                " cannot hold a single character");
+        }
+        parts.push_back(payload.substr(part_begin, rest.begin - part_begin));
+        part_begin = rest.begin;
+        used = 0;
+        continue;
+      }
+      used += segment_bits({rest.mode_specifier, rest.begin, take},
+                           max_version);
+      rest.begin += take;
+      rest.length -= take;
+    }
+  }
+  parts.push_back(payload.substr(part_begin));
+  if (parts.size() > MAX_STRUCTURED_APPEND_SYMBOLS) {
+    throw EncodeError(
+        REJECT_CAPACITY,
+        "Input needs " + std::to_string(parts.size()) + " symbols of version " +
+            std::to_string(max_version) + " but Structured Append allows " +
+            std::to_string(MAX_STRUCTURED_APPEND_SYMBOLS));
+  }
+}
+
+std::vector<Symbol> encode_structured_append(std::string_view payload,
+                                             const BatchOptions& options,
+                                             int max_version,
+                                             WorkStealingPool& pool) {
+  std::vector<std::string_view> parts;
+  try {
+    split_structured_append(payload, options.encode, max_version, parts);
+  } catch (const std::exception& e) {
+    std::vector<Symbol> failed(1);
+    failed[0].setError(e.what(), reject_reason(e));
+    return failed;
+  }
+  std::vector<Symbol> result(parts.size());
+  std::vector<EncodeScratch> scratch(pool.threadCount());
+  std::vector<DecodeResult> decoded(options.verify ? pool.threadCount() : 0);
+  const u_int8_t parity = structured_append_parity(payload);
+  // 部品は高々16個なので1つずつ配る
+  pool.parallelFor(parts.size(), 1, [&](size_t begin, size_t end, int worker) {
+    for (size_t i = begin; i < end; i++) {
+      EncodeOptions part_options = options.encode;
+      part_options.version = 0;
+      part_options.structured_append = {
+          static_cast<int>(i), static_cast<int>(parts.size()), parity};
+      encode_symbol(parts[i], part_options, scratch[worker], result[i]);
+      if (options.verify && result[i].ok()) {
+        verify_symbol(parts[i], part_options, result[i], decoded[worker]);
+      }
+    }
+  });
+  return result;
+}
+
+std::vector<Symbol> encode_structured_append(std::string_view payload,
+                                             const BatchOptions& options,
+                                             int max_version) {
+  WorkStealingPool pool(options.threads);
+  return encode_structured_append(payload, options, max_version, pool);
+}
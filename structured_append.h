@@ -0,0 +1,40 @@
+#ifndef STRUCTURED_APPEND_H
+#define STRUCTURED_APPEND_H
+
+#include <string_view>
+#include <vector>
+
+#include "batch.h"
+#include "qr.h"
+#include "thread_pool.h"
+
+// Structured Append (ISO/IEC 18004, 7.4): one message spread over up to 16
+// symbols, each starting with a 20-bit header (mode 0011, its position, the
+// total and the parity of the whole message). Several small symbols encode
+// in parallel and are quicker to aim a hand-held reader at than one large
+// symbol. The decoder side is join_structured_append() in decoder.h.
+
+// Cuts `payload` into as few parts as possible that each fit, header
+// included, in a symbol of at most `max_version` at
+// options.error_correction_level. With AUTO_MODE the cuts fall between the
+// segments of the optimal segmentation where the capacity allows and
+// otherwise inside a segment, on a character boundary. Throws
+// std::invalid_argument when more than 16 symbols would be needed.
+void split_structured_append(std::string_view payload,
+                             const EncodeOptions& options, int max_version,
+                             std::vector<std::string_view>& parts);
+
+// Splits `payload` as above and encodes the parts in parallel; result[i] is
+// the symbol at position i, each of the smallest version that fits.
+// options.encode.version and structured_append are ignored, and
+// options.verify decodes every symbol back as encode_batch() does. A payload
+// that cannot be split yields a single symbol whose error is set.
+std::vector<Symbol> encode_structured_append(std::string_view payload,
+                                             const BatchOptions& options,
+                                             int max_version,
+                                             WorkStealingPool& pool);
+std::vector<Symbol> encode_structured_append(std::string_view payload,
+                                             const BatchOptions& options = {},
+                                             int max_version = MAX_VERSION);
+
+#endif  // STRUCTURED_APPEND_H
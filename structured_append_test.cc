@@ -0,0 +1,154 @@
+#include "structured_append.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+namespace {
+std::string mixed_payload(size_t length, unsigned seed) {
+  // 数字・英大文字・バイトの連なりが入れ替わる、区間分割の効く入力
+  std::mt19937 random(seed);
+  const std::string alphabets[] = {"0123456789", "ABCDEFXYZ $%*+-./:",
+                                   "abc\xE3\x81\x82!?"};
+  std::string payload;
+  while (payload.size() < length) {
+    const std::string& alphabet = alphabets[random() % 3];
+    for (int run = 5 + static_cast<int>(random() % 40); run > 0; run--) {
+      payload += alphabet[random() % alphabet.size()];
+    }
+  }
+  payload.resize(length);
+  return payload;
+}
+
+TEST(StructuredAppendTest, SplitsEncodesAndJoins) {
+  const std::string payload = mixed_payload(3000, 1);
+  for (ErrorCorrectionLevel ecl : {L, M, H}) {
+    BatchOptions options;
+    options.encode = {ecl, 0, AUTO_MASK, AUTO_MODE};
+    options.threads = 4;
+    options.verify = true;
+    const int max_version = ecl == H ? 25 : 10;
+    std::vector<Symbol> symbols =
+        encode_structured_append(payload, options, max_version);
+    ASSERT_GT(symbols.size(), 1u);
+    ASSERT_LE(symbols.size(), 16u);
+
+    std::vector<DecodeResult> decoded;
+    for (size_t i = 0; i < symbols.size(); i++) {
+      ASSERT_TRUE(symbols[i].ok()) << i << ": " << symbols[i].error;
+      EXPECT_LE(symbols[i].version, max_version);
+      decoded.push_back(decode_symbol(symbols[i]));
+      ASSERT_TRUE(decoded.back().ok()) << decoded.back().error;
+      EXPECT_EQ(static_cast<int>(i), decoded.back().structured_append.index);
+      EXPECT_EQ(static_cast<int>(symbols.size()),
+                decoded.back().structured_append.total);
+      EXPECT_EQ(structured_append_parity(payload),
+                decoded.back().structured_append.parity);
+    }
+    // 読み取り順は問わない
+    std::shuffle(decoded.begin(), decoded.end(), std::mt19937(ecl));
+    DecodeResult joined = join_structured_append(decoded);
+    ASSERT_TRUE(joined.ok()) << joined.error;
+    EXPECT_EQ(payload, joined.text);
+    EXPECT_EQ(static_cast<int>(symbols.size()),
+              joined.structured_append.total);
+  }
+}
+
+TEST(StructuredAppendTest, SplitFillsEachSymbol) {
+  const std::string payload = mixed_payload(5000, 2);
+  const EncodeOptions options{M, 0, AUTO_MASK, AUTO_MODE};
+  std::vector<std::string_view> parts;
+  split_structured_append(payload, options, 12, parts);
+  std::string joined;
+  for (size_t i = 0; i < parts.size(); i++) {
+    joined += parts[i];
+    EncodeOptions part_options = options;
+    part_options.structured_append = {static_cast<int>(i),
+                                      static_cast<int>(parts.size()), 0};
+    Symbol symbol = encode_symbol(parts[i], part_options);
+    ASSERT_TRUE(symbol.ok()) << symbol.error;
+    EXPECT_LE(symbol.version, 12);
+    // 最後以外は、次の部品の先頭1文字を足すと版12に入らない
+    if (i + 1 < parts.size()) {
+      EXPECT_EQ(12, symbol.version);
+      part_options.version = 12;
+      const std::string longer =
+          std::string(parts[i]) + parts[i + 1].front();
+      EXPECT_FALSE(encode_symbol(longer, part_options).ok()) << i;
+    }
+  }
+  EXPECT_EQ(payload, joined);
+
+  // 1つに収まるなら分けない。固定モードも同じ規則で切る
+  split_structured_append("HELLO", options, 1, parts);
+  ASSERT_EQ(1u, parts.size());
+  EXPECT_EQ("HELLO", parts[0]);
+  // 5-L は108コードワード: 864 - 見出し20 - 数字の区間見出し14 = 830ビット
+  // で数字249文字
+  const std::string digits(2000, '7');
+  split_structured_append(digits, {L, 0, AUTO_MASK, NUMBER_MODE}, 5, parts);
+  ASSERT_EQ(9u, parts.size());
+  EXPECT_EQ(249u, parts[0].size());
+  EXPECT_EQ(8u, parts[8].size());
+}
+
+TEST(StructuredAppendTest, RejectsWhatCannotBeSplit) {
+  const std::string payload = mixed_payload(5000, 3);
+  std::vector<Symbol> symbols = encode_structured_append(payload, {}, 2);
+  ASSERT_EQ(1u, symbols.size());
+  EXPECT_FALSE(symbols[0].ok());
+  EXPECT_NE(std::string::npos, symbols[0].error.find("Structured Append"));
+
+  std::vector<std::string_view> parts;
+  EXPECT_THROW(split_structured_append(payload, {}, 41, parts),
+               std::invalid_argument);
+
+  Symbol bad_position = encode_symbol(
+      "X", {L, 0, AUTO_MASK, AUTO_MODE, StructuredAppend{3, 3, 0}});
+  EXPECT_FALSE(bad_position.ok());
+}
+
+TEST(StructuredAppendTest, JoinChecksTheSequence) {
+  const std::string payload = mixed_payload(1500, 4);
+  BatchOptions options;
+  options.encode = {Q, 0, AUTO_MASK, AUTO_MODE};
+  options.threads = 2;
+  std::vector<DecodeResult> decoded;
+  for (const Symbol& symbol : encode_structured_append(payload, options, 7)) {
+    decoded.push_back(decode_symbol(symbol));
+  }
+  ASSERT_GE(decoded.size(), 3u);
+  ASSERT_TRUE(join_structured_append(decoded).ok());
+
+  std::vector<DecodeResult> missing(decoded.begin() + 1, decoded.end());
+  EXPECT_FALSE(join_structured_append(missing).ok());
+
+  std::vector<DecodeResult> duplicated = decoded;
+  duplicated[1] = duplicated[0];
+  EXPECT_FALSE(join_structured_append(duplicated).ok());
+
+  std::vector<DecodeResult> tampered = decoded;
+  tampered[2].text[0] ^= 1;
+  DecodeResult joined = join_structured_append(tampered);
+  EXPECT_FALSE(joined.ok());
+  EXPECT_TRUE(joined.text.empty());
+
+  std::vector<DecodeResult> other = decoded;
+  other[0].structured_append.parity ^= 0x80;
+  EXPECT_FALSE(join_structured_append(other).ok());
+
+  EXPECT_FALSE(join_structured_append({}).ok());
+
+  // 見出しのないシンボルは total 0
+  DecodeResult single = decode_symbol(encode_symbol("HELLO"));
+  ASSERT_TRUE(single.ok());
+  EXPECT_EQ(0, single.structured_append.total);
+}
+}  // namespace
@@ -0,0 +1,164 @@
+#include "svg.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// 数値は高々4桁 + 符号
+constexpr size_t MAX_NUMBER_LENGTH = 5;
+// "m" dx dy "h" w "v" h "h-" w "z"
+constexpr size_t MAX_RUN_LENGTH = 1 + 2 * MAX_NUMBER_LENGTH + 1 +
+                                  MAX_NUMBER_LENGTH + 1 + MAX_NUMBER_LENGTH +
+                                  2 + MAX_NUMBER_LENGTH + 1;
+constexpr size_t MAX_FIXED_LENGTH = 256;
+
+class Writer {
+ public:
+  explicit Writer(char* out) : begin(out), p(out) {}
+
+  void text(const char* s) {
+    size_t n = std::strlen(s);
+    std::memcpy(p, s, n);
+    p += n;
+  }
+  void put(char c) { *p++ = c; }
+  void number(int value) {
+    p = std::to_chars(p, p + MAX_NUMBER_LENGTH, value).ptr;
+  }
+  // 負数は '-' が区切りを兼ねるので空白を省く
+  void pair(int a, int b) {
+    number(a);
+    if (b >= 0) {
+      put(' ');
+    }
+    number(b);
+  }
+  size_t length() const { return static_cast<size_t>(p - begin); }
+
+ private:
+  char* begin;
+  char* p;
+};
+
+bool bit(const u_int64_t* row, int y) { return (row[y / 64] >> (y % 64)) & 1; }
+
+// `from` 以降で最初に値が `value` のビット位置 (なければ limit)
+int next_bit(const u_int64_t* row, int from, int limit, bool value) {
+  while (from < limit) {
+    u_int64_t word = row[from / 64];
+    if (!value) {
+      word = ~word;
+    }
+    word >>= from % 64;
+    if (word != 0) {
+      return std::min(limit, from + __builtin_ctzll(word));
+    }
+    from = (from / 64 + 1) * 64;
+  }
+  return limit;
+}
+
+// [start, end) がちょうど1つの連なりになっているか
+bool is_exact_run(const u_int64_t* row, int size, int start, int end) {
+  if (start > 0 && bit(row, start - 1)) {
+    return false;
+  }
+  if (end < size && bit(row, end)) {
+    return false;
+  }
+  return next_bit(row, start, end, false) == end;
+}
+}  // namespace
+
+size_t svg_max_size(int size, const SvgOptions& options) {
+  const size_t runs = static_cast<size_t>(size) * ((size + 1) / 2);
+  return MAX_FIXED_LENGTH + std::strlen(options.dark_color) +
+         (options.light_color ? std::strlen(options.light_color) : 0) +
+         runs * MAX_RUN_LENGTH;
+}
+
+size_t write_svg(const ModuleMatrix& matrix, const SvgOptions& options,
+                 char* out) {
+  if (options.quiet_zone < 0 || options.quiet_zone > 1000 ||
+      options.pixel_size < 0 || options.pixel_size > 99999) {
+    throw std::invalid_argument("invalid SVG quiet zone or pixel size");
+  }
+  const int size = matrix.size;
+  const int q = options.quiet_zone;
+  const int extent = size + 2 * q;
+  Writer w(out);
+  w.text("<svg xmlns=\"http://www.w3.org/2000/svg\"");
+  if (options.pixel_size > 0) {
+    w.text(" width=\"");
+    w.number(options.pixel_size);
+    w.text("\" height=\"");
+    w.number(options.pixel_size);
+    w.put('"');
+  }
+  w.text(" viewBox=\"0 0 ");
+  w.pair(extent, extent);
+  w.text("\" shape-rendering=\"crispEdges\">");
+  if (options.light_color != nullptr) {
+    w.text("<path fill=\"");
+    w.text(options.light_color);
+    w.text("\" d=\"M0 0h");
+    w.number(extent);
+    w.put('v');
+    w.number(extent);
+    w.put('H');
+    w.text("0z\"/>");
+  }
+  w.text("<path fill=\"");
+  w.text(options.dark_color);
+  w.text("\" d=\"");
+
+  // 各矩形の後の "z" で現在点はその矩形の左上に戻る。パス先頭の "m" は
+  // 絶対座標として扱われるので原点から始めればよい
+  int cx = 0;
+  int cy = 0;
+  for (int x = 0; x < size; x++) {
+    const u_int64_t* row = matrix.row(x);
+    for (int start = next_bit(row, 0, size, true); start < size;
+         start = next_bit(row, start, size, true)) {
+      const int end = next_bit(row, start, size, false);
+      // 上の行に同じ連なりがあれば、その矩形がこの行まで伸びて出力済み
+      if (options.merge_rectangles && x > 0 &&
+          is_exact_run(matrix.row(x - 1), size, start, end)) {
+        start = end;
+        continue;
+      }
+      int height = 1;
+      if (options.merge_rectangles) {
+        while (x + height < size &&
+               is_exact_run(matrix.row(x + height), size, start, end)) {
+          height++;
+        }
+      }
+      const int left = start + q;
+      const int top = x + q;
+      w.put('m');
+      w.pair(left - cx, top - cy);
+      w.put('h');
+      w.number(end - start);
+      w.put('v');
+      w.number(height);
+      w.text("h-");
+      w.number(end - start);
+      w.put('z');
+      cx = left;
+      cy = top;
+      start = end;
+    }
+  }
+  w.text("\"/></svg>\n");
+  return w.length();
+}
+
+void render_svg(const ModuleMatrix& matrix, const SvgOptions& options,
+                std::string& out) {
+  const size_t offset = out.size();
+  out.resize(offset + svg_max_size(matrix.size, options));
+  out.resize(offset + write_svg(matrix, options, out.data() + offset));
+}
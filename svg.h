@@ -0,0 +1,32 @@
+#ifndef SVG_H
+#define SVG_H
+
+#include <cstddef>
+#include <string>
+
+#include "render.h"
+
+struct SvgOptions {
+  int quiet_zone = 4;  // light modules around the symbol
+  int pixel_size = 0;  // width/height attributes; 0 leaves them out
+  // Also merge identical runs on consecutive rows into one taller rectangle.
+  bool merge_rectangles = true;
+  const char* dark_color = "#000";
+  const char* light_color = "#fff";  // nullptr: transparent background
+};
+
+// Upper bound of write_svg() output for a symbol of `size` modules.
+size_t svg_max_size(int size, const SvgOptions& options);
+
+// Writes an SVG document into `out` (at least svg_max_size() bytes) and
+// returns its length; it does not allocate. All dark modules form one <path>
+// of relative "m dx dy h w v h h-w z" rectangles, one per horizontal run of
+// dark modules (or per block of identical runs with merge_rectangles), in
+// module units of the viewBox.
+size_t write_svg(const ModuleMatrix& matrix, const SvgOptions& options,
+                 char* out);
+// Appends the document to `out`.
+void render_svg(const ModuleMatrix& matrix, const SvgOptions& options,
+                std::string& out);
+
+#endif  // SVG_H
@@ -0,0 +1,96 @@
+#include "svg.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+// Fills the rectangles of the dark <path> into a size x size grid.
+std::vector<std::vector<int>> rasterize(const std::string& svg, int size,
+                                        int quiet_zone) {
+  std::vector<std::vector<int>> grid(size, std::vector<int>(size));
+  size_t begin = svg.rfind(" d=\"") + 4;
+  const char* p = svg.c_str() + begin;
+  int cx = 0, cy = 0;
+  while (*p == 'm') {
+    char* next;
+    cx += std::strtol(p + 1, &next, 10);
+    cy += std::strtol(next, &next, 10);
+    EXPECT_EQ(*next, 'h');
+    int width = std::strtol(next + 1, &next, 10);
+    EXPECT_EQ(*next, 'v');
+    int height = std::strtol(next + 1, &next, 10);
+    EXPECT_EQ(std::string(next, 2), "h-");
+    EXPECT_EQ(std::strtol(next + 2, &next, 10), width);
+    EXPECT_EQ(*next, 'z');
+    p = next + 1;
+    for (int x = cy; x < cy + height; x++) {
+      for (int y = cx; y < cx + width; y++) {
+        grid[x - quiet_zone][y - quiet_zone]++;
+      }
+    }
+  }
+  EXPECT_EQ(std::string(p), "\"/></svg>\n");
+  return grid;
+}
+
+TEST(SvgTest, PathCoversDarkModules) {
+  Symbol symbol = encode_symbol(std::string(100, '7'), EncodeOptions{H});
+  for (bool merge : {false, true}) {
+    SvgOptions options;
+    options.merge_rectangles = merge;
+    std::string svg;
+    render_svg(module_matrix(symbol), options, svg);
+    const std::string extent = std::to_string(symbol.size + 8);
+    EXPECT_EQ(svg.rfind("<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 "
+                        "0 " + extent + " " + extent + "\"",
+                        0),
+              0u);
+    auto grid = rasterize(svg, symbol.size, options.quiet_zone);
+    for (int x = 0; x < symbol.size; x++) {
+      for (int y = 0; y < symbol.size; y++) {
+        // 各暗モジュールはちょうど1つの矩形に含まれる
+        ASSERT_EQ(grid[x][y], symbol.getCell(x, y) ? 1 : 0) << x << ", " << y;
+      }
+    }
+  }
+}
+
+TEST(SvgTest, CompactAndBounded) {
+  Symbol symbol = encode_symbol(std::string(1000, 'A'), EncodeOptions{L});
+  int dark = 0;
+  for (int x = 0; x < symbol.size; x++) {
+    for (int y = 0; y < symbol.size; y++) {
+      dark += symbol.getCell(x, y);
+    }
+  }
+  std::string svg;
+  SvgOptions options;
+  options.pixel_size = 512;
+  render_svg(module_matrix(symbol), options, svg);
+  // 1モジュール1矩形 (<rect x=".." y=".." width="1" height="1"/>) の数分の1
+  EXPECT_LT(svg.size() * 5, static_cast<size_t>(dark) * 40);
+  EXPECT_NE(svg.find("width=\"512\" height=\"512\""), std::string::npos);
+
+  // 最悪ケース: 市松模様は全ての連なりが1モジュール
+  const int size = symbol_size(MAX_VERSION);
+  std::vector<u_int64_t> checker(size * MAX_WORDS_PER_ROW);
+  for (int x = 0; x < size; x++) {
+    for (int y = (x & 1); y < size; y += 2) {
+      checker[x * MAX_WORDS_PER_ROW + y / 64] |= u_int64_t{1} << (y % 64);
+    }
+  }
+  options.quiet_zone = 1000;
+  options.merge_rectangles = false;
+  std::vector<char> buffer(svg_max_size(size, options));
+  size_t length = write_svg({checker.data(), size, MAX_WORDS_PER_ROW},
+                            options, buffer.data());
+  EXPECT_LE(length, buffer.size());
+  auto grid = rasterize(std::string(buffer.data(), length), size, 1000);
+  EXPECT_EQ(grid[0][0], 1);
+  EXPECT_EQ(grid[0][1], 0);
+  EXPECT_EQ(grid[size - 1][size - 1], 1);
+}
+}  // namespace
@@ -0,0 +1,217 @@
+#include "symbol_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+constexpr u_int64_t MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+inline u_int64_t mix(u_int64_t h, u_int64_t v) {
+  h ^= v * MULTIPLIER;
+  h = (h << 31) | (h >> 33);
+  return h * 0xC2B2AE3D27D4EB4Full;
+}
+
+// 最後の攪拌 (splitmix64 の仕上げ)
+inline u_int64_t finish(u_int64_t h) {
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBull;
+  return h ^ (h >> 31);
+}
+
+// 符号化の設定を1語に詰める。描画の項目は最上位ビットで区別する
+constexpr u_int64_t RENDERED_TAG = u_int64_t{1} << 63;
+
+u_int64_t options_tag(const EncodeOptions& options) {
+  const StructuredAppend& append = options.structured_append;
+  return static_cast<u_int64_t>(options.error_correction_level) |
+         static_cast<u_int64_t>(options.version & 0xFF) << 2 |
+         static_cast<u_int64_t>((options.mask_byte + 1) & 0xFF) << 10 |
+         static_cast<u_int64_t>(options.mode_specifier) << 18 |
+         static_cast<u_int64_t>(append.index & 0xFF) << 26 |
+         static_cast<u_int64_t>(append.total & 0xFF) << 34 |
+         static_cast<u_int64_t>(append.parity) << 42;
+}
+
+u_int64_t rendered_tag(const Symbol& symbol, u_int32_t variant) {
+  return RENDERED_TAG | static_cast<u_int64_t>(variant) << 8 |
+         static_cast<u_int64_t>(symbol.version);
+}
+
+std::string_view module_bytes(const Symbol& symbol) {
+  return {reinterpret_cast<const char*>(symbol.modules.data()),
+          symbol.modules.size() * sizeof(u_int64_t)};
+}
+
+// 1項目が占めるおおよその大きさ (キーと値、リストと索引の節点)
+size_t entry_bytes(size_t key, const Symbol& symbol, size_t rendered) {
+  return key + symbol.modules.size() * sizeof(u_int64_t) + rendered + 160;
+}
+}  // namespace
+
+u_int64_t hash_bytes(const void* data, size_t size, u_int64_t seed) {
+  const auto* p = static_cast<const unsigned char*>(data);
+  u_int64_t h = seed ^ (size * MULTIPLIER);
+  for (; size >= 8; size -= 8, p += 8) {
+    u_int64_t word;
+    std::memcpy(&word, p, 8);
+    h = mix(h, word);
+  }
+  u_int64_t tail = 0;
+  std::memcpy(&tail, p, size);
+  return finish(mix(h, tail));
+}
+
+SymbolCache::SymbolCache(const SymbolCacheOptions& options) {
+  if (options.shards < 1) {
+    throw std::invalid_argument("a cache needs at least one shard");
+  }
+  shard_budget = options.max_bytes / options.shards;
+  for (int i = 0; i < options.shards; i++) {
+    shards.push_back(std::make_unique<Shard>());
+  }
+}
+
+SymbolCache::~SymbolCache() = default;
+
+SymbolCache::Entry* SymbolCache::find(Shard& shard, u_int64_t hash,
+                                      u_int64_t tag, std::string_view key) {
+  auto found = shard.index.find(hash);
+  if (found == shard.index.end()) {
+    return nullptr;
+  }
+  Entry& entry = *found->second;
+  if (entry.tag != tag || entry.key != key) {
+    return nullptr;  // ハッシュの衝突
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+  return &entry;
+}
+
+void SymbolCache::put(Entry entry) {
+  if (entry.bytes > shard_budget) {
+    return;
+  }
+  Shard& s = shard(entry.hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  // 同じハッシュの項目は (衝突していても) 新しい方で置き換える
+  auto found = s.index.find(entry.hash);
+  if (found != s.index.end()) {
+    s.bytes -= found->second->bytes;
+    s.lru.erase(found->second);
+    s.index.erase(found);
+  }
+  while (s.bytes + entry.bytes > shard_budget) {
+    const Entry& oldest = s.lru.back();
+    s.bytes -= oldest.bytes;
+    s.index.erase(oldest.hash);
+    s.lru.pop_back();
+    s.stats.evictions++;
+  }
+  s.bytes += entry.bytes;
+  s.stats.insertions++;
+  const u_int64_t hash = entry.hash;
+  s.lru.push_front(std::move(entry));
+  s.index.emplace(hash, s.lru.begin());
+}
+
+bool SymbolCache::lookup(std::string_view payload,
+                         const EncodeOptions& options, Symbol& out) {
+  const u_int64_t tag = options_tag(options);
+  const u_int64_t hash = hash_bytes(payload.data(), payload.size(), tag);
+  Shard& s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  const Entry* entry = find(s, hash, tag, payload);
+  if (entry == nullptr) {
+    s.stats.misses++;
+    return false;
+  }
+  s.stats.hits++;
+  const Symbol& cached = entry->symbol;
+  out.version = cached.version;
+  out.error_correction_level = cached.error_correction_level;
+  out.mask_pattern = cached.mask_pattern;
+  out.size = cached.size;
+  out.words_per_row = cached.words_per_row;
+  out.modules.assign(cached.modules.begin(), cached.modules.end());
+  out.error.clear();
+  return true;
+}
+
+void SymbolCache::insert(std::string_view payload,
+                         const EncodeOptions& options, const Symbol& symbol) {
+  if (!symbol.ok()) {
+    return;
+  }
+  const u_int64_t tag = options_tag(options);
+  const u_int64_t hash = hash_bytes(payload.data(), payload.size(), tag);
+  put({hash, tag, std::string(payload), symbol, std::string(),
+       entry_bytes(payload.size(), symbol, 0)});
+}
+
+bool SymbolCache::lookupRendered(const Symbol& symbol, u_int32_t variant,
+                                 std::string& out) {
+  const u_int64_t tag = rendered_tag(symbol, variant);
+  const std::string_view key = module_bytes(symbol);
+  const u_int64_t hash = hash_bytes(key.data(), key.size(), tag);
+  Shard& s = shard(hash);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  const Entry* entry = find(s, hash, tag, key);
+  if (entry == nullptr) {
+    s.stats.rendered_misses++;
+    return false;
+  }
+  s.stats.rendered_hits++;
+  out += entry->rendered;
+  return true;
+}
+
+void SymbolCache::insertRendered(const Symbol& symbol, u_int32_t variant,
+                                 std::string_view rendered) {
+  if (!symbol.ok()) {
+    return;
+  }
+  const u_int64_t tag = rendered_tag(symbol, variant);
+  const std::string_view key = module_bytes(symbol);
+  const u_int64_t hash = hash_bytes(key.data(), key.size(), tag);
+  put({hash, tag, std::string(key), Symbol(), std::string(rendered),
+       entry_bytes(key.size(), Symbol(), rendered.size())});
+}
+
+SymbolCacheStats SymbolCache::stats() const {
+  SymbolCacheStats total;
+  for (const auto& s : shards) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    total.hits += s->stats.hits;
+    total.misses += s->stats.misses;
+    total.rendered_hits += s->stats.rendered_hits;
+    total.rendered_misses += s->stats.rendered_misses;
+    total.insertions += s->stats.insertions;
+    total.evictions += s->stats.evictions;
+    total.entries += s->lru.size();
+    total.bytes += s->bytes;
+  }
+  return total;
+}
+
+void SymbolCache::clear() {
+  for (const auto& s : shards) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->lru.clear();
+    s->index.clear();
+    s->bytes = 0;
+  }
+}
+
+void encode_symbol_cached(std::string_view payload,
+                          const EncodeOptions& options, EncodeScratch& scratch,
+                          SymbolCache& cache, Symbol& out) {
+  if (cache.lookup(payload, options, out)) {
+    return;
+  }
+  encode_symbol(payload, options, scratch, out);
+  cache.insert(payload, options, out);
+}
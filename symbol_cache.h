@@ -0,0 +1,106 @@
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "qr.h"
+
+// Content-addressed cache of encoded symbols for traffic where a few hot
+// payloads repeat. A symbol is keyed by a 64-bit hash of the payload and every
+// EncodeOptions field (version, error correction level, mask and mode policy,
+// Structured Append header); rendered outputs are keyed by the symbol's
+// modules and a caller-chosen variant (format and render options). The key
+// itself is kept next to the value, so a hash collision is a miss, never a
+// wrong symbol. Entries are spread over shards by hash, each shard an LRU
+// list under its own mutex, and the total size of keys and values is bounded.
+
+struct SymbolCacheOptions {
+  size_t max_bytes = size_t{64} << 20;  // split evenly between the shards
+  int shards = 16;
+};
+
+struct SymbolCacheStats {
+  u_int64_t hits = 0;
+  u_int64_t misses = 0;
+  u_int64_t rendered_hits = 0;
+  u_int64_t rendered_misses = 0;
+  u_int64_t insertions = 0;
+  u_int64_t evictions = 0;  // entries dropped to stay within max_bytes
+  size_t entries = 0;
+  size_t bytes = 0;
+};
+
+// 64-bit hash of `size` bytes, 8 bytes per step.
+u_int64_t hash_bytes(const void* data, size_t size, u_int64_t seed = 0);
+
+// Thread safe; one cache is meant to be shared by every worker.
+class SymbolCache {
+ public:
+  explicit SymbolCache(const SymbolCacheOptions& options = {});
+  ~SymbolCache();
+  SymbolCache(const SymbolCache&) = delete;
+  SymbolCache& operator=(const SymbolCache&) = delete;
+
+  // Copies the cached symbol into `out` (reusing its capacity) and returns
+  // true, or returns false on a miss.
+  bool lookup(std::string_view payload, const EncodeOptions& options,
+              Symbol& out);
+  // Only successfully encoded symbols are stored.
+  void insert(std::string_view payload, const EncodeOptions& options,
+              const Symbol& symbol);
+
+  // Appends the cached rendering of `symbol` to `out` and returns true, or
+  // returns false on a miss.
+  bool lookupRendered(const Symbol& symbol, u_int32_t variant,
+                      std::string& out);
+  void insertRendered(const Symbol& symbol, u_int32_t variant,
+                      std::string_view rendered);
+
+  SymbolCacheStats stats() const;
+  void clear();
+
+ private:
+  struct Entry {
+    u_int64_t hash;
+    u_int64_t tag;    // 符号化の設定、または描画の variant
+    std::string key;  // ペイロード、または描画したシンボルのモジュール
+    Symbol symbol;
+    std::string rendered;
+    size_t bytes;
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> lru;  // 先頭ほど最近使った
+    std::unordered_map<u_int64_t, std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+    SymbolCacheStats stats;
+  };
+
+  Shard& shard(u_int64_t hash) {
+    return *shards[(hash >> 32) % shards.size()];
+  }
+  // 見つかれば最近使った側へ移して返す。呼び出し側がロックを持つ
+  Entry* find(Shard& shard, u_int64_t hash, u_int64_t tag,
+              std::string_view key);
+  void put(Entry entry);
+
+  size_t shard_budget;
+  std::vector<std::unique_ptr<Shard>> shards;
+};
+
+// encode_symbol() through `cache`: a hit copies the stored symbol, a miss
+// encodes with `scratch` and stores the result.
+void encode_symbol_cached(std::string_view payload,
+                          const EncodeOptions& options, EncodeScratch& scratch,
+                          SymbolCache& cache, Symbol& out);
+
+#endif  // SYMBOL_CACHE_H
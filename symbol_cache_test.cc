@@ -0,0 +1,187 @@
+#include "symbol_cache.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "stream.h"
+
+namespace {
+void expect_same_symbol(const Symbol& expected, const Symbol& actual) {
+  ASSERT_TRUE(actual.ok()) << actual.error;
+  EXPECT_EQ(expected.version, actual.version);
+  EXPECT_EQ(expected.error_correction_level, actual.error_correction_level);
+  EXPECT_EQ(expected.mask_pattern, actual.mask_pattern);
+  EXPECT_EQ(expected.size, actual.size);
+  EXPECT_EQ(expected.modules, actual.modules);
+}
+
+TEST(SymbolCacheTest, HashBytes) {
+  const std::string text = "https://example.com/venue/42";
+  EXPECT_EQ(hash_bytes(text.data(), text.size()),
+            hash_bytes(text.data(), text.size()));
+  // 長さ・末尾の端数・種のどれが違っても別の値になる
+  std::set<u_int64_t> hashes;
+  for (size_t n = 0; n <= text.size(); n++) {
+    hashes.insert(hash_bytes(text.data(), n));
+    hashes.insert(hash_bytes(text.data(), n, 1));
+  }
+  EXPECT_EQ(2 * (text.size() + 1), hashes.size());
+  const std::string zeros(9, '\0');
+  EXPECT_NE(hash_bytes(zeros.data(), 8), hash_bytes(zeros.data(), 9));
+}
+
+TEST(SymbolCacheTest, KeyedByPayloadAndOptions) {
+  SymbolCache cache;
+  EncodeScratch scratch;
+  Symbol symbol;
+  const EncodeOptions options{M, 0, AUTO_MASK, AUTO_MODE};
+  encode_symbol_cached("PROMO-2026", options, scratch, cache, symbol);
+  encode_symbol_cached("PROMO-2026", options, scratch, cache, symbol);
+  expect_same_symbol(encode_symbol("PROMO-2026", options), symbol);
+  SymbolCacheStats stats = cache.stats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(1u, stats.entries);
+  EXPECT_GT(stats.bytes, 0u);
+
+  // 設定のどれかが違えば別の項目
+  std::vector<EncodeOptions> variants(5, options);
+  variants[0].error_correction_level = H;
+  variants[1].version = 5;
+  variants[2].mask_byte = 3;
+  variants[3].mode_specifier = BYTE_MODE;
+  variants[4].structured_append = {0, 2, 0x5A};
+  for (const EncodeOptions& variant : variants) {
+    EXPECT_FALSE(cache.lookup("PROMO-2026", variant, symbol));
+    encode_symbol_cached("PROMO-2026", variant, scratch, cache, symbol);
+    expect_same_symbol(encode_symbol("PROMO-2026", variant), symbol);
+  }
+  EXPECT_FALSE(cache.lookup("PROMO-2027", options, symbol));
+
+  // 失敗した符号化は覚えない
+  encode_symbol_cached("lower case", {L, 0, AUTO_MASK, ALNUM_MODE}, scratch,
+                       cache, symbol);
+  EXPECT_FALSE(symbol.ok());
+  EXPECT_EQ(6u, cache.stats().entries);
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.stats().entries);
+  EXPECT_EQ(0u, cache.stats().bytes);
+  EXPECT_FALSE(cache.lookup("PROMO-2026", options, symbol));
+}
+
+TEST(SymbolCacheTest, EvictsLeastRecentlyUsed) {
+  // 1シャードに版1のシンボルが3つ入るだけの予算
+  const Symbol probe = encode_symbol("0");
+  SymbolCache measure({size_t{1} << 20, 1});
+  measure.insert("0", {}, probe);
+  const size_t entry = measure.stats().bytes;
+  SymbolCache cache({3 * entry + entry / 2, 1});
+
+  const EncodeOptions options;
+  Symbol symbol;
+  for (const char* payload : {"1", "2", "3"}) {
+    cache.insert(payload, options, encode_symbol(payload, options));
+  }
+  ASSERT_TRUE(cache.lookup("1", options, symbol));  // "2" が最も古くなる
+  cache.insert("4", options, encode_symbol("4", options));
+  SymbolCacheStats stats = cache.stats();
+  EXPECT_EQ(1u, stats.evictions);
+  EXPECT_EQ(3u, stats.entries);
+  EXPECT_LE(stats.bytes, 3 * entry + entry / 2);
+  EXPECT_FALSE(cache.lookup("2", options, symbol));
+  for (const char* payload : {"1", "3", "4"}) {
+    EXPECT_TRUE(cache.lookup(payload, options, symbol)) << payload;
+  }
+
+  // 予算を超える項目はそもそも入れない
+  SymbolCache tiny({entry / 2, 1});
+  tiny.insert("0", options, probe);
+  EXPECT_EQ(0u, tiny.stats().entries);
+  EXPECT_THROW(SymbolCache({size_t{1} << 20, 0}), std::invalid_argument);
+}
+
+TEST(SymbolCacheTest, RenderedOutputs) {
+  SymbolCache cache;
+  const Symbol symbol = encode_symbol("HELLO");
+  std::string out = "prefix";
+  EXPECT_FALSE(cache.lookupRendered(symbol, 1, out));
+  cache.insertRendered(symbol, 1, "rendered");
+  EXPECT_TRUE(cache.lookupRendered(symbol, 1, out));
+  EXPECT_EQ("prefixrendered", out);
+  EXPECT_FALSE(cache.lookupRendered(symbol, 2, out));
+  // 描画はシンボルのモジュールで引くので、別のシンボルでは外れる
+  EXPECT_FALSE(cache.lookupRendered(encode_symbol("HELLP"), 1, out));
+  SymbolCacheStats stats = cache.stats();
+  EXPECT_EQ(1u, stats.rendered_hits);
+  EXPECT_EQ(3u, stats.rendered_misses);
+  EXPECT_EQ(0u, stats.hits + stats.misses);
+}
+
+TEST(SymbolCacheTest, BatchAndStreamPaths) {
+  std::vector<std::string> payloads;
+  for (int i = 0; i < 200; i++) {
+    payloads.push_back(i % 5 ? "HTTPS://EXAMPLE.COM/VENUE/" +
+                                   std::to_string(i % 3)
+                             : std::string(1 + i, '7'));
+  }
+  std::vector<std::string_view> views(payloads.begin(), payloads.end());
+  SymbolCache cache;
+  BatchOptions options;
+  options.threads = 3;
+  options.chunk_size = 4;
+  options.verify = true;
+  options.cache = &cache;
+  const std::vector<Symbol> uncached = encode_batch(views, {});
+  const std::vector<Symbol> cached = encode_batch(views, options);
+  for (size_t i = 0; i < payloads.size(); i++) {
+    expect_same_symbol(uncached[i], cached[i]);
+  }
+  SymbolCacheStats stats = cache.stats();
+  EXPECT_EQ(payloads.size(), stats.hits + stats.misses);
+  EXPECT_GE(stats.hits, 150u);  // 3種類の URL は最初の1回ずつだけ外れる
+
+  // ストリームは符号化と描画の両方がキャッシュを通る
+  std::string input;
+  for (const std::string& payload : payloads) {
+    input += payload + '\n';
+  }
+  auto run = [&](SymbolCache* stream_cache) {
+    std::FILE* in = std::tmpfile();
+    std::fwrite(input.data(), 1, input.size(), in);
+    std::rewind(in);
+    std::FILE* errors = std::tmpfile();
+    char out_path[] = "/tmp/symbol_cache_test_XXXXXX";
+    ::close(::mkstemp(out_path));
+    StreamOptions stream;
+    stream.format = OutputFormat::PNG;
+    stream.batch.cache = stream_cache;
+    stream.block_records = 32;
+    stream.output_file = out_path;
+    run_stream(in, stream, errors);
+    std::fclose(in);
+    std::fclose(errors);
+    std::ifstream file(out_path, std::ios::binary);
+    std::string written((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+    std::remove(out_path);
+    return written;
+  };
+  SymbolCache stream_cache;
+  const std::string expected = run(nullptr);
+  ASSERT_FALSE(expected.empty());
+  EXPECT_EQ(expected, run(&stream_cache));
+  stats = stream_cache.stats();
+  EXPECT_GE(stats.hits, 150u);
+  EXPECT_GE(stats.rendered_hits, 150u);
+  EXPECT_EQ(payloads.size(), stats.rendered_hits + stats.rendered_misses);
+}
+}  // namespace
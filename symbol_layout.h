@@ -0,0 +1,287 @@
+#ifndef SYMBOL_LAYOUT_H
+#define SYMBOL_LAYOUT_H
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+#include "qr.h"
+#include "qr_tables.h"
+
+// Function patterns, format information placement, the zigzag data module
+// order and the mask planes of a version. Every builder is constexpr: the
+// run-time encoder builds its per-version resources with them once
+// (version_resources() in qr.cc), QrSymbol (qr_symbol.h) and qr::make
+// (qr_static.h) get the same tables from the compiler.
+
+// A module plane and its reserved (function module) plane in the row-major
+// layout of QrCode::row(): row x is words_per_row words and module (x, y) is
+// bit y % 64 of word y / 64.
+struct SymbolPlanes {
+  u_int64_t* modules;
+  u_int64_t* reserved;
+  int size;
+  int words_per_row;
+
+  constexpr size_t word(int x, int y) const {
+    return static_cast<size_t>(x) * words_per_row + y / 64;
+  }
+  constexpr bool isReserved(int x, int y) const {
+    return (reserved[word(x, y)] >> (y % 64)) & 1;
+  }
+  constexpr void set(int x, int y, bool value) const {
+    const u_int64_t bit = u_int64_t{1} << (y % 64);
+    u_int64_t& w = modules[word(x, y)];
+    w = value ? (w | bit) : (w & ~bit);
+  }
+  // Sets the module and marks it reserved.
+  constexpr void setFunction(int x, int y, bool value = true) const {
+    set(x, y, value);
+    reserved[word(x, y)] |= u_int64_t{1} << (y % 64);
+  }
+};
+
+// Finder pattern with its top-left module at (x, y), plus the separator
+// around it as far as it lies inside the symbol.
+constexpr void draw_finder_pattern(const SymbolPlanes& planes, int x, int y) {
+  // 分離パターンを含む8x8の領域を予約する
+  for (int row = std::max(x - 1, 0); row < std::min(x + 8, planes.size);
+       row++) {
+    for (int col = std::max(y - 1, 0); col < std::min(y + 8, planes.size);
+         col++) {
+      const int dx = row - x - 3 < 0 ? x + 3 - row : row - x - 3;
+      const int dy = col - y - 3 < 0 ? y + 3 - col : col - y - 3;
+      const int ring = std::max(dx, dy);
+      planes.setFunction(row, col, ring != 2 && ring != 4);
+    }
+  }
+}
+
+// 5x5 alignment pattern centred on (x, y).
+constexpr void draw_alignment_pattern(const SymbolPlanes& planes, int x,
+                                      int y) {
+  for (int dx = -2; dx <= 2; dx++) {
+    for (int dy = -2; dy <= 2; dy++) {
+      const int ring = std::max(dx < 0 ? -dx : dx, dy < 0 ? -dy : dy);
+      planes.setFunction(x + dx, y + dy, ring != 1);
+    }
+  }
+}
+
+// The two 6x3 version information blocks (versions 7 and up).
+constexpr void draw_version_information(const SymbolPlanes& planes,
+                                        int version) {
+  if (version < 7) {
+    return;
+  }
+  // 右上と左下の6x3領域。左下は右上の転置
+  const u_int32_t bits = VERSION_INFORMATION_BITS[version];
+  for (int i = 0; i < 18; i++) {
+    const bool bit = (bits >> i) & 1;
+    const int a = planes.size - 11 + i % 3;
+    const int b = i / 3;
+    planes.setFunction(a, b, bit);
+    planes.setFunction(b, a, bit);
+  }
+}
+
+struct ModulePosition {
+  int x;
+  int y;
+};
+
+// Module of format information bit i % 15: the copy around the upper left
+// finder for i < 15, the one split between the other two finders after.
+constexpr ModulePosition format_position(int size, int i) {
+  if (i < 15) {
+    // 左上: 列8の上から下へ、続いて行8の右から左へ
+    return i <= 5 ? ModulePosition{i, 8}
+           : i <= 7 ? ModulePosition{i + 1, 8}
+           : i == 8 ? ModulePosition{8, 7}
+                    : ModulePosition{8, 14 - i};
+  }
+  // 右上(行8)と左下(列8)にもう1組
+  i -= 15;
+  return i < 8 ? ModulePosition{8, size - 1 - i}
+               : ModulePosition{size - 15 + i, 8};
+}
+
+// Writes (and reserves) both copies of the format information of
+// `correction_level` and mask `pattern` (0-7), and the dark module.
+constexpr void draw_format_information(const SymbolPlanes& planes,
+                                       ErrorCorrectionLevel correction_level,
+                                       int pattern) {
+  const u_int16_t bits = FORMAT_INFORMATION_BITS[correction_level][pattern];
+  for (int i = 0; i < 30; i++) {
+    const ModulePosition p = format_position(planes.size, i);
+    planes.setFunction(p.x, p.y, (bits >> (i % 15)) & 1);
+  }
+  planes.setFunction(planes.size - 8, 8);  // timing pattern
+}
+
+// Finder, timing and alignment patterns, the dark module and version
+// information of `version` into zeroed planes. The format information area
+// is reserved but left light; draw_format_information() fills it per symbol.
+constexpr void draw_function_patterns(const SymbolPlanes& planes,
+                                      int version) {
+  const int size = planes.size;
+  draw_finder_pattern(planes, 0, 0);         // Upper left
+  draw_finder_pattern(planes, size - 7, 0);  // Lower left
+  draw_finder_pattern(planes, 0, size - 7);  // Upper right
+
+  for (int i = 8; i < size - 8; i++) {
+    planes.setFunction(6, i, i % 2 == 0);  // Horizontal timing pattern
+    planes.setFunction(i, 6, i % 2 == 0);  // Vertical timing pattern
+  }
+
+  // 位置合わせパターン (ファインダパターンと重なる3隅を除く)
+  const int count = alignment_pattern_count(version);
+  const auto& positions = ALIGNMENT_PATTERN_POSITIONS[version];
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < count; j++) {
+      if ((i == 0 && j == 0) || (i == 0 && j == count - 1) ||
+          (i == count - 1 && j == 0)) {
+        continue;
+      }
+      draw_alignment_pattern(planes, positions[i], positions[j]);
+    }
+  }
+
+  for (int i = 0; i < 30; i++) {
+    const ModulePosition p = format_position(size, i);
+    planes.setFunction(p.x, p.y, false);
+  }
+  planes.setFunction(size - 8, 8);  // timing pattern
+  draw_version_information(planes, version);
+}
+
+// Calls f(x, y) for every unreserved module in placement order: two columns
+// at a time from the bottom right, alternately upwards and downwards.
+template <typename F>
+constexpr void for_each_data_module(const SymbolPlanes& planes, F&& f) {
+  const int size = planes.size;
+  for (int right = size - 1; right >= 1; right -= 2) {
+    if (right == 6) {
+      right = 5;  // 縦のタイミングパターンの列は飛ばす
+    }
+    const bool upward = ((right + 1) & 2) == 0;
+    for (int vertical = 0; vertical < size; vertical++) {
+      const int x = upward ? size - 1 - vertical : vertical;
+      for (int j = 0; j < 2; j++) {
+        const int y = right - j;
+        if (!planes.isReserved(x, y)) {
+          f(x, y);
+        }
+      }
+    }
+  }
+}
+
+// Mask `pattern` (0-7) over the unreserved modules into `plane`
+// (size * words_per_row words), zero on function modules.
+constexpr void build_mask_plane(const SymbolPlanes& planes, int pattern,
+                                u_int64_t* plane) {
+  // どのマスクも行内では周期6なので、6モジュール分を倍々に複製して語を作る
+  // (モジュールごとに求めるとコンパイル時評価の上限に掛かる)
+  for (int x = 0; x < planes.size; x++) {
+    for (int w = 0; w < planes.words_per_row; w++) {
+      u_int64_t bits = 0;
+      for (int j = 0; j < 6; j++) {
+        if (mask_pattern_bit(pattern, x, w * 64 + j)) {
+          bits |= u_int64_t{1} << j;
+        }
+      }
+      for (int shift = 6; shift < 64; shift *= 2) {
+        bits |= bits << shift;
+      }
+      const int valid = std::min(planes.size - w * 64, 64);
+      if (valid < 64) {
+        bits &= (u_int64_t{1} << valid) - 1;
+      }
+      const size_t index = static_cast<size_t>(x) * planes.words_per_row + w;
+      plane[index] = bits & ~planes.reserved[index];
+    }
+  }
+}
+
+// Tables of one version, computed by the compiler into read-only data.
+template <int Version>
+struct FixedVersionTables {
+  static_assert(MIN_VERSION <= Version && Version <= MAX_VERSION);
+  static constexpr int size = symbol_size(Version);
+  static constexpr int words_per_row = (size + 63) / 64;
+  static constexpr int words = size * words_per_row;
+  using Plane = std::array<u_int64_t, words>;
+
+  // 機能パターンと型番情報を描いた面。形式情報の領域は0
+  Plane function_template;
+  // データビットk番目を置くモジュールのビット番号 x * words_per_row * 64 + y
+  std::array<u_int16_t, raw_data_modules(Version)> placement_order;
+  // マスクパターンごとの面 (機能パターンの位置は0)
+  std::array<Plane, 8> mask_planes;
+  // 形式情報ビットiを置く2箇所のビット番号: [i] と [15 + i]
+  std::array<u_int16_t, 30> format_positions;
+
+  // Scatters `codewords` (at most raw_data_modules(Version) / 8) over the
+  // data modules of `matrix`, which starts from function_template.
+  constexpr void placeCodewords(const u_int8_t* codewords, int count,
+                                Plane& matrix) const {
+    for (int k = 0; k < count; k++) {
+      const unsigned byte = codewords[k];
+      for (int bit = 0; bit < 8; bit++) {
+        const u_int16_t position = placement_order[k * 8 + bit];
+        matrix[position >> 6] |= static_cast<u_int64_t>((byte >> (7 - bit)) & 1)
+                                 << (position & 63);
+      }
+    }
+  }
+  // XORs mask `pattern` onto the data modules (applying it twice undoes it).
+  constexpr void applyMask(int pattern, Plane& matrix) const {
+    for (int i = 0; i < words; i++) {
+      matrix[i] ^= mask_planes[pattern][i];
+    }
+  }
+  constexpr void setFormatCells(ErrorCorrectionLevel correction_level,
+                                int pattern, Plane& matrix) const {
+    const u_int16_t format = FORMAT_INFORMATION_BITS[correction_level][pattern];
+    for (int i = 0; i < 30; i++) {
+      const u_int16_t position = format_positions[i];
+      const u_int64_t bit = u_int64_t{1} << (position & 63);
+      u_int64_t& word = matrix[position >> 6];
+      word = ((format >> (i % 15)) & 1) ? (word | bit) : (word & ~bit);
+    }
+  }
+};
+
+template <int Version>
+constexpr FixedVersionTables<Version> make_fixed_version_tables() {
+  using Tables = FixedVersionTables<Version>;
+  constexpr int stride = Tables::words_per_row * 64;
+  typename Tables::Plane modules{};
+  typename Tables::Plane reserved{};
+  const SymbolPlanes planes{modules.data(), reserved.data(), Tables::size,
+                            Tables::words_per_row};
+  draw_function_patterns(planes, Version);
+  Tables tables{};
+  tables.function_template = modules;
+  for (int i = 0; i < 30; i++) {
+    const ModulePosition p = format_position(Tables::size, i);
+    tables.format_positions[i] = static_cast<u_int16_t>(p.x * stride + p.y);
+  }
+  int k = 0;
+  for_each_data_module(planes, [&](int x, int y) {
+    tables.placement_order[k++] = static_cast<u_int16_t>(x * stride + y);
+  });
+  for (int p = 0; p < 8; p++) {
+    build_mask_plane(planes, p, tables.mask_planes[p].data());
+  }
+  return tables;
+}
+
+template <int Version>
+inline constexpr FixedVersionTables<Version> FIXED_VERSION_TABLES =
+    make_fixed_version_tables<Version>();
+
+#endif  // SYMBOL_LAYOUT_H
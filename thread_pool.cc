@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(int threads) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < threads; i++) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  // 呼び出し元スレッドがworker 0を兼ねる
+  for (int i = 1; i < threads; i++) {
+    this->threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::parallelFor(size_t n, size_t chunk,
+                                   const RangeFunction& body) {
+  if (n == 0) {
+    return;
+  }
+  chunk = std::max<size_t>(chunk, 1);
+  const int workers = threadCount();
+  // 連続したチャンクを各キューに配る。自分のキューは後ろから取るので、
+  // 盗む側(前から取る)とはなるべくぶつからない。
+  size_t index = 0;
+  for (size_t begin = 0; begin < n; begin += chunk, index++) {
+    Queue& queue = *queues[index % workers];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.ranges.emplace_back(begin, std::min(n, begin + chunk));
+  }
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    current = &body;
+    first_error = nullptr;
+    active_workers = workers;
+    generation++;
+  }
+  work_ready.notify_all();
+
+  run_chunks(0);
+
+  std::unique_lock<std::mutex> lock(state_mutex);
+  active_workers--;
+  work_done.wait(lock, [this] { return active_workers == 0; });
+  current = nullptr;
+  if (first_error) {
+    std::exception_ptr error = first_error;
+    first_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkStealingPool::worker_loop(int index) {
+  unsigned long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(state_mutex);
+      work_ready.wait(lock,
+                      [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+    run_chunks(index);
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      last = --active_workers == 0;
+    }
+    if (last) {
+      work_done.notify_all();
+    }
+  }
+}
+
+void WorkStealingPool::run_chunks(int index) {
+  std::pair<size_t, size_t> range;
+  while (pop_local(index, range) || steal(index, range)) {
+    try {
+      (*current)(range.first, range.second, index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      if (!first_error) {
+        first_error = std::current_exception();
+      }
+    }
+  }
+}
+
+bool WorkStealingPool::pop_local(int index, std::pair<size_t, size_t>& range) {
+  Queue& queue = *queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.ranges.empty()) {
+    return false;
+  }
+  range = queue.ranges.back();
+  queue.ranges.pop_back();
+  return true;
+}
+
+bool WorkStealingPool::steal(int thief, std::pair<size_t, size_t>& range) {
+  const int workers = threadCount();
+  for (int i = 1; i < workers; i++) {
+    Queue& queue = *queues[(thief + i) % workers];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.ranges.empty()) {
+      range = queue.ranges.front();
+      queue.ranges.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed set of worker threads that run parallelFor() jobs. Each job is cut into
+// chunks that are dealt round-robin onto per-worker deques; a worker pops its
+// own chunks from the back and, when it runs dry, steals from the front of the
+// other deques. Symbols of very different versions therefore do not leave
+// workers idle the way a static split would.
+class WorkStealingPool {
+ public:
+  // `threads` <= 0 uses std::thread::hardware_concurrency().
+  explicit WorkStealingPool(int threads = 0);
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  int threadCount() const { return static_cast<int>(queues.size()); }
+
+  // (begin, end, worker index in [0, threadCount()))
+  using RangeFunction = std::function<void(size_t, size_t, int)>;
+
+  // Calls `body` for consecutive ranges of at most `chunk` items covering
+  // [0, n) and returns once all of them finished. The calling thread works as
+  // worker 0. The first exception thrown by `body` is rethrown here after the
+  // remaining chunks have been drained. Not reentrant.
+  void parallelFor(size_t n, size_t chunk, const RangeFunction& body);
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::pair<size_t, size_t>> ranges;
+  };
+
+  void worker_loop(int index);
+  void run_chunks(int index);
+  bool pop_local(int index, std::pair<size_t, size_t>& range);
+  bool steal(int thief, std::pair<size_t, size_t>& range);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+
+  std::mutex state_mutex;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  const RangeFunction* current = nullptr;
+  unsigned long generation = 0;
+  int active_workers = 0;
+  bool stopping = false;
+  std::exception_ptr first_error;
+};
+
+#endif  // THREAD_POOL_H